@@ -36,7 +36,9 @@ struct _MPPC_CONTEXT
 	UINT32 HistoryBufferSize;
 	BYTE HistoryBuffer[65536];
 	UINT16 MatchBuffer[32768];
+	UINT16* MatchChain;
 	UINT32 CompressionLevel;
+	BOOL FastMode;
 };
 typedef struct _MPPC_CONTEXT MPPC_CONTEXT;
 
@@ -48,6 +50,7 @@ FREERDP_API int mppc_compress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize
 FREERDP_API int mppc_decompress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32 flags);
 
 FREERDP_API void mppc_set_compression_level(MPPC_CONTEXT* mppc, DWORD CompressionLevel);
+FREERDP_API void mppc_set_fast_mode(MPPC_CONTEXT* mppc, BOOL FastMode);
 
 FREERDP_API void mppc_context_reset(MPPC_CONTEXT* mppc, BOOL flush);
 
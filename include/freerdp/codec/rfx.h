@@ -154,6 +154,9 @@ struct _RFX_CONTEXT
 };
 
 FREERDP_API void rfx_context_set_pixel_format(RFX_CONTEXT* context, RDP_PIXEL_FORMAT pixel_format);
+FREERDP_API BOOL rfx_context_set_quantization_values(RFX_CONTEXT* context, const UINT32* quantVals, int numQuant);
+FREERDP_API BOOL rfx_context_set_quantization_index(RFX_CONTEXT* context, BYTE quantIdxY, BYTE quantIdxCb, BYTE quantIdxCr);
+FREERDP_API BOOL rfx_context_set_tile_quantization(RFX_CONTEXT* context, const BYTE* quantIdx, int gridWidth, int gridHeight);
 
 FREERDP_API int rfx_rlgr_decode(const BYTE* pSrcData, UINT32 SrcSize, INT16* pDstData, UINT32 DstSize, int mode);
 
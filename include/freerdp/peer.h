@@ -39,6 +39,7 @@ typedef HANDLE (*psPeerGetReceiveEventHandle)(freerdp_peer* client);
 typedef BOOL (*psPeerCheckFileDescriptor)(freerdp_peer* client);
 typedef BOOL (*psPeerIsWriteBlocked)(freerdp_peer* client);
 typedef int (*psPeerDrainOutputBuffer)(freerdp_peer* client);
+typedef size_t (*psPeerGetOutputBufferSize)(freerdp_peer* client);
 typedef BOOL (*psPeerClose)(freerdp_peer* client);
 typedef void (*psPeerDisconnect)(freerdp_peer* client);
 typedef BOOL (*psPeerCapabilities)(freerdp_peer* client);
@@ -49,6 +50,13 @@ typedef BOOL (*psPeerLogon)(freerdp_peer* client, SEC_WINNT_AUTH_IDENTITY* ident
 typedef int (*psPeerSendChannelData)(freerdp_peer* client, UINT16 channelId, BYTE* data, int size);
 typedef int (*psPeerReceiveChannelData)(freerdp_peer* client, UINT16 channelId, BYTE* data, int size, int flags, int totalSize);
 
+typedef struct rdp_freerdp_peer_loop freerdp_peer_loop;
+
+typedef BOOL (*psPeerLoopEvent)(freerdp_peer* client, HANDLE handle);
+typedef void (*psPeerLoopClosed)(freerdp_peer_loop* loop, freerdp_peer* client);
+
+#define FREERDP_PEER_LOOP_MAX_HANDLES	8
+
 typedef HANDLE (*psPeerVirtualChannelOpen)(freerdp_peer* client, const char* name, UINT32 flags);
 typedef BOOL (*psPeerVirtualChannelClose)(freerdp_peer* client, HANDLE hChannel);
 typedef int (*psPeerVirtualChannelRead)(freerdp_peer* client, HANDLE hChannel, BYTE* buffer, UINT32 length);
@@ -106,6 +114,7 @@ struct rdp_freerdp_peer
 
 	psPeerIsWriteBlocked IsWriteBlocked;
 	psPeerDrainOutputBuffer DrainOutputBuffer;
+	psPeerGetOutputBufferSize GetOutputBufferSize;
 };
 
 #ifdef __cplusplus
@@ -118,6 +127,13 @@ FREERDP_API void freerdp_peer_context_free(freerdp_peer* client);
 FREERDP_API freerdp_peer* freerdp_peer_new(int sockfd);
 FREERDP_API void freerdp_peer_free(freerdp_peer* client);
 
+FREERDP_API freerdp_peer_loop* freerdp_peer_loop_new(DWORD numThreads, psPeerLoopClosed PeerClosed);
+FREERDP_API void freerdp_peer_loop_free(freerdp_peer_loop* loop);
+
+FREERDP_API BOOL freerdp_peer_loop_add(freerdp_peer_loop* loop, freerdp_peer* client,
+		HANDLE* handles, psPeerLoopEvent* events, DWORD count);
+FREERDP_API DWORD freerdp_peer_loop_count(freerdp_peer_loop* loop);
+
 #ifdef __cplusplus
 }
 #endif
@@ -45,6 +45,12 @@ typedef struct rdp_shadow_screen rdpShadowScreen;
 typedef struct rdp_shadow_surface rdpShadowSurface;
 typedef struct rdp_shadow_encoder rdpShadowEncoder;
 typedef struct rdp_shadow_capture rdpShadowCapture;
+typedef struct rdp_shadow_cache rdpShadowCache;
+typedef struct rdp_shadow_stats rdpShadowStats;
+typedef struct rdp_shadow_client_stats rdpShadowClientStats;
+typedef struct rdp_shadow_admin rdpShadowAdmin;
+typedef struct rdp_shadow_pointer rdpShadowPointer;
+typedef struct rdp_shadow_pointer_cache rdpShadowPointerCache;
 typedef struct rdp_shadow_subsystem rdpShadowSubsystem;
 
 typedef struct _RDP_SHADOW_ENTRY_POINTS RDP_SHADOW_ENTRY_POINTS;
@@ -74,19 +80,30 @@ struct rdp_shadow_client
 {
 	rdpContext context;
 
-	HANDLE thread;
 	BOOL activated;
 	BOOL inLobby;
 	BOOL mayView;
 	BOOL mayInteract;
+	BOOL shareSubRect;
+	RECTANGLE_16 subRect;
 	HANDLE StopEvent;
+	HANDLE UpdateEvent;
+	LONG updatePending;
 	CRITICAL_SECTION lock;
 	REGION16 invalidRegion;
 	rdpShadowServer* server;
 	rdpShadowSurface* lobby;
 	rdpShadowEncoder* encoder;
+	rdpShadowClientStats* stats;
 	rdpShadowSubsystem* subsystem;
 
+	BOOL pointerUpdates;
+	UINT32 pointerX;
+	UINT32 pointerY;
+	UINT32 pointerId;
+	UINT64 pointerInputTime;
+	rdpShadowPointerCache* pointerCache;
+
 	HANDLE vcm;
 	EncomspServerContext* encomsp;
 	RemdeskServerContext* remdesk;
@@ -101,7 +118,12 @@ struct rdp_shadow_server
 	rdpShadowScreen* screen;
 	rdpShadowSurface* surface;
 	rdpShadowCapture* capture;
+	rdpShadowCache* cache;
+	rdpShadowStats* stats;
+	rdpShadowAdmin* admin;
+	rdpShadowPointer* pointer;
 	rdpShadowSubsystem* subsystem;
+	wArrayList* lobbies;
 
 	DWORD port;
 	BOOL mayView;
@@ -110,12 +132,17 @@ struct rdp_shadow_server
 	BOOL authentication;
 	int selectedMonitor;
 	RECTANGLE_16 subRect;
+	UINT32 maxBandwidth;
 	char* ipcSocket;
+	char* adminSocket;
+	char* subsystemName;
+	char* subsystemOptions;
 	char* ConfigPath;
 	char* CertificateFile;
 	char* PrivateKeyFile;
 	CRITICAL_SECTION lock;
 	freerdp_listener* listener;
+	freerdp_peer_loop* loop;
 };
 
 struct _RDP_SHADOW_ENTRY_POINTS
@@ -140,11 +167,14 @@ struct _RDP_SHADOW_ENTRY_POINTS
 	int selectedMonitor; \
 	MONITOR_DEF monitors[16]; \
 	MONITOR_DEF virtualScreen; \
-	HANDLE updateEvent; \
+	HANDLE updateDoneEvent; \
+	LONG updatePending; \
 	BOOL suppressOutput; \
 	REGION16 invalidRegion; \
+	RECTANGLE_16 moveRect; \
+	int moveDeltaX; \
+	int moveDeltaY; \
 	wMessagePipe* MsgPipe; \
-	SYNCHRONIZATION_BARRIER barrier; \
 	\
 	pfnShadowSynchronizeEvent SynchronizeEvent; \
 	pfnShadowKeyboardEvent KeyboardEvent; \
@@ -176,6 +206,8 @@ FREERDP_API int shadow_server_uninit(rdpShadowServer* server);
 
 FREERDP_API int shadow_enum_monitors(MONITOR_DEF* monitors, int maxMonitors, const char* name);
 
+FREERDP_API int shadow_client_select_monitor(rdpShadowClient* client, int index);
+
 FREERDP_API rdpShadowServer* shadow_server_new();
 FREERDP_API void shadow_server_free(rdpShadowServer* server);
 
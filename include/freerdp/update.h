@@ -132,6 +132,7 @@ typedef struct _SURFACE_FRAME SURFACE_FRAME;
 
 /* defined inside libfreerdp-core */
 typedef struct rdp_update_proxy rdpUpdateProxy;
+typedef struct rdp_update_arena rdpUpdateArena;
 
 /* Update Interface */
 
@@ -208,12 +209,18 @@ struct rdp_update
 	BOOL asynchronous;
 	rdpUpdateProxy* proxy;
 	wMessageQueue* queue;
+	rdpUpdateArena* arena;
 
 	wStream* us;
 	UINT16 numberOrders;
 	BOOL combineUpdates;
 	rdpBounds currentBounds;
 	rdpBounds previousBounds;
+
+	wStream* surfaceCommands;
+	BOOL surfaceCommandsSkipCompression;
+	BOOL surfaceFrameStarted;
+	BOOL paintStarted;
 };
 
 #endif /* FREERDP_UPDATE_H */
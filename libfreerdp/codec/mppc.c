@@ -460,6 +460,355 @@ int mppc_decompress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** p
 	return 1;
 }
 
+/**
+ * Fast Mode Compression
+ *
+ * The fast compressor keeps a hash chain (MatchBuffer heads, MatchChain links)
+ * over the history buffer so that several earlier occurrences of a trigram
+ * can be examined, and accumulates output bits in a 64-bit register that is
+ * flushed one 32-bit word at a time instead of going through BitStream_Write_Bits.
+ */
+
+#define MPPC_MAX_CHAIN_LENGTH	4
+#define MPPC_NICE_MATCH_LENGTH	16
+
+#define MPPC_TRIGRAM(_p) \
+	((((UINT32) (_p)[0]) << 16) | (((UINT32) (_p)[1]) << 8) | ((UINT32) (_p)[2]))
+
+#define MPPC_FAST_MATCH_INDEX(_trigram) \
+	(((_trigram) * 2654435761U) >> 17)
+
+struct _MPPC_BIT_WRITER
+{
+	BYTE* pointer;
+	UINT64 accumulator;
+	UINT32 count;
+};
+typedef struct _MPPC_BIT_WRITER MPPC_BIT_WRITER;
+
+static INLINE void mppc_bit_writer_write(MPPC_BIT_WRITER* bw, UINT32 bits, UINT32 nbits)
+{
+	UINT32 word;
+
+	bw->accumulator = (bw->accumulator << nbits) | bits;
+	bw->count += nbits;
+
+	if (bw->count >= 32)
+	{
+		bw->count -= 32;
+		word = (UINT32) (bw->accumulator >> bw->count);
+
+		bw->pointer[0] = (BYTE) (word >> 24);
+		bw->pointer[1] = (BYTE) (word >> 16);
+		bw->pointer[2] = (BYTE) (word >> 8);
+		bw->pointer[3] = (BYTE) (word);
+		bw->pointer += 4;
+	}
+}
+
+static INLINE void mppc_bit_writer_flush(MPPC_BIT_WRITER* bw)
+{
+	UINT32 word;
+
+	if (!bw->count)
+		return;
+
+	word = (UINT32) (bw->accumulator << (32 - bw->count));
+
+	while (bw->count > 0)
+	{
+		*bw->pointer++ = (BYTE) (word >> 24);
+		word <<= 8;
+		bw->count = (bw->count > 8) ? (bw->count - 8) : 0;
+	}
+}
+
+static INLINE void mppc_write_literal(MPPC_BIT_WRITER* bw, BYTE literal)
+{
+	if (literal < 0x80)
+	{
+		/* 8 bits of literal are encoded as-is */
+		mppc_bit_writer_write(bw, literal, 8);
+	}
+	else
+	{
+		/* bits 10 followed by lower 7 bits of literal */
+		mppc_bit_writer_write(bw, 0x100 | (literal & 0x7F), 9);
+	}
+}
+
+static INLINE void mppc_write_copy_offset(MPPC_BIT_WRITER* bw, UINT32 CopyOffset, UINT32 CompressionLevel)
+{
+	if (CompressionLevel) /* RDP5 */
+	{
+		if (CopyOffset < 64)
+			mppc_bit_writer_write(bw, 0x07C0 | CopyOffset, 11);
+		else if (CopyOffset < 320)
+			mppc_bit_writer_write(bw, 0x1E00 | (CopyOffset - 64), 13);
+		else if (CopyOffset < 2368)
+			mppc_bit_writer_write(bw, 0x7000 | (CopyOffset - 320), 15);
+		else
+			mppc_bit_writer_write(bw, 0x060000 | (CopyOffset - 2368), 19);
+	}
+	else /* RDP4 */
+	{
+		if (CopyOffset < 64)
+			mppc_bit_writer_write(bw, 0x03C0 | CopyOffset, 10);
+		else if (CopyOffset < 320)
+			mppc_bit_writer_write(bw, 0x0E00 | (CopyOffset - 64), 12);
+		else
+			mppc_bit_writer_write(bw, 0xC000 | (CopyOffset - 320), 16);
+	}
+}
+
+static INLINE void mppc_write_length_of_match(MPPC_BIT_WRITER* bw, UINT32 LengthOfMatch)
+{
+	UINT32 nbits;
+
+	if (LengthOfMatch == 3)
+	{
+		/* 0 + 0 lower bits of LengthOfMatch */
+		mppc_bit_writer_write(bw, 0, 1);
+		return;
+	}
+
+	/**
+	 * LengthOfMatch in [2^k, 2^(k+1)) is encoded as (k - 1) one bits,
+	 * a zero bit and the k lower bits of LengthOfMatch.
+	 */
+
+	nbits = 2;
+
+	while ((LengthOfMatch >> (nbits + 1)) != 0)
+		nbits++;
+
+	mppc_bit_writer_write(bw, ((((1 << (nbits - 1)) - 1) << 1) << nbits) |
+			(LengthOfMatch & ((1 << nbits) - 1)), (nbits * 2));
+}
+
+static int mppc_compress_fast(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
+{
+	BYTE* pDstData;
+	BYTE* pDstLimit;
+	BYTE* HistoryBuffer;
+	UINT32 DstSize;
+	UINT32 HistoryOffset;
+	UINT32 HistoryBufferSize;
+	UINT32 HistoryEnd;
+	UINT32 CompressionLevel;
+	UINT32 MaxLengthOfMatch;
+	UINT32 MatchIndex;
+	UINT32 Trigram;
+	UINT32 Candidate;
+	UINT32 ChainLength;
+	UINT32 LiteralRun;
+	UINT32 Length;
+	UINT32 Limit;
+	UINT32 Offset;
+	UINT32 MaxLength;
+	UINT32 BestLength;
+	UINT32 BestOffset;
+	UINT32 Position;
+	BOOL PacketFlushed;
+	BOOL PacketAtFront;
+	MPPC_BIT_WRITER bw;
+
+	HistoryBuffer = mppc->HistoryBuffer;
+	HistoryBufferSize = mppc->HistoryBufferSize;
+	CompressionLevel = mppc->CompressionLevel;
+	HistoryOffset = mppc->HistoryOffset;
+	MaxLengthOfMatch = CompressionLevel ? 65535 : 8191;
+
+	*pFlags = 0;
+	PacketFlushed = FALSE;
+
+	if (((HistoryOffset + SrcSize) < (HistoryBufferSize - 3)) && HistoryOffset)
+	{
+		PacketAtFront = FALSE;
+	}
+	else
+	{
+		if (HistoryOffset == (HistoryBufferSize + 1))
+			PacketFlushed = TRUE;
+
+		HistoryOffset = 0;
+		PacketAtFront = TRUE;
+	}
+
+	pDstData = *ppDstData;
+
+	if (!pDstData)
+		return -1;
+
+	if (*pDstSize > SrcSize)
+		DstSize = SrcSize;
+	else
+		DstSize = *pDstSize;
+
+	if ((SrcSize >= (HistoryBufferSize - 3)) || (DstSize < 12))
+		goto flush;
+
+	/**
+	 * A symbol is at most 49 bits (two 32-bit words), and up to
+	 * 4 more bytes of pending bits are written by the final flush.
+	 */
+	pDstLimit = &pDstData[DstSize - 12];
+
+	bw.pointer = pDstData;
+	bw.accumulator = 0;
+	bw.count = 0;
+
+	CopyMemory(&HistoryBuffer[HistoryOffset], pSrcData, SrcSize);
+
+	Position = HistoryOffset;
+	HistoryEnd = HistoryOffset + SrcSize;
+	LiteralRun = 0;
+
+	while ((Position + 2) < HistoryEnd)
+	{
+		if (bw.pointer > pDstLimit)
+			goto flush;
+
+		Trigram = MPPC_TRIGRAM(&HistoryBuffer[Position]);
+		MatchIndex = MPPC_FAST_MATCH_INDEX(Trigram);
+
+		Candidate = mppc->MatchBuffer[MatchIndex];
+		mppc->MatchBuffer[MatchIndex] = (UINT16) Position;
+		mppc->MatchChain[Position] = (UINT16) Candidate;
+
+		MaxLength = HistoryEnd - Position;
+
+		if (MaxLength > MaxLengthOfMatch)
+			MaxLength = MaxLengthOfMatch;
+
+		BestLength = 0;
+		BestOffset = 0;
+		ChainLength = (LiteralRun < MPPC_NICE_MATCH_LENGTH) ? MPPC_MAX_CHAIN_LENGTH : 1;
+
+		/**
+		 * Compressor and decompressor history buffers hold the same bytes, so a match may
+		 * start anywhere except in the part of the current packet not yet decoded by the
+		 * receiver. Positions past the end of the packet are reached by wrapping around.
+		 */
+
+		while (ChainLength--)
+		{
+			if (Candidate < Position)
+			{
+				Limit = MaxLength;
+				Offset = Position - Candidate;
+			}
+			else if ((Candidate >= HistoryEnd) && ((Candidate + 3) <= HistoryBufferSize))
+			{
+				Limit = HistoryBufferSize - Candidate;
+				Offset = Position + HistoryBufferSize - Candidate;
+
+				if (Limit > MaxLength)
+					Limit = MaxLength;
+			}
+			else
+			{
+				Limit = 0;
+				Offset = 0;
+			}
+
+			if ((Limit > BestLength) &&
+					(HistoryBuffer[Candidate + BestLength] == HistoryBuffer[Position + BestLength]) &&
+					(MPPC_TRIGRAM(&HistoryBuffer[Candidate]) == Trigram))
+			{
+				Length = 3;
+
+				while ((Length < Limit) && (HistoryBuffer[Candidate + Length] == HistoryBuffer[Position + Length]))
+					Length++;
+
+				if (Length > BestLength)
+				{
+					BestLength = Length;
+					BestOffset = Offset;
+
+					if (Length >= MPPC_NICE_MATCH_LENGTH)
+						break;
+				}
+			}
+
+			Candidate = mppc->MatchChain[Candidate];
+		}
+
+		if (BestLength < 3)
+		{
+			mppc_write_literal(&bw, HistoryBuffer[Position]);
+			Position++;
+			LiteralRun++;
+			continue;
+		}
+
+		LiteralRun = 0;
+
+#ifdef DEBUG_MPPC
+		WLog_DBG(TAG, "<%d,%d>", (int) BestOffset, (int) BestLength);
+#endif
+
+		mppc_write_copy_offset(&bw, BestOffset, CompressionLevel);
+		mppc_write_length_of_match(&bw, BestLength);
+
+		Length = Position + BestLength;
+		Position++;
+
+		/* only short matches are indexed in full, long runs would mostly fill the chains with duplicates */
+
+		if (BestLength > MPPC_NICE_MATCH_LENGTH)
+			Position = Length;
+
+		while ((Position < Length) && ((Position + 2) < HistoryEnd))
+		{
+			MatchIndex = MPPC_FAST_MATCH_INDEX(MPPC_TRIGRAM(&HistoryBuffer[Position]));
+
+			mppc->MatchChain[Position] = mppc->MatchBuffer[MatchIndex];
+			mppc->MatchBuffer[MatchIndex] = (UINT16) Position;
+			Position++;
+		}
+
+		Position = Length;
+	}
+
+	/* Encode trailing symbols as literals */
+
+	while (Position < HistoryEnd)
+	{
+		if (bw.pointer > pDstLimit)
+			goto flush;
+
+		mppc_write_literal(&bw, HistoryBuffer[Position]);
+		Position++;
+	}
+
+	mppc_bit_writer_flush(&bw);
+
+	*pFlags |= PACKET_COMPRESSED;
+	*pFlags |= CompressionLevel;
+
+	if (PacketAtFront)
+		*pFlags |= PACKET_AT_FRONT;
+
+	if (PacketFlushed)
+		*pFlags |= PACKET_FLUSHED;
+
+	*pDstSize = (UINT32) (bw.pointer - pDstData);
+
+	mppc->HistoryPtr = &HistoryBuffer[HistoryEnd];
+	mppc->HistoryOffset = HistoryEnd;
+
+	return 1;
+
+flush:
+	mppc_context_reset(mppc, TRUE);
+	*pFlags |= PACKET_FLUSHED;
+	*pFlags |= CompressionLevel;
+	*ppDstData = pSrcData;
+	*pDstSize = SrcSize;
+	return 1;
+}
+
 int mppc_compress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
 {
 	BYTE* pSrcPtr;
@@ -482,6 +831,9 @@ int mppc_compress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppD
 	UINT32 CompressionLevel;
 	wBitStream* bs = mppc->bs;
 
+	if (mppc->FastMode)
+		return mppc_compress_fast(mppc, pSrcData, SrcSize, ppDstData, pDstSize, pFlags);
+
 	HistoryBuffer = mppc->HistoryBuffer;
 	HistoryBufferSize = mppc->HistoryBufferSize;
 	CompressionLevel = mppc->CompressionLevel;
@@ -817,6 +1169,24 @@ void mppc_set_compression_level(MPPC_CONTEXT* mppc, DWORD CompressionLevel)
 	}
 }
 
+/**
+ * The hash chain links of the fast mode are only allocated once it is
+ * enabled, the mode stays disabled if they cannot be.
+ */
+
+void mppc_set_fast_mode(MPPC_CONTEXT* mppc, BOOL FastMode)
+{
+	if (FastMode && !mppc->MatchChain)
+	{
+		mppc->MatchChain = (UINT16*) calloc(65536, sizeof(UINT16));
+
+		if (!mppc->MatchChain)
+			FastMode = FALSE;
+	}
+
+	mppc->FastMode = FastMode;
+}
+
 void mppc_context_reset(MPPC_CONTEXT* mppc, BOOL flush)
 {
 	ZeroMemory(&(mppc->HistoryBuffer), sizeof(mppc->HistoryBuffer));
@@ -865,6 +1235,7 @@ void mppc_context_free(MPPC_CONTEXT* mppc)
 	{
 		BitStream_Free(mppc->bs);
 
+		free(mppc->MatchChain);
 		free(mppc);
 	}
 }
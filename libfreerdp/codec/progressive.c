@@ -1816,7 +1816,7 @@ PROGRESSIVE_CONTEXT* progressive_context_new(BOOL Compressor)
 
 		progressive->log = WLog_Get(TAG);
 
-		progressive->bufferPool = BufferPool_New(TRUE, (8192 + 32) * 3, 16);
+		progressive->bufferPool = BufferPool_NewEx(TRUE, (8192 + 32) * 3, 16, BUFFER_POOL_FLAG_THREAD_CACHE, 0);
 
 		progressive->cRects = 64;
 		progressive->rects = (RFX_RECT*) malloc(progressive->cRects * sizeof(RFX_RECT));
@@ -1855,9 +1855,7 @@ PROGRESSIVE_CONTEXT* progressive_context_new(BOOL Compressor)
 
 void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 {
-	int count;
-	int index;
-	ULONG_PTR* pKeys = NULL;
+	wHashTableEnumerator enumerator;
 	PROGRESSIVE_SURFACE_CONTEXT* surface;
 
 	if (!progressive)
@@ -1870,16 +1868,14 @@ void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 	free(progressive->quantVals);
 	free(progressive->quantProgVals);
 
-	count = HashTable_GetKeys(progressive->SurfaceContexts, &pKeys);
+	HashTable_Enumerator_Reset(progressive->SurfaceContexts, &enumerator);
 
-	for (index = 0; index < count; index++)
+	while (HashTable_Enumerator_MoveNext(&enumerator))
 	{
-		surface = (PROGRESSIVE_SURFACE_CONTEXT*) HashTable_GetItemValue(progressive->SurfaceContexts, (void*) pKeys[index]);
+		surface = (PROGRESSIVE_SURFACE_CONTEXT*) enumerator.value;
 		progressive_surface_context_free(surface);
 	}
 
-	free(pKeys);
-
 	HashTable_Free(progressive->SurfaceContexts);
 
 	free(progressive);
@@ -255,9 +255,12 @@ RFX_CONTEXT* rfx_context_new(BOOL encoder)
 	 * performed at the BufferPool_Take function calls in rfx_encode/decode.c.
 	 *
 	 * We then multiply by 3 to use a single, partioned buffer for all 3 channels.
+	 *
+	 * Tile workers take and return these buffers several times per tile,
+	 * so each thread keeps a small cache of them.
 	 */
 
-	priv->BufferPool = BufferPool_New(TRUE, (8192 + 32) * 3, 16);
+	priv->BufferPool = BufferPool_NewEx(TRUE, (8192 + 32) * 3, 16, BUFFER_POOL_FLAG_THREAD_CACHE, 0);
 	if (!priv->BufferPool)
 		goto error_BufferPool;
 
@@ -362,6 +365,8 @@ void rfx_context_free(RFX_CONTEXT* context)
 	if (context->quants)
 		free(context->quants);
 
+	free(priv->tileQuantIdx);
+
 	ObjectPool_Free(priv->TilePool);
 
 	rfx_profiler_print(context);
@@ -418,6 +423,94 @@ void rfx_context_set_pixel_format(RFX_CONTEXT* context, RDP_PIXEL_FORMAT pixel_f
 	}
 }
 
+/**
+ * Registers the quantization tables used by the encoder, 10 values per
+ * table in the order LL3, LH3, HL3, HH3, LH2, HL2, HH2, LH1, HL1, HH1.
+ * The quantization indices are reset to the first table, the tables must
+ * not be changed between encoding and writing a message.
+ */
+
+BOOL rfx_context_set_quantization_values(RFX_CONTEXT* context, const UINT32* quantVals, int numQuant)
+{
+	int i;
+	UINT32* quants;
+
+	if (!quantVals || (numQuant < 1) || (numQuant > 0xFF))
+		return FALSE;
+
+	for (i = 0; i < numQuant * 10; i++)
+	{
+		if ((quantVals[i] < 6) || (quantVals[i] > 15))
+			return FALSE;
+	}
+
+	quants = (UINT32*) realloc(context->quants, numQuant * 10 * sizeof(UINT32));
+
+	if (!quants)
+		return FALSE;
+
+	CopyMemory(quants, quantVals, numQuant * 10 * sizeof(UINT32));
+
+	context->quants = quants;
+	context->numQuant = (BYTE) numQuant;
+	context->quantIdxY = 0;
+	context->quantIdxCb = 0;
+	context->quantIdxCr = 0;
+
+	return TRUE;
+}
+
+BOOL rfx_context_set_quantization_index(RFX_CONTEXT* context, BYTE quantIdxY, BYTE quantIdxCb, BYTE quantIdxCr)
+{
+	if ((quantIdxY >= context->numQuant) || (quantIdxCb >= context->numQuant) ||
+			(quantIdxCr >= context->numQuant))
+		return FALSE;
+
+	context->quantIdxY = quantIdxY;
+	context->quantIdxCb = quantIdxCb;
+	context->quantIdxCr = quantIdxCr;
+
+	return TRUE;
+}
+
+/**
+ * Selects the quantization table of each tile, quantIdx is indexed by the
+ * tile grid position (yIdx * gridWidth + xIdx) of the encoded image. Tiles
+ * outside of the grid, or with an index that is not a registered table, use
+ * the context quantization indices. Passing NULL removes the selection.
+ */
+
+BOOL rfx_context_set_tile_quantization(RFX_CONTEXT* context, const BYTE* quantIdx, int gridWidth, int gridHeight)
+{
+	BYTE* tileQuantIdx;
+	RFX_CONTEXT_PRIV* priv = context->priv;
+
+	if (!quantIdx || (gridWidth < 1) || (gridHeight < 1))
+	{
+		free(priv->tileQuantIdx);
+		priv->tileQuantIdx = NULL;
+		priv->tileQuantWidth = priv->tileQuantHeight = 0;
+		return quantIdx ? FALSE : TRUE;
+	}
+
+	if ((gridWidth * gridHeight) != (priv->tileQuantWidth * priv->tileQuantHeight))
+	{
+		tileQuantIdx = (BYTE*) realloc(priv->tileQuantIdx, gridWidth * gridHeight);
+
+		if (!tileQuantIdx)
+			return FALSE;
+
+		priv->tileQuantIdx = tileQuantIdx;
+	}
+
+	priv->tileQuantWidth = gridWidth;
+	priv->tileQuantHeight = gridHeight;
+
+	CopyMemory(priv->tileQuantIdx, quantIdx, gridWidth * gridHeight);
+
+	return TRUE;
+}
+
 int rfx_context_reset(RFX_CONTEXT* context)
 {
 	context->state = RFX_STATE_SEND_HEADERS;
@@ -1206,6 +1299,7 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, int
 	int i, maxNbTiles, maxTilesX, maxTilesY;
 	int xIdx, yIdx, regionNbRects;
 	int gridRelX, gridRelY, ax, ay, bytesPerPixel;
+	BYTE quantIdx;
 	RFX_TILE* tile;
 	RFX_RECT* rfxRect;
 	RFX_MESSAGE* message = NULL;
@@ -1351,6 +1445,15 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, int
 				tile->quantIdxCb = context->quantIdxCb;
 				tile->quantIdxCr = context->quantIdxCr;
 
+				if (context->priv->tileQuantIdx && (xIdx < context->priv->tileQuantWidth) &&
+						(yIdx < context->priv->tileQuantHeight))
+				{
+					quantIdx = context->priv->tileQuantIdx[(yIdx * context->priv->tileQuantWidth) + xIdx];
+
+					if (quantIdx < context->numQuant)
+						tile->quantIdxY = tile->quantIdxCb = tile->quantIdxCr = quantIdx;
+				}
+
 				tile->YLen = tile->CbLen = tile->CrLen = 0;
 
 				tile->YCbCrData = (BYTE *)BufferPool_Take(context->priv->BufferPool, -1);
@@ -58,6 +58,11 @@ struct _RFX_CONTEXT_PRIV
  
 	wBufferPool* BufferPool;
 
+	/* per tile quantization selection (encoder) */
+	BYTE* tileQuantIdx;
+	int tileQuantWidth;
+	int tileQuantHeight;
+
 	/* profilers */
 	PROFILER_DEFINE(prof_rfx_decode_rgb);
 	PROFILER_DEFINE(prof_rfx_decode_component);
@@ -1,5 +1,6 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 #include <winpr/bitstream.h>
 
 #include <freerdp/freerdp.h>
@@ -995,6 +996,154 @@ int test_MppcDecompressBufferRdp5()
 	return 0;
 }
 
+/**
+ * Round-trips recorded RDP traffic through the fast compressor in PDU-sized chunks,
+ * so that matches against history from previous packets and history buffer
+ * wrap-around (PACKET_AT_FRONT) are exercised.
+ */
+
+static int test_MppcCompressFastRoundTrip(DWORD CompressionLevel, UINT32 ChunkSize)
+{
+	int status;
+	UINT32 Flags;
+	UINT32 SrcSize;
+	BYTE* pSrcData;
+	UINT32 DstSize;
+	BYTE* pDstData;
+	UINT32 OutSize;
+	BYTE* pOutData;
+	UINT32 offset;
+	UINT32 pass;
+	MPPC_CONTEXT* mppcSend;
+	MPPC_CONTEXT* mppcRecv;
+	BYTE OutputBuffer[65536];
+
+	mppcSend = mppc_context_new(CompressionLevel, TRUE);
+	mppcRecv = mppc_context_new(CompressionLevel, FALSE);
+
+	if (!mppcSend || !mppcRecv)
+		return -1;
+
+	mppc_set_fast_mode(mppcSend, TRUE);
+
+	for (pass = 0; pass < 12; pass++)
+	{
+		for (offset = 0; offset < sizeof(TEST_RDP5_UNCOMPRESSED_DATA); offset += ChunkSize)
+		{
+			pSrcData = &TEST_RDP5_UNCOMPRESSED_DATA[offset];
+			SrcSize = sizeof(TEST_RDP5_UNCOMPRESSED_DATA) - offset;
+
+			if (SrcSize > ChunkSize)
+				SrcSize = ChunkSize;
+
+			DstSize = sizeof(OutputBuffer);
+			pDstData = OutputBuffer;
+			status = mppc_compress(mppcSend, pSrcData, SrcSize, &pDstData, &DstSize, &Flags);
+
+			if (status < 0)
+			{
+				printf("MppcCompressFastRoundTrip: mppc_compress failure: %d\n", status);
+				return -1;
+			}
+
+			pOutData = NULL;
+			status = mppc_decompress(mppcRecv, pDstData, DstSize, &pOutData, &OutSize, Flags);
+
+			if (status < 0)
+			{
+				printf("MppcCompressFastRoundTrip: mppc_decompress failure: %d\n", status);
+				return -1;
+			}
+
+			if ((OutSize != SrcSize) || (memcmp(pOutData, pSrcData, SrcSize) != 0))
+			{
+				printf("MppcCompressFastRoundTrip: level %d chunk %d offset %d: output mismatch\n",
+						(int) CompressionLevel, (int) ChunkSize, (int) offset);
+				return -1;
+			}
+		}
+	}
+
+	mppc_context_free(mppcSend);
+	mppc_context_free(mppcRecv);
+	return 0;
+}
+
+static int test_MppcCompressBenchmarkLevel(DWORD CompressionLevel, BOOL FastMode, UINT32 ChunkSize, UINT32 Iterations)
+{
+	int status;
+	UINT32 Flags;
+	UINT32 SrcSize;
+	UINT32 DstSize;
+	BYTE* pDstData;
+	UINT32 offset;
+	UINT32 index;
+	UINT64 TotalSrcSize;
+	UINT64 TotalDstSize;
+	ULONGLONG start;
+	ULONGLONG elapsed;
+	MPPC_CONTEXT* mppc;
+	BYTE OutputBuffer[65536];
+
+	mppc = mppc_context_new(CompressionLevel, TRUE);
+
+	if (!mppc)
+		return -1;
+
+	mppc_set_fast_mode(mppc, FastMode);
+
+	TotalSrcSize = TotalDstSize = 0;
+	start = GetTickCount64();
+
+	for (index = 0; index < Iterations; index++)
+	{
+		for (offset = 0; offset < sizeof(TEST_RDP5_UNCOMPRESSED_DATA); offset += ChunkSize)
+		{
+			SrcSize = sizeof(TEST_RDP5_UNCOMPRESSED_DATA) - offset;
+
+			if (SrcSize > ChunkSize)
+				SrcSize = ChunkSize;
+
+			DstSize = sizeof(OutputBuffer);
+			pDstData = OutputBuffer;
+			status = mppc_compress(mppc, &TEST_RDP5_UNCOMPRESSED_DATA[offset], SrcSize, &pDstData, &DstSize, &Flags);
+
+			if (status < 0)
+				return -1;
+
+			TotalSrcSize += SrcSize;
+			TotalDstSize += DstSize;
+		}
+	}
+
+	elapsed = GetTickCount64() - start;
+
+	printf("MppcCompressBenchmark: %s %s: %d bytes -> %d bytes (ratio %.3f) in %d ms\n",
+			CompressionLevel ? "RDP5" : "RDP4", FastMode ? "fast" : "default",
+			(int) TotalSrcSize, (int) TotalDstSize,
+			(double) TotalDstSize / (double) TotalSrcSize, (int) elapsed);
+
+	mppc_context_free(mppc);
+	return 0;
+}
+
+static int test_MppcCompressBenchmark()
+{
+	if (test_MppcCompressBenchmarkLevel(0, FALSE, 1024, 2000) < 0)
+		return -1;
+
+	if (test_MppcCompressBenchmarkLevel(0, TRUE, 1024, 2000) < 0)
+		return -1;
+
+	if (test_MppcCompressBenchmarkLevel(1, FALSE, 4096, 2000) < 0)
+		return -1;
+
+	if (test_MppcCompressBenchmarkLevel(1, TRUE, 4096, 2000) < 0)
+		return -1;
+
+	return 0;
+}
+
 int TestFreeRDPCodecMppc(int argc, char* argv[])
 {
 	if (test_MppcCompressIslandRdp5() < 0)
@@ -1018,5 +1167,14 @@ int TestFreeRDPCodecMppc(int argc, char* argv[])
 	if (test_MppcDecompressBufferRdp5() < 0)
 		return -1;
 
+	if (test_MppcCompressFastRoundTrip(0, 1024) < 0)
+		return -1;
+
+	if (test_MppcCompressFastRoundTrip(1, 4096) < 0)
+		return -1;
+
+	if (test_MppcCompressBenchmark() < 0)
+		return -1;
+
 	return 0;
 }
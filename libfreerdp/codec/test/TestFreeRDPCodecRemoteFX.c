@@ -756,7 +756,134 @@ const UINT32 TEST_RFX_XRGB_IMAGE[4096] =
 	0x00169ff8, 0x00159ef7, 0x00149df7, 0x00139cf6, 0x00129bf5, 0x00129bf5, 0x00129bf5, 0x00129bf5
 };
 
+static int test_rfx_tile_quantization(void)
+{
+	int x, y;
+	int status = -1;
+	BYTE* data;
+	RFX_RECT rect;
+	RFX_TILE* tile;
+	RFX_CONTEXT* context;
+	RFX_MESSAGE* message = NULL;
+	UINT32 quants[20];
+	BYTE tileQuantIdx[2] = { 1, 7 };
+	UINT32 size[2] = { 0, 0 };
+
+	/* two 64x64 tiles of the same textured content */
+
+	data = (BYTE*) malloc(128 * 64 * 4);
+	context = rfx_context_new(TRUE);
+
+	if (!data || !context)
+		goto out;
+
+	for (y = 0; y < 64; y++)
+	{
+		for (x = 0; x < 128; x++)
+		{
+			data[(y * 128 + x) * 4 + 0] = (BYTE) (((x % 64) * 7) ^ (y * 13));
+			data[(y * 128 + x) * 4 + 1] = (BYTE) (((x % 64) * y) + 64);
+			data[(y * 128 + x) * 4 + 2] = (BYTE) (((x % 64) + y) * 3);
+			data[(y * 128 + x) * 4 + 3] = 0xFF;
+		}
+	}
+
+	context->mode = RLGR3;
+	context->width = 128;
+	context->height = 64;
+	rfx_context_set_pixel_format(context, RDP_PIXEL_FORMAT_B8G8R8A8);
+
+	/* the finest and the coarsest quantization */
+
+	for (x = 0; x < 10; x++)
+	{
+		quants[x] = 6;
+		quants[10 + x] = 15;
+	}
+
+	quants[0] = 5;
+
+	if (rfx_context_set_quantization_values(context, quants, 2))
+	{
+		fprintf(stderr, "rfx_context_set_quantization_values: out of range value accepted\n");
+		goto out;
+	}
+
+	quants[0] = 6;
+
+	if (!rfx_context_set_quantization_values(context, quants, 2) || (context->numQuant != 2))
+	{
+		fprintf(stderr, "rfx_context_set_quantization_values failure\n");
+		goto out;
+	}
+
+	if (rfx_context_set_quantization_index(context, 0, 0, 2) ||
+			!rfx_context_set_quantization_index(context, 0, 0, 0))
+	{
+		fprintf(stderr, "rfx_context_set_quantization_index failure\n");
+		goto out;
+	}
+
+	/* the second tile index is not a registered table, the context index applies */
+
+	if (!rfx_context_set_tile_quantization(context, tileQuantIdx, 2, 1))
+	{
+		fprintf(stderr, "rfx_context_set_tile_quantization failure\n");
+		goto out;
+	}
+
+	rect.x = 0;
+	rect.y = 0;
+	rect.width = 128;
+	rect.height = 64;
+
+	message = rfx_encode_message(context, &rect, 1, data, 128, 64, 128 * 4);
+
+	if (!message || (message->numTiles != 2) || (message->numQuant != 2))
+	{
+		fprintf(stderr, "rfx_encode_message failure\n");
+		goto out;
+	}
+
+	for (x = 0; x < message->numTiles; x++)
+	{
+		tile = message->tiles[x];
+
+		if ((tile->quantIdxY != tile->quantIdxCb) || (tile->quantIdxY != tile->quantIdxCr) ||
+				(tile->quantIdxY != ((tile->xIdx == 0) ? 1 : 0)))
+		{
+			fprintf(stderr, "tile %d,%d: unexpected quantization index %d\n",
+					tile->xIdx, tile->yIdx, tile->quantIdxY);
+			goto out;
+		}
+
+		size[tile->xIdx] = tile->YLen + tile->CbLen + tile->CrLen;
+	}
+
+	if (size[0] >= size[1])
+	{
+		fprintf(stderr, "coarse tile is not smaller: %u >= %u bytes\n", size[0], size[1]);
+		goto out;
+	}
+
+	status = 0;
+
+out:
+	if (message)
+		rfx_message_free(context, message);
+
+	if (context)
+		rfx_context_free(context);
+
+	free(data);
+
+	return status;
+}
+
 int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 {
+	if (test_rfx_tile_quantization() < 0)
+		return -1;
+
 	return 0;
 }
@@ -85,7 +85,7 @@ rdpChannels* freerdp_channels_new(void)
 	if (!channels)
 		return NULL;
 
-	channels->MsgPipe = MessagePipe_New();
+	channels->MsgPipe = MessagePipe_NewEx(WMQ_FLAG_LOCKFREE, 256);
 
 	if (!g_OpenHandles)
 	{
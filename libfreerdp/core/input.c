@@ -580,7 +580,7 @@ rdpInput* input_new(rdpRdp* rdp)
 	{
 		ZeroMemory(input, sizeof(rdpInput));
 
-		input->queue = MessageQueue_New(&cb);
+		input->queue = MessageQueue_NewEx(&cb, WMQ_FLAG_LOCKFREE, 256);
 	}
 
 	return input;
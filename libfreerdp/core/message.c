@@ -37,6 +37,206 @@
 #define TAG FREERDP_TAG("core.message")
 #define WITH_STREAM_POOL	1
 
+/**
+ * Update Message Arena
+ *
+ * Payloads of queued update messages are carved out of large chunks by the thread
+ * posting the messages. Each chunk counts the payloads still queued, and once the
+ * update thread has dispatched and released all of them the whole chunk is reused
+ * as one block, so the asynchronous update path does not go through malloc/free
+ * for every order.
+ */
+
+#define UPDATE_ARENA_CHUNK_SIZE		65536
+#define UPDATE_ARENA_ALIGNMENT		16
+
+struct rdp_update_arena_chunk
+{
+	LONG volatile count;
+	size_t offset;
+	size_t capacity;
+	BYTE* data;
+};
+typedef struct rdp_update_arena_chunk rdpUpdateArenaChunk;
+
+union rdp_update_arena_header
+{
+	rdpUpdateArenaChunk* chunk;
+	BYTE padding[UPDATE_ARENA_ALIGNMENT];
+};
+typedef union rdp_update_arena_header rdpUpdateArenaHeader;
+
+struct rdp_update_arena
+{
+	int size;
+	int count;
+	rdpUpdateArenaChunk** chunks;
+	rdpUpdateArenaChunk* current;
+};
+
+static rdpUpdateArenaChunk* update_arena_chunk_new(rdpUpdateArena* arena)
+{
+	rdpUpdateArenaChunk* chunk;
+	rdpUpdateArenaChunk** chunks;
+
+	if (arena->count >= arena->size)
+	{
+		chunks = (rdpUpdateArenaChunk**) realloc(arena->chunks, sizeof(rdpUpdateArenaChunk*) * arena->size * 2);
+
+		if (!chunks)
+			return NULL;
+
+		arena->size *= 2;
+		arena->chunks = chunks;
+	}
+
+	chunk = (rdpUpdateArenaChunk*) calloc(1, sizeof(rdpUpdateArenaChunk));
+
+	if (!chunk)
+		return NULL;
+
+	chunk->capacity = UPDATE_ARENA_CHUNK_SIZE;
+	chunk->data = (BYTE*) _aligned_malloc(chunk->capacity, UPDATE_ARENA_ALIGNMENT);
+
+	if (!chunk->data)
+	{
+		free(chunk);
+		return NULL;
+	}
+
+	arena->chunks[arena->count++] = chunk;
+
+	return chunk;
+}
+
+static rdpUpdateArenaChunk* update_arena_next_chunk(rdpUpdateArena* arena)
+{
+	int index;
+	rdpUpdateArenaChunk* chunk;
+
+	for (index = 0; index < arena->count; index++)
+	{
+		chunk = arena->chunks[index];
+
+		if ((chunk != arena->current) && (InterlockedCompareExchange(&chunk->count, 0, 0) == 0))
+			return chunk;
+	}
+
+	return update_arena_chunk_new(arena);
+}
+
+/**
+ * Must only be called from the thread posting update messages,
+ * update_arena_free() may be called from any thread.
+ */
+
+void* update_arena_alloc(rdpUpdateArena* arena, size_t size)
+{
+	size_t length;
+	rdpUpdateArenaChunk* chunk;
+	rdpUpdateArenaHeader* header;
+
+	length = sizeof(rdpUpdateArenaHeader) +
+			((size + UPDATE_ARENA_ALIGNMENT - 1) & ~((size_t) UPDATE_ARENA_ALIGNMENT - 1));
+
+	if (!arena || (length > (UPDATE_ARENA_CHUNK_SIZE / 4)))
+	{
+		header = (rdpUpdateArenaHeader*) _aligned_malloc(length, UPDATE_ARENA_ALIGNMENT);
+
+		if (!header)
+			return NULL;
+
+		header->chunk = NULL;
+		return (void*) &header[1];
+	}
+
+	chunk = arena->current;
+
+	/* every payload of the current chunk was released, start over from its beginning */
+
+	if (InterlockedCompareExchange(&chunk->count, 0, 0) == 0)
+		chunk->offset = 0;
+
+	if ((chunk->offset + length) > chunk->capacity)
+	{
+		chunk = update_arena_next_chunk(arena);
+
+		if (!chunk)
+			return NULL;
+
+		chunk->offset = 0;
+		arena->current = chunk;
+	}
+
+	header = (rdpUpdateArenaHeader*) &chunk->data[chunk->offset];
+	header->chunk = chunk;
+
+	chunk->offset += length;
+	InterlockedIncrement(&chunk->count);
+
+	return (void*) &header[1];
+}
+
+void update_arena_free(void* ptr)
+{
+	rdpUpdateArenaHeader* header;
+
+	if (!ptr)
+		return;
+
+	header = &((rdpUpdateArenaHeader*) ptr)[-1];
+
+	if (!header->chunk)
+		_aligned_free(header);
+	else
+		InterlockedDecrement(&header->chunk->count);
+}
+
+rdpUpdateArena* update_arena_new()
+{
+	rdpUpdateArena* arena;
+
+	arena = (rdpUpdateArena*) calloc(1, sizeof(rdpUpdateArena));
+
+	if (!arena)
+		return NULL;
+
+	arena->size = 4;
+	arena->chunks = (rdpUpdateArenaChunk**) calloc(arena->size, sizeof(rdpUpdateArenaChunk*));
+
+	if (arena->chunks)
+		arena->current = update_arena_chunk_new(arena);
+
+	if (!arena->current)
+	{
+		free(arena->chunks);
+		free(arena);
+		return NULL;
+	}
+
+	return arena;
+}
+
+void update_arena_destroy(rdpUpdateArena* arena)
+{
+	int index;
+
+	if (!arena)
+		return;
+
+	for (index = 0; index < arena->count; index++)
+	{
+		_aligned_free(arena->chunks[index]->data);
+		free(arena->chunks[index]);
+	}
+
+	free(arena->chunks);
+	free(arena);
+}
+
+#define update_message_alloc(_context, _size) \
+	update_arena_alloc((_context)->update->arena, (_size))
+
 /* Update */
 
 static void update_message_BeginPaint(rdpContext* context)
@@ -57,7 +257,7 @@ static void update_message_SetBounds(rdpContext* context, rdpBounds* bounds)
 
 	if (bounds)
 	{
-		wParam = (rdpBounds*) malloc(sizeof(rdpBounds));
+		wParam = (rdpBounds*) update_message_alloc(context, sizeof(rdpBounds));
 		CopyMemory(wParam, bounds, sizeof(rdpBounds));
 	}
 
@@ -82,12 +282,12 @@ static void update_message_BitmapUpdate(rdpContext* context, BITMAP_UPDATE* bitm
 	UINT32 index;
 	BITMAP_UPDATE* wParam;
 
-	wParam = (BITMAP_UPDATE*) malloc(sizeof(BITMAP_UPDATE));
+	wParam = (BITMAP_UPDATE*) update_message_alloc(context, sizeof(BITMAP_UPDATE));
 
 	wParam->number = bitmap->number;
 	wParam->count = wParam->number;
 
-	wParam->rectangles = (BITMAP_DATA*) malloc(sizeof(BITMAP_DATA) * wParam->number);
+	wParam->rectangles = (BITMAP_DATA*) update_message_alloc(context, sizeof(BITMAP_DATA) * wParam->number);
 	CopyMemory(wParam->rectangles, bitmap->rectangles, sizeof(BITMAP_DATA) * wParam->number);
 
 	for (index = 0; index < wParam->number; index++)
@@ -95,7 +295,7 @@ static void update_message_BitmapUpdate(rdpContext* context, BITMAP_UPDATE* bitm
 #ifdef WITH_STREAM_POOL
 		StreamPool_AddRef(context->rdp->transport->ReceivePool, bitmap->rectangles[index].bitmapDataStream);
 #else
-		wParam->rectangles[index].bitmapDataStream = (BYTE*) malloc(wParam->rectangles[index].bitmapLength);
+		wParam->rectangles[index].bitmapDataStream = (BYTE*) update_message_alloc(context, wParam->rectangles[index].bitmapLength);
 		CopyMemory(wParam->rectangles[index].bitmapDataStream, bitmap->rectangles[index].bitmapDataStream,
 				wParam->rectangles[index].bitmapLength);
 #endif
@@ -109,7 +309,7 @@ static void update_message_Palette(rdpContext* context, PALETTE_UPDATE* palette)
 {
 	PALETTE_UPDATE* wParam;
 
-	wParam = (PALETTE_UPDATE*) malloc(sizeof(PALETTE_UPDATE));
+	wParam = (PALETTE_UPDATE*) update_message_alloc(context, sizeof(PALETTE_UPDATE));
 	CopyMemory(wParam, palette, sizeof(PALETTE_UPDATE));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -120,7 +320,7 @@ static void update_message_PlaySound(rdpContext* context, PLAY_SOUND_UPDATE* pla
 {
 	PLAY_SOUND_UPDATE* wParam;
 
-	wParam = (PLAY_SOUND_UPDATE*) malloc(sizeof(PLAY_SOUND_UPDATE));
+	wParam = (PLAY_SOUND_UPDATE*) update_message_alloc(context, sizeof(PLAY_SOUND_UPDATE));
 	CopyMemory(wParam, playSound, sizeof(PLAY_SOUND_UPDATE));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -162,11 +362,14 @@ static void update_message_SurfaceCommand(rdpContext* context, wStream* s)
 {
 	wStream* wParam;
 
-	wParam = (wStream*) malloc(sizeof(wStream));
+	wParam = (wStream*) update_message_alloc(context, sizeof(wStream));
+	ZeroMemory(wParam, sizeof(wStream));
 
 	wParam->capacity = Stream_Capacity(s);
-	wParam->buffer = (BYTE*) malloc(wParam->capacity);
+	wParam->length = Stream_Length(s);
+	wParam->buffer = (BYTE*) update_message_alloc(context, wParam->capacity);
 	wParam->pointer = wParam->buffer;
+	CopyMemory(wParam->buffer, Stream_Buffer(s), wParam->capacity);
 
 	MessageQueue_Post(context->update->queue, (void*) context,
 			MakeMessageId(Update, SurfaceCommand), (void*) wParam, NULL);
@@ -176,13 +379,13 @@ static void update_message_SurfaceBits(rdpContext* context, SURFACE_BITS_COMMAND
 {
 	SURFACE_BITS_COMMAND* wParam;
 
-	wParam = (SURFACE_BITS_COMMAND*) malloc(sizeof(SURFACE_BITS_COMMAND));
+	wParam = (SURFACE_BITS_COMMAND*) update_message_alloc(context, sizeof(SURFACE_BITS_COMMAND));
 	CopyMemory(wParam, surfaceBitsCommand, sizeof(SURFACE_BITS_COMMAND));
 
 #ifdef WITH_STREAM_POOL
 	StreamPool_AddRef(context->rdp->transport->ReceivePool, surfaceBitsCommand->bitmapData);
 #else
-	wParam->bitmapData = (BYTE*) malloc(wParam->bitmapDataLength);
+	wParam->bitmapData = (BYTE*) update_message_alloc(context, wParam->bitmapDataLength);
 	CopyMemory(wParam->bitmapData, surfaceBitsCommand->bitmapData, wParam->bitmapDataLength);
 #endif
 
@@ -194,7 +397,7 @@ static void update_message_SurfaceFrameMarker(rdpContext* context, SURFACE_FRAME
 {
 	SURFACE_FRAME_MARKER* wParam;
 
-	wParam = (SURFACE_FRAME_MARKER*) malloc(sizeof(SURFACE_FRAME_MARKER));
+	wParam = (SURFACE_FRAME_MARKER*) update_message_alloc(context, sizeof(SURFACE_FRAME_MARKER));
 	CopyMemory(wParam, surfaceFrameMarker, sizeof(SURFACE_FRAME_MARKER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -213,7 +416,7 @@ static void update_message_DstBlt(rdpContext* context, DSTBLT_ORDER* dstBlt)
 {
 	DSTBLT_ORDER* wParam;
 
-	wParam = (DSTBLT_ORDER*) malloc(sizeof(DSTBLT_ORDER));
+	wParam = (DSTBLT_ORDER*) update_message_alloc(context, sizeof(DSTBLT_ORDER));
 	CopyMemory(wParam, dstBlt, sizeof(DSTBLT_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -224,7 +427,7 @@ static void update_message_PatBlt(rdpContext* context, PATBLT_ORDER* patBlt)
 {
 	PATBLT_ORDER* wParam;
 
-	wParam = (PATBLT_ORDER*) malloc(sizeof(PATBLT_ORDER));
+	wParam = (PATBLT_ORDER*) update_message_alloc(context, sizeof(PATBLT_ORDER));
 	CopyMemory(wParam, patBlt, sizeof(PATBLT_ORDER));
 
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
@@ -237,7 +440,7 @@ static void update_message_ScrBlt(rdpContext* context, SCRBLT_ORDER* scrBlt)
 {
 	SCRBLT_ORDER* wParam;
 
-	wParam = (SCRBLT_ORDER*) malloc(sizeof(SCRBLT_ORDER));
+	wParam = (SCRBLT_ORDER*) update_message_alloc(context, sizeof(SCRBLT_ORDER));
 	CopyMemory(wParam, scrBlt, sizeof(SCRBLT_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -248,7 +451,7 @@ static void update_message_OpaqueRect(rdpContext* context, OPAQUE_RECT_ORDER* op
 {
 	OPAQUE_RECT_ORDER* wParam;
 
-	wParam = (OPAQUE_RECT_ORDER*) malloc(sizeof(OPAQUE_RECT_ORDER));
+	wParam = (OPAQUE_RECT_ORDER*) update_message_alloc(context, sizeof(OPAQUE_RECT_ORDER));
 	CopyMemory(wParam, opaqueRect, sizeof(OPAQUE_RECT_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -259,7 +462,7 @@ static void update_message_DrawNineGrid(rdpContext* context, DRAW_NINE_GRID_ORDE
 {
 	DRAW_NINE_GRID_ORDER* wParam;
 
-	wParam = (DRAW_NINE_GRID_ORDER*) malloc(sizeof(DRAW_NINE_GRID_ORDER));
+	wParam = (DRAW_NINE_GRID_ORDER*) update_message_alloc(context, sizeof(DRAW_NINE_GRID_ORDER));
 	CopyMemory(wParam, drawNineGrid, sizeof(DRAW_NINE_GRID_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -270,7 +473,7 @@ static void update_message_MultiDstBlt(rdpContext* context, MULTI_DSTBLT_ORDER*
 {
 	MULTI_DSTBLT_ORDER* wParam;
 
-	wParam = (MULTI_DSTBLT_ORDER*) malloc(sizeof(MULTI_DSTBLT_ORDER));
+	wParam = (MULTI_DSTBLT_ORDER*) update_message_alloc(context, sizeof(MULTI_DSTBLT_ORDER));
 	CopyMemory(wParam, multiDstBlt, sizeof(MULTI_DSTBLT_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -281,7 +484,7 @@ static void update_message_MultiPatBlt(rdpContext* context, MULTI_PATBLT_ORDER*
 {
 	MULTI_PATBLT_ORDER* wParam;
 
-	wParam = (MULTI_PATBLT_ORDER*) malloc(sizeof(MULTI_PATBLT_ORDER));
+	wParam = (MULTI_PATBLT_ORDER*) update_message_alloc(context, sizeof(MULTI_PATBLT_ORDER));
 	CopyMemory(wParam, multiPatBlt, sizeof(MULTI_PATBLT_ORDER));
 
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
@@ -294,7 +497,7 @@ static void update_message_MultiScrBlt(rdpContext* context, MULTI_SCRBLT_ORDER*
 {
 	MULTI_SCRBLT_ORDER* wParam;
 
-	wParam = (MULTI_SCRBLT_ORDER*) malloc(sizeof(MULTI_SCRBLT_ORDER));
+	wParam = (MULTI_SCRBLT_ORDER*) update_message_alloc(context, sizeof(MULTI_SCRBLT_ORDER));
 	CopyMemory(wParam, multiScrBlt, sizeof(MULTI_SCRBLT_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -305,7 +508,7 @@ static void update_message_MultiOpaqueRect(rdpContext* context, MULTI_OPAQUE_REC
 {
 	MULTI_OPAQUE_RECT_ORDER* wParam;
 
-	wParam = (MULTI_OPAQUE_RECT_ORDER*) malloc(sizeof(MULTI_OPAQUE_RECT_ORDER));
+	wParam = (MULTI_OPAQUE_RECT_ORDER*) update_message_alloc(context, sizeof(MULTI_OPAQUE_RECT_ORDER));
 	CopyMemory(wParam, multiOpaqueRect, sizeof(MULTI_OPAQUE_RECT_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -316,7 +519,7 @@ static void update_message_MultiDrawNineGrid(rdpContext* context, MULTI_DRAW_NIN
 {
 	MULTI_DRAW_NINE_GRID_ORDER* wParam;
 
-	wParam = (MULTI_DRAW_NINE_GRID_ORDER*) malloc(sizeof(MULTI_DRAW_NINE_GRID_ORDER));
+	wParam = (MULTI_DRAW_NINE_GRID_ORDER*) update_message_alloc(context, sizeof(MULTI_DRAW_NINE_GRID_ORDER));
 	CopyMemory(wParam, multiDrawNineGrid, sizeof(MULTI_DRAW_NINE_GRID_ORDER));
 
 	/* TODO: complete copy */
@@ -329,7 +532,7 @@ static void update_message_LineTo(rdpContext* context, LINE_TO_ORDER* lineTo)
 {
 	LINE_TO_ORDER* wParam;
 
-	wParam = (LINE_TO_ORDER*) malloc(sizeof(LINE_TO_ORDER));
+	wParam = (LINE_TO_ORDER*) update_message_alloc(context, sizeof(LINE_TO_ORDER));
 	CopyMemory(wParam, lineTo, sizeof(LINE_TO_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -340,10 +543,10 @@ static void update_message_Polyline(rdpContext* context, POLYLINE_ORDER* polylin
 {
 	POLYLINE_ORDER* wParam;
 
-	wParam = (POLYLINE_ORDER*) malloc(sizeof(POLYLINE_ORDER));
+	wParam = (POLYLINE_ORDER*) update_message_alloc(context, sizeof(POLYLINE_ORDER));
 	CopyMemory(wParam, polyline, sizeof(POLYLINE_ORDER));
 
-	wParam->points = (DELTA_POINT*) malloc(sizeof(DELTA_POINT) * wParam->numDeltaEntries);
+	wParam->points = (DELTA_POINT*) update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numDeltaEntries);
 	CopyMemory(wParam->points, polyline->points, sizeof(DELTA_POINT) * wParam->numDeltaEntries);
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -354,7 +557,7 @@ static void update_message_MemBlt(rdpContext* context, MEMBLT_ORDER* memBlt)
 {
 	MEMBLT_ORDER* wParam;
 
-	wParam = (MEMBLT_ORDER*) malloc(sizeof(MEMBLT_ORDER));
+	wParam = (MEMBLT_ORDER*) update_message_alloc(context, sizeof(MEMBLT_ORDER));
 	CopyMemory(wParam, memBlt, sizeof(MEMBLT_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -365,7 +568,7 @@ static void update_message_Mem3Blt(rdpContext* context, MEM3BLT_ORDER* mem3Blt)
 {
 	MEM3BLT_ORDER* wParam;
 
-	wParam = (MEM3BLT_ORDER*) malloc(sizeof(MEM3BLT_ORDER));
+	wParam = (MEM3BLT_ORDER*) update_message_alloc(context, sizeof(MEM3BLT_ORDER));
 	CopyMemory(wParam, mem3Blt, sizeof(MEM3BLT_ORDER));
 
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
@@ -378,7 +581,7 @@ static void update_message_SaveBitmap(rdpContext* context, SAVE_BITMAP_ORDER* sa
 {
 	SAVE_BITMAP_ORDER* wParam;
 
-	wParam = (SAVE_BITMAP_ORDER*) malloc(sizeof(SAVE_BITMAP_ORDER));
+	wParam = (SAVE_BITMAP_ORDER*) update_message_alloc(context, sizeof(SAVE_BITMAP_ORDER));
 	CopyMemory(wParam, saveBitmap, sizeof(SAVE_BITMAP_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -389,7 +592,7 @@ static void update_message_GlyphIndex(rdpContext* context, GLYPH_INDEX_ORDER* gl
 {
 	GLYPH_INDEX_ORDER* wParam;
 
-	wParam = (GLYPH_INDEX_ORDER*) malloc(sizeof(GLYPH_INDEX_ORDER));
+	wParam = (GLYPH_INDEX_ORDER*) update_message_alloc(context, sizeof(GLYPH_INDEX_ORDER));
 	CopyMemory(wParam, glyphIndex, sizeof(GLYPH_INDEX_ORDER));
 
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
@@ -402,7 +605,7 @@ static void update_message_FastIndex(rdpContext* context, FAST_INDEX_ORDER* fast
 {
 	FAST_INDEX_ORDER* wParam;
 
-	wParam = (FAST_INDEX_ORDER*) malloc(sizeof(FAST_INDEX_ORDER));
+	wParam = (FAST_INDEX_ORDER*) update_message_alloc(context, sizeof(FAST_INDEX_ORDER));
 	CopyMemory(wParam, fastIndex, sizeof(FAST_INDEX_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -413,12 +616,12 @@ static void update_message_FastGlyph(rdpContext* context, FAST_GLYPH_ORDER* fast
 {
 	FAST_GLYPH_ORDER* wParam;
 
-	wParam = (FAST_GLYPH_ORDER*) malloc(sizeof(FAST_GLYPH_ORDER));
+	wParam = (FAST_GLYPH_ORDER*) update_message_alloc(context, sizeof(FAST_GLYPH_ORDER));
 	CopyMemory(wParam, fastGlyph, sizeof(FAST_GLYPH_ORDER));
 
 	if (wParam->cbData > 1)
 	{
-		wParam->glyphData.aj = (BYTE*) malloc(fastGlyph->glyphData.cb);
+		wParam->glyphData.aj = (BYTE*) update_message_alloc(context, fastGlyph->glyphData.cb);
 		CopyMemory(wParam->glyphData.aj, fastGlyph->glyphData.aj, fastGlyph->glyphData.cb);
 	}
 	else
@@ -434,10 +637,10 @@ static void update_message_PolygonSC(rdpContext* context, POLYGON_SC_ORDER* poly
 {
 	POLYGON_SC_ORDER* wParam;
 
-	wParam = (POLYGON_SC_ORDER*) malloc(sizeof(POLYGON_SC_ORDER));
+	wParam = (POLYGON_SC_ORDER*) update_message_alloc(context, sizeof(POLYGON_SC_ORDER));
 	CopyMemory(wParam, polygonSC, sizeof(POLYGON_SC_ORDER));
 
-	wParam->points = (DELTA_POINT*) malloc(sizeof(DELTA_POINT) * wParam->numPoints);
+	wParam->points = (DELTA_POINT*) update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numPoints);
 	CopyMemory(wParam->points, polygonSC, sizeof(DELTA_POINT) * wParam->numPoints);
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -448,10 +651,10 @@ static void update_message_PolygonCB(rdpContext* context, POLYGON_CB_ORDER* poly
 {
 	POLYGON_CB_ORDER* wParam;
 
-	wParam = (POLYGON_CB_ORDER*) malloc(sizeof(POLYGON_CB_ORDER));
+	wParam = (POLYGON_CB_ORDER*) update_message_alloc(context, sizeof(POLYGON_CB_ORDER));
 	CopyMemory(wParam, polygonCB, sizeof(POLYGON_CB_ORDER));
 
-	wParam->points = (DELTA_POINT*) malloc(sizeof(DELTA_POINT) * wParam->numPoints);
+	wParam->points = (DELTA_POINT*) update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numPoints);
 	CopyMemory(wParam->points, polygonCB, sizeof(DELTA_POINT) * wParam->numPoints);
 
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
@@ -464,7 +667,7 @@ static void update_message_EllipseSC(rdpContext* context, ELLIPSE_SC_ORDER* elli
 {
 	ELLIPSE_SC_ORDER* wParam;
 
-	wParam = (ELLIPSE_SC_ORDER*) malloc(sizeof(ELLIPSE_SC_ORDER));
+	wParam = (ELLIPSE_SC_ORDER*) update_message_alloc(context, sizeof(ELLIPSE_SC_ORDER));
 	CopyMemory(wParam, ellipseSC, sizeof(ELLIPSE_SC_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -475,7 +678,7 @@ static void update_message_EllipseCB(rdpContext* context, ELLIPSE_CB_ORDER* elli
 {
 	ELLIPSE_CB_ORDER* wParam;
 
-	wParam = (ELLIPSE_CB_ORDER*) malloc(sizeof(ELLIPSE_CB_ORDER));
+	wParam = (ELLIPSE_CB_ORDER*) update_message_alloc(context, sizeof(ELLIPSE_CB_ORDER));
 	CopyMemory(wParam, ellipseCB, sizeof(ELLIPSE_CB_ORDER));
 
 	wParam->brush.data = (BYTE*) wParam->brush.p8x8;
@@ -490,10 +693,10 @@ static void update_message_CacheBitmap(rdpContext* context, CACHE_BITMAP_ORDER*
 {
 	CACHE_BITMAP_ORDER* wParam;
 
-	wParam = (CACHE_BITMAP_ORDER*) malloc(sizeof(CACHE_BITMAP_ORDER));
+	wParam = (CACHE_BITMAP_ORDER*) update_message_alloc(context, sizeof(CACHE_BITMAP_ORDER));
 	CopyMemory(wParam, cacheBitmapOrder, sizeof(CACHE_BITMAP_ORDER));
 
-	wParam->bitmapDataStream = (BYTE*) malloc(wParam->bitmapLength);
+	wParam->bitmapDataStream = (BYTE*) update_message_alloc(context, wParam->bitmapLength);
 	CopyMemory(wParam->bitmapDataStream, cacheBitmapOrder, wParam->bitmapLength);
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -504,10 +707,10 @@ static void update_message_CacheBitmapV2(rdpContext* context, CACHE_BITMAP_V2_OR
 {
 	CACHE_BITMAP_V2_ORDER* wParam;
 
-	wParam = (CACHE_BITMAP_V2_ORDER*) malloc(sizeof(CACHE_BITMAP_V2_ORDER));
+	wParam = (CACHE_BITMAP_V2_ORDER*) update_message_alloc(context, sizeof(CACHE_BITMAP_V2_ORDER));
 	CopyMemory(wParam, cacheBitmapV2Order, sizeof(CACHE_BITMAP_V2_ORDER));
 
-	wParam->bitmapDataStream = (BYTE*) malloc(wParam->bitmapLength);
+	wParam->bitmapDataStream = (BYTE*) update_message_alloc(context, wParam->bitmapLength);
 	CopyMemory(wParam->bitmapDataStream, cacheBitmapV2Order->bitmapDataStream, wParam->bitmapLength);
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -518,10 +721,10 @@ static void update_message_CacheBitmapV3(rdpContext* context, CACHE_BITMAP_V3_OR
 {
 	CACHE_BITMAP_V3_ORDER* wParam;
 
-	wParam = (CACHE_BITMAP_V3_ORDER*) malloc(sizeof(CACHE_BITMAP_V3_ORDER));
+	wParam = (CACHE_BITMAP_V3_ORDER*) update_message_alloc(context, sizeof(CACHE_BITMAP_V3_ORDER));
 	CopyMemory(wParam, cacheBitmapV3Order, sizeof(CACHE_BITMAP_V3_ORDER));
 
-	wParam->bitmapData.data = (BYTE*) malloc(wParam->bitmapData.length);
+	wParam->bitmapData.data = (BYTE*) update_message_alloc(context, wParam->bitmapData.length);
 	CopyMemory(wParam->bitmapData.data, cacheBitmapV3Order->bitmapData.data, wParam->bitmapData.length);
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -532,7 +735,7 @@ static void update_message_CacheColorTable(rdpContext* context, CACHE_COLOR_TABL
 {
 	CACHE_COLOR_TABLE_ORDER* wParam;
 
-	wParam = (CACHE_COLOR_TABLE_ORDER*) malloc(sizeof(CACHE_COLOR_TABLE_ORDER));
+	wParam = (CACHE_COLOR_TABLE_ORDER*) update_message_alloc(context, sizeof(CACHE_COLOR_TABLE_ORDER));
 	CopyMemory(wParam, cacheColorTableOrder, sizeof(CACHE_COLOR_TABLE_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -543,7 +746,7 @@ static void update_message_CacheGlyph(rdpContext* context, CACHE_GLYPH_ORDER* ca
 {
 	CACHE_GLYPH_ORDER* wParam;
 
-	wParam = (CACHE_GLYPH_ORDER*) malloc(sizeof(CACHE_GLYPH_ORDER));
+	wParam = (CACHE_GLYPH_ORDER*) update_message_alloc(context, sizeof(CACHE_GLYPH_ORDER));
 	CopyMemory(wParam, cacheGlyphOrder, sizeof(CACHE_GLYPH_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -554,7 +757,7 @@ static void update_message_CacheGlyphV2(rdpContext* context, CACHE_GLYPH_V2_ORDE
 {
 	CACHE_GLYPH_V2_ORDER* wParam;
 
-	wParam = (CACHE_GLYPH_V2_ORDER*) malloc(sizeof(CACHE_GLYPH_V2_ORDER));
+	wParam = (CACHE_GLYPH_V2_ORDER*) update_message_alloc(context, sizeof(CACHE_GLYPH_V2_ORDER));
 	CopyMemory(wParam, cacheGlyphV2Order, sizeof(CACHE_GLYPH_V2_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -565,7 +768,7 @@ static void update_message_CacheBrush(rdpContext* context, CACHE_BRUSH_ORDER* ca
 {
 	CACHE_BRUSH_ORDER* wParam;
 
-	wParam = (CACHE_BRUSH_ORDER*) malloc(sizeof(CACHE_BRUSH_ORDER));
+	wParam = (CACHE_BRUSH_ORDER*) update_message_alloc(context, sizeof(CACHE_BRUSH_ORDER));
 	CopyMemory(wParam, cacheBrushOrder, sizeof(CACHE_BRUSH_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -578,12 +781,12 @@ static void update_message_CreateOffscreenBitmap(rdpContext* context, CREATE_OFF
 {
 	CREATE_OFFSCREEN_BITMAP_ORDER* wParam;
 
-	wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*) malloc(sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
+	wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*) update_message_alloc(context, sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
 	CopyMemory(wParam, createOffscreenBitmap, sizeof(CREATE_OFFSCREEN_BITMAP_ORDER));
 
 	wParam->deleteList.cIndices = createOffscreenBitmap->deleteList.cIndices;
 	wParam->deleteList.sIndices = wParam->deleteList.cIndices;
-	wParam->deleteList.indices = (UINT16*) malloc(sizeof(UINT16) * wParam->deleteList.cIndices);
+	wParam->deleteList.indices = (UINT16*) update_message_alloc(context, sizeof(UINT16) * wParam->deleteList.cIndices);
 	CopyMemory(wParam->deleteList.indices, createOffscreenBitmap->deleteList.indices, wParam->deleteList.cIndices);
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -594,7 +797,7 @@ static void update_message_SwitchSurface(rdpContext* context, SWITCH_SURFACE_ORD
 {
 	SWITCH_SURFACE_ORDER* wParam;
 
-	wParam = (SWITCH_SURFACE_ORDER*) malloc(sizeof(SWITCH_SURFACE_ORDER));
+	wParam = (SWITCH_SURFACE_ORDER*) update_message_alloc(context, sizeof(SWITCH_SURFACE_ORDER));
 	CopyMemory(wParam, switchSurface, sizeof(SWITCH_SURFACE_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -605,7 +808,7 @@ static void update_message_CreateNineGridBitmap(rdpContext* context, CREATE_NINE
 {
 	CREATE_NINE_GRID_BITMAP_ORDER* wParam;
 
-	wParam = (CREATE_NINE_GRID_BITMAP_ORDER*) malloc(sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
+	wParam = (CREATE_NINE_GRID_BITMAP_ORDER*) update_message_alloc(context, sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
 	CopyMemory(wParam, createNineGridBitmap, sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -616,7 +819,7 @@ static void update_message_FrameMarker(rdpContext* context, FRAME_MARKER_ORDER*
 {
 	FRAME_MARKER_ORDER* wParam;
 
-	wParam = (FRAME_MARKER_ORDER*) malloc(sizeof(FRAME_MARKER_ORDER));
+	wParam = (FRAME_MARKER_ORDER*) update_message_alloc(context, sizeof(FRAME_MARKER_ORDER));
 	CopyMemory(wParam, frameMarker, sizeof(FRAME_MARKER_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -627,7 +830,7 @@ static void update_message_StreamBitmapFirst(rdpContext* context, STREAM_BITMAP_
 {
 	STREAM_BITMAP_FIRST_ORDER* wParam;
 
-	wParam = (STREAM_BITMAP_FIRST_ORDER*) malloc(sizeof(STREAM_BITMAP_FIRST_ORDER));
+	wParam = (STREAM_BITMAP_FIRST_ORDER*) update_message_alloc(context, sizeof(STREAM_BITMAP_FIRST_ORDER));
 	CopyMemory(wParam, streamBitmapFirst, sizeof(STREAM_BITMAP_FIRST_ORDER));
 
 	/* TODO: complete copy */
@@ -640,7 +843,7 @@ static void update_message_StreamBitmapNext(rdpContext* context, STREAM_BITMAP_N
 {
 	STREAM_BITMAP_NEXT_ORDER* wParam;
 
-	wParam = (STREAM_BITMAP_NEXT_ORDER*) malloc(sizeof(STREAM_BITMAP_NEXT_ORDER));
+	wParam = (STREAM_BITMAP_NEXT_ORDER*) update_message_alloc(context, sizeof(STREAM_BITMAP_NEXT_ORDER));
 	CopyMemory(wParam, streamBitmapNext, sizeof(STREAM_BITMAP_NEXT_ORDER));
 
 	/* TODO: complete copy */
@@ -653,7 +856,7 @@ static void update_message_DrawGdiPlusFirst(rdpContext* context, DRAW_GDIPLUS_FI
 {
 	DRAW_GDIPLUS_FIRST_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_FIRST_ORDER*) malloc(sizeof(DRAW_GDIPLUS_FIRST_ORDER));
+	wParam = (DRAW_GDIPLUS_FIRST_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_FIRST_ORDER));
 	CopyMemory(wParam, drawGdiPlusFirst, sizeof(DRAW_GDIPLUS_FIRST_ORDER));
 
 	/* TODO: complete copy */
@@ -666,7 +869,7 @@ static void update_message_DrawGdiPlusNext(rdpContext* context, DRAW_GDIPLUS_NEX
 {
 	DRAW_GDIPLUS_NEXT_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_NEXT_ORDER*) malloc(sizeof(DRAW_GDIPLUS_NEXT_ORDER));
+	wParam = (DRAW_GDIPLUS_NEXT_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_NEXT_ORDER));
 	CopyMemory(wParam, drawGdiPlusNext, sizeof(DRAW_GDIPLUS_NEXT_ORDER));
 
 	/* TODO: complete copy */
@@ -679,7 +882,7 @@ static void update_message_DrawGdiPlusEnd(rdpContext* context, DRAW_GDIPLUS_END_
 {
 	DRAW_GDIPLUS_END_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_END_ORDER*) malloc(sizeof(DRAW_GDIPLUS_END_ORDER));
+	wParam = (DRAW_GDIPLUS_END_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_END_ORDER));
 	CopyMemory(wParam, drawGdiPlusEnd, sizeof(DRAW_GDIPLUS_END_ORDER));
 
 	/* TODO: complete copy */
@@ -692,7 +895,7 @@ static void update_message_DrawGdiPlusCacheFirst(rdpContext* context, DRAW_GDIPL
 {
 	DRAW_GDIPLUS_CACHE_FIRST_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_CACHE_FIRST_ORDER*) malloc(sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
+	wParam = (DRAW_GDIPLUS_CACHE_FIRST_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
 	CopyMemory(wParam, drawGdiPlusCacheFirst, sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
 
 	/* TODO: complete copy */
@@ -705,7 +908,7 @@ static void update_message_DrawGdiPlusCacheNext(rdpContext* context, DRAW_GDIPLU
 {
 	DRAW_GDIPLUS_CACHE_NEXT_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_CACHE_NEXT_ORDER*) malloc(sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
+	wParam = (DRAW_GDIPLUS_CACHE_NEXT_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
 	CopyMemory(wParam, drawGdiPlusCacheNext, sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
 
 	/* TODO: complete copy */
@@ -718,7 +921,7 @@ static void update_message_DrawGdiPlusCacheEnd(rdpContext* context, DRAW_GDIPLUS
 {
 	DRAW_GDIPLUS_CACHE_END_ORDER* wParam;
 
-	wParam = (DRAW_GDIPLUS_CACHE_END_ORDER*) malloc(sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
+	wParam = (DRAW_GDIPLUS_CACHE_END_ORDER*) update_message_alloc(context, sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
 	CopyMemory(wParam, drawGdiPlusCacheEnd, sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
 
 	/* TODO: complete copy */
@@ -734,10 +937,10 @@ static void update_message_WindowCreate(rdpContext* context, WINDOW_ORDER_INFO*
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_STATE_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (WINDOW_STATE_ORDER*) malloc(sizeof(WINDOW_STATE_ORDER));
+	lParam = (WINDOW_STATE_ORDER*) update_message_alloc(context, sizeof(WINDOW_STATE_ORDER));
 	CopyMemory(lParam, windowState, sizeof(WINDOW_STATE_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -749,10 +952,10 @@ static void update_message_WindowUpdate(rdpContext* context, WINDOW_ORDER_INFO*
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_STATE_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (WINDOW_STATE_ORDER*) malloc(sizeof(WINDOW_STATE_ORDER));
+	lParam = (WINDOW_STATE_ORDER*) update_message_alloc(context, sizeof(WINDOW_STATE_ORDER));
 	CopyMemory(lParam, windowState, sizeof(WINDOW_STATE_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -764,29 +967,29 @@ static void update_message_WindowIcon(rdpContext* context, WINDOW_ORDER_INFO* or
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_ICON_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (WINDOW_ICON_ORDER*) malloc(sizeof(WINDOW_ICON_ORDER));
+	lParam = (WINDOW_ICON_ORDER*) update_message_alloc(context, sizeof(WINDOW_ICON_ORDER));
 	CopyMemory(lParam, windowIcon, sizeof(WINDOW_ICON_ORDER));
 
 	WLog_VRB(TAG,  "update_message_WindowIcon");
 
 	if (windowIcon->iconInfo->cbBitsColor > 0)
 	{
-		lParam->iconInfo->bitsColor = (BYTE*) malloc(windowIcon->iconInfo->cbBitsColor);
+		lParam->iconInfo->bitsColor = (BYTE*) update_message_alloc(context, windowIcon->iconInfo->cbBitsColor);
 		CopyMemory(lParam->iconInfo->bitsColor, windowIcon->iconInfo->bitsColor, windowIcon->iconInfo->cbBitsColor);
 	}
 
 	if (windowIcon->iconInfo->cbBitsMask > 0)
 	{
-		lParam->iconInfo->bitsMask = (BYTE*) malloc(windowIcon->iconInfo->cbBitsMask);
+		lParam->iconInfo->bitsMask = (BYTE*) update_message_alloc(context, windowIcon->iconInfo->cbBitsMask);
 		CopyMemory(lParam->iconInfo->bitsMask, windowIcon->iconInfo->bitsMask, windowIcon->iconInfo->cbBitsMask);
 	}
 
 	if (windowIcon->iconInfo->cbColorTable > 0)
 	{
-		lParam->iconInfo->colorTable = (BYTE*) malloc(windowIcon->iconInfo->cbColorTable);
+		lParam->iconInfo->colorTable = (BYTE*) update_message_alloc(context, windowIcon->iconInfo->cbColorTable);
 		CopyMemory(lParam->iconInfo->colorTable, windowIcon->iconInfo->colorTable, windowIcon->iconInfo->cbColorTable);
 	}
 
@@ -799,10 +1002,10 @@ static void update_message_WindowCachedIcon(rdpContext* context, WINDOW_ORDER_IN
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_CACHED_ICON_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (WINDOW_CACHED_ICON_ORDER*) malloc(sizeof(WINDOW_CACHED_ICON_ORDER));
+	lParam = (WINDOW_CACHED_ICON_ORDER*) update_message_alloc(context, sizeof(WINDOW_CACHED_ICON_ORDER));
 	CopyMemory(lParam, windowCachedIcon, sizeof(WINDOW_CACHED_ICON_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -813,7 +1016,7 @@ static void update_message_WindowDelete(rdpContext* context, WINDOW_ORDER_INFO*
 {
 	WINDOW_ORDER_INFO* wParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -825,10 +1028,10 @@ static void update_message_NotifyIconCreate(rdpContext* context, WINDOW_ORDER_IN
 	WINDOW_ORDER_INFO* wParam;
 	NOTIFY_ICON_STATE_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (NOTIFY_ICON_STATE_ORDER*) malloc(sizeof(NOTIFY_ICON_STATE_ORDER));
+	lParam = (NOTIFY_ICON_STATE_ORDER*) update_message_alloc(context, sizeof(NOTIFY_ICON_STATE_ORDER));
 	CopyMemory(lParam, notifyIconState, sizeof(NOTIFY_ICON_STATE_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -840,10 +1043,10 @@ static void update_message_NotifyIconUpdate(rdpContext* context, WINDOW_ORDER_IN
 	WINDOW_ORDER_INFO* wParam;
 	NOTIFY_ICON_STATE_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (NOTIFY_ICON_STATE_ORDER*) malloc(sizeof(NOTIFY_ICON_STATE_ORDER));
+	lParam = (NOTIFY_ICON_STATE_ORDER*) update_message_alloc(context, sizeof(NOTIFY_ICON_STATE_ORDER));
 	CopyMemory(lParam, notifyIconState, sizeof(NOTIFY_ICON_STATE_ORDER));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -854,7 +1057,7 @@ static void update_message_NotifyIconDelete(rdpContext* context, WINDOW_ORDER_IN
 {
 	WINDOW_ORDER_INFO* wParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -866,17 +1069,17 @@ static void update_message_MonitoredDesktop(rdpContext* context, WINDOW_ORDER_IN
 	WINDOW_ORDER_INFO* wParam;
 	MONITORED_DESKTOP_ORDER* lParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	lParam = (MONITORED_DESKTOP_ORDER*) malloc(sizeof(MONITORED_DESKTOP_ORDER));
+	lParam = (MONITORED_DESKTOP_ORDER*) update_message_alloc(context, sizeof(MONITORED_DESKTOP_ORDER));
 	CopyMemory(lParam, monitoredDesktop, sizeof(MONITORED_DESKTOP_ORDER));
 
 	lParam->windowIds = NULL;
 
 	if (lParam->numWindowIds)
 	{
-		lParam->windowIds = (UINT32*) malloc(sizeof(UINT32) * lParam->numWindowIds);
+		lParam->windowIds = (UINT32*) update_message_alloc(context, sizeof(UINT32) * lParam->numWindowIds);
 		CopyMemory(lParam->windowIds, monitoredDesktop->windowIds, lParam->numWindowIds);
 	}
 
@@ -888,7 +1091,7 @@ static void update_message_NonMonitoredDesktop(rdpContext* context, WINDOW_ORDER
 {
 	WINDOW_ORDER_INFO* wParam;
 
-	wParam = (WINDOW_ORDER_INFO*) malloc(sizeof(WINDOW_ORDER_INFO));
+	wParam = (WINDOW_ORDER_INFO*) update_message_alloc(context, sizeof(WINDOW_ORDER_INFO));
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -901,7 +1104,7 @@ static void update_message_PointerPosition(rdpContext* context, POINTER_POSITION
 {
 	POINTER_POSITION_UPDATE* wParam;
 
-	wParam = (POINTER_POSITION_UPDATE*) malloc(sizeof(POINTER_POSITION_UPDATE));
+	wParam = (POINTER_POSITION_UPDATE*) update_message_alloc(context, sizeof(POINTER_POSITION_UPDATE));
 	CopyMemory(wParam, pointerPosition, sizeof(POINTER_POSITION_UPDATE));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -912,7 +1115,7 @@ static void update_message_PointerSystem(rdpContext* context, POINTER_SYSTEM_UPD
 {
 	POINTER_SYSTEM_UPDATE* wParam;
 
-	wParam = (POINTER_SYSTEM_UPDATE*) malloc(sizeof(POINTER_SYSTEM_UPDATE));
+	wParam = (POINTER_SYSTEM_UPDATE*) update_message_alloc(context, sizeof(POINTER_SYSTEM_UPDATE));
 	CopyMemory(wParam, pointerSystem, sizeof(POINTER_SYSTEM_UPDATE));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -923,20 +1126,20 @@ static void update_message_PointerColor(rdpContext* context, POINTER_COLOR_UPDAT
 {
 	POINTER_COLOR_UPDATE* wParam;
 
-	wParam = (POINTER_COLOR_UPDATE*) malloc(sizeof(POINTER_COLOR_UPDATE));
+	wParam = (POINTER_COLOR_UPDATE*) update_message_alloc(context, sizeof(POINTER_COLOR_UPDATE));
 	CopyMemory(wParam, pointerColor, sizeof(POINTER_COLOR_UPDATE));
 
 	wParam->andMaskData = wParam->xorMaskData = NULL;
 
 	if (wParam->lengthAndMask)
 	{
-		wParam->andMaskData = (BYTE*) malloc(wParam->lengthAndMask);
+		wParam->andMaskData = (BYTE*) update_message_alloc(context, wParam->lengthAndMask);
 		CopyMemory(wParam->andMaskData, pointerColor->andMaskData, wParam->lengthAndMask);
 	}
 
 	if (wParam->lengthXorMask)
 	{
-		wParam->xorMaskData = (BYTE*) malloc(wParam->lengthXorMask);
+		wParam->xorMaskData = (BYTE*) update_message_alloc(context, wParam->lengthXorMask);
 		CopyMemory(wParam->xorMaskData, pointerColor->xorMaskData, wParam->lengthXorMask);
 	}
 
@@ -948,20 +1151,20 @@ static void update_message_PointerNew(rdpContext* context, POINTER_NEW_UPDATE* p
 {
 	POINTER_NEW_UPDATE* wParam;
 
-	wParam = (POINTER_NEW_UPDATE*) malloc(sizeof(POINTER_NEW_UPDATE));
+	wParam = (POINTER_NEW_UPDATE*) update_message_alloc(context, sizeof(POINTER_NEW_UPDATE));
 	CopyMemory(wParam, pointerNew, sizeof(POINTER_NEW_UPDATE));
 
 	wParam->colorPtrAttr.andMaskData = wParam->colorPtrAttr.xorMaskData = NULL;
 
 	if (wParam->colorPtrAttr.lengthAndMask)
 	{
-		wParam->colorPtrAttr.andMaskData = (BYTE*) malloc(wParam->colorPtrAttr.lengthAndMask);
+		wParam->colorPtrAttr.andMaskData = (BYTE*) update_message_alloc(context, wParam->colorPtrAttr.lengthAndMask);
 		CopyMemory(wParam->colorPtrAttr.andMaskData, pointerNew->colorPtrAttr.andMaskData, wParam->colorPtrAttr.lengthAndMask);
 	}
 
 	if (wParam->colorPtrAttr.lengthXorMask)
 	{
-		wParam->colorPtrAttr.xorMaskData = (BYTE*) malloc(wParam->colorPtrAttr.lengthXorMask);
+		wParam->colorPtrAttr.xorMaskData = (BYTE*) update_message_alloc(context, wParam->colorPtrAttr.lengthXorMask);
 		CopyMemory(wParam->colorPtrAttr.xorMaskData, pointerNew->colorPtrAttr.xorMaskData, wParam->colorPtrAttr.lengthXorMask);
 	}
 
@@ -973,7 +1176,7 @@ static void update_message_PointerCached(rdpContext* context, POINTER_CACHED_UPD
 {
 	POINTER_CACHED_UPDATE* wParam;
 
-	wParam = (POINTER_CACHED_UPDATE*) malloc(sizeof(POINTER_CACHED_UPDATE));
+	wParam = (POINTER_CACHED_UPDATE*) update_message_alloc(context, sizeof(POINTER_CACHED_UPDATE));
 	CopyMemory(wParam, pointerCached, sizeof(POINTER_CACHED_UPDATE));
 
 	MessageQueue_Post(context->update->queue, (void*) context,
@@ -995,7 +1198,7 @@ static int update_message_free_update_class(wMessage* msg, int type)
 
 		case Update_SetBounds:
 			if (msg->wParam)
-				free(msg->wParam);
+				update_arena_free(msg->wParam);
 			break;
 
 		case Update_Synchronize:
@@ -1015,21 +1218,21 @@ static int update_message_free_update_class(wMessage* msg, int type)
 					rdpContext* context = (rdpContext*) msg->context;
 					StreamPool_Release(context->rdp->transport->ReceivePool, wParam->rectangles[index].bitmapDataStream);
 #else
-					free(wParam->rectangles[index].bitmapDataStream);
+					update_arena_free(wParam->rectangles[index].bitmapDataStream);
 #endif
 				}
 
-				free(wParam->rectangles);
-				free(wParam);
+				update_arena_free(wParam->rectangles);
+				update_arena_free(wParam);
 			}
 			break;
 
 		case Update_Palette:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case Update_PlaySound:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case Update_RefreshRect:
@@ -1044,7 +1247,8 @@ static int update_message_free_update_class(wMessage* msg, int type)
 		case Update_SurfaceCommand:
 			{
 				wStream* s = (wStream*) msg->wParam;
-				Stream_Free(s, TRUE);
+				update_arena_free(Stream_Buffer(s));
+				update_arena_free(s);
 			}
 			break;
 
@@ -1054,16 +1258,17 @@ static int update_message_free_update_class(wMessage* msg, int type)
 				rdpContext* context = (rdpContext*) msg->context;
 				SURFACE_BITS_COMMAND* wParam = (SURFACE_BITS_COMMAND*) msg->wParam;
 				StreamPool_Release(context->rdp->transport->ReceivePool, wParam->bitmapData);
+				update_arena_free(wParam);
 #else
 				SURFACE_BITS_COMMAND* wParam = (SURFACE_BITS_COMMAND*) msg->wParam;
-				free(wParam->bitmapData);
-				free(wParam);
+				update_arena_free(wParam->bitmapData);
+				update_arena_free(wParam);
 #endif
 			}
 			break;
 
 		case Update_SurfaceFrameMarker:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case Update_SurfaceFrameAcknowledge:
@@ -1162,84 +1367,84 @@ static int update_message_free_primary_update_class(wMessage* msg, int type)
 	switch (type)
 	{
 		case PrimaryUpdate_DstBlt:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_PatBlt:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_ScrBlt:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_OpaqueRect:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_DrawNineGrid:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiDstBlt:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiPatBlt:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiScrBlt:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiOpaqueRect:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_MultiDrawNineGrid:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_LineTo:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_Polyline:
 			{
 				POLYLINE_ORDER* wParam = (POLYLINE_ORDER*) msg->wParam;
 
-				free(wParam->points);
-				free(wParam);
+				update_arena_free(wParam->points);
+				update_arena_free(wParam);
 			}
 			break;
 
 		case PrimaryUpdate_MemBlt:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_Mem3Blt:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_SaveBitmap:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_GlyphIndex:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_FastIndex:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_FastGlyph:
 			{
 				FAST_GLYPH_ORDER* wParam = (FAST_GLYPH_ORDER*) msg->wParam;
 				if (wParam->glyphData.aj)
-					free(wParam->glyphData.aj);
-				free(wParam);
+					update_arena_free(wParam->glyphData.aj);
+				update_arena_free(wParam);
 			}
 			break;
 
@@ -1247,8 +1452,8 @@ static int update_message_free_primary_update_class(wMessage* msg, int type)
 			{
 				POLYGON_SC_ORDER* wParam = (POLYGON_SC_ORDER*) msg->wParam;
 
-				free(wParam->points);
-				free(wParam);
+				update_arena_free(wParam->points);
+				update_arena_free(wParam);
 			}
 			break;
 
@@ -1256,17 +1461,17 @@ static int update_message_free_primary_update_class(wMessage* msg, int type)
 			{
 				POLYGON_CB_ORDER* wParam = (POLYGON_CB_ORDER*) msg->wParam;
 
-				free(wParam->points);
-				free(wParam);
+				update_arena_free(wParam->points);
+				update_arena_free(wParam);
 			}
 			break;
 
 		case PrimaryUpdate_EllipseSC:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PrimaryUpdate_EllipseCB:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		default:
@@ -1390,8 +1595,8 @@ static int update_message_free_secondary_update_class(wMessage* msg, int type)
 			{
 				CACHE_BITMAP_ORDER* wParam = (CACHE_BITMAP_ORDER*) msg->wParam;
 
-				free(wParam->bitmapDataStream);
-				free(wParam);
+				update_arena_free(wParam->bitmapDataStream);
+				update_arena_free(wParam);
 			}
 			break;
 
@@ -1399,8 +1604,8 @@ static int update_message_free_secondary_update_class(wMessage* msg, int type)
 			{
 				CACHE_BITMAP_V2_ORDER* wParam = (CACHE_BITMAP_V2_ORDER*) msg->wParam;
 
-				free(wParam->bitmapDataStream);
-				free(wParam);
+				update_arena_free(wParam->bitmapDataStream);
+				update_arena_free(wParam);
 			}
 			break;
 
@@ -1408,36 +1613,36 @@ static int update_message_free_secondary_update_class(wMessage* msg, int type)
 			{
 				CACHE_BITMAP_V3_ORDER* wParam = (CACHE_BITMAP_V3_ORDER*) msg->wParam;
 
-				free(wParam->bitmapData.data);
-				free(wParam);
+				update_arena_free(wParam->bitmapData.data);
+				update_arena_free(wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheColorTable:
 			{
 				CACHE_COLOR_TABLE_ORDER* wParam = (CACHE_COLOR_TABLE_ORDER*) msg->wParam;
-				free(wParam);
+				update_arena_free(wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheGlyph:
 			{
 				CACHE_GLYPH_ORDER* wParam = (CACHE_GLYPH_ORDER*) msg->wParam;
-				free(wParam);
+				update_arena_free(wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheGlyphV2:
 			{
 				CACHE_GLYPH_V2_ORDER* wParam = (CACHE_GLYPH_V2_ORDER*) msg->wParam;
-				free(wParam);
+				update_arena_free(wParam);
 			}
 			break;
 
 		case SecondaryUpdate_CacheBrush:
 			{
 				CACHE_BRUSH_ORDER* wParam = (CACHE_BRUSH_ORDER*) msg->wParam;
-				free(wParam);
+				update_arena_free(wParam);
 			}
 			break;
 
@@ -1502,53 +1707,53 @@ static int update_message_free_altsec_update_class(wMessage* msg, int type)
 			{
 				CREATE_OFFSCREEN_BITMAP_ORDER* wParam = (CREATE_OFFSCREEN_BITMAP_ORDER*) msg->wParam;
 
-				free(wParam->deleteList.indices);
-				free(wParam);
+				update_arena_free(wParam->deleteList.indices);
+				update_arena_free(wParam);
 			}
 			break;
 
 		case AltSecUpdate_SwitchSurface:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_CreateNineGridBitmap:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_FrameMarker:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_StreamBitmapFirst:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_StreamBitmapNext:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusFirst:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusNext:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusEnd:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheFirst:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheNext:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case AltSecUpdate_DrawGdiPlusCacheEnd:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		default:
@@ -1629,13 +1834,13 @@ static int update_message_free_window_update_class(wMessage* msg, int type)
 	switch (type)
 	{
 		case WindowUpdate_WindowCreate:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_arena_free(msg->wParam);
+			update_arena_free(msg->lParam);
 			break;
 
 		case WindowUpdate_WindowUpdate:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_arena_free(msg->wParam);
+			update_arena_free(msg->lParam);
 			break;
 
 		case WindowUpdate_WindowIcon:
@@ -1645,60 +1850,60 @@ static int update_message_free_window_update_class(wMessage* msg, int type)
 
 				if (windowIcon->iconInfo->cbBitsColor > 0)
 				{
-					free(windowIcon->iconInfo->bitsColor);
+					update_arena_free(windowIcon->iconInfo->bitsColor);
 				}
 
 				if (windowIcon->iconInfo->cbBitsMask > 0)
 				{
-					free(windowIcon->iconInfo->bitsMask);
+					update_arena_free(windowIcon->iconInfo->bitsMask);
 				}
 
 				if (windowIcon->iconInfo->cbColorTable > 0)
 				{
-					free(windowIcon->iconInfo->colorTable);
+					update_arena_free(windowIcon->iconInfo->colorTable);
 				}
 
-				free(orderInfo);
-				free(windowIcon);
+				update_arena_free(orderInfo);
+				update_arena_free(windowIcon);
 			}
 			break;
 
 		case WindowUpdate_WindowCachedIcon:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_arena_free(msg->wParam);
+			update_arena_free(msg->lParam);
 			break;
 
 		case WindowUpdate_WindowDelete:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case WindowUpdate_NotifyIconCreate:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_arena_free(msg->wParam);
+			update_arena_free(msg->lParam);
 			break;
 
 		case WindowUpdate_NotifyIconUpdate:
-			free(msg->wParam);
-			free(msg->lParam);
+			update_arena_free(msg->wParam);
+			update_arena_free(msg->lParam);
 			break;
 
 		case WindowUpdate_NotifyIconDelete:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case WindowUpdate_MonitoredDesktop:
 			{
 				MONITORED_DESKTOP_ORDER* lParam = (MONITORED_DESKTOP_ORDER*) msg->lParam;
 
-				free(msg->wParam);
+				update_arena_free(msg->wParam);
 
-				free(lParam->windowIds);
-				free(lParam);
+				update_arena_free(lParam->windowIds);
+				update_arena_free(lParam);
 			}
 			break;
 
 		case WindowUpdate_NonMonitoredDesktop:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		default:
@@ -1784,16 +1989,16 @@ int update_message_free_pointer_update_class(wMessage* msg, int type)
 		case PointerUpdate_PointerPosition:
 		case PointerUpdate_PointerSystem:
 		case PointerUpdate_PointerCached:
-			free(msg->wParam);
+			update_arena_free(msg->wParam);
 			break;
 
 		case PointerUpdate_PointerColor:
 			{
 				POINTER_COLOR_UPDATE* wParam = (POINTER_COLOR_UPDATE*) msg->wParam;
 
-				free(wParam->andMaskData);
-				free(wParam->xorMaskData);
-				free(wParam);
+				update_arena_free(wParam->andMaskData);
+				update_arena_free(wParam->xorMaskData);
+				update_arena_free(wParam);
 			}
 			break;
 		
@@ -1801,9 +2006,9 @@ int update_message_free_pointer_update_class(wMessage* msg, int type)
 			{
 				POINTER_NEW_UPDATE* wParam = (POINTER_NEW_UPDATE*) msg->wParam;
 
-				free(wParam->colorPtrAttr.andMaskData);
-				free(wParam->colorPtrAttr.xorMaskData);
-				free(wParam);
+				update_arena_free(wParam->colorPtrAttr.andMaskData);
+				update_arena_free(wParam->colorPtrAttr.xorMaskData);
+				update_arena_free(wParam);
 			}
 			break;
 		default:
@@ -125,6 +125,12 @@ struct rdp_update_proxy
 	HANDLE thread;
 };
 
+void* update_arena_alloc(rdpUpdateArena* arena, size_t size);
+void update_arena_free(void* ptr);
+
+rdpUpdateArena* update_arena_new();
+void update_arena_destroy(rdpUpdateArena* arena);
+
 int update_message_queue_process_message(rdpUpdate* update, wMessage* message);
 int update_message_queue_free_message(wMessage* message);
 
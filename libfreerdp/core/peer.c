@@ -591,6 +591,11 @@ static int freerdp_peer_drain_output_buffer(freerdp_peer* peer)
 	return tranport_drain_output_buffer(transport);
 }
 
+static size_t freerdp_peer_get_output_buffer_size(freerdp_peer* peer)
+{
+	return transport_get_output_buffer_size(peer->context->rdp->transport);
+}
+
 void freerdp_peer_context_new(freerdp_peer* client)
 {
 	rdpRdp* rdp;
@@ -630,6 +635,7 @@ void freerdp_peer_context_new(freerdp_peer* client)
 
 	client->IsWriteBlocked = freerdp_peer_is_write_blocked;
 	client->DrainOutputBuffer = freerdp_peer_drain_output_buffer;
+	client->GetOutputBufferSize = freerdp_peer_get_output_buffer_size;
 
 	IFCALL(client->ContextNew, client, client->context);
 }
@@ -662,6 +668,7 @@ freerdp_peer* freerdp_peer_new(int sockfd)
 		client->SendChannelData = freerdp_peer_send_channel_data;
 		client->IsWriteBlocked = freerdp_peer_is_write_blocked;
 		client->DrainOutputBuffer = freerdp_peer_drain_output_buffer;
+		client->GetOutputBufferSize = freerdp_peer_get_output_buffer_size;
 		client->VirtualChannelOpen = freerdp_peer_virtual_channel_open;
 		client->VirtualChannelClose = freerdp_peer_virtual_channel_close;
 		client->VirtualChannelWrite = freerdp_peer_virtual_channel_write;
@@ -0,0 +1,732 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP Server Peer Loop
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/log.h>
+
+#include "peerloop.h"
+
+#define TAG FREERDP_TAG("core.peerloop")
+
+/**
+ * Peer Loop
+ *
+ * Runs many peers on a fixed number of threads instead of one thread per
+ * peer. The connection sequence blocks, so it runs on a thread of its own
+ * and the peer only joins the loop once activated. Each peer is assigned
+ * to one of the I/O threads, which waits on the handles of all its peers
+ * in a wait set. A ready peer is removed from the wait set and processed
+ * by a worker of the pool: output is drained, the peer is checked when its
+ * event handle is ready and the event callbacks are called for the other
+ * ready handles. Workers never process the same peer concurrently, and the
+ * peer is put back into the wait set once done. A peer with queued output
+ * is also waited for to become writable.
+ *
+ * A peer is closed when a check or an event callback fails, or when the
+ * loop is freed: the PeerClosed callback is then responsible for
+ * disconnecting and freeing it.
+ */
+
+static void peer_loop_entry_free(rdpPeerLoopEntry* entry)
+{
+	if (entry->handshake)
+	{
+		WaitForSingleObject(entry->handshake, INFINITE);
+		CloseHandle(entry->handshake);
+	}
+
+	if (entry->work)
+	{
+		WaitForThreadpoolWorkCallbacks(entry->work, FALSE);
+		CloseThreadpoolWork(entry->work);
+	}
+
+	free(entry);
+}
+
+static void CALLBACK peer_loop_work_callback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	DWORD index;
+	BOOL status = TRUE;
+	rdpPeerLoopEntry* entry = (rdpPeerLoopEntry*) context;
+	rdpPeerLoopThread* thread = entry->thread;
+	freerdp_peer* peer = entry->peer;
+
+	if (peer->IsWriteBlocked(peer) && (peer->DrainOutputBuffer(peer) < 0))
+		status = FALSE;
+
+	for (index = 0; status && (index < entry->count); index++)
+	{
+		if (!entry->ready[index])
+			continue;
+
+		entry->ready[index] = FALSE;
+
+		if (index == 0)
+			status = peer->CheckFileDescriptor(peer);
+		else
+			status = entry->events[index](peer, entry->handles[index]);
+	}
+
+	if (status)
+	{
+		entry->writeBlocked = peer->IsWriteBlocked(peer);
+	}
+	else
+	{
+		entry->closed = TRUE;
+		entry->peer = NULL;
+		thread->loop->PeerClosed(thread->loop, peer);
+	}
+
+	Queue_Enqueue(thread->queue, (void*) entry);
+}
+
+static BOOL peer_loop_thread_set_slot(rdpPeerLoopThread* thread, DWORD index, rdpPeerLoopEntry* entry, DWORD handle)
+{
+	if (index >= thread->numSlots)
+	{
+		DWORD numSlots = (index + 1) * 2;
+		rdpPeerLoopSlot* slots;
+		DWORD* ready;
+
+		slots = (rdpPeerLoopSlot*) realloc(thread->slots, numSlots * sizeof(rdpPeerLoopSlot));
+
+		if (!slots)
+			return FALSE;
+
+		thread->slots = slots;
+		ZeroMemory(&slots[thread->numSlots], (numSlots - thread->numSlots) * sizeof(rdpPeerLoopSlot));
+
+		ready = (DWORD*) realloc(thread->ready, numSlots * sizeof(DWORD));
+
+		if (!ready)
+			return FALSE;
+
+		thread->ready = ready;
+		thread->numSlots = numSlots;
+	}
+
+	thread->slots[index].entry = entry;
+	thread->slots[index].handle = handle;
+
+	return TRUE;
+}
+
+static void peer_loop_thread_disarm(rdpPeerLoopThread* thread, rdpPeerLoopEntry* entry)
+{
+	DWORD index;
+
+	for (index = 0; index < entry->count; index++)
+	{
+		if (entry->indices[index] == WAIT_SET_INVALID_INDEX)
+			continue;
+
+		WaitSet_Remove(thread->set, entry->indices[index]);
+		thread->slots[entry->indices[index]].entry = NULL;
+		entry->indices[index] = WAIT_SET_INVALID_INDEX;
+	}
+
+	if (entry->polled)
+		thread->blocked--;
+
+	entry->polled = FALSE;
+	entry->armed = FALSE;
+}
+
+static BOOL peer_loop_thread_arm(rdpPeerLoopThread* thread, rdpPeerLoopEntry* entry)
+{
+	DWORD index;
+
+	for (index = 0; index < entry->count; index++)
+	{
+		entry->indices[index] = WaitSet_Add(thread->set, entry->handles[index]);
+
+		if ((entry->indices[index] == WAIT_SET_INVALID_INDEX) ||
+				!peer_loop_thread_set_slot(thread, entry->indices[index], entry, index))
+		{
+			peer_loop_thread_disarm(thread, entry);
+			return FALSE;
+		}
+	}
+
+	entry->armed = TRUE;
+
+	if (entry->writeBlocked && !WaitSet_SetWritable(thread->set, entry->indices[0], TRUE))
+	{
+		entry->polled = TRUE;
+		thread->blocked++;
+	}
+
+	return TRUE;
+}
+
+static void peer_loop_thread_remove(rdpPeerLoopThread* thread, rdpPeerLoopEntry* entry)
+{
+	DWORD index;
+
+	for (index = 0; index < thread->numEntries; index++)
+	{
+		if (thread->entries[index] == entry)
+		{
+			thread->entries[index] = thread->entries[--thread->numEntries];
+			break;
+		}
+	}
+
+	InterlockedDecrement(&(thread->count));
+
+	peer_loop_entry_free(entry);
+}
+
+static BOOL peer_loop_thread_insert(rdpPeerLoopThread* thread, rdpPeerLoopEntry* entry)
+{
+	DWORD index;
+
+	for (index = 0; index < thread->numEntries; index++)
+	{
+		if (thread->entries[index] == entry)
+			return TRUE;
+	}
+
+	if (thread->numEntries == thread->maxEntries)
+	{
+		DWORD maxEntries = thread->maxEntries ? thread->maxEntries * 2 : 32;
+		rdpPeerLoopEntry** entries;
+
+		entries = (rdpPeerLoopEntry**) realloc(thread->entries, maxEntries * sizeof(rdpPeerLoopEntry*));
+
+		if (!entries)
+			return FALSE;
+
+		thread->entries = entries;
+
+		entries = (rdpPeerLoopEntry**) realloc(thread->dispatch, maxEntries * sizeof(rdpPeerLoopEntry*));
+
+		if (!entries)
+			return FALSE;
+
+		thread->dispatch = entries;
+		thread->maxEntries = maxEntries;
+	}
+
+	thread->entries[thread->numEntries++] = entry;
+
+	return TRUE;
+}
+
+/* takes back peers added to the loop or processed by a worker */
+
+static void peer_loop_thread_collect(rdpPeerLoopThread* thread)
+{
+	freerdp_peer* peer;
+	rdpPeerLoopEntry* entry;
+
+	while ((entry = (rdpPeerLoopEntry*) Queue_Dequeue(thread->queue)) != NULL)
+	{
+		if (entry->handshake)
+		{
+			WaitForSingleObject(entry->handshake, INFINITE);
+			CloseHandle(entry->handshake);
+			entry->handshake = NULL;
+		}
+
+		if (!entry->closed)
+		{
+			if (peer_loop_thread_insert(thread, entry) && peer_loop_thread_arm(thread, entry))
+				continue;
+
+			WLog_ERR(TAG, "failed to wait for peer events");
+
+			peer = entry->peer;
+			entry->closed = TRUE;
+			entry->peer = NULL;
+			thread->loop->PeerClosed(thread->loop, peer);
+		}
+
+		peer_loop_thread_remove(thread, entry);
+	}
+}
+
+static void* peer_loop_thread(rdpPeerLoopThread* thread)
+{
+	DWORD index;
+	DWORD status;
+	DWORD numReady;
+	DWORD numDispatch;
+	freerdp_peer* peer;
+	rdpPeerLoopSlot* slot;
+	rdpPeerLoopEntry* entry;
+	freerdp_peer_loop* loop = thread->loop;
+
+	while (!thread->stop)
+	{
+		status = WaitSet_Wait(thread->set, thread->blocked ? PEER_LOOP_DRAIN_INTERVAL : INFINITE);
+
+		if (status == WAIT_FAILED)
+		{
+			WLog_ERR(TAG, "WaitSet_Wait failure");
+			break;
+		}
+
+		numDispatch = 0;
+		numReady = WaitSet_GetReady(thread->set, thread->ready, thread->numSlots);
+
+		if (numReady > thread->numSlots)
+			numReady = thread->numSlots;
+
+		for (index = 0; index < numReady; index++)
+		{
+			slot = &(thread->slots[thread->ready[index]]);
+			entry = slot->entry;
+
+			if (!entry)
+				continue;
+
+			if (WaitSet_IsReady(thread->set, thread->ready[index]))
+				entry->ready[slot->handle] = TRUE;
+
+			if (!entry->dispatched)
+			{
+				entry->dispatched = TRUE;
+				thread->dispatch[numDispatch++] = entry;
+			}
+		}
+
+		/* without writability events, peers with queued output are polled */
+
+		if (thread->blocked)
+		{
+			for (index = 0; index < thread->numEntries; index++)
+			{
+				entry = thread->entries[index];
+
+				if (entry->polled && !entry->dispatched)
+				{
+					entry->dispatched = TRUE;
+					thread->dispatch[numDispatch++] = entry;
+				}
+			}
+		}
+
+		for (index = 0; index < numDispatch; index++)
+		{
+			entry = thread->dispatch[index];
+			entry->dispatched = FALSE;
+
+			peer_loop_thread_disarm(thread, entry);
+			SubmitThreadpoolWork(entry->work);
+		}
+
+		if (WaitSet_IsReady(thread->set, thread->queueIndex))
+			peer_loop_thread_collect(thread);
+	}
+
+	/* wait for the workers, then close the remaining peers */
+
+	for (index = 0; index < thread->numEntries; index++)
+		WaitForThreadpoolWorkCallbacks(thread->entries[index]->work, FALSE);
+
+	peer_loop_thread_collect(thread);
+
+	while (thread->numEntries > 0)
+	{
+		entry = thread->entries[0];
+
+		peer_loop_thread_disarm(thread, entry);
+
+		peer = entry->peer;
+		entry->closed = TRUE;
+		entry->peer = NULL;
+		loop->PeerClosed(loop, peer);
+
+		peer_loop_thread_remove(thread, entry);
+	}
+
+	ExitThread(0);
+	return NULL;
+}
+
+static void peer_loop_handshake_done(freerdp_peer_loop* loop)
+{
+	EnterCriticalSection(&(loop->lock));
+
+	if (--loop->handshakes == 0)
+		SetEvent(loop->HandshakeEvent);
+
+	LeaveCriticalSection(&(loop->lock));
+}
+
+/**
+ * Runs the connection sequence of a peer until it is activated, then hands
+ * it to its I/O thread. A peer which fails or does not complete it in time
+ * is closed, a peer still connecting when the loop is freed is handed over
+ * as is and closed with the others.
+ */
+
+static void* peer_loop_handshake_thread(rdpPeerLoopEntry* entry)
+{
+	DWORD index;
+	DWORD status;
+	DWORD nCount;
+	UINT64 now;
+	UINT64 deadline;
+	BOOL result = TRUE;
+	HANDLE events[PEER_LOOP_MAX_HANDLES + 1];
+	rdpPeerLoopThread* thread = entry->thread;
+	freerdp_peer_loop* loop = thread->loop;
+	freerdp_peer* peer = entry->peer;
+
+	nCount = 0;
+	events[nCount++] = loop->StopEvent;
+
+	for (index = 0; index < entry->count; index++)
+		events[nCount++] = entry->handles[index];
+
+	deadline = GetTickCount64() + PEER_LOOP_HANDSHAKE_TIMEOUT;
+
+	while (result && !peer->activated)
+	{
+		now = GetTickCount64();
+
+		if (now >= deadline)
+		{
+			WLog_WARN(TAG, "peer %s did not complete the connection sequence", peer->hostname);
+			result = FALSE;
+			break;
+		}
+
+		status = WaitForMultipleObjects(nCount, events, FALSE, (DWORD) (deadline - now));
+
+		if (status == WAIT_FAILED)
+		{
+			WLog_ERR(TAG, "WaitForMultipleObjects failure");
+			result = FALSE;
+			break;
+		}
+
+		if (WaitForSingleObject(loop->StopEvent, 0) == WAIT_OBJECT_0)
+			break;
+
+		if (peer->IsWriteBlocked(peer) && (peer->DrainOutputBuffer(peer) < 0))
+		{
+			result = FALSE;
+			break;
+		}
+
+		for (index = 0; result && (index < entry->count); index++)
+		{
+			if (status != (WAIT_OBJECT_0 + index + 1))
+			{
+				if ((status == WAIT_TIMEOUT) ||
+						(WaitForSingleObject(entry->handles[index], 0) != WAIT_OBJECT_0))
+					continue;
+			}
+
+			if (index == 0)
+				result = peer->CheckFileDescriptor(peer);
+			else
+				result = entry->events[index](peer, entry->handles[index]);
+		}
+	}
+
+	if (result)
+	{
+		entry->writeBlocked = peer->IsWriteBlocked(peer);
+	}
+	else
+	{
+		entry->closed = TRUE;
+		entry->peer = NULL;
+		loop->PeerClosed(loop, peer);
+	}
+
+	/* the I/O thread joins this thread, it cannot fail to take the entry */
+	while (!Queue_Enqueue(thread->queue, (void*) entry))
+		Sleep(10);
+
+	peer_loop_handshake_done(loop);
+
+	ExitThread(0);
+	return NULL;
+}
+
+/**
+ * Adds a peer to the loop. The event handle of the peer is always waited
+ * for, up to FREERDP_PEER_LOOP_MAX_HANDLES other handles can be passed with
+ * the callbacks to call when they are ready. A callback returning FALSE
+ * closes the peer. The peer does not need to be connected yet, the
+ * connection sequence is run before it joins the loop.
+ */
+
+BOOL freerdp_peer_loop_add(freerdp_peer_loop* loop, freerdp_peer* client,
+		HANDLE* handles, psPeerLoopEvent* events, DWORD count)
+{
+	DWORD index;
+	BOOL status;
+	rdpPeerLoopEntry* entry;
+	rdpPeerLoopThread* thread;
+
+	if (!loop || !client || (count > FREERDP_PEER_LOOP_MAX_HANDLES))
+		return FALSE;
+
+	entry = (rdpPeerLoopEntry*) calloc(1, sizeof(rdpPeerLoopEntry));
+
+	if (!entry)
+		return FALSE;
+
+	entry->peer = client;
+	entry->count = count + 1;
+	entry->handles[0] = client->GetEventHandle(client);
+
+	for (index = 0; index < count; index++)
+	{
+		entry->handles[index + 1] = handles[index];
+		entry->events[index + 1] = events[index];
+	}
+
+	for (index = 0; index < entry->count; index++)
+		entry->indices[index] = WAIT_SET_INVALID_INDEX;
+
+	entry->work = CreateThreadpoolWork((PTP_WORK_CALLBACK) peer_loop_work_callback,
+			(void*) entry, &(loop->environment));
+
+	if (!entry->handles[0] || !entry->work)
+	{
+		peer_loop_entry_free(entry);
+		return FALSE;
+	}
+
+	/* the least loaded thread gets the peer */
+
+	thread = &(loop->threads[0]);
+
+	for (index = 1; index < loop->numThreads; index++)
+	{
+		if (loop->threads[index].count < thread->count)
+			thread = &(loop->threads[index]);
+	}
+
+	entry->thread = thread;
+
+	EnterCriticalSection(&(loop->lock));
+
+	if (loop->stop)
+	{
+		LeaveCriticalSection(&(loop->lock));
+		peer_loop_entry_free(entry);
+		return FALSE;
+	}
+
+	InterlockedIncrement(&(thread->count));
+
+	if (client->activated)
+	{
+		status = Queue_Enqueue(thread->queue, (void*) entry);
+	}
+	else
+	{
+		entry->handshake = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) peer_loop_handshake_thread,
+				(void*) entry, CREATE_SUSPENDED, NULL);
+
+		status = entry->handshake ? TRUE : FALSE;
+
+		if (status)
+		{
+			if (loop->handshakes++ == 0)
+				ResetEvent(loop->HandshakeEvent);
+
+			ResumeThread(entry->handshake);
+		}
+	}
+
+	LeaveCriticalSection(&(loop->lock));
+
+	if (!status)
+	{
+		InterlockedDecrement(&(thread->count));
+		peer_loop_entry_free(entry);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+DWORD freerdp_peer_loop_count(freerdp_peer_loop* loop)
+{
+	DWORD index;
+	DWORD count = 0;
+
+	for (index = 0; index < loop->numThreads; index++)
+		count += (DWORD) loop->threads[index].count;
+
+	return count;
+}
+
+freerdp_peer_loop* freerdp_peer_loop_new(DWORD numThreads, psPeerLoopClosed PeerClosed)
+{
+	DWORD index;
+	SYSTEM_INFO sysinfo;
+	freerdp_peer_loop* loop;
+	rdpPeerLoopThread* thread;
+
+	if (!PeerClosed)
+		return NULL;
+
+	loop = (freerdp_peer_loop*) calloc(1, sizeof(freerdp_peer_loop));
+
+	if (!loop)
+		return NULL;
+
+	loop->PeerClosed = PeerClosed;
+	loop->numThreads = numThreads ? numThreads : 1;
+
+	if (!InitializeCriticalSectionAndSpinCount(&(loop->lock), 4000))
+	{
+		free(loop);
+		return NULL;
+	}
+
+	loop->StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	loop->HandshakeEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
+
+	if (!loop->StopEvent || !loop->HandshakeEvent)
+		goto fail;
+
+	GetNativeSystemInfo(&sysinfo);
+
+	loop->pool = CreateThreadpool(NULL);
+
+	if (!loop->pool)
+		goto fail;
+
+	InitializeThreadpoolEnvironment(&(loop->environment));
+	SetThreadpoolCallbackPool(&(loop->environment), loop->pool);
+	SetThreadpoolThreadMaximum(loop->pool, sysinfo.dwNumberOfProcessors);
+
+	loop->threads = (rdpPeerLoopThread*) calloc(loop->numThreads, sizeof(rdpPeerLoopThread));
+
+	if (!loop->threads)
+		goto fail;
+
+	for (index = 0; index < loop->numThreads; index++)
+	{
+		thread = &(loop->threads[index]);
+		thread->loop = loop;
+
+		thread->queue = Queue_New(TRUE, -1, -1);
+		thread->set = WaitSet_New();
+
+		if (!thread->queue || !thread->set)
+			goto fail;
+
+		thread->queueIndex = WaitSet_Add(thread->set, Queue_Event(thread->queue));
+
+		if ((thread->queueIndex == WAIT_SET_INVALID_INDEX) ||
+				!peer_loop_thread_set_slot(thread, thread->queueIndex, NULL, 0))
+			goto fail;
+	}
+
+	for (index = 0; index < loop->numThreads; index++)
+	{
+		thread = &(loop->threads[index]);
+
+		thread->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) peer_loop_thread,
+				(void*) thread, 0, NULL);
+
+		if (!thread->thread)
+			goto fail;
+	}
+
+	return loop;
+
+fail:
+	freerdp_peer_loop_free(loop);
+	return NULL;
+}
+
+void freerdp_peer_loop_free(freerdp_peer_loop* loop)
+{
+	DWORD index;
+	rdpPeerLoopThread* thread;
+
+	if (!loop)
+		return;
+
+	/* peers still connecting are handed to the I/O threads, which close them */
+
+	EnterCriticalSection(&(loop->lock));
+	loop->stop = TRUE;
+	LeaveCriticalSection(&(loop->lock));
+
+	if (loop->StopEvent)
+		SetEvent(loop->StopEvent);
+
+	if (loop->HandshakeEvent)
+		WaitForSingleObject(loop->HandshakeEvent, INFINITE);
+
+	for (index = 0; loop->threads && (index < loop->numThreads); index++)
+	{
+		thread = &(loop->threads[index]);
+
+		if (thread->thread)
+		{
+			thread->stop = TRUE;
+			SetEvent(Queue_Event(thread->queue));
+			WaitForSingleObject(thread->thread, INFINITE);
+			CloseHandle(thread->thread);
+		}
+	}
+
+	for (index = 0; loop->threads && (index < loop->numThreads); index++)
+	{
+		thread = &(loop->threads[index]);
+
+		WaitSet_Free(thread->set);
+		Queue_Free(thread->queue);
+
+		free(thread->entries);
+		free(thread->dispatch);
+		free(thread->slots);
+		free(thread->ready);
+	}
+
+	free(loop->threads);
+
+	if (loop->pool)
+	{
+		CloseThreadpool(loop->pool);
+		DestroyThreadpoolEnvironment(&(loop->environment));
+	}
+
+	if (loop->StopEvent)
+		CloseHandle(loop->StopEvent);
+
+	if (loop->HandshakeEvent)
+		CloseHandle(loop->HandshakeEvent);
+
+	DeleteCriticalSection(&(loop->lock));
+	free(loop);
+}
@@ -0,0 +1,113 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP Server Peer Loop
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PEERLOOP_H
+#define __PEERLOOP_H
+
+typedef struct rdp_peer_loop_entry rdpPeerLoopEntry;
+typedef struct rdp_peer_loop_slot rdpPeerLoopSlot;
+typedef struct rdp_peer_loop_thread rdpPeerLoopThread;
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/pool.h>
+#include <winpr/collections.h>
+
+#include <freerdp/peer.h>
+
+/* the peer event handle comes first */
+#define PEER_LOOP_MAX_HANDLES		(FREERDP_PEER_LOOP_MAX_HANDLES + 1)
+
+/* polling interval of peers with queued output, when writability cannot be waited for */
+#define PEER_LOOP_DRAIN_INTERVAL	10
+
+/* time given to a peer to complete the connection sequence */
+#define PEER_LOOP_HANDSHAKE_TIMEOUT	30000
+
+struct rdp_peer_loop_entry
+{
+	freerdp_peer* peer;
+	rdpPeerLoopThread* thread;
+	PTP_WORK work;
+	HANDLE handshake;
+
+	DWORD count;
+	HANDLE handles[PEER_LOOP_MAX_HANDLES];
+	psPeerLoopEvent events[PEER_LOOP_MAX_HANDLES];
+	DWORD indices[PEER_LOOP_MAX_HANDLES];
+	BOOL ready[PEER_LOOP_MAX_HANDLES];
+
+	BOOL armed;
+	BOOL dispatched;
+	BOOL writeBlocked;
+	BOOL polled;
+	BOOL closed;
+};
+
+struct rdp_peer_loop_slot
+{
+	rdpPeerLoopEntry* entry;
+	DWORD handle;
+};
+
+/**
+ * An I/O thread only waits: ready peers are taken out of its wait set and
+ * handed to the worker pool, workers hand them back through the queue.
+ */
+
+struct rdp_peer_loop_thread
+{
+	freerdp_peer_loop* loop;
+
+	BOOL stop;
+	HANDLE thread;
+	wQueue* queue;
+	DWORD queueIndex;
+	WINPR_WAIT_SET* set;
+	LONG count;
+
+	DWORD numEntries;
+	DWORD maxEntries;
+	rdpPeerLoopEntry** entries;
+	rdpPeerLoopEntry** dispatch;
+
+	DWORD numSlots;
+	rdpPeerLoopSlot* slots;
+	DWORD* ready;
+
+	DWORD blocked;
+};
+
+struct rdp_freerdp_peer_loop
+{
+	BOOL stop;
+	HANDLE StopEvent;
+	CRITICAL_SECTION lock;
+
+	LONG handshakes;
+	HANDLE HandshakeEvent;
+
+	DWORD numThreads;
+	rdpPeerLoopThread* threads;
+
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+
+	psPeerLoopClosed PeerClosed;
+};
+
+#endif /* __PEERLOOP_H */
@@ -689,7 +689,7 @@ HANDLE WINAPI FreeRDP_WTSOpenServerA(LPSTR pServerName)
 
 		HashTable_Add(g_ServerHandles, (void*) (UINT_PTR) vcm->SessionId, (void*) vcm);
 
-		vcm->queue = MessageQueue_New(NULL);
+		vcm->queue = MessageQueue_NewEx(NULL, WMQ_FLAG_LOCKFREE, 256);
 
 		vcm->dvc_channel_id_seq = 1;
 		vcm->dynamicVirtualChannels = ArrayList_New(TRUE);
@@ -0,0 +1,449 @@
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/peer.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#define TEST_PEERS		64
+#define TEST_TIMEOUT		5000
+
+/* connected, failing to connect, write blocked and never connected peers */
+#define TEST_EXTRA_PEERS	4
+#define TEST_ALL_PEERS		(TEST_PEERS + TEST_EXTRA_PEERS)
+
+struct test_peer
+{
+	freerdp_peer peer;
+
+	HANDLE event;
+	HANDLE extra;
+	int fds[2];
+
+	LONG busy;
+	LONG overlaps;
+	LONG checks;
+	LONG extras;
+	LONG drains;
+	LONG unblocked;
+	LONG closed;
+
+	LONG handshake;
+	BOOL fail;
+	BOOL blocked;
+};
+typedef struct test_peer testPeer;
+
+static LONG g_Closed = 0;
+
+static void test_peer_enter(testPeer* test)
+{
+	if (InterlockedIncrement(&(test->busy)) != 1)
+		InterlockedIncrement(&(test->overlaps));
+}
+
+static void test_peer_leave(testPeer* test)
+{
+	InterlockedDecrement(&(test->busy));
+}
+
+static HANDLE test_peer_get_event_handle(freerdp_peer* client)
+{
+	return ((testPeer*) client)->event;
+}
+
+static BOOL test_peer_check_file_descriptor(freerdp_peer* client)
+{
+	testPeer* test = (testPeer*) client;
+
+	test_peer_enter(test);
+
+	if (!test->fds[0] && !test->fds[1])
+		ResetEvent(test->event);
+
+	InterlockedIncrement(&(test->checks));
+
+	/* the connection sequence takes a few round trips */
+	if (!client->activated && (test->handshake > 0) && (--test->handshake == 0))
+		client->activated = TRUE;
+
+	test_peer_leave(test);
+
+	return !test->fail;
+}
+
+static BOOL test_peer_extra_event(freerdp_peer* client, HANDLE handle)
+{
+	testPeer* test = (testPeer*) client;
+
+	if (handle != test->extra)
+		return FALSE;
+
+	test_peer_enter(test);
+	ResetEvent(handle);
+	InterlockedIncrement(&(test->extras));
+	test_peer_leave(test);
+
+	return !test->fail;
+}
+
+static BOOL test_peer_is_write_blocked(freerdp_peer* client)
+{
+	return ((testPeer*) client)->blocked;
+}
+
+static int test_peer_drain_output_buffer(freerdp_peer* client)
+{
+	testPeer* test = (testPeer*) client;
+
+	InterlockedIncrement(&(test->drains));
+
+#ifndef _WIN32
+	/* the output is drained once the socket takes a byte again */
+	if (test->fds[0] && (send(test->fds[0], "x", 1, MSG_DONTWAIT) == 1))
+	{
+		test->blocked = FALSE;
+		InterlockedIncrement(&(test->unblocked));
+	}
+#endif
+
+	return 1;
+}
+
+static void test_peer_closed(freerdp_peer_loop* loop, freerdp_peer* client)
+{
+	testPeer* test = (testPeer*) client;
+
+	InterlockedIncrement(&(test->closed));
+	InterlockedIncrement(&g_Closed);
+}
+
+static BOOL test_wait_for(LONG volatile* value, LONG expected)
+{
+	UINT64 deadline = GetTickCount64() + TEST_TIMEOUT;
+
+	while (*value < expected)
+	{
+		if (GetTickCount64() >= deadline)
+			return FALSE;
+
+		Sleep(1);
+	}
+
+	return TRUE;
+}
+
+static BOOL test_peer_init(testPeer* test)
+{
+	ZeroMemory(test, sizeof(testPeer));
+
+	test->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	test->extra = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	test->peer.GetEventHandle = test_peer_get_event_handle;
+	test->peer.CheckFileDescriptor = test_peer_check_file_descriptor;
+	test->peer.IsWriteBlocked = test_peer_is_write_blocked;
+	test->peer.DrainOutputBuffer = test_peer_drain_output_buffer;
+	test->peer.activated = TRUE;
+
+	return (test->event && test->extra) ? TRUE : FALSE;
+}
+
+static void test_peer_uninit(testPeer* test)
+{
+	CloseHandle(test->event);
+	CloseHandle(test->extra);
+
+#ifndef _WIN32
+	if (test->fds[0] || test->fds[1])
+	{
+		close(test->fds[0]);
+		close(test->fds[1]);
+	}
+#endif
+}
+
+static BOOL test_peer_loop_add(freerdp_peer_loop* loop, testPeer* test)
+{
+	psPeerLoopEvent event = test_peer_extra_event;
+
+	return freerdp_peer_loop_add(loop, &(test->peer), &(test->extra), &event, 1);
+}
+
+static int test_peer_loop_dispatch(freerdp_peer_loop* loop, testPeer* peers)
+{
+	int index;
+	int round;
+
+	for (round = 0; round < 20; round++)
+	{
+		for (index = round % 2; index < TEST_PEERS; index += 1 + (round % 3))
+		{
+			SetEvent(peers[index].event);
+
+			if (index % 3 == 0)
+				SetEvent(peers[index].extra);
+		}
+
+		Sleep(1);
+	}
+
+	for (index = 0; index < TEST_PEERS; index++)
+	{
+		if (!test_wait_for(&(peers[index].checks), 1) ||
+				((index % 3 == 0) && !test_wait_for(&(peers[index].extras), 1)))
+		{
+			fprintf(stderr, "peer %d was not dispatched\n", index);
+			return -1;
+		}
+
+		if (peers[index].overlaps)
+		{
+			fprintf(stderr, "peer %d was processed concurrently\n", index);
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+static int test_peer_loop_handshake(freerdp_peer_loop* loop, testPeer* test, testPeer* failing)
+{
+	LONG round;
+
+	test->peer.activated = FALSE;
+	test->handshake = 3;
+
+	failing->peer.activated = FALSE;
+	failing->handshake = 3;
+	failing->fail = TRUE;
+
+	if (!test_peer_loop_add(loop, test) || !test_peer_loop_add(loop, failing))
+		return -1;
+
+	for (round = 1; round <= 3; round++)
+	{
+		SetEvent(test->event);
+
+		if (!test_wait_for(&(test->checks), round))
+		{
+			fprintf(stderr, "connection sequence did not progress\n");
+			return -1;
+		}
+	}
+
+	SetEvent(failing->event);
+
+	if (!test_wait_for(&(failing->closed), 1))
+	{
+		fprintf(stderr, "failed connection sequence did not close the peer\n");
+		return -1;
+	}
+
+	/* the activated peer is now part of the loop */
+
+	SetEvent(test->extra);
+
+	if (!test_wait_for(&(test->extras), 1) || test->closed)
+	{
+		fprintf(stderr, "activated peer was not dispatched\n");
+		return -1;
+	}
+
+	return 1;
+}
+
+static int test_peer_loop_close(freerdp_peer_loop* loop, testPeer* peers, int count)
+{
+	int index;
+	LONG closed = g_Closed;
+	DWORD total = freerdp_peer_loop_count(loop);
+
+	for (index = 0; index < count; index++)
+	{
+		peers[index].fail = TRUE;
+		SetEvent((index % 2) ? peers[index].event : peers[index].extra);
+	}
+
+	if (!test_wait_for(&g_Closed, closed + count))
+	{
+		fprintf(stderr, "peers closed from a callback were not closed\n");
+		return -1;
+	}
+
+	/* further events must not reach a closed peer */
+
+	for (index = 0; index < count; index++)
+	{
+		SetEvent(peers[index].event);
+		SetEvent(peers[index].extra);
+	}
+
+	Sleep(50);
+
+	for (index = 0; index < count; index++)
+	{
+		if (peers[index].closed != 1)
+		{
+			fprintf(stderr, "peer %d closed %d times\n", index, (int) peers[index].closed);
+			return -1;
+		}
+	}
+
+	if (freerdp_peer_loop_count(loop) != total - count)
+	{
+		fprintf(stderr, "unexpected peer count %u\n", freerdp_peer_loop_count(loop));
+		return -1;
+	}
+
+	return 1;
+}
+
+static int test_peer_loop_write_blocked(freerdp_peer_loop* loop, testPeer* test)
+{
+#ifndef _WIN32
+	char buffer[4096];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, test->fds) < 0)
+		return -1;
+
+	CloseHandle(test->event);
+	test->event = CreateFileDescriptorEvent(NULL, FALSE, FALSE, test->fds[0]);
+
+	if (!test->event)
+		return -1;
+
+	/* fill the socket until it no longer takes output */
+
+	fcntl(test->fds[0], F_SETFL, fcntl(test->fds[0], F_GETFL) | O_NONBLOCK);
+
+	while (send(test->fds[0], buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+
+	test->blocked = TRUE;
+
+	if (!test_peer_loop_add(loop, test))
+		return -1;
+
+	/* the loop learns that the peer is write blocked once it processes it */
+
+	SetEvent(test->extra);
+
+	if (!test_wait_for(&(test->extras), 1))
+		return -1;
+
+	/* it is then not processed again until the socket is writable */
+
+	Sleep(100);
+
+	if (test->drains > 1)
+	{
+		fprintf(stderr, "write blocked peer was drained %d times\n", (int) test->drains);
+		return -1;
+	}
+
+	while (recv(test->fds[1], buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+
+	if (!test_wait_for(&(test->unblocked), 1) || test->closed)
+	{
+		fprintf(stderr, "write blocked peer was not drained\n");
+		return -1;
+	}
+#endif
+
+	return 1;
+}
+
+int TestPeerLoop(int argc, char* argv[])
+{
+	int index;
+	int status = -1;
+	testPeer* peers;
+	testPeer* connecting;
+	freerdp_peer_loop* loop = NULL;
+
+	peers = (testPeer*) calloc(TEST_ALL_PEERS, sizeof(testPeer));
+
+	if (!peers)
+		return -1;
+
+	for (index = 0; index < TEST_ALL_PEERS; index++)
+	{
+		if (!test_peer_init(&peers[index]))
+			goto out;
+	}
+
+	loop = freerdp_peer_loop_new(2, test_peer_closed);
+
+	if (!loop)
+		goto out;
+
+	for (index = 0; index < TEST_PEERS; index++)
+	{
+		if (!test_peer_loop_add(loop, &peers[index]))
+		{
+			fprintf(stderr, "failed to add peer %d\n", index);
+			goto out;
+		}
+	}
+
+	if (freerdp_peer_loop_count(loop) != TEST_PEERS)
+	{
+		fprintf(stderr, "unexpected peer count %u\n", freerdp_peer_loop_count(loop));
+		goto out;
+	}
+
+	if (test_peer_loop_dispatch(loop, peers) < 0)
+		goto out;
+
+	if (test_peer_loop_handshake(loop, &peers[TEST_PEERS], &peers[TEST_PEERS + 1]) < 0)
+		goto out;
+
+	if (test_peer_loop_close(loop, peers, 8) < 0)
+		goto out;
+
+	if (test_peer_loop_write_blocked(loop, &peers[TEST_PEERS + 2]) < 0)
+		goto out;
+
+	/* a peer stuck in the connection sequence must not hold up the loop */
+
+	connecting = &peers[TEST_PEERS + 3];
+	connecting->peer.activated = FALSE;
+
+	if (!test_peer_loop_add(loop, connecting))
+		goto out;
+
+	status = 1;
+
+out:
+	/* the remaining peers are closed with the loop */
+
+	freerdp_peer_loop_free(loop);
+
+	if ((status > 0) && (g_Closed != TEST_ALL_PEERS))
+	{
+		fprintf(stderr, "%d peers closed instead of %d\n", (int) g_Closed, TEST_ALL_PEERS);
+		status = -1;
+	}
+
+	for (index = 0; index < TEST_ALL_PEERS; index++)
+	{
+		if (peers[index].closed > 1)
+		{
+			fprintf(stderr, "peer %d closed %d times\n", index, (int) peers[index].closed);
+			status = -1;
+		}
+
+		test_peer_uninit(&peers[index]);
+	}
+
+	free(peers);
+
+	return (status > 0) ? 0 : -1;
+}
@@ -30,6 +30,7 @@
 #include <winpr/synch.h>
 #include <winpr/print.h>
 #include <winpr/stream.h>
+#include <winpr/interlocked.h>
 
 #include <freerdp/log.h>
 #include <freerdp/error.h>
@@ -798,7 +799,8 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 #endif
 
 	if (Stream_GetPosition(s) >= pduLength)
-		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), pduLength, WLOG_PACKET_INBOUND);
+		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), pduLength,
+				WLOG_PACKET_INBOUND | WLOG_PACKET_INTERFACE(transport->PacketInterface));
 
 	Stream_SealLength(s);
 	Stream_SetPosition(s, 0);
@@ -826,7 +828,8 @@ int transport_write(rdpTransport* transport, wStream* s)
 
 	if (length > 0)
 	{
-		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), length, WLOG_PACKET_OUTBOUND);
+		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), length,
+				WLOG_PACKET_OUTBOUND | WLOG_PACKET_INTERFACE(transport->PacketInterface));
 	}
 
 	while (length > 0)
@@ -840,15 +843,22 @@ int transport_write(rdpTransport* transport, wStream* s)
 			 * is a SSL or TSG BIO in the chain.
 			 */
 			if (!BIO_should_retry(transport->frontBio))
+			{
+				LeaveCriticalSection(&(transport->WriteLock));
 				return status;
+			}
 
 			/* non-blocking can live with blocked IOs */
 			if (!transport->blocking)
+			{
+				LeaveCriticalSection(&(transport->WriteLock));
 				return status;
+			}
 
 			if (transport_wait_for_write(transport) < 0)
 			{
 				WLog_ERR(TAG, "error when selecting for write");
+				LeaveCriticalSection(&(transport->WriteLock));
 				return -1;
 			}
 
@@ -865,12 +875,14 @@ int transport_write(rdpTransport* transport, wStream* s)
 				if (transport_wait_for_write(transport) < 0)
 				{
 					WLog_ERR(TAG, "error when selecting for write");
+					LeaveCriticalSection(&(transport->WriteLock));
 					return -1;
 				}
 
 				if (!transport_bio_buffered_drain(out->bufferedBio))
 				{
 					WLog_ERR(TAG, "error when draining outputBuffer");
+					LeaveCriticalSection(&(transport->WriteLock));
 					return -1;
 				}
 			}
@@ -971,6 +983,16 @@ BOOL tranport_is_write_blocked(rdpTransport* transport)
 		   transport->TcpOut->writeBlocked;
 }
 
+size_t transport_get_output_buffer_size(rdpTransport* transport)
+{
+	size_t size = BIO_ctrl_wpending(transport->TcpIn->bufferedBio);
+
+	if (transport->SplitInputOutput && transport->TcpOut)
+		size += BIO_ctrl_wpending(transport->TcpOut->bufferedBio);
+
+	return size;
+}
+
 int tranport_drain_output_buffer(rdpTransport* transport)
 {
 	BOOL ret = FALSE;
@@ -1149,6 +1171,8 @@ static void* transport_client_thread(void* arg)
 	return NULL;
 }
 
+static LONG g_PacketInterface = 0;
+
 rdpTransport* transport_new(rdpSettings* settings)
 {
 	rdpTransport* transport;
@@ -1163,6 +1187,9 @@ rdpTransport* transport_new(rdpSettings* settings)
 	if (!transport->log)
 		goto out_free;
 
+	/* packets of each connection are captured on their own interface */
+	transport->PacketInterface = (DWORD) InterlockedIncrement(&g_PacketInterface);
+
 	transport->TcpIn = tcp_new(settings);
 
 	if (!transport->TcpIn)
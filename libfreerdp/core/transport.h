@@ -82,6 +82,7 @@ struct rdp_transport
 	CRITICAL_SECTION ReadLock;
 	CRITICAL_SECTION WriteLock;
 	wLog* log;
+	DWORD PacketInterface;
 	void* rdp;
 };
 
@@ -106,6 +107,7 @@ void transport_set_nla_mode(rdpTransport* transport, BOOL NlaMode);
 void transport_get_read_handles(rdpTransport* transport, HANDLE* events, DWORD* count);
 BOOL tranport_is_write_blocked(rdpTransport* transport);
 int tranport_drain_output_buffer(rdpTransport* transport);
+size_t transport_get_output_buffer_size(rdpTransport* transport);
 
 wStream* transport_receive_pool_take(rdpTransport* transport);
 int transport_receive_pool_return(rdpTransport* transport, wStream* pdu);
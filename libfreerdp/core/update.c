@@ -580,6 +580,8 @@ void update_post_disconnect(rdpUpdate* update)
 		update_message_proxy_free(update->proxy);
 }
 
+static void update_flush_surface_commands(rdpContext* context);
+
 static void update_begin_paint(rdpContext* context)
 {
 	wStream* s;
@@ -593,6 +595,7 @@ static void update_begin_paint(rdpContext* context)
 	Stream_Seek(s, 2); /* numberOrders (2 bytes) */
 
 	update->combineUpdates = TRUE;
+	update->paintStarted = TRUE;
 	update->numberOrders = 0;
 	update->us = s;
 }
@@ -603,6 +606,8 @@ static void update_end_paint(rdpContext* context)
 	int headerLength;
 	rdpUpdate* update = context->update;
 
+	update_flush_surface_commands(context);
+
 	if (!update->us)
 		return;
 
@@ -616,37 +621,39 @@ static void update_end_paint(rdpContext* context)
 
 	if (update->numberOrders > 0)
 	{
-		WLog_ERR(TAG,  "sending %d orders", update->numberOrders);
+		WLog_DBG(TAG, "sending %d orders", update->numberOrders);
 		fastpath_send_update_pdu(context->rdp->fastpath, FASTPATH_UPDATETYPE_ORDERS, s, FALSE);
 	}
 
 	update->combineUpdates = FALSE;
+	update->paintStarted = FALSE;
 	update->numberOrders = 0;
 	update->us = NULL;
 
 	Stream_Free(s, TRUE);
 }
 
+/* flushing keeps the paint state of the caller, explicit or implicit */
+
 static void update_flush(rdpContext* context)
 {
+	BOOL paintStarted;
 	rdpUpdate* update = context->update;
 
 	if (update->numberOrders > 0)
 	{
+		paintStarted = update->paintStarted;
 		update->EndPaint(context);
 		update->BeginPaint(context);
+		update->paintStarted = paintStarted;
 	}
 }
 
 static void update_force_flush(rdpContext* context)
 {
-	rdpUpdate* update = context->update;
+	update_flush_surface_commands(context);
 
-	if (update->numberOrders > 0)
-	{
-		update->EndPaint(context);
-		update->BeginPaint(context);
-	}
+	update_flush(context);
 }
 
 static BOOL update_check_flush(rdpContext* context, int size)
@@ -658,7 +665,9 @@ static BOOL update_check_flush(rdpContext* context, int size)
 
 	if (!update->us)
 	{
+		/* orders sent outside of a paint are combined, but do not start one */
 		update->BeginPaint(context);
+		update->paintStarted = FALSE;
 		return FALSE;
 	}
 
@@ -855,77 +864,148 @@ static void update_send_suppress_output(rdpContext* context, BYTE allow, RECTANG
 	}
 }
 
+/**
+ * Surface commands sent between BeginPaint/EndPaint or between frame markers are
+ * accumulated in update->surfaceCommands and sent as a single fastpath SURFCMDS
+ * update, up to MultifragMaxRequestSize bytes per update.
+ */
+
+static void update_flush_surface_commands(rdpContext* context)
+{
+	wStream* s;
+	rdpUpdate* update = context->update;
+
+	s = update->surfaceCommands;
+
+	if (!s || (Stream_GetPosition(s) == 0))
+		return;
+
+	fastpath_send_update_pdu(context->rdp->fastpath, FASTPATH_UPDATETYPE_SURFCMDS, s, update->surfaceCommandsSkipCompression);
+
+	Stream_SetPosition(s, 0);
+	update->surfaceCommandsSkipCompression = FALSE;
+}
+
+static wStream* update_begin_surface_command(rdpContext* context, UINT32 length, BOOL skipCompression)
+{
+	wStream* s;
+	UINT32 position;
+	rdpUpdate* update = context->update;
+	rdpSettings* settings = context->settings;
+
+	update_flush(context);
+
+	if (!update->surfaceCommands)
+	{
+		update->surfaceCommands = Stream_New(NULL, FASTPATH_MAX_PACKET_SIZE);
+
+		if (!update->surfaceCommands)
+			return NULL;
+	}
+
+	s = update->surfaceCommands;
+	position = Stream_GetPosition(s);
+
+	if (position > 0)
+	{
+		if ((position + length > settings->MultifragMaxRequestSize) ||
+				(skipCompression != update->surfaceCommandsSkipCompression))
+		{
+			update_flush_surface_commands(context);
+		}
+	}
+
+	Stream_EnsureRemainingCapacity(s, length);
+	update->surfaceCommandsSkipCompression = skipCompression;
+
+	return s;
+}
+
+static void update_end_surface_command(rdpContext* context)
+{
+	rdpUpdate* update = context->update;
+
+	/* surface commands are batched within a paint or a surface frame only */
+
+	if (!update->paintStarted && !update->surfaceFrameStarted)
+		update_flush_surface_commands(context);
+}
+
 static void update_send_surface_command(rdpContext* context, wStream* s)
 {
 	wStream* update;
-	rdpRdp* rdp = context->rdp;
 
-	update = fastpath_update_pdu_init(rdp->fastpath);
-	Stream_EnsureRemainingCapacity(update, Stream_GetPosition(s));
+	update = update_begin_surface_command(context, Stream_GetPosition(s), FALSE);
+
+	if (!update)
+		return;
+
 	Stream_Write(update, Stream_Buffer(s), Stream_GetPosition(s));
-	fastpath_send_update_pdu(rdp->fastpath, FASTPATH_UPDATETYPE_SURFCMDS, update, FALSE);
-	Stream_Release(update);
+
+	update_end_surface_command(context);
 }
 
 static void update_send_surface_bits(rdpContext* context, SURFACE_BITS_COMMAND* surfaceBitsCommand)
 {
 	wStream* s;
-	rdpRdp* rdp = context->rdp;
 
-	update_force_flush(context);
+	s = update_begin_surface_command(context, SURFCMD_SURFACE_BITS_HEADER_LENGTH +
+			surfaceBitsCommand->bitmapDataLength, surfaceBitsCommand->skipCompression);
+
+	if (!s)
+		return;
 
-	s = fastpath_update_pdu_init(rdp->fastpath);
-	Stream_EnsureRemainingCapacity(s, SURFCMD_SURFACE_BITS_HEADER_LENGTH + (int) surfaceBitsCommand->bitmapDataLength);
 	update_write_surfcmd_surface_bits_header(s, surfaceBitsCommand);
 	Stream_Write(s, surfaceBitsCommand->bitmapData, surfaceBitsCommand->bitmapDataLength);
-	fastpath_send_update_pdu(rdp->fastpath, FASTPATH_UPDATETYPE_SURFCMDS, s, surfaceBitsCommand->skipCompression);
 
-	update_force_flush(context);
-
-	Stream_Release(s);
+	update_end_surface_command(context);
 }
 
 static void update_send_surface_frame_marker(rdpContext* context, SURFACE_FRAME_MARKER* surfaceFrameMarker)
 {
 	wStream* s;
-	rdpRdp* rdp = context->rdp;
+	rdpUpdate* update = context->update;
 
-	update_force_flush(context);
+	s = update_begin_surface_command(context, SURFCMD_FRAME_MARKER_LENGTH, update->surfaceCommandsSkipCompression);
+
+	if (!s)
+		return;
 
-	s = fastpath_update_pdu_init(rdp->fastpath);
 	update_write_surfcmd_frame_marker(s, surfaceFrameMarker->frameAction, surfaceFrameMarker->frameId);
-	fastpath_send_update_pdu(rdp->fastpath, FASTPATH_UPDATETYPE_SURFCMDS, s, FALSE);
 
-	update_force_flush(context);
+	update->surfaceFrameStarted = (surfaceFrameMarker->frameAction == SURFACECMD_FRAMEACTION_BEGIN) ? TRUE : FALSE;
 
-	Stream_Release(s);
+	update_end_surface_command(context);
 }
 
 static void update_send_surface_frame_bits(rdpContext* context, SURFACE_BITS_COMMAND* cmd, BOOL first, BOOL last, UINT32 frameId)
 {
 	wStream* s;
-	rdpRdp* rdp = context->rdp;
+	rdpUpdate* update = context->update;
 
-	update_force_flush(context);
+	s = update_begin_surface_command(context, SURFCMD_SURFACE_BITS_HEADER_LENGTH +
+			cmd->bitmapDataLength + (first ? SURFCMD_FRAME_MARKER_LENGTH : 0) +
+			(last ? SURFCMD_FRAME_MARKER_LENGTH : 0), cmd->skipCompression);
 
-	s = fastpath_update_pdu_init(rdp->fastpath);
-	Stream_EnsureRemainingCapacity(s, SURFCMD_SURFACE_BITS_HEADER_LENGTH + (int) cmd->bitmapDataLength + 16);
+	if (!s)
+		return;
 
 	if (first)
+	{
 		update_write_surfcmd_frame_marker(s, SURFACECMD_FRAMEACTION_BEGIN, frameId);
+		update->surfaceFrameStarted = TRUE;
+	}
 
 	update_write_surfcmd_surface_bits_header(s, cmd);
 	Stream_Write(s, cmd->bitmapData, cmd->bitmapDataLength);
 
-
 	if (last)
+	{
 		update_write_surfcmd_frame_marker(s, SURFACECMD_FRAMEACTION_END, frameId);
+		update->surfaceFrameStarted = FALSE;
+	}
 
-	fastpath_send_update_pdu(rdp->fastpath, FASTPATH_UPDATETYPE_SURFCMDS, s, cmd->skipCompression);
-
-	update_force_flush(context);
-
-	Stream_Release(s);
+	update_end_surface_command(context);
 }
 
 static void update_send_frame_acknowledge(rdpContext* context, UINT32 frameId)
@@ -1489,6 +1569,18 @@ static void update_send_switch_surface_order(rdpContext* context, SWITCH_SURFACE
 	update->numberOrders++;
 }
 
+static void update_send_pointer_position(rdpContext* context, POINTER_POSITION_UPDATE* pointer_position)
+{
+	wStream* s;
+	rdpRdp* rdp = context->rdp;
+
+	s = fastpath_update_pdu_init(rdp->fastpath);
+	Stream_Write_UINT16(s, pointer_position->xPos); /* xPos (2 bytes) */
+	Stream_Write_UINT16(s, pointer_position->yPos); /* yPos (2 bytes) */
+	fastpath_send_update_pdu(rdp->fastpath, FASTPATH_UPDATETYPE_PTR_POSITION, s, FALSE);
+	Stream_Release(s);
+}
+
 static void update_send_pointer_system(rdpContext* context, POINTER_SYSTEM_UPDATE* pointer_system)
 {
 	wStream* s;
@@ -1654,6 +1746,7 @@ void update_register_server_callbacks(rdpUpdate* update)
 	update->secondary->CacheBrush = update_send_cache_brush;
 	update->altsec->CreateOffscreenBitmap = update_send_create_offscreen_bitmap_order;
 	update->altsec->SwitchSurface = update_send_switch_surface_order;
+	update->pointer->PointerPosition = update_send_pointer_position;
 	update->pointer->PointerSystem = update_send_pointer_system;
 	update->pointer->PointerColor = update_send_pointer_color;
 	update->pointer->PointerNew = update_send_pointer_new;
@@ -1723,7 +1816,8 @@ rdpUpdate* update_new(rdpRdp* rdp)
 
 		update->initialState = TRUE;
 
-		update->queue = MessageQueue_New(&cb);
+		update->queue = MessageQueue_NewEx(&cb, WMQ_FLAG_LOCKFREE, 1024);
+		update->arena = update_arena_new();
 	}
 
 	return update;
@@ -1757,6 +1851,10 @@ void update_free(rdpUpdate* update)
 		free(update->window);
 
 		MessageQueue_Free(update->queue);
+		update_arena_destroy(update->arena);
+
+		if (update->surfaceCommands)
+			Stream_Free(update->surfaceCommands, TRUE);
 
 		free(update);
 	}
@@ -54,6 +54,7 @@
 
 static char* test_pcap_file = NULL;
 static BOOL test_dump_rfx_realtime = TRUE;
+static freerdp_peer_loop* test_peer_loop = NULL;
 
 void test_peer_context_new(freerdp_peer* client, testPeerContext* context)
 {
@@ -657,16 +658,26 @@ static void tf_peer_suppress_output(rdpContext* context, BYTE allow, RECTANGLE_1
 	}
 }
 
-static void* test_peer_mainloop(void* arg)
+static BOOL test_peer_channel_event(freerdp_peer* client, HANDLE handle)
 {
-	int i;
-	int fds;
-	int max_fds;
-	int rcount;
-	void* rfds[32];
-	fd_set rfds_set;
+	testPeerContext* context = (testPeerContext*) client->context;
+
+	return WTSVirtualChannelManagerCheckFileDescriptor(context->vcm);
+}
+
+static void test_peer_closed(freerdp_peer_loop* loop, freerdp_peer* client)
+{
+	WLog_INFO(TAG, "Client %s disconnected.", client->local ? "(local)" : client->hostname);
+	client->Disconnect(client);
+	freerdp_peer_context_free(client);
+	freerdp_peer_free(client);
+}
+
+static void test_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
+{
+	HANDLE handle;
+	psPeerLoopEvent event;
 	testPeerContext* context;
-	freerdp_peer* client = (freerdp_peer*) arg;
 
 	test_peer_init(client);
 
@@ -697,84 +708,12 @@ static void* test_peer_mainloop(void* arg)
 	context = (testPeerContext*) client->context;
 	WLog_INFO(TAG, "We've got a client %s", client->local ? "(local)" : client->hostname);
 
-	while (1)
-	{
-		rcount = 0;
-
-		memset(rfds, 0, sizeof(rfds));
-		if (client->GetFileDescriptor(client, rfds, &rcount) != TRUE)
-		{
-			WLog_ERR(TAG, "Failed to get FreeRDP file descriptor");
-			break;
-		}
-
-#ifndef _WIN32
-		/* winsock's select() only works with sockets ! */
-		WTSVirtualChannelManagerGetFileDescriptor(context->vcm, rfds, &rcount);
-#endif
+	/* all clients share the threads of the peer loop */
+	handle = WTSVirtualChannelManagerGetEventHandle(context->vcm);
+	event = test_peer_channel_event;
 
-		max_fds = 0;
-		FD_ZERO(&rfds_set);
-
-		for (i = 0; i < rcount; i++)
-		{
-			fds = (int)(long)(rfds[i]);
-
-			if (fds > max_fds)
-				max_fds = fds;
-
-			FD_SET(fds, &rfds_set);
-		}
-
-		if (max_fds == 0)
-			break;
-
-		if (select(max_fds + 1, &rfds_set, NULL, NULL, NULL) == -1)
-		{
-#ifdef _WIN32
-			/* error codes set by windows sockets are not made available through errno ! */
-			int wsa_error = WSAGetLastError();
-			if (!((wsa_error == WSAEWOULDBLOCK) ||
-				(wsa_error == WSAEINPROGRESS) ||
-				(wsa_error == WSAEINTR)))
-			{
-				WLog_ERR(TAG, "select failed (WSAGetLastError: %d)", wsa_error);
-				break;
-			}
-#else
-			/* these are not really errors */
-			if (!((errno == EAGAIN) ||
-				(errno == EWOULDBLOCK) ||
-				(errno == EINPROGRESS) ||
-				(errno == EINTR))) /* signal occurred */
-			{
-				WLog_ERR(TAG, "select failed (errno: %d)", errno);
-				break;
-			}
-#endif
-		}
-
-		if (client->CheckFileDescriptor(client) != TRUE)
-			break;
-
-		if (WTSVirtualChannelManagerCheckFileDescriptor(context->vcm) != TRUE)
-			break;
-	}
-
-	WLog_INFO(TAG, "Client %s disconnected.", client->local ? "(local)" : client->hostname);
-	client->Disconnect(client);
-	freerdp_peer_context_free(client);
-	freerdp_peer_free(client);
-
-	return NULL;
-}
-
-static void test_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
-{
-	HANDLE hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) test_peer_mainloop, (void*) client, 0, NULL);
-	if (hThread != NULL) {
-		CloseHandle(hThread);
-	}
+	if (!freerdp_peer_loop_add(test_peer_loop, client, &handle, &event, 1))
+		test_peer_closed(test_peer_loop, client);
 }
 
 static void test_server_mainloop(freerdp_listener* instance)
@@ -851,6 +790,14 @@ int main(int argc, char* argv[])
 	if (argc > 2 && !strcmp(argv[2], "--fast"))
 		test_dump_rfx_realtime = FALSE;
 
+	test_peer_loop = freerdp_peer_loop_new(1, test_peer_closed);
+
+	if (!test_peer_loop)
+	{
+		freerdp_listener_free(instance);
+		return -1;
+	}
+
 	/* Open the server socket and start listening. */
 	freerdp_wsa_startup();
 	if (instance->Open(instance, NULL, 3389) &&
@@ -859,6 +806,7 @@ int main(int argc, char* argv[])
 		/* Entering the server main loop. In a real server the listener can be run in its own thread. */
 		test_server_mainloop(instance);
 	}
+	freerdp_peer_loop_free(test_peer_loop);
 	freerdp_wsa_cleanup();
 
 	freerdp_listener_free(instance);
@@ -357,34 +357,12 @@ void (^mac_capture_stream_handler)(CGDisplayStreamFrameStatus, uint64_t, IOSurfa
 		}
 		
 		IOSurfaceUnlock(frameSurface, kIOSurfaceLockReadOnly, NULL);
-			
-		ArrayList_Lock(server->clients);
-			
-		count = ArrayList_Count(server->clients);
-			
-		InitializeSynchronizationBarrier(&(subsystem->barrier), count + 1, -1);
-			
-		SetEvent(subsystem->updateEvent);
-			
-		EnterSynchronizationBarrier(&(subsystem->barrier), 0);
-		
-		DeleteSynchronizationBarrier(&(subsystem->barrier));
 		
-		if (count == 1)
-		{
-			rdpShadowClient* client;
-			
-			client = (rdpShadowClient*) ArrayList_GetItem(server->clients, 0);
+		surface->version++;
 			
-			if (client)
-			{
-				subsystem->captureFrameRate = client->encoder->fps;
-			}
-		}
+		shadow_client_broadcast_update(server);
 		
-		ResetEvent(subsystem->updateEvent);
-			
-		ArrayList_Unlock(server->clients);
+		subsystem->captureFrameRate = shadow_client_capture_frame_rate(server);
 			
 		region16_clear(&(subsystem->invalidRegion));
 	}
@@ -0,0 +1,860 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Copyright 2014 Marc-Andre Moreau <marcandre.moreau@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/log.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/region.h>
+
+#include "../shadow_screen.h"
+#include "../shadow_client.h"
+#include "../shadow_encoder.h"
+#include "../shadow_capture.h"
+#include "../shadow_stats.h"
+#include "../shadow_surface.h"
+#include "../shadow_subsystem.h"
+
+#include "synthetic_shadow.h"
+
+#define TAG SERVER_TAG("shadow.synthetic")
+
+#define SYNTHETIC_DEFAULT_WIDTH		1024
+#define SYNTHETIC_DEFAULT_HEIGHT	768
+#define SYNTHETIC_DEFAULT_FRAME_RATE	30
+
+#define SYNTHETIC_WINDOW_WIDTH		320
+#define SYNTHETIC_WINDOW_HEIGHT		240
+#define SYNTHETIC_TITLE_HEIGHT		20
+#define SYNTHETIC_TASKBAR_HEIGHT	32
+
+#define SYNTHETIC_COLOR_DESKTOP1	0xFF3A6EA5
+#define SYNTHETIC_COLOR_DESKTOP2	0xFF3465A0
+#define SYNTHETIC_COLOR_TASKBAR		0xFF202020
+#define SYNTHETIC_COLOR_TEXT		0xFFD0D0D0
+#define SYNTHETIC_COLOR_CONSOLE		0xFF1E1E1E
+#define SYNTHETIC_COLOR_TITLE		0xFF2B5797
+#define SYNTHETIC_COLOR_WINDOW		0xFFF0F0F0
+#define SYNTHETIC_COLOR_CONTENT		0xFFA0A0A0
+
+static UINT32 synthetic_shadow_hash(UINT32 x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352D;
+	x ^= x >> 15;
+	x *= 0x846CA68B;
+	x ^= x >> 16;
+	return x;
+}
+
+static UINT32 synthetic_shadow_desktop_pixel(int x, int y)
+{
+	return (((x >> 5) + (y >> 5)) & 1) ? SYNTHETIC_COLOR_DESKTOP1 : SYNTHETIC_COLOR_DESKTOP2;
+}
+
+static BOOL synthetic_shadow_clip_rect(syntheticShadowSubsystem* subsystem, int* x, int* y, int* width, int* height)
+{
+	if (*x < 0)
+	{
+		*width += *x;
+		*x = 0;
+	}
+
+	if (*y < 0)
+	{
+		*height += *y;
+		*y = 0;
+	}
+
+	if ((*x + *width) > subsystem->width)
+		*width = subsystem->width - *x;
+
+	if ((*y + *height) > subsystem->height)
+		*height = subsystem->height - *y;
+
+	return ((*width > 0) && (*height > 0)) ? TRUE : FALSE;
+}
+
+static void synthetic_shadow_fill_desktop(syntheticShadowSubsystem* subsystem, int x, int y, int width, int height)
+{
+	int i, j;
+	UINT32* pixel;
+
+	if (!synthetic_shadow_clip_rect(subsystem, &x, &y, &width, &height))
+		return;
+
+	for (j = y; j < y + height; j++)
+	{
+		pixel = (UINT32*) &subsystem->frame[(j * subsystem->scanline) + (x * 4)];
+
+		for (i = x; i < x + width; i++)
+			*pixel++ = synthetic_shadow_desktop_pixel(i, j);
+	}
+}
+
+static void synthetic_shadow_fill_rect(syntheticShadowSubsystem* subsystem, int x, int y, int width, int height, UINT32 color)
+{
+	int i, j;
+	UINT32* pixel;
+
+	if (!synthetic_shadow_clip_rect(subsystem, &x, &y, &width, &height))
+		return;
+
+	for (j = y; j < y + height; j++)
+	{
+		pixel = (UINT32*) &subsystem->frame[(j * subsystem->scanline) + (x * 4)];
+
+		for (i = 0; i < width; i++)
+			*pixel++ = color;
+	}
+}
+
+static void synthetic_shadow_draw_glyph(syntheticShadowSubsystem* subsystem, int x, int y, int glyph, UINT32 fg, UINT32 bg)
+{
+	int i, j;
+	BYTE bits;
+	UINT32* pixel;
+
+	if ((x < 0) || (y < 0) || ((x + SYNTHETIC_GLYPH_WIDTH) > subsystem->width) ||
+			((y + SYNTHETIC_GLYPH_HEIGHT) > subsystem->height))
+		return;
+
+	for (j = 0; j < SYNTHETIC_GLYPH_HEIGHT; j++)
+	{
+		bits = subsystem->glyphs[glyph][j];
+		pixel = (UINT32*) &subsystem->frame[((y + j) * subsystem->scanline) + (x * 4)];
+
+		for (i = 0; i < SYNTHETIC_GLYPH_WIDTH; i++)
+			*pixel++ = (bits & (0x80 >> i)) ? fg : bg;
+	}
+}
+
+/**
+ * Renders frame buffer row y from row v of an endless console document.
+ * Lines are generated from their number, so any row can be rendered alone.
+ */
+
+static void synthetic_shadow_render_text_row(syntheticShadowSubsystem* subsystem, int y, UINT32 v)
+{
+	int i, c;
+	int cols;
+	BYTE bits;
+	UINT32 line;
+	UINT32 hash;
+	UINT32 length;
+	UINT32* pixel;
+
+	line = v / SYNTHETIC_GLYPH_HEIGHT;
+	cols = subsystem->width / SYNTHETIC_GLYPH_WIDTH;
+	length = synthetic_shadow_hash(subsystem->seed ^ (line * 0x9E3779B9));
+	length = ((length & 7) == 0) ? 0 : (length % cols);
+
+	pixel = (UINT32*) &subsystem->frame[y * subsystem->scanline];
+
+	for (c = 0; c < cols; c++)
+	{
+		bits = 0;
+
+		if ((UINT32) c < length)
+		{
+			hash = synthetic_shadow_hash(subsystem->seed + (line * 4099) + c);
+
+			if ((hash % 7) != 0)
+				bits = subsystem->glyphs[hash % SYNTHETIC_GLYPH_COUNT][v % SYNTHETIC_GLYPH_HEIGHT];
+		}
+
+		for (i = 0; i < SYNTHETIC_GLYPH_WIDTH; i++)
+			*pixel++ = (bits & (0x80 >> i)) ? SYNTHETIC_COLOR_TEXT : SYNTHETIC_COLOR_CONSOLE;
+	}
+
+	for (i = cols * SYNTHETIC_GLYPH_WIDTH; i < subsystem->width; i++)
+		*pixel++ = SYNTHETIC_COLOR_CONSOLE;
+}
+
+static void synthetic_shadow_render_scroll(syntheticShadowSubsystem* subsystem)
+{
+	int y;
+	int step = subsystem->scrollStep;
+
+	MoveMemory(subsystem->frame, &subsystem->frame[step * subsystem->scanline],
+			(subsystem->height - step) * subsystem->scanline);
+
+	subsystem->scrollTop += step;
+
+	for (y = subsystem->height - step; y < subsystem->height; y++)
+		synthetic_shadow_render_text_row(subsystem, y, subsystem->scrollTop + y);
+}
+
+/**
+ * Video-like content: a moving plasma pattern with some per-pixel noise in
+ * a quarter of the screen, so that every frame differs everywhere inside.
+ */
+
+static void synthetic_shadow_render_video(syntheticShadowSubsystem* subsystem)
+{
+	int x, y;
+	int left, top;
+	int width, height;
+	UINT32 t, noise;
+	UINT32 v1, v2, v3;
+	UINT32* pixel;
+
+	width = subsystem->width / 2;
+	height = subsystem->height / 2;
+	left = (subsystem->width - width) / 2;
+	top = (subsystem->height - height) / 2;
+
+	t = subsystem->frameCount;
+	noise = subsystem->seed ^ t;
+
+	for (y = 0; y < height; y++)
+	{
+		pixel = (UINT32*) &subsystem->frame[((top + y) * subsystem->scanline) + (left * 4)];
+		v2 = subsystem->plasma[((y / 2) + (t * 2)) & 0xFF];
+
+		for (x = 0; x < width; x++)
+		{
+			noise ^= noise << 13;
+			noise ^= noise >> 17;
+			noise ^= noise << 5;
+
+			v1 = subsystem->plasma[((x / 2) + t) & 0xFF];
+			v3 = subsystem->plasma[(((x + y) / 4) + (t * 3)) & 0xFF];
+
+			*pixel++ = 0xFF000000 |
+					((((v1 + v2) / 2) ^ (noise & 0x0F)) << 16) |
+					((((v2 + v3) / 2) ^ ((noise >> 8) & 0x0F)) << 8) |
+					(((v1 + v3) / 2) ^ ((noise >> 16) & 0x0F));
+		}
+	}
+}
+
+static void synthetic_shadow_draw_window(syntheticShadowSubsystem* subsystem, int x, int y)
+{
+	int line;
+	int length;
+
+	synthetic_shadow_fill_rect(subsystem, x, y, SYNTHETIC_WINDOW_WIDTH,
+			SYNTHETIC_TITLE_HEIGHT, SYNTHETIC_COLOR_TITLE);
+
+	synthetic_shadow_fill_rect(subsystem, x, y + SYNTHETIC_TITLE_HEIGHT, SYNTHETIC_WINDOW_WIDTH,
+			SYNTHETIC_WINDOW_HEIGHT - SYNTHETIC_TITLE_HEIGHT, SYNTHETIC_COLOR_WINDOW);
+
+	for (line = 0; line < (SYNTHETIC_WINDOW_HEIGHT - SYNTHETIC_TITLE_HEIGHT - 16) / 16; line++)
+	{
+		length = 32 + (synthetic_shadow_hash(subsystem->seed + line) % (SYNTHETIC_WINDOW_WIDTH - 48));
+
+		synthetic_shadow_fill_rect(subsystem, x + 8, y + SYNTHETIC_TITLE_HEIGHT + 8 + (line * 16),
+				length, 8, SYNTHETIC_COLOR_CONTENT);
+	}
+}
+
+static void synthetic_shadow_render_drag(syntheticShadowSubsystem* subsystem)
+{
+	synthetic_shadow_fill_desktop(subsystem, subsystem->dragX, subsystem->dragY,
+			SYNTHETIC_WINDOW_WIDTH, SYNTHETIC_WINDOW_HEIGHT);
+
+	subsystem->dragX += subsystem->dragDeltaX;
+	subsystem->dragY += subsystem->dragDeltaY;
+
+	if ((subsystem->dragX < 0) || ((subsystem->dragX + SYNTHETIC_WINDOW_WIDTH) > subsystem->width))
+	{
+		subsystem->dragDeltaX = -subsystem->dragDeltaX;
+		subsystem->dragX += 2 * subsystem->dragDeltaX;
+	}
+
+	if ((subsystem->dragY < 0) || ((subsystem->dragY + SYNTHETIC_WINDOW_HEIGHT) > subsystem->height))
+	{
+		subsystem->dragDeltaY = -subsystem->dragDeltaY;
+		subsystem->dragY += 2 * subsystem->dragDeltaY;
+	}
+
+	synthetic_shadow_draw_window(subsystem, subsystem->dragX, subsystem->dragY);
+}
+
+/**
+ * An idle desktop only changes its taskbar clock, once per second.
+ */
+
+static void synthetic_shadow_render_idle(syntheticShadowSubsystem* subsystem)
+{
+	int index;
+	UINT32 seconds;
+	int x, y;
+
+	if ((subsystem->frameCount % subsystem->frameRate) != 0)
+		return;
+
+	seconds = subsystem->frameCount / subsystem->frameRate;
+
+	x = subsystem->width - (6 * SYNTHETIC_GLYPH_WIDTH) - 8;
+	y = subsystem->height - SYNTHETIC_TASKBAR_HEIGHT + 8;
+
+	for (index = 5; index >= 0; index--)
+	{
+		synthetic_shadow_draw_glyph(subsystem, x + (index * SYNTHETIC_GLYPH_WIDTH), y,
+				16 + (seconds % 10), SYNTHETIC_COLOR_TEXT, SYNTHETIC_COLOR_TASKBAR);
+		seconds /= 10;
+	}
+}
+
+static void synthetic_shadow_render_file(syntheticShadowSubsystem* subsystem)
+{
+	size_t size = subsystem->scanline * subsystem->height;
+
+	if (fread(subsystem->frame, size, 1, subsystem->fp) == 1)
+		return;
+
+	/* loop the recording */
+	fseek(subsystem->fp, 0, SEEK_SET);
+
+	if (fread(subsystem->frame, size, 1, subsystem->fp) != 1)
+		WLog_ERR(TAG, "failed to read frame from %s", subsystem->fileName);
+}
+
+static int synthetic_shadow_render_init(syntheticShadowSubsystem* subsystem)
+{
+	int y;
+	int glyph, row;
+
+	for (glyph = 0; glyph < SYNTHETIC_GLYPH_COUNT; glyph++)
+	{
+		for (row = 0; row < SYNTHETIC_GLYPH_HEIGHT; row++)
+		{
+			/* leave a margin around the glyph, as a font would */
+			if ((row < 3) || (row > 12))
+				subsystem->glyphs[glyph][row] = 0;
+			else
+				subsystem->glyphs[glyph][row] = synthetic_shadow_hash(subsystem->seed ^ ((glyph << 4) | row)) & 0x7E;
+		}
+	}
+
+	/* triangle wave, smooth enough for moving gradients */
+	for (y = 0; y < 256; y++)
+		subsystem->plasma[y] = (BYTE) ((y < 128) ? (y * 2) : ((255 - y) * 2));
+
+	switch (subsystem->workload)
+	{
+		case SYNTHETIC_WORKLOAD_SCROLL:
+			for (y = 0; y < subsystem->height; y++)
+				synthetic_shadow_render_text_row(subsystem, y, y);
+			break;
+
+		case SYNTHETIC_WORKLOAD_DRAG:
+			synthetic_shadow_fill_desktop(subsystem, 0, 0, subsystem->width, subsystem->height);
+			synthetic_shadow_draw_window(subsystem, subsystem->dragX, subsystem->dragY);
+			break;
+
+		case SYNTHETIC_WORKLOAD_FILE:
+			synthetic_shadow_render_file(subsystem);
+			break;
+
+		default:
+			synthetic_shadow_fill_desktop(subsystem, 0, 0, subsystem->width, subsystem->height);
+			synthetic_shadow_fill_rect(subsystem, 0, subsystem->height - SYNTHETIC_TASKBAR_HEIGHT,
+					subsystem->width, SYNTHETIC_TASKBAR_HEIGHT, SYNTHETIC_COLOR_TASKBAR);
+			synthetic_shadow_render_idle(subsystem);
+			break;
+	}
+
+	return 1;
+}
+
+static void synthetic_shadow_render(syntheticShadowSubsystem* subsystem)
+{
+	subsystem->frameCount++;
+
+	switch (subsystem->workload)
+	{
+		case SYNTHETIC_WORKLOAD_SCROLL:
+			synthetic_shadow_render_scroll(subsystem);
+			break;
+
+		case SYNTHETIC_WORKLOAD_VIDEO:
+			synthetic_shadow_render_video(subsystem);
+			break;
+
+		case SYNTHETIC_WORKLOAD_DRAG:
+			synthetic_shadow_render_drag(subsystem);
+			break;
+
+		case SYNTHETIC_WORKLOAD_FILE:
+			synthetic_shadow_render_file(subsystem);
+			break;
+
+		default:
+			synthetic_shadow_render_idle(subsystem);
+			break;
+	}
+}
+
+int synthetic_shadow_screen_grab(syntheticShadowSubsystem* subsystem)
+{
+	int count;
+	int x, y;
+	int index;
+	int numRects;
+	int width, height;
+	UINT64 startTime;
+	BYTE* pFrameData;
+	rdpShadowServer* server;
+	rdpShadowSurface* surface;
+	REGION16 invalidRegion;
+	RECTANGLE_16 surfaceRect;
+	const RECTANGLE_16* rects;
+
+	server = subsystem->server;
+	surface = server->surface;
+
+	count = ArrayList_Count(server->clients);
+
+	if (count < 1)
+		return 1;
+
+	if ((count == 1) && subsystem->suppressOutput)
+		return 1;
+
+	startTime = shadow_stats_timestamp();
+
+	synthetic_shadow_render(subsystem);
+
+	shadow_stats_capture(server, startTime);
+
+	surfaceRect.left = 0;
+	surfaceRect.top = 0;
+	surfaceRect.right = surface->width;
+	surfaceRect.bottom = surface->height;
+
+	pFrameData = &(subsystem->frame[(surface->y * subsystem->scanline) + (surface->x * 4)]);
+
+	region16_init(&invalidRegion);
+
+	if (shadow_capture_compare_outputs(server->capture, surface->data, surface->scanline,
+			pFrameData, subsystem->scanline, &invalidRegion) > 0)
+	{
+		/* refreshed areas are copied again, but unchanged */
+		surface->version++;
+
+		shadow_capture_detect_region_move(surface->data, surface->scanline, pFrameData, subsystem->scanline,
+				&invalidRegion, &(subsystem->moveRect), &(subsystem->moveDeltaX), &(subsystem->moveDeltaY));
+	}
+
+	rects = region16_rects(&invalidRegion, &numRects);
+
+	for (index = 0; index < numRects; index++)
+		region16_union_rect(&(subsystem->invalidRegion), &(subsystem->invalidRegion), &rects[index]);
+
+	region16_uninit(&invalidRegion);
+
+	region16_intersect_rect(&(subsystem->invalidRegion), &(subsystem->invalidRegion), &surfaceRect);
+
+	if (!region16_is_empty(&(subsystem->invalidRegion)) || shadow_client_update_pending(server))
+	{
+		rects = region16_rects(&(subsystem->invalidRegion), &numRects);
+
+		for (index = 0; index < numRects; index++)
+		{
+			x = rects[index].left;
+			y = rects[index].top;
+			width = rects[index].right - rects[index].left;
+			height = rects[index].bottom - rects[index].top;
+
+			freerdp_image_copy(surface->data, PIXEL_FORMAT_XRGB32,
+					surface->scanline, x, y, width, height,
+					pFrameData, PIXEL_FORMAT_XRGB32,
+					subsystem->scanline, x, y, NULL);
+		}
+
+		shadow_client_broadcast_update(server);
+
+		/* unlike a real display, the frame rate does not follow the client */
+
+		region16_clear(&(subsystem->invalidRegion));
+		ZeroMemory(&(subsystem->moveRect), sizeof(RECTANGLE_16));
+	}
+
+	return 1;
+}
+
+int synthetic_shadow_subsystem_process_message(syntheticShadowSubsystem* subsystem, wMessage* message)
+{
+	if (message->id == SHADOW_MSG_IN_REFRESH_OUTPUT_ID)
+	{
+		UINT32 index;
+		SHADOW_MSG_IN_REFRESH_OUTPUT* msg = (SHADOW_MSG_IN_REFRESH_OUTPUT*) message->wParam;
+
+		if (msg->numRects)
+		{
+			for (index = 0; index < msg->numRects; index++)
+			{
+				region16_union_rect(&(subsystem->invalidRegion),
+						&(subsystem->invalidRegion), &msg->rects[index]);
+			}
+		}
+		else
+		{
+			RECTANGLE_16 refreshRect;
+
+			refreshRect.left = 0;
+			refreshRect.top = 0;
+			refreshRect.right = subsystem->width;
+			refreshRect.bottom = subsystem->height;
+
+			region16_union_rect(&(subsystem->invalidRegion),
+						&(subsystem->invalidRegion), &refreshRect);
+		}
+	}
+	else if (message->id == SHADOW_MSG_IN_SUPPRESS_OUTPUT_ID)
+	{
+		SHADOW_MSG_IN_SUPPRESS_OUTPUT* msg = (SHADOW_MSG_IN_SUPPRESS_OUTPUT*) message->wParam;
+
+		subsystem->suppressOutput = (msg->allow) ? FALSE : TRUE;
+
+		if (msg->allow)
+		{
+			region16_union_rect(&(subsystem->invalidRegion),
+					&(subsystem->invalidRegion), &(msg->rect));
+		}
+	}
+
+	if (message->Free)
+		message->Free(message);
+
+	return 1;
+}
+
+void* synthetic_shadow_subsystem_thread(syntheticShadowSubsystem* subsystem)
+{
+	DWORD status;
+	DWORD nCount;
+	UINT64 cTime;
+	DWORD dwTimeout;
+	DWORD dwInterval;
+	UINT64 frameTime;
+	HANDLE events[32];
+	wMessage message;
+	wMessagePipe* MsgPipe;
+
+	MsgPipe = subsystem->MsgPipe;
+
+	nCount = 0;
+	events[nCount++] = MessageQueue_Event(MsgPipe->In);
+
+	subsystem->captureFrameRate = subsystem->frameRate;
+	dwInterval = 1000 / subsystem->captureFrameRate;
+	frameTime = GetTickCount64() + dwInterval;
+
+	while (1)
+	{
+		cTime = GetTickCount64();
+		dwTimeout = (cTime > frameTime) ? 0 : frameTime - cTime;
+
+		status = WaitForMultipleObjects(nCount, events, FALSE, dwTimeout);
+
+		if (WaitForSingleObject(MessageQueue_Event(MsgPipe->In), 0) == WAIT_OBJECT_0)
+		{
+			if (MessageQueue_Peek(MsgPipe->In, &message, TRUE))
+			{
+				if (message.id == WMQ_QUIT)
+					break;
+
+				synthetic_shadow_subsystem_process_message(subsystem, &message);
+			}
+		}
+
+		if ((status == WAIT_TIMEOUT) || (GetTickCount64() > frameTime))
+		{
+			synthetic_shadow_screen_grab(subsystem);
+
+			dwInterval = 1000 / subsystem->captureFrameRate;
+			frameTime += dwInterval;
+		}
+	}
+
+	ExitThread(0);
+	return NULL;
+}
+
+/**
+ * Options are a comma-separated list of a workload name (idle, scroll,
+ * video, drag), file:<path> for raw XRGB32 frames of the configured size,
+ * fps:<rate>, size:<width>x<height>, monitors:<count> to split the frame
+ * into side by side monitors and seed:<number>.
+ */
+
+int synthetic_shadow_parse_options(syntheticShadowSubsystem* subsystem, const char* options)
+{
+	int status = 1;
+	char* str;
+	char* option;
+	char* next;
+
+	if (!options)
+		return 1;
+
+	str = _strdup(options);
+
+	if (!str)
+		return -1;
+
+	for (option = str; option && (status > 0); option = next)
+	{
+		next = strchr(option, ',');
+
+		if (next)
+			*next++ = '\0';
+
+		if (strcmp(option, "idle") == 0)
+			subsystem->workload = SYNTHETIC_WORKLOAD_IDLE;
+		else if (strcmp(option, "scroll") == 0)
+			subsystem->workload = SYNTHETIC_WORKLOAD_SCROLL;
+		else if (strcmp(option, "video") == 0)
+			subsystem->workload = SYNTHETIC_WORKLOAD_VIDEO;
+		else if (strcmp(option, "drag") == 0)
+			subsystem->workload = SYNTHETIC_WORKLOAD_DRAG;
+		else if (strncmp(option, "file:", 5) == 0)
+		{
+			free(subsystem->fileName);
+			subsystem->fileName = _strdup(&option[5]);
+			subsystem->workload = SYNTHETIC_WORKLOAD_FILE;
+
+			if (!subsystem->fileName)
+				status = -1;
+		}
+		else if (strncmp(option, "fps:", 4) == 0)
+		{
+			subsystem->frameRate = atoi(&option[4]);
+
+			if ((subsystem->frameRate < 1) || (subsystem->frameRate > 1000))
+				status = -1;
+		}
+		else if (strncmp(option, "size:", 5) == 0)
+		{
+			if ((sscanf(&option[5], "%dx%d", &subsystem->width, &subsystem->height) != 2) ||
+					(subsystem->width < SYNTHETIC_WINDOW_WIDTH) || (subsystem->width > 8192) ||
+					(subsystem->height < SYNTHETIC_WINDOW_HEIGHT) || (subsystem->height > 8192))
+				status = -1;
+		}
+		else if (strncmp(option, "monitors:", 9) == 0)
+		{
+			subsystem->numMonitors = atoi(&option[9]);
+
+			if ((subsystem->numMonitors < 1) || (subsystem->numMonitors > 16))
+				status = -1;
+		}
+		else if (strncmp(option, "seed:", 5) == 0)
+		{
+			subsystem->seed = (UINT32) strtoul(&option[5], NULL, 0);
+		}
+		else
+		{
+			status = -1;
+		}
+
+		if (status < 0)
+			WLog_ERR(TAG, "invalid synthetic subsystem option: %s", option);
+	}
+
+	free(str);
+
+	return status;
+}
+
+int synthetic_shadow_enum_monitors(MONITOR_DEF* monitors, int maxMonitors)
+{
+	MONITOR_DEF* monitor;
+
+	if (maxMonitors < 1)
+		return 0;
+
+	monitor = &monitors[0];
+
+	monitor->left = 0;
+	monitor->top = 0;
+	monitor->right = SYNTHETIC_DEFAULT_WIDTH;
+	monitor->bottom = SYNTHETIC_DEFAULT_HEIGHT;
+	monitor->flags = 1;
+
+	return 1;
+}
+
+int synthetic_shadow_subsystem_init(syntheticShadowSubsystem* subsystem)
+{
+	int index;
+	MONITOR_DEF* monitor;
+	rdpShadowServer* server = subsystem->server;
+
+	if (synthetic_shadow_parse_options(subsystem, server->subsystemOptions) < 0)
+		return -1;
+
+	subsystem->scanline = subsystem->width * 4;
+	subsystem->frame = (BYTE*) _aligned_malloc(subsystem->scanline * subsystem->height, 16);
+
+	if (!subsystem->frame)
+		return -1;
+
+	if (subsystem->workload == SYNTHETIC_WORKLOAD_FILE)
+	{
+		subsystem->fp = fopen(subsystem->fileName, "rb");
+
+		if (!subsystem->fp)
+		{
+			WLog_ERR(TAG, "failed to open %s", subsystem->fileName);
+			return -1;
+		}
+	}
+
+	/* the frame is split into side by side monitors of equal width */
+
+	for (index = 0; index < subsystem->numMonitors; index++)
+	{
+		monitor = &(subsystem->monitors[index]);
+		monitor->left = (subsystem->width * index) / subsystem->numMonitors;
+		monitor->top = 0;
+		monitor->right = (subsystem->width * (index + 1)) / subsystem->numMonitors;
+		monitor->bottom = subsystem->height;
+		monitor->flags = (index == 0) ? 1 : 0;
+	}
+
+	if (subsystem->selectedMonitor >= subsystem->numMonitors)
+		subsystem->selectedMonitor = 0;
+
+	monitor = &(subsystem->virtualScreen);
+	monitor->left = 0;
+	monitor->top = 0;
+	monitor->right = subsystem->width;
+	monitor->bottom = subsystem->height;
+	monitor->flags = 1;
+
+	synthetic_shadow_render_init(subsystem);
+
+	WLog_INFO(TAG, "synthetic workload %d: %dx%d at %d fps", subsystem->workload,
+			subsystem->width, subsystem->height, subsystem->frameRate);
+
+	return 1;
+}
+
+int synthetic_shadow_subsystem_uninit(syntheticShadowSubsystem* subsystem)
+{
+	if (!subsystem)
+		return -1;
+
+	if (subsystem->fp)
+	{
+		fclose(subsystem->fp);
+		subsystem->fp = NULL;
+	}
+
+	if (subsystem->frame)
+	{
+		_aligned_free(subsystem->frame);
+		subsystem->frame = NULL;
+	}
+
+	free(subsystem->fileName);
+	subsystem->fileName = NULL;
+
+	return 1;
+}
+
+int synthetic_shadow_subsystem_start(syntheticShadowSubsystem* subsystem)
+{
+	if (!subsystem)
+		return -1;
+
+	subsystem->thread = CreateThread(NULL, 0,
+			(LPTHREAD_START_ROUTINE) synthetic_shadow_subsystem_thread,
+			(void*) subsystem, 0, NULL);
+
+	return 1;
+}
+
+int synthetic_shadow_subsystem_stop(syntheticShadowSubsystem* subsystem)
+{
+	if (!subsystem)
+		return -1;
+
+	if (subsystem->thread)
+	{
+		MessageQueue_PostQuit(subsystem->MsgPipe->In, 0);
+		WaitForSingleObject(subsystem->thread, INFINITE);
+		CloseHandle(subsystem->thread);
+		subsystem->thread = NULL;
+	}
+
+	return 1;
+}
+
+syntheticShadowSubsystem* synthetic_shadow_subsystem_new()
+{
+	syntheticShadowSubsystem* subsystem;
+
+	subsystem = (syntheticShadowSubsystem*) calloc(1, sizeof(syntheticShadowSubsystem));
+
+	if (!subsystem)
+		return NULL;
+
+	subsystem->workload = SYNTHETIC_WORKLOAD_IDLE;
+	subsystem->frameRate = SYNTHETIC_DEFAULT_FRAME_RATE;
+	subsystem->width = SYNTHETIC_DEFAULT_WIDTH;
+	subsystem->height = SYNTHETIC_DEFAULT_HEIGHT;
+	subsystem->seed = 0x5EED;
+	subsystem->numMonitors = 1;
+
+	subsystem->scrollStep = 4;
+	subsystem->dragX = 16;
+	subsystem->dragY = 16;
+	subsystem->dragDeltaX = 7;
+	subsystem->dragDeltaY = 5;
+
+	return subsystem;
+}
+
+void synthetic_shadow_subsystem_free(syntheticShadowSubsystem* subsystem)
+{
+	if (!subsystem)
+		return;
+
+	synthetic_shadow_subsystem_uninit(subsystem);
+
+	free(subsystem);
+}
+
+int Synthetic_ShadowSubsystemEntry(RDP_SHADOW_ENTRY_POINTS* pEntryPoints)
+{
+	pEntryPoints->New = (pfnShadowSubsystemNew) synthetic_shadow_subsystem_new;
+	pEntryPoints->Free = (pfnShadowSubsystemFree) synthetic_shadow_subsystem_free;
+
+	pEntryPoints->Init = (pfnShadowSubsystemInit) synthetic_shadow_subsystem_init;
+	pEntryPoints->Uninit = (pfnShadowSubsystemInit) synthetic_shadow_subsystem_uninit;
+
+	pEntryPoints->Start = (pfnShadowSubsystemStart) synthetic_shadow_subsystem_start;
+	pEntryPoints->Stop = (pfnShadowSubsystemStop) synthetic_shadow_subsystem_stop;
+
+	pEntryPoints->EnumMonitors = (pfnShadowEnumMonitors) synthetic_shadow_enum_monitors;
+
+	return 1;
+}
@@ -0,0 +1,86 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Copyright 2014 Marc-Andre Moreau <marcandre.moreau@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_SYNTHETIC_H
+#define FREERDP_SHADOW_SERVER_SYNTHETIC_H
+
+#include <freerdp/server/shadow.h>
+
+typedef struct synthetic_shadow_subsystem syntheticShadowSubsystem;
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/collections.h>
+
+/**
+ * The synthetic subsystem renders scripted workloads into a private frame
+ * buffer at a fixed rate and feeds them through the regular capture path,
+ * so that the shadow server can be benchmarked without a display.
+ */
+
+#define SYNTHETIC_WORKLOAD_IDLE		0
+#define SYNTHETIC_WORKLOAD_SCROLL	1
+#define SYNTHETIC_WORKLOAD_VIDEO	2
+#define SYNTHETIC_WORKLOAD_DRAG		3
+#define SYNTHETIC_WORKLOAD_FILE		4
+
+#define SYNTHETIC_GLYPH_COUNT		95
+#define SYNTHETIC_GLYPH_WIDTH		8
+#define SYNTHETIC_GLYPH_HEIGHT		16
+
+struct synthetic_shadow_subsystem
+{
+	RDP_SHADOW_SUBSYSTEM_COMMON();
+
+	HANDLE thread;
+
+	int width;
+	int height;
+	int scanline;
+	BYTE* frame;
+
+	int workload;
+	int frameRate;
+	UINT32 seed;
+	UINT32 frameCount;
+
+	int scrollTop;
+	int scrollStep;
+	int dragX;
+	int dragY;
+	int dragDeltaX;
+	int dragDeltaY;
+	BYTE plasma[256];
+	BYTE glyphs[SYNTHETIC_GLYPH_COUNT][SYNTHETIC_GLYPH_HEIGHT];
+
+	char* fileName;
+	FILE* fp;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_SYNTHETIC_H */
@@ -209,7 +209,6 @@ int win_shadow_surface_copy(winShadowSubsystem* subsystem)
 	int x, y;
 	int width;
 	int height;
-	int count;
 	int status = 1;
 	int nDstStep = 0;
 	BYTE* pDstData = NULL;
@@ -283,20 +282,9 @@ int win_shadow_surface_copy(winShadowSubsystem* subsystem)
 			surface->scanline, x - surface->x, y - surface->y, width, height,
 			pDstData, PIXEL_FORMAT_XRGB32, nDstStep, 0, 0, NULL);
 
-	ArrayList_Lock(server->clients);
+	surface->version++;
 
-	count = ArrayList_Count(server->clients);
-
-	InitializeSynchronizationBarrier(&(subsystem->barrier), count + 1, -1);
-
-	SetEvent(subsystem->updateEvent);
-
-	EnterSynchronizationBarrier(&(subsystem->barrier), 0);
-	ResetEvent(subsystem->updateEvent);
-
-	DeleteSynchronizationBarrier(&(subsystem->barrier));
-
-	ArrayList_Unlock(server->clients);
+	shadow_client_broadcast_update(server);
 
 	region16_clear(&(subsystem->invalidRegion));
 
@@ -44,7 +44,9 @@
 #include "../shadow_client.h"
 #include "../shadow_encoder.h"
 #include "../shadow_capture.h"
+#include "../shadow_stats.h"
 #include "../shadow_surface.h"
+#include "../shadow_pointer.h"
 #include "../shadow_subsystem.h"
 
 #include "x11_shadow.h"
@@ -259,12 +261,6 @@ void x11_shadow_input_mouse_event(x11ShadowSubsystem* subsystem, UINT16 flags, U
 	x += surface->x;
 	y += surface->y;
 
-	if (server->shareSubRect)
-	{
-		x += server->subRect.left;
-		y += server->subRect.top;
-	}
-
 	XTestGrabControl(subsystem->display, True);
 
 	if (flags & PTR_FLAGS_WHEEL)
@@ -316,12 +312,6 @@ void x11_shadow_input_extended_mouse_event(x11ShadowSubsystem* subsystem, UINT16
 	x += surface->x;
 	y += surface->y;
 
-	if (server->shareSubRect)
-	{
-		x += server->subRect.left;
-		y += server->subRect.top;
-	}
-
 	XTestGrabControl(subsystem->display, True);
 
 	XTestFakeMotionEvent(subsystem->display, 0, x, y, CurrentTime);
@@ -385,6 +375,9 @@ int x11_shadow_query_cursor(x11ShadowSubsystem* subsystem, BOOL getImage)
 		}
 
 		XFree(ci);
+
+		shadow_pointer_set_shape(server->pointer, subsystem->cursorPixels, subsystem->cursorWidth * 4,
+				subsystem->cursorWidth, subsystem->cursorHeight, subsystem->cursorHotX, subsystem->cursorHotY);
 #endif
 	}
 	else
@@ -565,18 +558,26 @@ int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	int count;
 	int status;
 	int x, y;
+	BOOL blend;
 	int width, height;
 	XImage* image;
 	rdpShadowScreen* screen;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
-	RECTANGLE_16 invalidRect;
+	rdpShadowPointer* pointer;
+	int index;
+	int numRects;
+	UINT64 startTime;
+	BYTE* pImageData;
+	REGION16 invalidRegion;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16 *extents;
+	RECTANGLE_16 cursorRect;
+	const RECTANGLE_16* rects;
 
 	server = subsystem->server;
 	surface = server->surface;
 	screen = server->screen;
+	pointer = server->pointer;
 
 	count = ArrayList_Count(server->clients);
 
@@ -591,6 +592,8 @@ int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	surfaceRect.right = surface->width;
 	surfaceRect.bottom = surface->height;
 
+	startTime = shadow_stats_timestamp();
+
 	XLockDisplay(subsystem->display);
 
 	if (subsystem->use_xshm)
@@ -600,66 +603,106 @@ int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 		XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
 				subsystem->xshm_gc, 0, 0, subsystem->width, subsystem->height, 0, 0);
 
-		status = shadow_capture_compare(surface->data, surface->scanline, surface->width, surface->height,
-				(BYTE*) &(image->data[surface->width * 4]), image->bytes_per_line, &invalidRect);
+		/* the shared image holds the whole screen */
+		pImageData = (BYTE*) &(image->data[(surface->y * image->bytes_per_line) + (surface->x * 4)]);
 	}
 	else
 	{
 		image = XGetImage(subsystem->display, subsystem->root_window,
 					surface->x, surface->y, surface->width, surface->height, AllPlanes, ZPixmap);
 
-		status = shadow_capture_compare(surface->data, surface->scanline, surface->width, surface->height,
-				(BYTE*) image->data, image->bytes_per_line, &invalidRect);
+		pImageData = (BYTE*) image->data;
 	}
 
 	XSync(subsystem->display, False);
 
 	XUnlockDisplay(subsystem->display);
 
-	region16_union_rect(&(subsystem->invalidRegion), &(subsystem->invalidRegion), &invalidRect);
-	region16_intersect_rect(&(subsystem->invalidRegion), &(subsystem->invalidRegion), &surfaceRect);
+	shadow_stats_capture(server, startTime);
 
-	if (!region16_is_empty(&(subsystem->invalidRegion)))
-	{
-		extents = region16_extents(&(subsystem->invalidRegion));
+	region16_init(&invalidRegion);
 
-		x = extents->left;
-		y = extents->top;
-		width = extents->right - extents->left;
-		height = extents->bottom - extents->top;
+	status = shadow_capture_compare_outputs(server->capture, surface->data, surface->scanline,
+			pImageData, image->bytes_per_line, &invalidRegion);
 
-		freerdp_image_copy(surface->data, PIXEL_FORMAT_XRGB32,
-				surface->scanline, x, y, width, height,
-				(BYTE*) image->data, PIXEL_FORMAT_XRGB32,
-				image->bytes_per_line, x, y, NULL);
+	rects = region16_rects(&invalidRegion, &numRects);
 
-		x11_shadow_blend_cursor(subsystem);
+	for (index = 0; index < numRects; index++)
+		region16_union_rect(&(subsystem->invalidRegion), &(subsystem->invalidRegion), &rects[index]);
 
-		count = ArrayList_Count(server->clients);
+	/**
+	 * The cursor is sent as pointer updates, unless a client cannot receive
+	 * them: it is then blended into the surface, which has to be updated
+	 * under the new cursor position (the old one is caught by the compare).
+	 */
 
-		InitializeSynchronizationBarrier(&(subsystem->barrier), count + 1, -1);
+	blend = shadow_pointer_blend_required(server);
 
-		SetEvent(subsystem->updateEvent);
+	/* a blended cursor would be moved along with the content */
 
-		EnterSynchronizationBarrier(&(subsystem->barrier), 0);
+	if ((status > 0) && !blend)
+	{
+		shadow_capture_detect_region_move(surface->data, surface->scanline, pImageData,
+				image->bytes_per_line, &invalidRegion, &(subsystem->moveRect),
+				&(subsystem->moveDeltaX), &(subsystem->moveDeltaY));
+	}
 
-		DeleteSynchronizationBarrier(&(subsystem->barrier));
+	region16_uninit(&invalidRegion);
 
-		if (count == 1)
-		{
-			rdpShadowClient* client;
+	shadow_pointer_set_position(pointer, subsystem->cursorX - surface->x, subsystem->cursorY - surface->y);
 
-			client = (rdpShadowClient*) ArrayList_GetItem(server->clients, 0);
+	if (blend && pointer->changed)
+	{
+		x = subsystem->cursorX - surface->x - subsystem->cursorHotX;
+		y = subsystem->cursorY - surface->y - subsystem->cursorHotY;
+
+		cursorRect.left = (x < 0) ? 0 : x;
+		cursorRect.top = (y < 0) ? 0 : y;
+		cursorRect.right = ((x + subsystem->cursorWidth) < 0) ? 0 : x + subsystem->cursorWidth;
+		cursorRect.bottom = ((y + subsystem->cursorHeight) < 0) ? 0 : y + subsystem->cursorHeight;
+
+		region16_union_rect(&(subsystem->invalidRegion), &(subsystem->invalidRegion), &cursorRect);
+	}
+
+	region16_intersect_rect(&(subsystem->invalidRegion), &(subsystem->invalidRegion), &surfaceRect);
+
+	if (!region16_is_empty(&(subsystem->invalidRegion)) || pointer->changed ||
+			shadow_client_update_pending(server))
+	{
+		if (!region16_is_empty(&(subsystem->invalidRegion)))
+		{
+			rects = region16_rects(&(subsystem->invalidRegion), &numRects);
 
-			if (client)
+			for (index = 0; index < numRects; index++)
 			{
-				subsystem->captureFrameRate = client->encoder->fps;
+				x = rects[index].left;
+				y = rects[index].top;
+				width = rects[index].right - rects[index].left;
+				height = rects[index].bottom - rects[index].top;
+
+				freerdp_image_copy(surface->data, PIXEL_FORMAT_XRGB32,
+						surface->scanline, x, y, width, height,
+						pImageData, PIXEL_FORMAT_XRGB32,
+						image->bytes_per_line, x, y, NULL);
 			}
+
+			if (blend)
+				x11_shadow_blend_cursor(subsystem);
+
+			/* refreshed areas are copied again, but unchanged */
+
+			if ((status > 0) || (blend && pointer->changed))
+				surface->version++;
 		}
 
-		ResetEvent(subsystem->updateEvent);
+		shadow_client_broadcast_update(server);
+
+		subsystem->captureFrameRate = shadow_client_capture_frame_rate(server);
 
 		region16_clear(&(subsystem->invalidRegion));
+		ZeroMemory(&(subsystem->moveRect), sizeof(RECTANGLE_16));
+
+		pointer->changed = FALSE;
 	}
 
 	if (!subsystem->use_xshm)
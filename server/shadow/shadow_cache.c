@@ -0,0 +1,363 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "shadow.h"
+
+#include "shadow_cache.h"
+#include "shadow_stats.h"
+
+/* frees the content of an entry, its event and users are kept */
+
+static void shadow_cache_entry_free(rdpShadowCacheEntry* entry)
+{
+	UINT32 index;
+	UINT32 users = entry->users;
+	BOOL filling = entry->filling;
+	HANDLE event = entry->event;
+
+	for (index = 0; index < entry->numCommands; index++)
+		free(entry->commands[index].bitmapData);
+
+	free(entry->commands);
+	free(entry->bitmaps);
+	free(entry->bitmapBuffer);
+
+	ZeroMemory(entry, sizeof(rdpShadowCacheEntry));
+
+	entry->users = users;
+	entry->filling = filling;
+	entry->event = event;
+}
+
+static BOOL shadow_cache_key_equal(const rdpShadowCacheKey* key1, const rdpShadowCacheKey* key2)
+{
+	return (key1->surface == key2->surface) && (key1->version == key2->version) &&
+			(key1->rect.left == key2->rect.left) && (key1->rect.top == key2->rect.top) &&
+			(key1->rect.right == key2->rect.right) && (key1->rect.bottom == key2->rect.bottom) &&
+			(key1->codec == key2->codec) && (key1->params == key2->params) &&
+			(key1->colorDepth == key2->colorDepth) && (key1->maxRequestSize == key2->maxRequestSize) &&
+			(key1->quality == key2->quality);
+}
+
+/**
+ * The cache lock only covers looking up and claiming entries. Encoding into
+ * an entry and sending from it happen out of the lock: a client that misses
+ * fills the entry, clients asking for the same frame at once wait for that
+ * entry instead of all encoding it, and other keys are not held up.
+ */
+
+static rdpShadowCacheEntry* shadow_cache_find(rdpShadowCache* cache, const rdpShadowCacheKey* key)
+{
+	int index;
+	rdpShadowCacheEntry* entry;
+
+	for (index = 0; index < SHADOW_CACHE_SIZE; index++)
+	{
+		entry = &(cache->entries[index]);
+
+		if (entry->purged || !(entry->complete || entry->filling))
+			continue;
+
+		if (shadow_cache_key_equal(&(entry->key), key))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* must be called with the lock held */
+
+static void shadow_cache_put(rdpShadowCacheEntry* entry)
+{
+	entry->users--;
+
+	if (!entry->users && entry->purged)
+		shadow_cache_entry_free(entry);
+}
+
+/**
+ * Returns the complete entry for the key, to be sent and released, or an
+ * entry to fill and complete. Entries of older versions of the surface can
+ * never match again and are dropped first. Returns NULL when all the entries
+ * are in use, the frame is then encoded without the cache.
+ */
+
+rdpShadowCacheEntry* shadow_cache_acquire(rdpShadowCache* cache, const rdpShadowCacheKey* key, BOOL* fill)
+{
+	int index;
+	rdpShadowCacheEntry* entry;
+	rdpShadowCacheEntry* lru = NULL;
+
+	*fill = FALSE;
+
+	EnterCriticalSection(&(cache->lock));
+
+	while ((entry = shadow_cache_find(cache, key)) != NULL)
+	{
+		entry->users++;
+
+		if (entry->complete)
+		{
+			entry->lastUse = ++(cache->useCount);
+			LeaveCriticalSection(&(cache->lock));
+
+			shadow_stats_add(&(cache->hits), 1);
+
+			return entry;
+		}
+
+		/* another client is filling it, look again once it is done */
+
+		LeaveCriticalSection(&(cache->lock));
+		WaitForSingleObject(entry->event, INFINITE);
+		EnterCriticalSection(&(cache->lock));
+
+		shadow_cache_put(entry);
+	}
+
+	for (index = 0; index < SHADOW_CACHE_SIZE; index++)
+	{
+		entry = &(cache->entries[index]);
+
+		if (entry->users)
+			continue;
+
+		if ((entry->key.surface == key->surface) &&
+				(entry->key.version != key->version))
+			shadow_cache_entry_free(entry);
+
+		if (!lru || (entry->lastUse < lru->lastUse))
+			lru = entry;
+	}
+
+	if (lru)
+	{
+		shadow_cache_entry_free(lru);
+
+		lru->key = *key;
+		lru->lastUse = ++(cache->useCount);
+		lru->filling = TRUE;
+		lru->users = 1;
+		ResetEvent(lru->event);
+
+		*fill = TRUE;
+	}
+
+	LeaveCriticalSection(&(cache->lock));
+
+	shadow_stats_add(&(cache->misses), 1);
+
+	return lru;
+}
+
+void shadow_cache_release(rdpShadowCache* cache, rdpShadowCacheEntry* entry)
+{
+	EnterCriticalSection(&(cache->lock));
+	shadow_cache_put(entry);
+	LeaveCriticalSection(&(cache->lock));
+}
+
+/* ends the filling of an entry and wakes the clients waiting for it */
+
+void shadow_cache_complete(rdpShadowCache* cache, rdpShadowCacheEntry* entry, BOOL success)
+{
+	EnterCriticalSection(&(cache->lock));
+
+	entry->filling = FALSE;
+
+	if (success && !entry->failed && !entry->purged)
+		entry->complete = TRUE;
+	else if (!entry->purged)
+		shadow_cache_entry_free(entry);
+
+	SetEvent(entry->event);
+	shadow_cache_put(entry);
+
+	LeaveCriticalSection(&(cache->lock));
+}
+
+/**
+ * Drops the entries of a surface, or all of them without one. Entries in
+ * use are freed by their last user.
+ */
+
+void shadow_cache_purge(rdpShadowCache* cache, rdpShadowSurface* surface)
+{
+	int index;
+	rdpShadowCacheEntry* entry;
+
+	EnterCriticalSection(&(cache->lock));
+
+	for (index = 0; index < SHADOW_CACHE_SIZE; index++)
+	{
+		entry = &(cache->entries[index]);
+
+		if (surface && (entry->key.surface != surface))
+			continue;
+
+		if (entry->users)
+			entry->purged = TRUE;
+		else
+			shadow_cache_entry_free(entry);
+	}
+
+	LeaveCriticalSection(&(cache->lock));
+}
+
+LONGLONG shadow_cache_hits(rdpShadowCache* cache)
+{
+	return shadow_stats_get(&(cache->hits));
+}
+
+LONGLONG shadow_cache_misses(rdpShadowCache* cache)
+{
+	return shadow_stats_get(&(cache->misses));
+}
+
+/* the content of an entry is only written by the client filling it */
+
+BOOL shadow_cache_add_command(rdpShadowCacheEntry* entry, const SURFACE_BITS_COMMAND* cmd)
+{
+	SURFACE_BITS_COMMAND* command;
+
+	if (entry->numCommands == entry->maxCommands)
+	{
+		UINT32 maxCommands = entry->maxCommands ? entry->maxCommands * 2 : 4;
+		SURFACE_BITS_COMMAND* commands;
+
+		commands = (SURFACE_BITS_COMMAND*) realloc(entry->commands, maxCommands * sizeof(SURFACE_BITS_COMMAND));
+
+		if (!commands)
+		{
+			entry->failed = TRUE;
+			return FALSE;
+		}
+
+		entry->commands = commands;
+		entry->maxCommands = maxCommands;
+	}
+
+	command = &(entry->commands[entry->numCommands]);
+	*command = *cmd;
+
+	command->bitmapData = (BYTE*) malloc(cmd->bitmapDataLength);
+
+	if (!command->bitmapData)
+	{
+		entry->failed = TRUE;
+		return FALSE;
+	}
+
+	CopyMemory(command->bitmapData, cmd->bitmapData, cmd->bitmapDataLength);
+
+	entry->numCommands++;
+	entry->size += cmd->bitmapDataLength;
+
+	return TRUE;
+}
+
+BOOL shadow_cache_set_bitmaps(rdpShadowCacheEntry* entry, const BITMAP_DATA* bitmaps, UINT32 count)
+{
+	UINT32 index;
+	UINT32 length = 0;
+	BYTE* pDstData;
+
+	for (index = 0; index < count; index++)
+		length += bitmaps[index].bitmapLength;
+
+	entry->bitmaps = (BITMAP_DATA*) calloc(count ? count : 1, sizeof(BITMAP_DATA));
+	entry->bitmapBuffer = (BYTE*) malloc(length ? length : 1);
+
+	if (!entry->bitmaps || !entry->bitmapBuffer)
+	{
+		entry->failed = TRUE;
+		return FALSE;
+	}
+
+	pDstData = entry->bitmapBuffer;
+
+	for (index = 0; index < count; index++)
+	{
+		entry->bitmaps[index] = bitmaps[index];
+		entry->bitmaps[index].bitmapDataStream = pDstData;
+
+		CopyMemory(pDstData, bitmaps[index].bitmapDataStream, bitmaps[index].bitmapLength);
+		pDstData += bitmaps[index].bitmapLength;
+	}
+
+	entry->numBitmaps = count;
+	entry->size = length;
+
+	return TRUE;
+}
+
+rdpShadowCache* shadow_cache_new(rdpShadowServer* server)
+{
+	int index;
+	rdpShadowCache* cache;
+
+	cache = (rdpShadowCache*) calloc(1, sizeof(rdpShadowCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->server = server;
+
+	for (index = 0; index < SHADOW_CACHE_SIZE; index++)
+	{
+		cache->entries[index].event = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+		if (!cache->entries[index].event)
+			goto fail;
+	}
+
+	if (!InitializeCriticalSectionAndSpinCount(&(cache->lock), 4000))
+		goto fail;
+
+	return cache;
+
+fail:
+	for (index = 0; index < SHADOW_CACHE_SIZE; index++)
+	{
+		if (cache->entries[index].event)
+			CloseHandle(cache->entries[index].event);
+	}
+
+	free(cache);
+	return NULL;
+}
+
+void shadow_cache_free(rdpShadowCache* cache)
+{
+	int index;
+
+	if (!cache)
+		return;
+
+	for (index = 0; index < SHADOW_CACHE_SIZE; index++)
+	{
+		shadow_cache_entry_free(&(cache->entries[index]));
+		CloseHandle(cache->entries[index].event);
+	}
+
+	DeleteCriticalSection(&(cache->lock));
+
+	free(cache);
+}
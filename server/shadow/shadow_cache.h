@@ -0,0 +1,119 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_CACHE_H
+#define FREERDP_SHADOW_SERVER_CACHE_H
+
+#include <freerdp/server/shadow.h>
+#include <freerdp/update.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#define SHADOW_CACHE_SIZE		8
+
+/**
+ * Full frames are sent to new clients and on refresh requests, most of the
+ * time without any change of the surface in between. The encoded output of
+ * the last full frames is kept per surface content version and encoder
+ * configuration, so that the clients sharing both are sent the same bytes
+ * without encoding them again.
+ */
+
+struct rdp_shadow_cache_key
+{
+	rdpShadowSurface* surface;
+	UINT32 version;
+	RECTANGLE_16 rect;
+	UINT32 codec;
+	UINT32 params;
+	UINT32 colorDepth;
+	UINT32 maxRequestSize;
+	int quality;
+};
+typedef struct rdp_shadow_cache_key rdpShadowCacheKey;
+
+struct rdp_shadow_cache_entry
+{
+	rdpShadowCacheKey key;
+	UINT32 lastUse;
+
+	/**
+	 * An entry is filled by the client that missed it, out of the cache lock.
+	 * Clients asking for the same key meanwhile wait for its event, and users
+	 * keeps the entry from being reused while it is filled or sent.
+	 */
+	BOOL filling;
+	BOOL complete;
+	BOOL failed;
+	BOOL purged;
+	UINT32 users;
+	HANDLE event;
+
+	/**
+	 * RemoteFX and NSCodec output, the bitmap data is owned by the entry.
+	 * RemoteFX messages are kept without the stream headers and sent with
+	 * the frame index of the client patched in.
+	 */
+	UINT32 numCommands;
+	UINT32 maxCommands;
+	SURFACE_BITS_COMMAND* commands;
+
+	/* planar and interleaved output, the bitmap data points into bitmapBuffer */
+	UINT32 numBitmaps;
+	BITMAP_DATA* bitmaps;
+	BYTE* bitmapBuffer;
+
+	UINT32 size;
+};
+typedef struct rdp_shadow_cache_entry rdpShadowCacheEntry;
+
+struct rdp_shadow_cache
+{
+	rdpShadowServer* server;
+
+	CRITICAL_SECTION lock;
+	UINT32 useCount;
+	rdpShadowCacheEntry entries[SHADOW_CACHE_SIZE];
+
+	/* full frames served from the cache and encoded, read without the lock */
+	LONGLONG hits;
+	LONGLONG misses;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+rdpShadowCacheEntry* shadow_cache_acquire(rdpShadowCache* cache, const rdpShadowCacheKey* key, BOOL* fill);
+void shadow_cache_release(rdpShadowCache* cache, rdpShadowCacheEntry* entry);
+void shadow_cache_complete(rdpShadowCache* cache, rdpShadowCacheEntry* entry, BOOL success);
+void shadow_cache_purge(rdpShadowCache* cache, rdpShadowSurface* surface);
+
+LONGLONG shadow_cache_hits(rdpShadowCache* cache);
+LONGLONG shadow_cache_misses(rdpShadowCache* cache);
+
+BOOL shadow_cache_add_command(rdpShadowCacheEntry* entry, const SURFACE_BITS_COMMAND* cmd);
+BOOL shadow_cache_set_bitmaps(rdpShadowCacheEntry* entry, const BITMAP_DATA* bitmaps, UINT32 count);
+
+rdpShadowCache* shadow_cache_new(rdpShadowServer* server);
+void shadow_cache_free(rdpShadowCache* cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_CACHE_H */
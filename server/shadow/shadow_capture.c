@@ -22,12 +22,14 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/log.h>
 
 #include "shadow_surface.h"
 
 #include "shadow_capture.h"
+#include "shadow_stats.h"
 
 #define TAG SERVER_TAG("shadow")
 
@@ -91,12 +93,10 @@ int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth, int nHeight, BY
 	BYTE *p1, *p2;
 	BOOL rows[1024];
 	BOOL cols[1024];
-	BOOL grid[1024][1024];
 
 	allEqual = TRUE;
 	FillMemory(rows, sizeof(rows), 0xFF);
 	FillMemory(cols, sizeof(cols), 0xFF);
-	FillMemory(grid, sizeof(grid), 0xFF);
 	ZeroMemory(rect, sizeof(RECTANGLE_16));
 
 	nrow = (nHeight + 15) / 16;
@@ -141,7 +141,6 @@ int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth, int nHeight, BY
 
 			if (!equal)
 			{
-				grid[ty][tx] = FALSE;
 				rows[ty] = FALSE;
 				cols[tx] = FALSE;
 
@@ -216,8 +215,580 @@ int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth, int nHeight, BY
 	return 1;
 }
 
+static void CALLBACK shadow_capture_output_work_callback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	int x, y;
+	rdpShadowCaptureOutput* output = (rdpShadowCaptureOutput*) context;
+	rdpShadowCapture* capture = output->capture;
+
+	x = output->rect.left;
+	y = output->rect.top;
+
+	output->status = shadow_capture_compare(&capture->pData1[(y * capture->nStep1) + (x * 4)], capture->nStep1,
+			output->rect.right - x, output->rect.bottom - y,
+			&capture->pData2[(y * capture->nStep2) + (x * 4)], capture->nStep2, &(output->invalidRect));
+
+	if (output->status > 0)
+	{
+		output->invalidRect.left += x;
+		output->invalidRect.top += y;
+		output->invalidRect.right += x;
+		output->invalidRect.bottom += y;
+	}
+}
+
+static void shadow_capture_free_outputs(rdpShadowCapture* capture)
+{
+	int index;
+
+	for (index = 0; index < capture->numOutputs; index++)
+	{
+		if (capture->outputs[index].work)
+			CloseThreadpoolWork(capture->outputs[index].work);
+	}
+
+	free(capture->outputs);
+	capture->outputs = NULL;
+	capture->numOutputs = 0;
+}
+
+/**
+ * Sets the monitors of the captured surface, in the coordinates of the
+ * virtual screen. The surface is at (x, y) in the virtual screen, monitors
+ * are clipped to it and the whole surface is one output if none is left.
+ */
+
+int shadow_capture_set_outputs(rdpShadowCapture* capture, MONITOR_DEF* monitors, int numMonitors,
+		int x, int y, int width, int height)
+{
+	int index;
+	int other;
+	int top;
+	int count = 0;
+	int numRects = 0;
+	RECTANGLE_16* rects;
+	RECTANGLE_16 bounds;
+	RECTANGLE_16 rect;
+	rdpShadowCaptureOutput* output;
+
+	if ((width < 1) || (height < 1) || (numMonitors < 0))
+		return -1;
+
+	rects = (RECTANGLE_16*) calloc(numMonitors + 1, sizeof(RECTANGLE_16));
+
+	if (!rects)
+		return -1;
+
+	bounds.left = 0;
+	bounds.top = 0;
+	bounds.right = width;
+	bounds.bottom = height;
+
+	for (index = 0; index < numMonitors; index++)
+	{
+		rect.left = (monitors[index].left < x) ? 0 : monitors[index].left - x;
+		rect.top = (monitors[index].top < y) ? 0 : monitors[index].top - y;
+		rect.right = (monitors[index].right < x) ? 0 : monitors[index].right - x;
+		rect.bottom = (monitors[index].bottom < y) ? 0 : monitors[index].bottom - y;
+
+		if (!rectangles_intersection(&rect, &bounds, &rects[numRects]))
+			continue;
+
+		/* mirrored monitors are compared once */
+
+		for (other = 0; other < numRects; other++)
+		{
+			if (rectangles_equal(&rects[other], &rects[numRects]))
+				break;
+		}
+
+		if (other == numRects)
+			numRects++;
+	}
+
+	if (!numRects)
+		rects[numRects++] = bounds;
+
+	for (index = 0; index < numRects; index++)
+	{
+		count += (rects[index].bottom - rects[index].top + SHADOW_CAPTURE_STRIPE_HEIGHT - 1) /
+				SHADOW_CAPTURE_STRIPE_HEIGHT;
+	}
+
+	EnterCriticalSection(&(capture->lock));
+
+	shadow_capture_free_outputs(capture);
+
+	capture->outputs = (rdpShadowCaptureOutput*) calloc(count, sizeof(rdpShadowCaptureOutput));
+
+	if (!capture->outputs)
+	{
+		LeaveCriticalSection(&(capture->lock));
+		free(rects);
+		return -1;
+	}
+
+	capture->numOutputs = count;
+	output = capture->outputs;
+
+	for (index = 0; index < numRects; index++)
+	{
+		for (top = rects[index].top; top < rects[index].bottom; top += SHADOW_CAPTURE_STRIPE_HEIGHT)
+		{
+			output->capture = capture;
+			output->rect.left = rects[index].left;
+			output->rect.top = top;
+			output->rect.right = rects[index].right;
+			output->rect.bottom = ((top + SHADOW_CAPTURE_STRIPE_HEIGHT) < rects[index].bottom) ?
+					top + SHADOW_CAPTURE_STRIPE_HEIGHT : rects[index].bottom;
+
+			if (capture->pool && (count > 1))
+			{
+				output->work = CreateThreadpoolWork((PTP_WORK_CALLBACK) shadow_capture_output_work_callback,
+						(void*) output, &(capture->environment));
+
+				if (!output->work)
+				{
+					shadow_capture_free_outputs(capture);
+					LeaveCriticalSection(&(capture->lock));
+					free(rects);
+					return -1;
+				}
+			}
+
+			output++;
+		}
+	}
+
+	capture->width = width;
+	capture->height = height;
+
+	LeaveCriticalSection(&(capture->lock));
+
+	free(rects);
+
+	return count;
+}
+
+/**
+ * Compares all outputs and adds the damaged area of each one to the
+ * invalid region. Returns 1 if anything changed, 0 otherwise.
+ */
+
+int shadow_capture_compare_outputs(rdpShadowCapture* capture, BYTE* pData1, int nStep1,
+		BYTE* pData2, int nStep2, REGION16* invalidRegion)
+{
+	int index;
+	int status = 0;
+	UINT64 startTime;
+	rdpShadowCaptureOutput* output;
+
+	startTime = shadow_stats_timestamp();
+
+	EnterCriticalSection(&(capture->lock));
+
+	capture->pData1 = pData1;
+	capture->nStep1 = nStep1;
+	capture->pData2 = pData2;
+	capture->nStep2 = nStep2;
+
+	for (index = 0; index < capture->numOutputs; index++)
+	{
+		output = &(capture->outputs[index]);
+
+		if (output->work)
+			SubmitThreadpoolWork(output->work);
+		else
+			shadow_capture_output_work_callback(NULL, (void*) output, NULL);
+	}
+
+	for (index = 0; index < capture->numOutputs; index++)
+	{
+		output = &(capture->outputs[index]);
+
+		if (output->work)
+			WaitForThreadpoolWorkCallbacks(output->work, FALSE);
+
+		if (output->status > 0)
+		{
+			region16_union_rect(invalidRegion, invalidRegion, &(output->invalidRect));
+			status = 1;
+		}
+	}
+
+	LeaveCriticalSection(&(capture->lock));
+
+	shadow_stats_compare(capture->server, startTime);
+
+	return status;
+}
+
+/**
+ * Move detection: lines (rows for vertical moves, columns for horizontal
+ * moves) are hashed in bands of SHADOW_CAPTURE_MOVE_BAND pixels. Lines of
+ * the new frame vote for the offset of the line of the old frame with the
+ * same hash, if that hash is unique within the band of the old frame. The
+ * largest block of bands and lines matching at the best offset is the move.
+ */
+
+static void shadow_capture_hash_lines(BYTE* pData, int nStep, const RECTANGLE_16* rect,
+		BOOL vertical, UINT32* hashes, int numLines, int numBands)
+{
+	int x, y;
+	int band;
+	UINT32 hash;
+	UINT32* pixel;
+	UINT32* bandHashes;
+
+	for (x = 0; x < (numLines * numBands); x++)
+		hashes[x] = 2166136261U;
+
+	for (y = rect->top; y < rect->bottom; y++)
+	{
+		pixel = (UINT32*) &pData[(y * nStep) + (rect->left * 4)];
+
+		if (vertical)
+		{
+			/* one line per row, bands of columns */
+
+			for (x = rect->left; x < rect->right; x++)
+			{
+				band = (x - rect->left) / SHADOW_CAPTURE_MOVE_BAND;
+				hash = hashes[(band * numLines) + (y - rect->top)];
+				hashes[(band * numLines) + (y - rect->top)] = (hash ^ (*pixel++)) * 16777619;
+			}
+		}
+		else
+		{
+			/* one line per column, bands of rows */
+
+			band = (y - rect->top) / SHADOW_CAPTURE_MOVE_BAND;
+			bandHashes = &hashes[band * numLines];
+
+			for (x = 0; x < numLines; x++)
+				bandHashes[x] = (bandHashes[x] ^ (*pixel++)) * 16777619;
+		}
+	}
+}
+
+static int shadow_capture_compare_hashes(const void* a, const void* b)
+{
+	UINT64 ha = *((const UINT64*) a);
+	UINT64 hb = *((const UINT64*) b);
+
+	return (ha < hb) ? -1 : ((ha > hb) ? 1 : 0);
+}
+
+static int shadow_capture_match_lines(const UINT32* oldHashes, const UINT32* newHashes,
+		int numLines, int numBands, int* pDelta, int* pBand0, int* pBand1, int* pLine0, int* pLine1)
+{
+	int i, j, d;
+	int band;
+	int bestDelta = 0;
+	int line0, line1;
+	int lo, hi, mid;
+	int* votes;
+	int* runStart;
+	int* runEnd;
+	UINT64* sorted;
+	const UINT32* oldLines;
+	const UINT32* newLines;
+	int status = 0;
+
+	votes = (int*) calloc((2 * numLines) + 1, sizeof(int));
+	runStart = (int*) calloc(numBands, sizeof(int));
+	runEnd = (int*) calloc(numBands, sizeof(int));
+	sorted = (UINT64*) malloc(numLines * sizeof(UINT64));
+
+	if (!votes || !runStart || !runEnd || !sorted)
+		goto out;
+
+	for (band = 0; band < numBands; band++)
+	{
+		oldLines = &oldHashes[band * numLines];
+		newLines = &newHashes[band * numLines];
+
+		for (i = 0; i < numLines; i++)
+			sorted[i] = (((UINT64) oldLines[i]) << 32) | (UINT64) i;
+
+		qsort(sorted, numLines, sizeof(UINT64), shadow_capture_compare_hashes);
+
+		for (i = 0; i < numLines; i++)
+		{
+			if (newLines[i] == oldLines[i])
+				continue;
+
+			lo = 0;
+			hi = numLines;
+
+			while (lo < hi)
+			{
+				mid = (lo + hi) / 2;
+
+				if ((UINT32) (sorted[mid] >> 32) < newLines[i])
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			if ((lo >= numLines) || ((UINT32) (sorted[lo] >> 32) != newLines[i]))
+				continue;
+
+			if (((lo + 1) < numLines) && ((UINT32) (sorted[lo + 1] >> 32) == newLines[i]))
+				continue;
+
+			j = (int) (sorted[lo] & 0xFFFFFFFF);
+			votes[(i - j) + numLines]++;
+		}
+	}
+
+	for (d = 0; d <= (2 * numLines); d++)
+	{
+		if ((d != numLines) && (votes[d] > votes[bestDelta + numLines]))
+			bestDelta = d - numLines;
+	}
+
+	if (!bestDelta || (votes[bestDelta + numLines] < SHADOW_CAPTURE_MOVE_VOTES))
+		goto out;
+
+	/* longest run of matching lines of each band */
+
+	for (band = 0; band < numBands; band++)
+	{
+		oldLines = &oldHashes[band * numLines];
+		newLines = &newHashes[band * numLines];
+
+		i = (bestDelta > 0) ? bestDelta : 0;
+
+		while (i < numLines)
+		{
+			if (((i - bestDelta) >= numLines) || (newLines[i] != oldLines[i - bestDelta]))
+			{
+				i++;
+				continue;
+			}
+
+			for (j = i; (j < numLines) && ((j - bestDelta) < numLines) &&
+					(newLines[j] == oldLines[j - bestDelta]); j++);
+
+			if ((j - i) > (runEnd[band] - runStart[band]))
+			{
+				runStart[band] = i;
+				runEnd[band] = j;
+			}
+
+			i = j;
+		}
+	}
+
+	/* grow the longest run over the neighbouring bands, as long as the area grows */
+
+	j = 0;
+
+	for (band = 1; band < numBands; band++)
+	{
+		if ((runEnd[band] - runStart[band]) > (runEnd[j] - runStart[j]))
+			j = band;
+	}
+
+	line0 = runStart[j];
+	line1 = runEnd[j];
+
+	if ((line1 - line0) < SHADOW_CAPTURE_MOVE_MIN)
+		goto out;
+
+	*pBand0 = *pBand1 = j;
+
+	for (band = j - 1; band >= 0; band--)
+	{
+		lo = (runStart[band] > line0) ? runStart[band] : line0;
+		hi = (runEnd[band] < line1) ? runEnd[band] : line1;
+
+		if (((hi - lo) < SHADOW_CAPTURE_MOVE_MIN) ||
+				(((*pBand1 - *pBand0 + 2) * (hi - lo)) < ((*pBand1 - *pBand0 + 1) * (line1 - line0))))
+			break;
+
+		line0 = lo;
+		line1 = hi;
+		*pBand0 = band;
+	}
+
+	for (band = j + 1; band < numBands; band++)
+	{
+		lo = (runStart[band] > line0) ? runStart[band] : line0;
+		hi = (runEnd[band] < line1) ? runEnd[band] : line1;
+
+		if (((hi - lo) < SHADOW_CAPTURE_MOVE_MIN) ||
+				(((*pBand1 - *pBand0 + 2) * (hi - lo)) < ((*pBand1 - *pBand0 + 1) * (line1 - line0))))
+			break;
+
+		line0 = lo;
+		line1 = hi;
+		*pBand1 = band;
+	}
+
+	*pDelta = bestDelta;
+	*pLine0 = line0;
+	*pLine1 = line1;
+
+	status = 1;
+
+out:
+	free(votes);
+	free(runStart);
+	free(runEnd);
+	free(sorted);
+
+	return status;
+}
+
+/**
+ * Detects a vertical or horizontal block move within rect between the old
+ * frame (pData1) and the new frame (pData2). On success, moveRect is the
+ * destination of the move in the new frame, which is the same as the area
+ * of the old frame offset by -dx, -dy.
+ */
+
+int shadow_capture_detect_move(BYTE* pData1, int nStep1, BYTE* pData2, int nStep2,
+		const RECTANGLE_16* rect, RECTANGLE_16* moveRect, int* dx, int* dy)
+{
+	int y;
+	int status;
+	int vertical;
+	int numLines;
+	int numBands;
+	int delta = 0;
+	int band0 = 0, band1 = 0;
+	int line0 = 0, line1 = 0;
+	int width, height;
+	UINT32* oldHashes;
+	UINT32* newHashes;
+
+	*dx = *dy = 0;
+	ZeroMemory(moveRect, sizeof(RECTANGLE_16));
+
+	width = rect->right - rect->left;
+	height = rect->bottom - rect->top;
+
+	if ((width < SHADOW_CAPTURE_MOVE_MIN) || (height < SHADOW_CAPTURE_MOVE_MIN))
+		return 0;
+
+	/* scrolling is mostly vertical, try it first */
+
+	for (vertical = 1; vertical >= 0; vertical--)
+	{
+		numLines = vertical ? height : width;
+		numBands = ((vertical ? width : height) + (SHADOW_CAPTURE_MOVE_BAND - 1)) / SHADOW_CAPTURE_MOVE_BAND;
+
+		oldHashes = (UINT32*) malloc(numLines * numBands * sizeof(UINT32));
+		newHashes = (UINT32*) malloc(numLines * numBands * sizeof(UINT32));
+
+		if (!oldHashes || !newHashes)
+		{
+			free(oldHashes);
+			free(newHashes);
+			return -1;
+		}
+
+		shadow_capture_hash_lines(pData1, nStep1, rect, vertical, oldHashes, numLines, numBands);
+		shadow_capture_hash_lines(pData2, nStep2, rect, vertical, newHashes, numLines, numBands);
+
+		status = shadow_capture_match_lines(oldHashes, newHashes, numLines, numBands,
+				&delta, &band0, &band1, &line0, &line1);
+
+		free(oldHashes);
+		free(newHashes);
+
+		if (status > 0)
+			break;
+	}
+
+	if (vertical < 0)
+		return 0;
+
+	if (vertical)
+	{
+		moveRect->left = rect->left + (band0 * SHADOW_CAPTURE_MOVE_BAND);
+		moveRect->right = rect->left + ((band1 + 1) * SHADOW_CAPTURE_MOVE_BAND);
+		moveRect->top = rect->top + line0;
+		moveRect->bottom = rect->top + line1;
+		*dy = delta;
+	}
+	else
+	{
+		moveRect->left = rect->left + line0;
+		moveRect->right = rect->left + line1;
+		moveRect->top = rect->top + (band0 * SHADOW_CAPTURE_MOVE_BAND);
+		moveRect->bottom = rect->top + ((band1 + 1) * SHADOW_CAPTURE_MOVE_BAND);
+		*dx = delta;
+	}
+
+	if (moveRect->right > rect->right)
+		moveRect->right = rect->right;
+
+	if (moveRect->bottom > rect->bottom)
+		moveRect->bottom = rect->bottom;
+
+	/* hashes may collide */
+
+	width = (moveRect->right - moveRect->left) * 4;
+
+	for (y = moveRect->top; y < moveRect->bottom; y++)
+	{
+		if (memcmp(&pData2[(y * nStep2) + (moveRect->left * 4)],
+				&pData1[((y - *dy) * nStep1) + ((moveRect->left - *dx) * 4)], width) != 0)
+		{
+			*dx = *dy = 0;
+			ZeroMemory(moveRect, sizeof(RECTANGLE_16));
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Detects moves within each rectangle of a damaged region, so that a scroll
+ * on one monitor is found while other monitors change. The largest move wins.
+ */
+
+int shadow_capture_detect_region_move(BYTE* pData1, int nStep1, BYTE* pData2, int nStep2,
+		REGION16* region, RECTANGLE_16* moveRect, int* dx, int* dy)
+{
+	int index;
+	int numRects;
+	int moveX, moveY;
+	int area, bestArea = 0;
+	RECTANGLE_16 rect;
+	const RECTANGLE_16* rects;
+
+	*dx = *dy = 0;
+	ZeroMemory(moveRect, sizeof(RECTANGLE_16));
+
+	rects = region16_rects(region, &numRects);
+
+	for (index = 0; index < numRects; index++)
+	{
+		if (shadow_capture_detect_move(pData1, nStep1, pData2, nStep2, &rects[index], &rect, &moveX, &moveY) < 1)
+			continue;
+
+		area = (rect.right - rect.left) * (rect.bottom - rect.top);
+
+		if (area > bestArea)
+		{
+			bestArea = area;
+			*moveRect = rect;
+			*dx = moveX;
+			*dy = moveY;
+		}
+	}
+
+	return (bestArea > 0) ? 1 : 0;
+}
+
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
 {
+	SYSTEM_INFO sysinfo;
 	rdpShadowCapture* capture;
 
 	capture = (rdpShadowCapture*) calloc(1, sizeof(rdpShadowCapture));
@@ -230,6 +801,22 @@ rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
 	if (!InitializeCriticalSectionAndSpinCount(&(capture->lock), 4000))
 		return NULL;
 
+	GetNativeSystemInfo(&sysinfo);
+
+	/* the capture thread waits for the workers, a single processor compares inline */
+
+	if (sysinfo.dwNumberOfProcessors > 1)
+	{
+		capture->pool = CreateThreadpool(NULL);
+
+		if (capture->pool)
+		{
+			InitializeThreadpoolEnvironment(&(capture->environment));
+			SetThreadpoolCallbackPool(&(capture->environment), capture->pool);
+			SetThreadpoolThreadMaximum(capture->pool, sysinfo.dwNumberOfProcessors);
+		}
+	}
+
 	return capture;
 }
 
@@ -238,6 +825,14 @@ void shadow_capture_free(rdpShadowCapture* capture)
 	if (!capture)
 		return;
 
+	shadow_capture_free_outputs(capture);
+
+	if (capture->pool)
+	{
+		CloseThreadpool(capture->pool);
+		DestroyThreadpoolEnvironment(&(capture->environment));
+	}
+
 	DeleteCriticalSection(&(capture->lock));
 
 	free(capture);
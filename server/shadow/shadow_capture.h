@@ -23,6 +23,30 @@
 
 #include <winpr/crt.h>
 #include <winpr/synch.h>
+#include <winpr/pool.h>
+
+#define SHADOW_CAPTURE_MOVE_BAND		64
+#define SHADOW_CAPTURE_MOVE_MIN			32
+#define SHADOW_CAPTURE_MOVE_VOTES		8
+
+#define SHADOW_CAPTURE_STRIPE_HEIGHT		256
+
+/**
+ * Each monitor is split into horizontal stripes which are compared
+ * in parallel, so that the damage of a frame is found per monitor
+ * and the compare of large or multiple monitors scales across cores.
+ */
+
+struct rdp_shadow_capture_output
+{
+	rdpShadowCapture* capture;
+
+	PTP_WORK work;
+	RECTANGLE_16 rect;
+	RECTANGLE_16 invalidRect;
+	int status;
+};
+typedef struct rdp_shadow_capture_output rdpShadowCaptureOutput;
 
 struct rdp_shadow_capture
 {
@@ -31,6 +55,17 @@ struct rdp_shadow_capture
 	int width;
 	int height;
 
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+
+	int numOutputs;
+	rdpShadowCaptureOutput* outputs;
+
+	BYTE* pData1;
+	int nStep1;
+	BYTE* pData2;
+	int nStep2;
+
 	CRITICAL_SECTION lock;
 };
 
@@ -40,6 +75,14 @@ extern "C" {
 
 int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip);
 int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth, int nHeight, BYTE* pData2, int nStep2, RECTANGLE_16* rect);
+int shadow_capture_set_outputs(rdpShadowCapture* capture, MONITOR_DEF* monitors, int numMonitors,
+		int x, int y, int width, int height);
+int shadow_capture_compare_outputs(rdpShadowCapture* capture, BYTE* pData1, int nStep1,
+		BYTE* pData2, int nStep2, REGION16* invalidRegion);
+int shadow_capture_detect_move(BYTE* pData1, int nStep1, BYTE* pData2, int nStep2,
+		const RECTANGLE_16* rect, RECTANGLE_16* moveRect, int* dx, int* dy);
+int shadow_capture_detect_region_move(BYTE* pData1, int nStep1, BYTE* pData2, int nStep2,
+		REGION16* region, RECTANGLE_16* moveRect, int* dx, int* dy);
 
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server);
 void shadow_capture_free(rdpShadowCapture* capture);
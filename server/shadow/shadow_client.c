@@ -26,6 +26,7 @@
 #include <winpr/synch.h>
 #include <winpr/thread.h>
 #include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 
 #include <freerdp/log.h>
 
@@ -33,6 +34,17 @@
 
 #define TAG CLIENT_TAG("shadow")
 
+static void shadow_client_update_done(rdpShadowClient* client)
+{
+	rdpShadowSubsystem* subsystem = client->subsystem;
+
+	if (!InterlockedExchange(&(client->updatePending), 0))
+		return;
+
+	if (InterlockedDecrement(&(subsystem->updatePending)) == 0)
+		SetEvent(subsystem->updateDoneEvent);
+}
+
 void shadow_client_context_new(freerdp_peer* peer, rdpShadowClient* client)
 {
 	rdpSettings* settings;
@@ -60,6 +72,13 @@ void shadow_client_context_new(freerdp_peer* peer, rdpShadowClient* client)
 	settings->TlsSecurity = TRUE;
 	settings->NlaSecurity = FALSE;
 
+	/**
+	 * Output is queued in the transport and drained by the server loop, so
+	 * that a congested client does not hold the thread handling its input.
+	 * The encoder skips frames while too much of it is queued.
+	 */
+	settings->WaitForOutputBufferFlush = FALSE;
+
 	settings->CertificateFile = _strdup(server->CertificateFile);
 	settings->PrivateKeyFile = _strdup(server->PrivateKeyFile);
 
@@ -68,6 +87,8 @@ void shadow_client_context_new(freerdp_peer* peer, rdpShadowClient* client)
 	client->inLobby = TRUE;
 	client->mayView = server->mayView;
 	client->mayInteract = server->mayInteract;
+	client->shareSubRect = server->shareSubRect;
+	client->subRect = server->subRect;
 
 	InitializeCriticalSectionAndSpinCount(&(client->lock), 4000);
 
@@ -76,8 +97,10 @@ void shadow_client_context_new(freerdp_peer* peer, rdpShadowClient* client)
 	client->vcm = WTSOpenServerA((LPSTR) peer->context);
 
 	client->StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	client->UpdateEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 	client->encoder = shadow_encoder_new(client);
+	client->stats = shadow_client_stats_new(server);
 
 	ArrayList_Add(server->clients, (void*) client);
 }
@@ -88,6 +111,9 @@ void shadow_client_context_free(freerdp_peer* peer, rdpShadowClient* client)
 
 	ArrayList_Remove(server->clients, (void*) client);
 
+	/* the client no longer takes part in updates, but may owe the current one */
+	shadow_client_update_done(client);
+
 	DeleteCriticalSection(&(client->lock));
 
 	region16_uninit(&(client->invalidRegion));
@@ -95,18 +121,29 @@ void shadow_client_context_free(freerdp_peer* peer, rdpShadowClient* client)
 	WTSCloseServer((HANDLE) client->vcm);
 
 	CloseHandle(client->StopEvent);
+	CloseHandle(client->UpdateEvent);
 
-	if (client->lobby)
-	{
-		shadow_surface_free(client->lobby);
-		client->lobby = NULL;
-	}
+	shadow_client_uninit_lobby(client);
 
 	if (client->encoder)
 	{
 		shadow_encoder_free(client->encoder);
 		client->encoder = NULL;
 	}
+
+	if (client->pointerCache)
+	{
+		shadow_pointer_cache_free(client->pointerCache);
+		client->pointerCache = NULL;
+	}
+
+	/* the admin endpoint reads the counters of listed clients only */
+
+	if (client->stats)
+	{
+		shadow_client_stats_free(client->stats);
+		client->stats = NULL;
+	}
 }
 
 void shadow_client_message_free(wMessage* message)
@@ -145,15 +182,15 @@ BOOL shadow_client_post_connect(freerdp_peer* peer)
 	server = client->server;
 	subsystem = server->subsystem;
 
-	if (!server->shareSubRect)
+	if (!client->shareSubRect)
 	{
 		width = server->screen->width;
 		height = server->screen->height;
 	}
 	else
 	{
-		width = server->subRect.right - server->subRect.left;
-		height = server->subRect.bottom - server->subRect.top;
+		width = client->subRect.right - client->subRect.left;
+		height = client->subRect.bottom - client->subRect.top;
 	}
 
 	settings->DesktopWidth = width;
@@ -174,6 +211,14 @@ BOOL shadow_client_post_connect(freerdp_peer* peer)
 	invalidRect.right = width;
 	invalidRect.bottom = height;
 
+	if (client->shareSubRect)
+	{
+		invalidRect.left += client->subRect.left;
+		invalidRect.top += client->subRect.top;
+		invalidRect.right += client->subRect.left;
+		invalidRect.bottom += client->subRect.top;
+	}
+
 	region16_union_rect(&(client->invalidRegion), &(client->invalidRegion), &invalidRect);
 
 	shadow_client_init_lobby(client);
@@ -206,6 +251,7 @@ BOOL shadow_client_post_connect(freerdp_peer* peer)
 
 void shadow_client_refresh_rect(rdpShadowClient* client, BYTE count, RECTANGLE_16* areas)
 {
+	UINT32 index;
 	wMessage message = { 0 };
 	SHADOW_MSG_IN_REFRESH_OUTPUT* wParam;
 	wMessagePipe* MsgPipe = client->subsystem->MsgPipe;
@@ -227,6 +273,17 @@ void shadow_client_refresh_rect(rdpShadowClient* client, BYTE count, RECTANGLE_1
 
 	CopyMemory(wParam->rects, areas, wParam->numRects * sizeof(RECTANGLE_16));
 
+	if (client->shareSubRect)
+	{
+		for (index = 0; index < wParam->numRects; index++)
+		{
+			wParam->rects[index].left += client->subRect.left;
+			wParam->rects[index].top += client->subRect.top;
+			wParam->rects[index].right += client->subRect.left;
+			wParam->rects[index].bottom += client->subRect.top;
+		}
+	}
+
 	message.id = SHADOW_MSG_IN_REFRESH_OUTPUT_ID;
 	message.wParam = (void*) wParam;
 	message.lParam = NULL;
@@ -278,6 +335,16 @@ BOOL shadow_client_activate(freerdp_peer* peer)
 		settings->SurfaceFrameMarkerEnabled = FALSE;
 	}
 
+	/* clients without a pointer cache get the cursor blended into the surface */
+
+	shadow_pointer_cache_free(client->pointerCache);
+	client->pointerCache = shadow_pointer_cache_new(settings->PointerCacheSize);
+
+	client->pointerUpdates = (client->pointerCache && settings->PointerCacheSize) ? TRUE : FALSE;
+	client->pointerId = 0;
+	client->pointerX = client->server->pointer->x;
+	client->pointerY = client->server->pointer->y;
+
 	client->activated = TRUE;
 	client->inLobby = client->mayView ? FALSE : TRUE;
 
@@ -290,17 +357,7 @@ BOOL shadow_client_activate(freerdp_peer* peer)
 
 void shadow_client_surface_frame_acknowledge(rdpShadowClient* client, UINT32 frameId)
 {
-	SURFACE_FRAME* frame;
-	wListDictionary* frameList;
-
-	frameList = client->encoder->frameList;
-	frame = (SURFACE_FRAME*) ListDictionary_GetItemValue(frameList, (void*) (size_t) frameId);
-
-	if (frame)
-	{
-		ListDictionary_Remove(frameList, (void*) (size_t) frameId);
-		free(frame);
-	}
+	shadow_encoder_frame_acknowledge(client->encoder, frameId);
 }
 
 int shadow_client_send_surface_frame_marker(rdpShadowClient* client, UINT32 action, UINT32 id)
@@ -317,12 +374,14 @@ int shadow_client_send_surface_frame_marker(rdpShadowClient* client, UINT32 acti
 	return 1;
 }
 
-int shadow_client_send_surface_bits(rdpShadowClient* client, rdpShadowSurface* surface, int nXSrc, int nYSrc, int nWidth, int nHeight)
+int shadow_client_send_surface_bits(rdpShadowClient* client, rdpShadowSurface* surface,
+		int nXSrc, int nYSrc, int nWidth, int nHeight, rdpShadowCacheEntry* entry)
 {
 	int i;
 	BOOL first;
 	BOOL last;
 	wStream* s;
+	size_t offset;
 	int nSrcStep;
 	BYTE* pSrcData;
 	int numMessages;
@@ -333,6 +392,7 @@ int shadow_client_send_surface_bits(rdpShadowClient* client, rdpShadowSurface* s
 	rdpShadowServer* server;
 	rdpShadowEncoder* encoder;
 	SURFACE_BITS_COMMAND cmd;
+	SURFACE_BITS_COMMAND cached;
 
 	context = (rdpContext*) client;
 	update = context->update;
@@ -344,15 +404,15 @@ int shadow_client_send_surface_bits(rdpShadowClient* client, rdpShadowSurface* s
 	pSrcData = surface->data;
 	nSrcStep = surface->scanline;
 
-	if (server->shareSubRect)
+	if (client->shareSubRect)
 	{
 		int subX, subY;
 		int subWidth, subHeight;
 
-		subX = server->subRect.left;
-		subY = server->subRect.top;
-		subWidth = server->subRect.right - server->subRect.left;
-		subHeight = server->subRect.bottom - server->subRect.top;
+		subX = client->subRect.left;
+		subY = client->subRect.top;
+		subWidth = client->subRect.right - client->subRect.left;
+		subHeight = client->subRect.bottom - client->subRect.top;
 
 		nXSrc -= subX;
 		nYSrc -= subY;
@@ -369,6 +429,18 @@ int shadow_client_send_surface_bits(rdpShadowClient* client, rdpShadowSurface* s
 
 		shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX);
 
+		if (client->inLobby)
+		{
+			rfx_context_set_quantization_index(encoder->rfx, 0, 0, 0);
+			rfx_context_set_tile_quantization(encoder->rfx, NULL, 0, 0);
+		}
+		else
+		{
+			rfx_context_set_quantization_index(encoder->rfx, encoder->quality, encoder->quality, encoder->quality);
+			rfx_context_set_tile_quantization(encoder->rfx, encoder->tileQuant,
+					encoder->gridWidth, encoder->gridHeight);
+		}
+
 		s = encoder->bs;
 
 		rect.x = nXSrc;
@@ -391,24 +463,55 @@ int shadow_client_send_surface_bits(rdpShadowClient* client, rdpShadowSurface* s
 		cmd.width = surface->width;
 		cmd.height = surface->height;
 
+		/* batch the messages of a frame into as few fastpath updates as possible */
+
+		if (!encoder->frameAck)
+			IFCALL(update->BeginPaint, context);
+
 		for (i = 0; i < numMessages; i++)
 		{
 			Stream_SetPosition(s, 0);
+
+			/* the stream headers are written apart, they are not part of cached messages */
+
+			if (encoder->rfx->state == RFX_STATE_SEND_HEADERS)
+			{
+				rfx_compose_message_header(encoder->rfx, s);
+				encoder->rfx->state = RFX_STATE_SEND_FRAME_DATA;
+			}
+
+			offset = Stream_GetPosition(s);
+
 			rfx_write_message(encoder->rfx, s, &messages[i]);
 			rfx_message_free(encoder->rfx, &messages[i]);
 
 			cmd.bitmapDataLength = Stream_GetPosition(s);
 			cmd.bitmapData = Stream_Buffer(s);
 
+			if (entry)
+			{
+				cached = cmd;
+				cached.bitmapData += offset;
+				cached.bitmapDataLength -= offset;
+
+				if (!shadow_cache_add_command(entry, &cached))
+					entry = NULL;
+			}
+
 			first = (i == 0) ? TRUE : FALSE;
 			last = ((i + 1) == numMessages) ? TRUE : FALSE;
 
+			encoder->encodedBytes += cmd.bitmapDataLength;
+
 			if (!encoder->frameAck)
 				IFCALL(update->SurfaceBits, update->context, &cmd);
 			else
 				IFCALL(update->SurfaceFrameBits, update->context, &cmd, first, last, frameId);
 		}
 
+		if (!encoder->frameAck)
+			IFCALL(update->EndPaint, context);
+
 		free(messages);
 	}
 	else if (settings->NSCodec)
@@ -437,6 +540,11 @@ int shadow_client_send_surface_bits(rdpShadowClient* client, rdpShadowSurface* s
 		first = TRUE;
 		last = TRUE;
 
+		if (entry && !shadow_cache_add_command(entry, &cmd))
+			entry = NULL;
+
+		encoder->encodedBytes += cmd.bitmapDataLength;
+
 		if (!encoder->frameAck)
 			IFCALL(update->SurfaceBits, update->context, &cmd);
 		else
@@ -446,7 +554,8 @@ int shadow_client_send_surface_bits(rdpShadowClient* client, rdpShadowSurface* s
 	return 1;
 }
 
-int shadow_client_send_bitmap_update(rdpShadowClient* client, rdpShadowSurface* surface, int nXSrc, int nYSrc, int nWidth, int nHeight)
+int shadow_client_send_bitmap_update(rdpShadowClient* client, rdpShadowSurface* surface,
+		int nXSrc, int nYSrc, int nWidth, int nHeight, rdpShadowCacheEntry* entry)
 {
 	BYTE* data;
 	BYTE* buffer;
@@ -486,6 +595,13 @@ int shadow_client_send_bitmap_update(rdpShadowClient* client, rdpShadowSurface*
 	nSrcStep = surface->scanline;
 	SrcFormat = PIXEL_FORMAT_RGB32;
 
+	if (client->shareSubRect)
+	{
+		nXSrc -= client->subRect.left;
+		nYSrc -= client->subRect.top;
+		pSrcData = &pSrcData[(client->subRect.top * nSrcStep) + (client->subRect.left * 4)];
+	}
+
 	if ((nXSrc % 4) != 0)
 	{
 		nWidth += (nXSrc % 4);
@@ -598,6 +714,11 @@ int shadow_client_send_bitmap_update(rdpShadowClient* client, rdpShadowSurface*
 		fprintf(stderr, "update size estimate larger than maximum update size\n");
 	}
 
+	if (entry)
+		shadow_cache_set_bitmaps(entry, bitmapData, k);
+
+	encoder->encodedBytes += totalBitmapSize;
+
 	IFCALL(update->BitmapUpdate, context, &bitmapUpdate);
 
 	free(bitmapData);
@@ -605,9 +726,168 @@ int shadow_client_send_bitmap_update(rdpShadowClient* client, rdpShadowSurface*
 	return 1;
 }
 
+/**
+ * Full frames are the same for all the clients sharing the version of the
+ * surface and the encoder configuration, except for RemoteFX tiles sent at
+ * a quality of their own.
+ */
+
+static BOOL shadow_client_cache_key(rdpShadowClient* client, rdpShadowSurface* surface,
+		REGION16* invalidRegion, const RECTANGLE_16* surfaceRect, rdpShadowCacheKey* key)
+{
+	int index;
+	int numRects;
+	const RECTANGLE_16* rects;
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings = context->settings;
+	rdpShadowEncoder* encoder = client->encoder;
+
+	rects = region16_rects(invalidRegion, &numRects);
+
+	if ((numRects != 1) || (rects[0].left != surfaceRect->left) || (rects[0].top != surfaceRect->top) ||
+			(rects[0].right != surfaceRect->right) || (rects[0].bottom != surfaceRect->bottom))
+		return FALSE;
+
+	ZeroMemory(key, sizeof(rdpShadowCacheKey));
+
+	key->surface = surface;
+	key->version = surface->version;
+	key->rect = *surfaceRect;
+	key->colorDepth = settings->ColorDepth;
+	key->maxRequestSize = settings->MultifragMaxRequestSize;
+
+	if (settings->RemoteFxCodec)
+	{
+		key->codec = FREERDP_CODEC_REMOTEFX;
+		key->quality = client->inLobby ? 0 : encoder->quality;
+
+		if (!client->inLobby && encoder->tileQuant)
+		{
+			for (index = 0; index < (encoder->gridWidth * encoder->gridHeight); index++)
+			{
+				if (encoder->tileQuant[index] != encoder->quality)
+					return FALSE;
+			}
+		}
+	}
+	else if (settings->NSCodec)
+	{
+		key->codec = FREERDP_CODEC_NSCODEC;
+		key->params = settings->NSCodecColorLossLevel |
+				(settings->NSCodecAllowSubsampling ? 0x100 : 0) |
+				(settings->NSCodecAllowDynamicColorFidelity ? 0x200 : 0);
+	}
+	else
+	{
+		key->codec = (settings->ColorDepth < 32) ? FREERDP_CODEC_INTERLEAVED : FREERDP_CODEC_PLANAR;
+		key->params = settings->DrawAllowSkipAlpha ? 1 : 0;
+	}
+
+	return TRUE;
+}
+
+static int shadow_client_send_cached(rdpShadowClient* client, rdpShadowCacheEntry* entry)
+{
+	UINT32 i;
+	BOOL first;
+	BOOL last;
+	wStream* s;
+	size_t offset;
+	size_t length;
+	UINT32 frameId = 0;
+	rdpUpdate* update;
+	rdpContext* context;
+	rdpSettings* settings;
+	rdpShadowEncoder* encoder;
+	SURFACE_BITS_COMMAND cmd;
+	BITMAP_UPDATE bitmapUpdate;
+
+	context = (rdpContext*) client;
+	update = context->update;
+	settings = context->settings;
+	encoder = client->encoder;
+
+	shadow_encoder_prepare(encoder, entry->key.codec);
+
+	if ((entry->key.codec == FREERDP_CODEC_PLANAR) || (entry->key.codec == FREERDP_CODEC_INTERLEAVED))
+	{
+		bitmapUpdate.count = bitmapUpdate.number = entry->numBitmaps;
+		bitmapUpdate.rectangles = entry->bitmaps;
+		bitmapUpdate.skipCompression = FALSE;
+
+		encoder->encodedBytes += entry->size;
+
+		IFCALL(update->BitmapUpdate, context, &bitmapUpdate);
+
+		return 1;
+	}
+
+	if (encoder->frameAck)
+		frameId = (UINT32) shadow_encoder_create_frame_id(encoder);
+
+	if ((entry->key.codec == FREERDP_CODEC_REMOTEFX) && !encoder->frameAck)
+		IFCALL(update->BeginPaint, context);
+
+	s = encoder->bs;
+
+	for (i = 0; i < entry->numCommands; i++)
+	{
+		cmd = entry->commands[i];
+
+		if (entry->key.codec == FREERDP_CODEC_REMOTEFX)
+		{
+			Stream_SetPosition(s, 0);
+
+			if (encoder->rfx->state == RFX_STATE_SEND_HEADERS)
+			{
+				rfx_compose_message_header(encoder->rfx, s);
+				encoder->rfx->state = RFX_STATE_SEND_FRAME_DATA;
+			}
+
+			offset = Stream_GetPosition(s);
+
+			Stream_EnsureRemainingCapacity(s, cmd.bitmapDataLength);
+			Stream_Write(s, cmd.bitmapData, cmd.bitmapDataLength);
+			length = Stream_GetPosition(s);
+
+			/* the frame index follows the block header and the codec and channel ids of the frame begin */
+
+			Stream_SetPosition(s, offset + 8);
+			Stream_Write_UINT32(s, encoder->rfx->frameIdx++);
+			Stream_SetPosition(s, length);
+
+			cmd.codecID = settings->RemoteFxCodecId;
+			cmd.bitmapDataLength = length;
+			cmd.bitmapData = Stream_Buffer(s);
+		}
+		else
+		{
+			cmd.codecID = settings->NSCodecId;
+		}
+
+		first = (i == 0) ? TRUE : FALSE;
+		last = ((i + 1) == entry->numCommands) ? TRUE : FALSE;
+
+		encoder->encodedBytes += cmd.bitmapDataLength;
+
+		if (!encoder->frameAck)
+			IFCALL(update->SurfaceBits, update->context, &cmd);
+		else
+			IFCALL(update->SurfaceFrameBits, update->context, &cmd, first, last, frameId);
+	}
+
+	if ((entry->key.codec == FREERDP_CODEC_REMOTEFX) && !encoder->frameAck)
+		IFCALL(update->EndPaint, context);
+
+	return 1;
+}
+
 int shadow_client_send_surface_update(rdpShadowClient* client)
 {
+	int codec;
 	int status = -1;
+	UINT64 startTime;
+	UINT64 encodedBytes;
 	int nXSrc, nYSrc;
 	int nWidth, nHeight;
 	rdpContext* context;
@@ -615,6 +895,10 @@ int shadow_client_send_surface_update(rdpShadowClient* client)
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
 	rdpShadowEncoder* encoder;
+	rdpShadowCacheKey key;
+	rdpShadowCacheEntry* entry = NULL;
+	BOOL cached = FALSE;
+	BOOL fill = FALSE;
 	REGION16 invalidRegion;
 	RECTANGLE_16 surfaceRect;
 	const RECTANGLE_16* extents;
@@ -641,11 +925,15 @@ int shadow_client_send_surface_update(rdpShadowClient* client)
 
 	region16_intersect_rect(&invalidRegion, &invalidRegion, &surfaceRect);
 
-	if (server->shareSubRect)
+	if (client->shareSubRect)
 	{
-		region16_intersect_rect(&invalidRegion, &invalidRegion, &(server->subRect));
+		region16_intersect_rect(&invalidRegion, &invalidRegion, &(client->subRect));
+		rectangles_intersection(&surfaceRect, &(client->subRect), &surfaceRect);
 	}
 
+	if (settings->RemoteFxCodec && !client->inLobby)
+		shadow_encoder_select_quality(encoder, &invalidRegion, &surfaceRect);
+
 	if (region16_is_empty(&invalidRegion))
 	{
 		region16_uninit(&invalidRegion);
@@ -662,20 +950,183 @@ int shadow_client_send_surface_update(rdpShadowClient* client)
 	//WLog_INFO(TAG, "shadow_client_send_surface_update: x: %d y: %d width: %d height: %d right: %d bottom: %d",
 	//	nXSrc, nYSrc, nWidth, nHeight, nXSrc + nWidth, nYSrc + nHeight);
 
-	if (settings->RemoteFxCodec || settings->NSCodec)
+	startTime = shadow_stats_timestamp();
+	encodedBytes = encoder->encodedBytes;
+
+	if (shadow_client_cache_key(client, surface, &invalidRegion, &surfaceRect, &key))
 	{
-		status = shadow_client_send_surface_bits(client, surface, nXSrc, nYSrc, nWidth, nHeight);
+		entry = shadow_cache_acquire(server->cache, &key, &fill);
+		cached = (entry && !fill) ? TRUE : FALSE;
+	}
+
+	if (cached)
+	{
+		codec = SHADOW_STATS_CACHED;
+		status = shadow_client_send_cached(client, entry);
+	}
+	else if (settings->RemoteFxCodec || settings->NSCodec)
+	{
+		codec = settings->RemoteFxCodec ? SHADOW_STATS_REMOTEFX : SHADOW_STATS_NSCODEC;
+		status = shadow_client_send_surface_bits(client, surface, nXSrc, nYSrc, nWidth, nHeight, entry);
 	}
 	else
 	{
-		status = shadow_client_send_bitmap_update(client, surface, nXSrc, nYSrc, nWidth, nHeight);
+		codec = (settings->ColorDepth < 32) ? SHADOW_STATS_INTERLEAVED : SHADOW_STATS_PLANAR;
+		status = shadow_client_send_bitmap_update(client, surface, nXSrc, nYSrc, nWidth, nHeight, entry);
 	}
 
+	if (entry)
+	{
+		if (cached)
+			shadow_cache_release(server->cache, entry);
+		else
+			shadow_cache_complete(server->cache, entry, (status >= 0) ? TRUE : FALSE);
+	}
+
+	encoder->encodeTime += shadow_stats_timestamp() - startTime;
+	encoder->frameCount++;
+
+	shadow_stats_encode(client, codec, startTime, encoder->encodedBytes - encodedBytes);
+
 	region16_uninit(&invalidRegion);
 
 	return status;
 }
 
+int shadow_client_send_pointer_update(rdpShadowClient* client)
+{
+	int index;
+	BOOL cached;
+	rdpContext* context;
+	rdpPointerUpdate* update;
+	rdpShadowPointer* pointer;
+	rdpShadowPointerShape* shape;
+
+	context = (rdpContext*) client;
+	update = context->update->pointer;
+	pointer = client->server->pointer;
+	shape = pointer->shape;
+
+	if (!client->pointerUpdates || !shape)
+		return 1;
+
+	if (client->pointerId != shape->id)
+	{
+		index = shadow_pointer_cache_get(client->pointerCache, shape->id, &cached);
+
+		if (index < 0)
+			return -1;
+
+		if (cached)
+		{
+			POINTER_CACHED_UPDATE pointerCached;
+
+			pointerCached.cacheIndex = (UINT32) index;
+
+			IFCALL(update->PointerCached, context, &pointerCached);
+		}
+		else
+		{
+			POINTER_NEW_UPDATE pointerNew;
+
+			CopyMemory(&pointerNew, &(shape->pointerNew), sizeof(POINTER_NEW_UPDATE));
+			pointerNew.colorPtrAttr.cacheIndex = (UINT32) index;
+
+			IFCALL(update->PointerNew, context, &pointerNew);
+		}
+
+		client->pointerId = shape->id;
+	}
+
+	/**
+	 * Position updates move the local pointer of the client, so they are only
+	 * sent when the pointer was moved by something other than this client.
+	 */
+
+	if ((client->pointerX != pointer->x) || (client->pointerY != pointer->y))
+	{
+		if ((GetTickCount64() - client->pointerInputTime) >= SHADOW_POINTER_INPUT_TIMEOUT)
+		{
+			POINTER_POSITION_UPDATE pointerPosition;
+
+			pointerPosition.xPos = pointer->x;
+			pointerPosition.yPos = pointer->y;
+
+			if (client->shareSubRect)
+			{
+				pointerPosition.xPos = (pointer->x > client->subRect.left) ? pointer->x - client->subRect.left : 0;
+				pointerPosition.yPos = (pointer->y > client->subRect.top) ? pointer->y - client->subRect.top : 0;
+			}
+
+			IFCALL(update->PointerPosition, context, &pointerPosition);
+
+			client->pointerX = pointer->x;
+			client->pointerY = pointer->y;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * The subsystem captures at the frame rate of the fastest client,
+ * slower clients skip frames according to their own pacing.
+ */
+
+int shadow_client_capture_frame_rate(rdpShadowServer* server)
+{
+	int index;
+	int frameRate = 0;
+	rdpShadowClient* client;
+
+	ArrayList_Lock(server->clients);
+
+	for (index = 0; index < ArrayList_Count(server->clients); index++)
+	{
+		client = (rdpShadowClient*) ArrayList_GetItem(server->clients, index);
+
+		if (client->activated && (client->encoder->fps > frameRate))
+			frameRate = client->encoder->fps;
+	}
+
+	ArrayList_Unlock(server->clients);
+
+	return (frameRate > 0) ? frameRate : 16;
+}
+
+/**
+ * Returns TRUE if a client has deferred updates or tiles to refine, which are sent during
+ * the next update even if nothing else changed.
+ */
+
+BOOL shadow_client_update_pending(rdpShadowServer* server)
+{
+	int index;
+	BOOL pending = FALSE;
+	rdpShadowClient* client;
+
+	ArrayList_Lock(server->clients);
+
+	for (index = 0; (index < ArrayList_Count(server->clients)) && !pending; index++)
+	{
+		client = (rdpShadowClient*) ArrayList_GetItem(server->clients, index);
+
+		if (!client->activated)
+			continue;
+
+		EnterCriticalSection(&(client->lock));
+		pending = region16_is_empty(&(client->invalidRegion)) ? FALSE : TRUE;
+		LeaveCriticalSection(&(client->lock));
+
+		if (client->encoder && client->encoder->refinePending)
+			pending = TRUE;
+	}
+
+	ArrayList_Unlock(server->clients);
+
+	return pending;
+}
+
 int shadow_client_surface_update(rdpShadowClient* client, REGION16* region)
 {
 	int index;
@@ -696,123 +1147,316 @@ int shadow_client_surface_update(rdpShadowClient* client, REGION16* region)
 	return 1;
 }
 
-void* shadow_client_thread(rdpShadowClient* client)
+static void shadow_client_region_subtract_rect(REGION16* region, const RECTANGLE_16* rect)
 {
-	DWORD status;
-	DWORD nCount;
-	HANDLE events[32];
-	HANDLE StopEvent;
-	HANDLE ClientEvent;
-	HANDLE ChannelEvent;
-	HANDLE UpdateEvent;
-	freerdp_peer* peer;
-	rdpContext* context;
-	rdpSettings* settings;
-	rdpShadowServer* server;
-	rdpShadowScreen* screen;
-	rdpShadowEncoder* encoder;
-	rdpShadowSubsystem* subsystem;
+	int index;
+	int numRects = 0;
+	REGION16 result;
+	RECTANGLE_16 part;
+	const RECTANGLE_16* rects;
 
-	server = client->server;
-	screen = server->screen;
-	encoder = client->encoder;
-	subsystem = server->subsystem;
+	/* the rectangles are split around rect */
 
-	context = (rdpContext*) client;
-	peer = context->peer;
-	settings = peer->settings;
+	region16_init(&result);
 
-	peer->Capabilities = shadow_client_capabilities;
-	peer->PostConnect = shadow_client_post_connect;
-	peer->Activate = shadow_client_activate;
+	rects = region16_rects(region, &numRects);
 
-	shadow_input_register_callbacks(peer->input);
+	for (index = 0; index < numRects; index++)
+	{
+		if (!rectangles_intersects(&rects[index], rect))
+		{
+			region16_union_rect(&result, &result, &rects[index]);
+			continue;
+		}
 
-	peer->Initialize(peer);
+		part = rects[index];
 
-	peer->update->RefreshRect = (pRefreshRect) shadow_client_refresh_rect;
-	peer->update->SuppressOutput = (pSuppressOutput) shadow_client_suppress_output;
-	peer->update->SurfaceFrameAcknowledge = (pSurfaceFrameAcknowledge) shadow_client_surface_frame_acknowledge;
+		if (part.top < rect->top)
+		{
+			part.bottom = rect->top;
+			region16_union_rect(&result, &result, &part);
+		}
 
-	StopEvent = client->StopEvent;
-	UpdateEvent = subsystem->updateEvent;
-	ClientEvent = peer->GetEventHandle(peer);
-	ChannelEvent = WTSVirtualChannelManagerGetEventHandle(client->vcm);
+		part = rects[index];
 
-	while (1)
-	{
-		nCount = 0;
-		events[nCount++] = StopEvent;
-		events[nCount++] = UpdateEvent;
-		events[nCount++] = ClientEvent;
-		events[nCount++] = ChannelEvent;
+		if (part.bottom > rect->bottom)
+		{
+			part.top = rect->bottom;
+			region16_union_rect(&result, &result, &part);
+		}
 
-		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+		part = rects[index];
+		part.top = (part.top > rect->top) ? part.top : rect->top;
+		part.bottom = (part.bottom < rect->bottom) ? part.bottom : rect->bottom;
 
-		if (WaitForSingleObject(StopEvent, 0) == WAIT_OBJECT_0)
+		if (part.left < rect->left)
 		{
-			if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
-			{
-				EnterSynchronizationBarrier(&(subsystem->barrier), 0);
-			}
-
-			break;
+			part.right = rect->left;
+			region16_union_rect(&result, &result, &part);
+			part.right = rects[index].right;
 		}
 
-		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
+		if (part.right > rect->right)
 		{
-			if (client->activated)
-			{
-				int index;
-				int numRects = 0;
-				const RECTANGLE_16* rects;
+			part.left = rect->right;
+			region16_union_rect(&result, &result, &part);
+		}
+	}
 
-				rects = region16_rects(&(subsystem->invalidRegion), &numRects);
+	region16_copy(region, &result);
+	region16_uninit(&result);
+}
 
-				for (index = 0; index < numRects; index++)
-				{
-					region16_union_rect(&(client->invalidRegion), &(client->invalidRegion), &rects[index]);
-				}
+/**
+ * Sends the move detected by the subsystem as a ScrBlt order if the client
+ * supports it and its copy of the source area is up to date, then adds the
+ * rest of the update to the client invalid region. Returns FALSE when the
+ * whole update has to be encoded instead.
+ */
 
-				shadow_client_send_surface_update(client);
-			}
+static BOOL shadow_client_surface_move(rdpShadowClient* client, rdpShadowSubsystem* subsystem)
+{
+	int dx, dy;
+	SCRBLT_ORDER scrblt;
+	REGION16 invalidRegion;
+	RECTANGLE_16 bounds;
+	RECTANGLE_16 srcRect;
+	RECTANGLE_16 moveRect;
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings = context->settings;
+	rdpUpdate* update = context->update;
+	rdpShadowServer* server = client->server;
 
-			EnterSynchronizationBarrier(&(subsystem->barrier), 0);
+	moveRect = subsystem->moveRect;
+	dx = subsystem->moveDeltaX;
+	dy = subsystem->moveDeltaY;
 
-			while (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0);
-		}
+	if ((moveRect.right <= moveRect.left) || (moveRect.bottom <= moveRect.top))
+		return FALSE;
 
-		if (WaitForSingleObject(ClientEvent, 0) == WAIT_OBJECT_0)
-		{
-			if (!peer->CheckFileDescriptor(peer))
-			{
-				WLog_ERR(TAG, "Failed to check FreeRDP file descriptor");
-				break;
-			}
-		}
+	if (client->inLobby || !settings->OrderSupport[NEG_SCRBLT_INDEX])
+		return FALSE;
 
-		if (WaitForSingleObject(ChannelEvent, 0) == WAIT_OBJECT_0)
-		{
-			if (WTSVirtualChannelManagerCheckFileDescriptor(client->vcm) != TRUE)
-			{
-				WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
-				break;
-			}
-		}
+	srcRect.left = moveRect.left - dx;
+	srcRect.top = moveRect.top - dy;
+	srcRect.right = moveRect.right - dx;
+	srcRect.bottom = moveRect.bottom - dy;
+
+	bounds.left = 0;
+	bounds.top = 0;
+	bounds.right = server->surface->width;
+	bounds.bottom = server->surface->height;
+
+	if (client->shareSubRect)
+		rectangles_intersection(&bounds, &(client->subRect), &bounds);
+
+	if ((srcRect.left < bounds.left) || (srcRect.top < bounds.top) ||
+			(srcRect.right > bounds.right) || (srcRect.bottom > bounds.bottom) ||
+			(moveRect.left < bounds.left) || (moveRect.top < bounds.top) ||
+			(moveRect.right > bounds.right) || (moveRect.bottom > bounds.bottom))
+		return FALSE;
+
+	EnterCriticalSection(&(client->lock));
+
+	if (region16_intersects_rect(&(client->invalidRegion), &srcRect))
+	{
+		LeaveCriticalSection(&(client->lock));
+		return FALSE;
 	}
 
+	/* the destination of the move is up to date once the order is processed */
+
+	shadow_client_region_subtract_rect(&(client->invalidRegion), &moveRect);
+
+	LeaveCriticalSection(&(client->lock));
+
+	region16_init(&invalidRegion);
+	region16_copy(&invalidRegion, &(subsystem->invalidRegion));
+	shadow_client_region_subtract_rect(&invalidRegion, &moveRect);
+	shadow_client_surface_update(client, &invalidRegion);
+	region16_uninit(&invalidRegion);
+
+	scrblt.nLeftRect = moveRect.left - bounds.left;
+	scrblt.nTopRect = moveRect.top - bounds.top;
+	scrblt.nWidth = moveRect.right - moveRect.left;
+	scrblt.nHeight = moveRect.bottom - moveRect.top;
+	scrblt.bRop = 0xCC; /* SRCCOPY */
+	scrblt.nXSrc = srcRect.left - bounds.left;
+	scrblt.nYSrc = srcRect.top - bounds.top;
+
+	IFCALL(update->BeginPaint, context);
+	IFCALL(update->primary->ScrBlt, context, &scrblt);
+	IFCALL(update->EndPaint, context);
+
+	shadow_encoder_move_tiles(client->encoder, &moveRect, dx, dy, &bounds);
+
+	return TRUE;
+}
+
+/**
+ * Restricts a client to one monitor of the shared surface, or to what the
+ * server shares with an index of -1. Takes effect when the client is activated.
+ */
+
+int shadow_client_select_monitor(rdpShadowClient* client, int index)
+{
+	MONITOR_DEF* monitor;
+	RECTANGLE_16 rect;
+	RECTANGLE_16 bounds;
+	rdpShadowServer* server = client->server;
+	rdpShadowSurface* surface = server->surface;
+	rdpShadowSubsystem* subsystem = client->subsystem;
+
+	if (index < 0)
+	{
+		EnterCriticalSection(&(client->lock));
+		client->shareSubRect = server->shareSubRect;
+		client->subRect = server->subRect;
+		LeaveCriticalSection(&(client->lock));
+		return 1;
+	}
+
+	if (!surface || (index >= subsystem->numMonitors))
+		return -1;
+
+	monitor = &(subsystem->monitors[index]);
+
+	rect.left = (monitor->left < surface->x) ? 0 : monitor->left - surface->x;
+	rect.top = (monitor->top < surface->y) ? 0 : monitor->top - surface->y;
+	rect.right = (monitor->right < surface->x) ? 0 : monitor->right - surface->x;
+	rect.bottom = (monitor->bottom < surface->y) ? 0 : monitor->bottom - surface->y;
+
+	bounds.left = 0;
+	bounds.top = 0;
+	bounds.right = surface->width;
+	bounds.bottom = surface->height;
+
+	if (!rectangles_intersection(&rect, &bounds, &rect))
+		return -1;
+
+	EnterCriticalSection(&(client->lock));
+	client->shareSubRect = TRUE;
+	client->subRect = rect;
+	LeaveCriticalSection(&(client->lock));
+
+	return 1;
+}
+
+/**
+ * Signals the update of the subsystem invalid region to all activated
+ * clients and waits until each of them is done with it. Clients still in
+ * the connection sequence do not take part, clients removed meanwhile are
+ * accounted for when they are freed.
+ */
+
+int shadow_client_broadcast_update(rdpShadowServer* server)
+{
+	int index;
+	UINT64 startTime;
+	rdpShadowClient* client;
+	rdpShadowSubsystem* subsystem = server->subsystem;
+
+	startTime = shadow_stats_timestamp();
+
+	ResetEvent(subsystem->updateDoneEvent);
+
+	ArrayList_Lock(server->clients);
+
+	/* one more for the broadcast itself, so that the round cannot end early */
+	subsystem->updatePending = 1;
+
+	for (index = 0; index < ArrayList_Count(server->clients); index++)
+	{
+		client = (rdpShadowClient*) ArrayList_GetItem(server->clients, index);
+
+		if (!client->activated)
+			continue;
+
+		InterlockedIncrement(&(subsystem->updatePending));
+		client->updatePending = TRUE;
+		SetEvent(client->UpdateEvent);
+	}
+
+	ArrayList_Unlock(server->clients);
+
+	if (InterlockedDecrement(&(subsystem->updatePending)) == 0)
+		SetEvent(subsystem->updateDoneEvent);
+
+	if (WaitForSingleObject(subsystem->updateDoneEvent, INFINITE) != WAIT_OBJECT_0)
+		return -1;
+
+	shadow_stats_update(server, startTime);
+
+	return 1;
+}
+
+static BOOL shadow_client_stop_event(freerdp_peer* peer, HANDLE handle)
+{
+	return FALSE;
+}
+
+static BOOL shadow_client_update_event(freerdp_peer* peer, HANDLE handle)
+{
+	BOOL send;
+	BOOL writeBlocked;
+	size_t queuedBytes;
+	rdpShadowClient* client = (rdpShadowClient*) peer->context;
+	rdpShadowSubsystem* subsystem = client->subsystem;
+
+	ResetEvent(client->UpdateEvent);
+
+	if (client->activated)
+	{
+		writeBlocked = peer->IsWriteBlocked(peer);
+		shadow_stats_write_blocked(client, writeBlocked);
+
+		queuedBytes = peer->GetOutputBufferSize(peer);
+		send = shadow_encoder_pace_frame(client->encoder, queuedBytes);
+
+		if (!send)
+			shadow_stats_skip(client);
+
+		/* moves can only be sent along with the update they were detected in */
+
+		if (!send || !shadow_client_surface_move(client, subsystem))
+			shadow_client_surface_update(client, &(subsystem->invalidRegion));
+
+		shadow_client_send_pointer_update(client);
+
+		if (send)
+			shadow_client_send_surface_update(client);
+	}
+
+	shadow_client_update_done(client);
+
+	return TRUE;
+}
+
+static BOOL shadow_client_channel_event(freerdp_peer* peer, HANDLE handle)
+{
+	rdpShadowClient* client = (rdpShadowClient*) peer->context;
+
+	if (WTSVirtualChannelManagerCheckFileDescriptor(client->vcm) != TRUE)
+	{
+		WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void shadow_client_closed(freerdp_peer_loop* loop, freerdp_peer* peer)
+{
 	peer->Disconnect(peer);
-	
+
 	freerdp_peer_context_free(peer);
 	freerdp_peer_free(peer);
-
-	ExitThread(0);
-
-	return NULL;
 }
 
 void shadow_client_accepted(freerdp_listener* listener, freerdp_peer* peer)
 {
+	HANDLE handles[3];
+	psPeerLoopEvent events[3];
 	rdpShadowClient* client;
 	rdpShadowServer* server;
 
@@ -826,6 +1470,32 @@ void shadow_client_accepted(freerdp_listener* listener, freerdp_peer* peer)
 
 	client = (rdpShadowClient*) peer->context;
 
-	client->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)
-			shadow_client_thread, client, 0, NULL);
+	peer->Capabilities = shadow_client_capabilities;
+	peer->PostConnect = shadow_client_post_connect;
+	peer->Activate = shadow_client_activate;
+
+	shadow_input_register_callbacks(peer->input);
+
+	peer->Initialize(peer);
+
+	peer->update->RefreshRect = (pRefreshRect) shadow_client_refresh_rect;
+	peer->update->SuppressOutput = (pSuppressOutput) shadow_client_suppress_output;
+	peer->update->SurfaceFrameAcknowledge = (pSurfaceFrameAcknowledge) shadow_client_surface_frame_acknowledge;
+
+	/* the peer event handle is waited for by the loop itself */
+
+	handles[0] = client->StopEvent;
+	events[0] = shadow_client_stop_event;
+
+	handles[1] = client->UpdateEvent;
+	events[1] = shadow_client_update_event;
+
+	handles[2] = WTSVirtualChannelManagerGetEventHandle(client->vcm);
+	events[2] = shadow_client_channel_event;
+
+	if (!freerdp_peer_loop_add(server->loop, peer, handles, events, 3))
+	{
+		WLog_ERR(TAG, "Failed to add peer to the server loop");
+		shadow_client_closed(server->loop, peer);
+	}
 }
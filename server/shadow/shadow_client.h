@@ -21,11 +21,18 @@
 
 #include <freerdp/server/shadow.h>
 
+/* threads waiting for client events, the clients are processed by a pool */
+#define SHADOW_CLIENT_LOOP_THREADS	2
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int shadow_client_surface_update(rdpShadowClient* client, REGION16* region);
+int shadow_client_capture_frame_rate(rdpShadowServer* server);
+BOOL shadow_client_update_pending(rdpShadowServer* server);
+int shadow_client_broadcast_update(rdpShadowServer* server);
+void shadow_client_closed(freerdp_peer_loop* loop, freerdp_peer* client);
 void shadow_client_accepted(freerdp_listener* instance, freerdp_peer* client);
 
 #ifdef __cplusplus
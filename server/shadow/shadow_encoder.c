@@ -20,44 +20,405 @@
 #include "config.h"
 #endif
 
+#include <winpr/sysinfo.h>
+
 #include "shadow.h"
 
 #include "shadow_encoder.h"
 
-int shadow_encoder_create_frame_id(rdpShadowEncoder* encoder)
+/**
+ * Default RemoteFX quantization values (see rfx.c), each quality level
+ * below the best one doubles the quantization step of all subbands.
+ */
+
+static const UINT32 shadow_encoder_rfx_quants[10] =
+{
+	6, 6, 6, 6, 7, 7, 8, 8, 8, 9
+};
+
+static UINT32 shadow_encoder_expire_frames(rdpShadowEncoder* encoder, UINT64 now)
+{
+	UINT32 count;
+	rdpShadowFrame* frame;
+	wListDictionary* frameList = encoder->frameList;
+
+	/* frames are added in order, the oldest one is at the head */
+
+	ListDictionary_Lock(frameList);
+
+	while (frameList->head)
+	{
+		frame = (rdpShadowFrame*) frameList->head->value;
+
+		if ((now - frame->sendTime) < SHADOW_ENCODER_FRAME_TIMEOUT)
+			break;
+
+		ListDictionary_Remove_Head(frameList);
+		free(frame);
+	}
+
+	count = (UINT32) ListDictionary_Count(frameList);
+
+	ListDictionary_Unlock(frameList);
+
+	return count;
+}
+
+static void shadow_encoder_free_frames(rdpShadowEncoder* encoder)
+{
+	rdpShadowFrame* frame;
+
+	while ((frame = (rdpShadowFrame*) ListDictionary_Remove_Head(encoder->frameList)))
+		free(frame);
+}
+
+static UINT32 shadow_encoder_adjust_interval(rdpShadowEncoder* encoder)
+{
+	/* adjust the rate at most once per round-trip */
+	return (encoder->rtt > 100) ? encoder->rtt : 100;
+}
+
+static void shadow_encoder_slow_down(rdpShadowEncoder* encoder, UINT64 now)
 {
-	UINT32 frameId;
-	int inFlightFrames;
-	SURFACE_FRAME* frame;
+	if ((now - encoder->lastAdjustTime) < shadow_encoder_adjust_interval(encoder))
+		return;
+
+	encoder->lastAdjustTime = now;
 
-	inFlightFrames = ListDictionary_Count(encoder->frameList);
+	/* lower the quality first, then the frame rate */
 
-	if (inFlightFrames > encoder->frameAck)
+	if (encoder->quality < (SHADOW_ENCODER_QUALITY_LEVELS - 1))
 	{
-		encoder->fps = (100 / (inFlightFrames + 1) * encoder->maxFps) / 100;
+		encoder->quality++;
+		return;
 	}
-	else
+
+	encoder->fps = (encoder->fps * 3) / 4;
+
+	if (encoder->fps < 1)
+		encoder->fps = 1;
+}
+
+static void shadow_encoder_speed_up(rdpShadowEncoder* encoder, UINT64 now)
+{
+	if ((now - encoder->lastAdjustTime) < (2 * shadow_encoder_adjust_interval(encoder)))
+		return;
+
+	encoder->lastAdjustTime = now;
+
+	if (encoder->fps < encoder->maxFps)
 	{
 		encoder->fps += 2;
 
 		if (encoder->fps > encoder->maxFps)
 			encoder->fps = encoder->maxFps;
+
+		return;
 	}
 
-	if (encoder->fps < 1)
-		encoder->fps = 1;
+	if (encoder->quality > 0)
+	{
+		encoder->quality--;
 
-	frame = (SURFACE_FRAME*) malloc(sizeof(SURFACE_FRAME));
+		/* refine what was sent at a lower quality */
+		encoder->refinePending = TRUE;
+	}
+}
+
+static BOOL shadow_encoder_measure_bandwidth(rdpShadowEncoder* encoder, UINT64 now)
+{
+	if (!encoder->bandwidthTime)
+	{
+		encoder->bandwidthTime = now;
+		encoder->bandwidthBytes = encoder->encodedBytes;
+		return FALSE;
+	}
+
+	if ((now - encoder->bandwidthTime) < 1000)
+		return FALSE;
+
+	encoder->bandwidth = (UINT32) (((encoder->encodedBytes - encoder->bandwidthBytes) * 1000) /
+			(now - encoder->bandwidthTime));
+
+	encoder->bandwidthTime = now;
+	encoder->bandwidthBytes = encoder->encodedBytes;
+
+	return TRUE;
+}
+
+/**
+ * The output queued in the transport is bounded to about what the client
+ * received in a frame interval: a new frame would only wait behind it.
+ */
+
+static size_t shadow_encoder_max_queued_bytes(rdpShadowEncoder* encoder)
+{
+	size_t maxQueuedBytes = encoder->bandwidth / encoder->fps;
+
+	if (maxQueuedBytes < SHADOW_ENCODER_MIN_QUEUED_BYTES)
+		maxQueuedBytes = SHADOW_ENCODER_MIN_QUEUED_BYTES;
+
+	if (maxQueuedBytes > SHADOW_ENCODER_MAX_QUEUED_BYTES)
+		maxQueuedBytes = SHADOW_ENCODER_MAX_QUEUED_BYTES;
+
+	return maxQueuedBytes;
+}
+
+/**
+ * Decides if a frame can be sent to the client now. Frames are deferred
+ * while too many of them are unacknowledged or too much output is queued
+ * for the client (which also lowers the quality and frame rate), or to
+ * keep the frame rate of the client. Exceeding the bandwidth target lowers
+ * the quality and frame rate without deferring frames. Deferred updates
+ * are coalesced into the next frame sent.
+ */
+
+BOOL shadow_encoder_pace_frame(rdpShadowEncoder* encoder, size_t queuedBytes)
+{
+	UINT64 now;
+	UINT32 interval;
+	size_t maxQueuedBytes;
+	UINT32 inFlightFrames = 0;
+
+	now = GetTickCount64();
+
+	if (encoder->frameList)
+		inFlightFrames = shadow_encoder_expire_frames(encoder, now);
+
+	maxQueuedBytes = shadow_encoder_max_queued_bytes(encoder);
+
+	if ((queuedBytes > maxQueuedBytes) ||
+			(encoder->frameAck && (inFlightFrames >= encoder->maxInFlightFrames)))
+	{
+		shadow_encoder_slow_down(encoder, now);
+		return FALSE;
+	}
+
+	if (shadow_encoder_measure_bandwidth(encoder, now) && encoder->maxBandwidth &&
+			(encoder->bandwidth > encoder->maxBandwidth))
+		shadow_encoder_slow_down(encoder, now);
+
+	interval = 1000 / encoder->fps;
+
+	/* tolerate some jitter of the capture interval */
+	if ((now - encoder->lastFrameTime) < (interval - (interval / 4)))
+		return FALSE;
+
+	if ((!encoder->frameAck || (inFlightFrames <= (encoder->maxInFlightFrames / 2))) &&
+			(queuedBytes <= (maxQueuedBytes / 2)) &&
+			(!encoder->maxBandwidth || (encoder->bandwidth < ((encoder->maxBandwidth / 4) * 3))))
+		shadow_encoder_speed_up(encoder, now);
+
+	encoder->lastFrameTime = now;
+
+	return TRUE;
+}
+
+int shadow_encoder_create_frame_id(rdpShadowEncoder* encoder)
+{
+	rdpShadowFrame* frame;
+
+	frame = (rdpShadowFrame*) malloc(sizeof(rdpShadowFrame));
 
 	if (!frame)
 		return -1;
 
-	frameId = frame->frameId = ++encoder->frameId;
-	ListDictionary_Add(encoder->frameList, (void*) (size_t) frame->frameId, frame);
+	frame->frameId = ++encoder->frameId;
+	frame->sendTime = GetTickCount64();
+
+	if (!ListDictionary_Add(encoder->frameList, (void*) (size_t) frame->frameId, frame))
+	{
+		free(frame);
+		return -1;
+	}
 
 	return (int) frame->frameId;
 }
 
+void shadow_encoder_frame_acknowledge(rdpShadowEncoder* encoder, UINT32 frameId)
+{
+	UINT32 rtt;
+	UINT32 maxInFlightFrames;
+	rdpShadowFrame* frame;
+
+	if (!encoder->frameList)
+		return;
+
+	frame = (rdpShadowFrame*) ListDictionary_GetItemValue(encoder->frameList, (void*) (size_t) frameId);
+
+	if (!frame)
+		return;
+
+	ListDictionary_Remove(encoder->frameList, (void*) (size_t) frameId);
+
+	rtt = (UINT32) (GetTickCount64() - frame->sendTime);
+	encoder->rtt = encoder->rtt ? ((encoder->rtt * 7) + rtt) / 8 : rtt;
+
+	/* keep about one round-trip worth of frames in flight */
+
+	maxInFlightFrames = ((encoder->rtt * encoder->fps) / 1000) + 1;
+
+	if (maxInFlightFrames < 2)
+		maxInFlightFrames = 2;
+
+	if (maxInFlightFrames > SHADOW_ENCODER_MAX_IN_FLIGHT_FRAMES)
+		maxInFlightFrames = SHADOW_ENCODER_MAX_IN_FLIGHT_FRAMES;
+
+	encoder->maxInFlightFrames = maxInFlightFrames;
+
+	free(frame);
+}
+
+/**
+ * Selects the quality level of each tile for the next frame: tiles that
+ * keep changing are sent coarser than the base quality, static tiles at
+ * the base quality. Tiles that stopped changing after being sent coarser
+ * are added to the invalid region to be refined. The grid is relative to
+ * the top-left corner of bounds, which is also the origin of the encoder.
+ */
+
+int shadow_encoder_select_quality(rdpShadowEncoder* encoder, REGION16* invalidRegion, const RECTANGLE_16* bounds)
+{
+	int x, y, k;
+	int level;
+	BYTE motion;
+	BOOL changed;
+	RECTANGLE_16 tileRect;
+	const RECTANGLE_16* extents;
+
+	if (!encoder->tileMotion)
+		return -1;
+
+	for (y = 0; y < encoder->gridHeight; y++)
+	{
+		tileRect.top = bounds->top + (y * encoder->maxTileHeight);
+		tileRect.bottom = tileRect.top + encoder->maxTileHeight;
+
+		if (tileRect.top >= bounds->bottom)
+			break;
+
+		if (tileRect.bottom > bounds->bottom)
+			tileRect.bottom = bounds->bottom;
+
+		for (x = 0; x < encoder->gridWidth; x++)
+		{
+			tileRect.left = bounds->left + (x * encoder->maxTileWidth);
+			tileRect.right = tileRect.left + encoder->maxTileWidth;
+
+			if (tileRect.left >= bounds->right)
+				break;
+
+			if (tileRect.right > bounds->right)
+				tileRect.right = bounds->right;
+
+			k = (y * encoder->gridWidth) + x;
+			motion = encoder->tileMotion[k];
+			changed = region16_intersects_rect(invalidRegion, &tileRect);
+
+			if (changed)
+			{
+				if (motion < SHADOW_ENCODER_MOTION_FRAMES)
+					motion++;
+			}
+			else if (motion > 0)
+			{
+				motion--;
+			}
+
+			level = encoder->quality + ((motion > 1) ? (motion - 1) : 0);
+
+			if (level > (SHADOW_ENCODER_QUALITY_LEVELS - 1))
+				level = SHADOW_ENCODER_QUALITY_LEVELS - 1;
+
+			if (!changed && !motion && (encoder->tileQuality[k] > level))
+				region16_union_rect(invalidRegion, invalidRegion, &tileRect);
+
+			encoder->tileMotion[k] = motion;
+			encoder->tileQuant[k] = (BYTE) level;
+		}
+	}
+
+	encoder->refinePending = FALSE;
+
+	if (!region16_is_empty(invalidRegion))
+	{
+		/* the whole extents are encoded */
+
+		extents = region16_extents(invalidRegion);
+
+		for (y = 0; y < encoder->gridHeight; y++)
+		{
+			for (x = 0; x < encoder->gridWidth; x++)
+			{
+				k = (y * encoder->gridWidth) + x;
+
+				tileRect.left = bounds->left + (x * encoder->maxTileWidth);
+				tileRect.top = bounds->top + (y * encoder->maxTileHeight);
+
+				if ((tileRect.left < extents->right) && (tileRect.left + encoder->maxTileWidth > extents->left) &&
+						(tileRect.top < extents->bottom) && (tileRect.top + encoder->maxTileHeight > extents->top))
+					encoder->tileQuality[k] = encoder->tileQuant[k];
+
+				if (encoder->tileQuality[k] > encoder->quality)
+					encoder->refinePending = TRUE;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Moved content keeps the quality it was sent at: the tiles covered by the
+ * destination of a move take the coarsest level of the source tiles.
+ */
+
+void shadow_encoder_move_tiles(rdpShadowEncoder* encoder, const RECTANGLE_16* rect,
+		int dx, int dy, const RECTANGLE_16* bounds)
+{
+	int x, y, k;
+	int x0, y0, x1, y1;
+	BYTE level = 0;
+
+	if (!encoder->tileQuality)
+		return;
+
+	x0 = (rect->left - dx - bounds->left) / encoder->maxTileWidth;
+	y0 = (rect->top - dy - bounds->top) / encoder->maxTileHeight;
+	x1 = (rect->right - 1 - dx - bounds->left) / encoder->maxTileWidth;
+	y1 = (rect->bottom - 1 - dy - bounds->top) / encoder->maxTileHeight;
+
+	for (y = y0; (y <= y1) && (y < encoder->gridHeight); y++)
+	{
+		for (x = x0; (x <= x1) && (x < encoder->gridWidth); x++)
+		{
+			k = (y * encoder->gridWidth) + x;
+
+			if (encoder->tileQuality[k] > level)
+				level = encoder->tileQuality[k];
+		}
+	}
+
+	x0 = (rect->left - bounds->left) / encoder->maxTileWidth;
+	y0 = (rect->top - bounds->top) / encoder->maxTileHeight;
+	x1 = (rect->right - 1 - bounds->left) / encoder->maxTileWidth;
+	y1 = (rect->bottom - 1 - bounds->top) / encoder->maxTileHeight;
+
+	for (y = y0; (y <= y1) && (y < encoder->gridHeight); y++)
+	{
+		for (x = x0; (x <= x1) && (x < encoder->gridWidth); x++)
+		{
+			k = (y * encoder->gridWidth) + x;
+
+			if (encoder->tileQuality[k] < level)
+				encoder->tileQuality[k] = level;
+		}
+	}
+
+	if (level > encoder->quality)
+		encoder->refinePending = TRUE;
+}
+
 int shadow_encoder_init_grid(rdpShadowEncoder* encoder)
 {
 	int i, j, k;
@@ -80,6 +441,13 @@ int shadow_encoder_init_grid(rdpShadowEncoder* encoder)
 	if (!encoder->grid)
 		return -1;
 
+	encoder->tileMotion = (BYTE*) calloc(tileCount, sizeof(BYTE));
+	encoder->tileQuant = (BYTE*) calloc(tileCount, sizeof(BYTE));
+	encoder->tileQuality = (BYTE*) calloc(tileCount, sizeof(BYTE));
+
+	if (!encoder->tileMotion || !encoder->tileQuant || !encoder->tileQuality)
+		return -1;
+
 	for (i = 0; i < encoder->gridHeight; i++)
 	{
 		for (j = 0; j < encoder->gridWidth; j++)
@@ -106,6 +474,13 @@ int shadow_encoder_uninit_grid(rdpShadowEncoder* encoder)
 		encoder->grid = NULL;
 	}
 
+	free(encoder->tileMotion);
+	free(encoder->tileQuant);
+	free(encoder->tileQuality);
+	encoder->tileMotion = NULL;
+	encoder->tileQuant = NULL;
+	encoder->tileQuality = NULL;
+
 	encoder->gridWidth = 0;
 	encoder->gridHeight = 0;
 
@@ -129,6 +504,25 @@ int shadow_encoder_init_rfx(rdpShadowEncoder* encoder)
 
 	rfx_context_set_pixel_format(encoder->rfx, RDP_PIXEL_FORMAT_B8G8R8A8);
 
+	if (encoder->rfx->numQuant != SHADOW_ENCODER_QUALITY_LEVELS)
+	{
+		int level, index;
+		UINT32 value;
+		UINT32 quants[SHADOW_ENCODER_QUALITY_LEVELS * 10];
+
+		for (level = 0; level < SHADOW_ENCODER_QUALITY_LEVELS; level++)
+		{
+			for (index = 0; index < 10; index++)
+			{
+				value = shadow_encoder_rfx_quants[index] + level;
+				quants[(level * 10) + index] = (value > 15) ? 15 : value;
+			}
+		}
+
+		if (!rfx_context_set_quantization_values(encoder->rfx, quants, SHADOW_ENCODER_QUALITY_LEVELS))
+			return -1;
+	}
+
 	if (!encoder->frameList)
 	{
 		encoder->fps = 16;
@@ -238,6 +632,7 @@ int shadow_encoder_uninit_rfx(rdpShadowEncoder* encoder)
 
 	if (encoder->frameList)
 	{
+		shadow_encoder_free_frames(encoder);
 		ListDictionary_Free(encoder->frameList);
 		encoder->frameList = NULL;
 	}
@@ -257,6 +652,7 @@ int shadow_encoder_uninit_nsc(rdpShadowEncoder* encoder)
 
 	if (encoder->frameList)
 	{
+		shadow_encoder_free_frames(encoder);
 		ListDictionary_Free(encoder->frameList);
 		encoder->frameList = NULL;
 	}
@@ -330,6 +726,15 @@ int shadow_encoder_reset(rdpShadowEncoder* encoder)
 	int status;
 	UINT32 codecs = encoder->codecs;
 
+	encoder->quality = 0;
+	encoder->rtt = 0;
+	encoder->maxInFlightFrames = 2;
+	encoder->lastFrameTime = 0;
+	encoder->lastAdjustTime = 0;
+	encoder->bandwidth = 0;
+	encoder->bandwidthTime = 0;
+	encoder->refinePending = FALSE;
+
 	status = shadow_encoder_uninit(encoder);
 
 	if (status < 0)
@@ -402,6 +807,8 @@ rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client)
 
 	encoder->fps = 16;
 	encoder->maxFps = 32;
+	encoder->maxInFlightFrames = 2;
+	encoder->maxBandwidth = (server->maxBandwidth * 1000) / 8;
 
 	encoder->width = server->screen->width;
 	encoder->height = server->screen->height;
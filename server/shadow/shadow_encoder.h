@@ -27,6 +27,20 @@
 
 #include <freerdp/server/shadow.h>
 
+#define SHADOW_ENCODER_QUALITY_LEVELS		4
+#define SHADOW_ENCODER_MAX_IN_FLIGHT_FRAMES	8
+#define SHADOW_ENCODER_FRAME_TIMEOUT		2000
+#define SHADOW_ENCODER_MOTION_FRAMES		3
+#define SHADOW_ENCODER_MIN_QUEUED_BYTES		(64 * 1024)
+#define SHADOW_ENCODER_MAX_QUEUED_BYTES		(1024 * 1024)
+
+struct rdp_shadow_frame
+{
+	UINT32 frameId;
+	UINT64 sendTime;
+};
+typedef struct rdp_shadow_frame rdpShadowFrame;
+
 struct rdp_shadow_encoder
 {
 	rdpShadowClient* client;
@@ -55,6 +69,37 @@ struct rdp_shadow_encoder
 	BOOL frameAck;
 	UINT32 frameId;
 	wListDictionary* frameList;
+
+	/**
+	 * Frame pacing: the quality level selects the base RemoteFX quantization,
+	 * rtt is the smoothed frame acknowledgement round-trip time (in ms) and
+	 * bandwidth the encoded bytes per second, kept below maxBandwidth if set.
+	 */
+	int quality;
+	UINT32 rtt;
+	UINT32 maxInFlightFrames;
+	UINT64 lastFrameTime;
+	UINT64 lastAdjustTime;
+	UINT32 bandwidth;
+	UINT32 maxBandwidth;
+	UINT64 bandwidthTime;
+	UINT64 bandwidthBytes;
+
+	/**
+	 * Per tile quality, indexed like the grid: tileMotion counts the recent
+	 * frames a tile changed in, tileQuant is the level selected for the next
+	 * frame and tileQuality the level a tile was last sent at. Tiles sent
+	 * coarser than the base quality are refined once they stop changing.
+	 */
+	BYTE* tileMotion;
+	BYTE* tileQuant;
+	BYTE* tileQuality;
+	BOOL refinePending;
+
+	/* surface updates sent, time spent encoding them (in microseconds) and encoded size */
+	UINT64 frameCount;
+	UINT64 encodeTime;
+	UINT64 encodedBytes;
 };
 
 #ifdef __cplusplus
@@ -64,6 +109,11 @@ extern "C" {
 int shadow_encoder_reset(rdpShadowEncoder* encoder);
 int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs);
 int shadow_encoder_create_frame_id(rdpShadowEncoder* encoder);
+void shadow_encoder_frame_acknowledge(rdpShadowEncoder* encoder, UINT32 frameId);
+BOOL shadow_encoder_pace_frame(rdpShadowEncoder* encoder, size_t queuedBytes);
+int shadow_encoder_select_quality(rdpShadowEncoder* encoder, REGION16* invalidRegion, const RECTANGLE_16* bounds);
+void shadow_encoder_move_tiles(rdpShadowEncoder* encoder, const RECTANGLE_16* rect,
+		int dx, int dy, const RECTANGLE_16* bounds);
 
 rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client);
 void shadow_encoder_free(rdpShadowEncoder* encoder);
@@ -20,6 +20,8 @@
 #include "config.h"
 #endif
 
+#include <winpr/sysinfo.h>
+
 #include "shadow.h"
 
 void shadow_input_synchronize_event(rdpInput* input, UINT32 flags)
@@ -72,6 +74,16 @@ void shadow_input_mouse_event(rdpInput* input, UINT16 flags, UINT16 x, UINT16 y)
 	if (!client->mayInteract)
 		return;
 
+	if (client->shareSubRect)
+	{
+		x += client->subRect.left;
+		y += client->subRect.top;
+	}
+
+	client->pointerX = x;
+	client->pointerY = y;
+	client->pointerInputTime = GetTickCount64();
+
 	if (subsystem->MouseEvent)
 	{
 		subsystem->MouseEvent(subsystem, flags, x, y);
@@ -86,6 +98,16 @@ void shadow_input_extended_mouse_event(rdpInput* input, UINT16 flags, UINT16 x,
 	if (!client->mayInteract)
 		return;
 
+	if (client->shareSubRect)
+	{
+		x += client->subRect.left;
+		y += client->subRect.top;
+	}
+
+	client->pointerX = x;
+	client->pointerY = y;
+	client->pointerInputTime = GetTickCount64();
+
 	if (subsystem->ExtendedMouseEvent)
 	{
 		subsystem->ExtendedMouseEvent(subsystem, flags, x, y);
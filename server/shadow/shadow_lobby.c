@@ -26,24 +26,17 @@
 
 #include "shadow_lobby.h"
 
-int shadow_client_init_lobby(rdpShadowClient* client)
+static rdpShadowSurface* shadow_lobby_new(rdpShadowServer* server, int width, int height)
 {
-	int width;
-	int height;
 	rdtkEngine* engine;
 	rdtkSurface* surface;
 	RECTANGLE_16 invalidRect;
 	rdpShadowSurface* lobby;
-	rdpContext* context = (rdpContext*) client;
-	rdpSettings* settings = context->settings;
 
-	width = settings->DesktopWidth;
-	height = settings->DesktopHeight;
-
-	lobby = client->lobby = shadow_surface_new(client->server, 0, 0, width, height);
+	lobby = shadow_surface_new(server, 0, 0, width, height);
 
-	if (!client->lobby)
-		return -1;
+	if (!lobby)
+		return NULL;
 
 	engine = rdtk_engine_new();
 
@@ -65,5 +58,83 @@ int shadow_client_init_lobby(rdpShadowClient* client)
 
 	region16_union_rect(&(lobby->invalidRegion), &(lobby->invalidRegion), &invalidRect);
 
-	return 1;
+	/* the content never changes */
+	lobby->version = 1;
+
+	return lobby;
+}
+
+/**
+ * The lobby only depends on the size of the client, clients of the same
+ * size share the same lobby surface and thereby its cached encodes.
+ */
+
+int shadow_client_init_lobby(rdpShadowClient* client)
+{
+	int index;
+	int width;
+	int height;
+	rdpShadowSurface* lobby = NULL;
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings = context->settings;
+	rdpShadowServer* server = client->server;
+
+	shadow_client_uninit_lobby(client);
+
+	width = settings->DesktopWidth;
+	height = settings->DesktopHeight;
+
+	ArrayList_Lock(server->lobbies);
+
+	for (index = 0; index < ArrayList_Count(server->lobbies); index++)
+	{
+		lobby = (rdpShadowSurface*) ArrayList_GetItem(server->lobbies, index);
+
+		if ((lobby->width == width) && (lobby->height == height))
+			break;
+
+		lobby = NULL;
+	}
+
+	if (!lobby)
+	{
+		lobby = shadow_lobby_new(server, width, height);
+
+		if (lobby && (ArrayList_Add(server->lobbies, (void*) lobby) < 0))
+		{
+			shadow_surface_free(lobby);
+			lobby = NULL;
+		}
+	}
+
+	if (lobby)
+		lobby->refCount++;
+
+	client->lobby = lobby;
+
+	ArrayList_Unlock(server->lobbies);
+
+	return lobby ? 1 : -1;
+}
+
+void shadow_client_uninit_lobby(rdpShadowClient* client)
+{
+	rdpShadowSurface* lobby = client->lobby;
+	rdpShadowServer* server = client->server;
+
+	if (!lobby)
+		return;
+
+	ArrayList_Lock(server->lobbies);
+
+	client->lobby = NULL;
+
+	if (--(lobby->refCount) == 0)
+	{
+		ArrayList_Remove(server->lobbies, (void*) lobby);
+		shadow_cache_purge(server->cache, lobby);
+		shadow_surface_free(lobby);
+	}
+
+	ArrayList_Unlock(server->lobbies);
 }
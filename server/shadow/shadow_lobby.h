@@ -31,6 +31,7 @@ extern "C" {
 #endif
 
 int shadow_client_init_lobby(rdpShadowClient* client);
+void shadow_client_uninit_lobby(rdpShadowClient* client);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,358 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Copyright 2014 Marc-Andre Moreau <marcandre.moreau@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "shadow.h"
+
+#include "shadow_pointer.h"
+
+static UINT32 shadow_pointer_hash(const BYTE* data, UINT32 length, UINT32 hash)
+{
+	UINT32 index;
+
+	/* FNV-1a */
+
+	for (index = 0; index < length; index++)
+	{
+		hash ^= data[index];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+static void shadow_pointer_shape_free(rdpShadowPointerShape* shape)
+{
+	free(shape->pointerNew.colorPtrAttr.xorMaskData);
+	free(shape->pointerNew.colorPtrAttr.andMaskData);
+
+	ZeroMemory(shape, sizeof(rdpShadowPointerShape));
+}
+
+/**
+ * Sets the pointer shape from 32bpp ARGB pixels (top-down).
+ * The shape is padded to a width multiple of 16 so that the AND mask
+ * scanlines are word-aligned, and clipped to SHADOW_POINTER_MAX_SIZE.
+ */
+
+int shadow_pointer_set_shape(rdpShadowPointer* pointer, BYTE* pixels, int step,
+		int width, int height, int xHot, int yHot)
+{
+	int x, y;
+	BYTE A;
+	UINT32 hash;
+	UINT32 index;
+	int nWidth, nHeight;
+	UINT32 xorStep, andStep;
+	UINT32 lengthXorMask;
+	UINT32 lengthAndMask;
+	BYTE* pSrcPixel;
+	BYTE* pXorPixel;
+	BYTE* pAndBits;
+	BYTE* xorMaskData;
+	BYTE* andMaskData;
+	POINTER_COLOR_UPDATE* colorPtrAttr;
+	rdpShadowPointerShape* shape = NULL;
+
+	if ((width < 1) || (height < 1))
+		return -1;
+
+	nWidth = (width + 15) & ~15;
+
+	if (nWidth > SHADOW_POINTER_MAX_SIZE)
+		nWidth = SHADOW_POINTER_MAX_SIZE;
+
+	nHeight = height;
+
+	if (nHeight > SHADOW_POINTER_MAX_SIZE)
+		nHeight = SHADOW_POINTER_MAX_SIZE;
+
+	if (width > nWidth)
+		width = nWidth;
+
+	if ((xHot < 0) || (xHot >= nWidth))
+		xHot = 0;
+
+	if ((yHot < 0) || (yHot >= nHeight))
+		yHot = 0;
+
+	xorStep = nWidth * 4;
+	andStep = nWidth / 8;
+	lengthXorMask = xorStep * nHeight;
+	lengthAndMask = andStep * nHeight;
+
+	xorMaskData = (BYTE*) calloc(1, lengthXorMask);
+	andMaskData = (BYTE*) calloc(1, lengthAndMask);
+
+	if (!xorMaskData || !andMaskData)
+	{
+		free(xorMaskData);
+		free(andMaskData);
+		return -1;
+	}
+
+	/* both masks are bottom-up */
+
+	for (y = 0; y < nHeight; y++)
+	{
+		pSrcPixel = &pixels[y * step];
+		pXorPixel = &xorMaskData[(nHeight - 1 - y) * xorStep];
+		pAndBits = &andMaskData[(nHeight - 1 - y) * andStep];
+
+		for (x = 0; x < width; x++)
+		{
+			A = pSrcPixel[3];
+
+			pXorPixel[0] = pSrcPixel[0];
+			pXorPixel[1] = pSrcPixel[1];
+			pXorPixel[2] = pSrcPixel[2];
+			pXorPixel[3] = A;
+
+			if (!A)
+				pAndBits[x / 8] |= (0x80 >> (x % 8));
+
+			pSrcPixel += 4;
+			pXorPixel += 4;
+		}
+
+		for (; x < nWidth; x++)
+			pAndBits[x / 8] |= (0x80 >> (x % 8));
+	}
+
+	hash = shadow_pointer_hash(xorMaskData, lengthXorMask, 2166136261U);
+	hash = shadow_pointer_hash(andMaskData, lengthAndMask, hash);
+
+	for (index = 0; index < SHADOW_POINTER_CACHE_SIZE; index++)
+	{
+		colorPtrAttr = &(pointer->shapes[index].pointerNew.colorPtrAttr);
+
+		if (!pointer->shapes[index].id || (pointer->shapes[index].hash != hash))
+			continue;
+
+		if ((colorPtrAttr->width != (UINT32) nWidth) || (colorPtrAttr->height != (UINT32) nHeight) ||
+				(colorPtrAttr->xPos != (UINT32) xHot) || (colorPtrAttr->yPos != (UINT32) yHot))
+			continue;
+
+		if ((memcmp(colorPtrAttr->xorMaskData, xorMaskData, lengthXorMask) != 0) ||
+				(memcmp(colorPtrAttr->andMaskData, andMaskData, lengthAndMask) != 0))
+			continue;
+
+		shape = &(pointer->shapes[index]);
+		break;
+	}
+
+	if (shape)
+	{
+		free(xorMaskData);
+		free(andMaskData);
+	}
+	else
+	{
+		/* replace the least recently used shape, never the current one */
+
+		for (index = 0; index < SHADOW_POINTER_CACHE_SIZE; index++)
+		{
+			if (&(pointer->shapes[index]) == pointer->shape)
+				continue;
+
+			if (!shape || (pointer->shapes[index].lastUse < shape->lastUse))
+				shape = &(pointer->shapes[index]);
+		}
+
+		shadow_pointer_shape_free(shape);
+
+		/* shape ids are never reused, stale client cache entries simply never match */
+		shape->id = ++(pointer->nextId);
+		shape->hash = hash;
+
+		shape->pointerNew.xorBpp = 32;
+		colorPtrAttr = &(shape->pointerNew.colorPtrAttr);
+
+		colorPtrAttr->xPos = xHot;
+		colorPtrAttr->yPos = yHot;
+		colorPtrAttr->width = nWidth;
+		colorPtrAttr->height = nHeight;
+		colorPtrAttr->lengthXorMask = lengthXorMask;
+		colorPtrAttr->lengthAndMask = lengthAndMask;
+		colorPtrAttr->xorMaskData = xorMaskData;
+		colorPtrAttr->andMaskData = andMaskData;
+	}
+
+	shape->lastUse = ++(pointer->useCount);
+
+	if (pointer->shape != shape)
+	{
+		pointer->shape = shape;
+		pointer->changed = TRUE;
+	}
+
+	return 1;
+}
+
+int shadow_pointer_set_position(rdpShadowPointer* pointer, int x, int y)
+{
+	if (x < 0)
+		x = 0;
+
+	if (y < 0)
+		y = 0;
+
+	if ((pointer->x != (UINT32) x) || (pointer->y != (UINT32) y))
+	{
+		pointer->x = (UINT32) x;
+		pointer->y = (UINT32) y;
+		pointer->changed = TRUE;
+	}
+
+	return 1;
+}
+
+/**
+ * The cursor has to be blended into the shared surface when no shape is
+ * known or when an active client cannot receive new pointer updates.
+ */
+
+BOOL shadow_pointer_blend_required(rdpShadowServer* server)
+{
+	int index;
+	BOOL blend = FALSE;
+	rdpShadowClient* client;
+
+	if (!server->pointer || !server->pointer->shape)
+		return TRUE;
+
+	ArrayList_Lock(server->clients);
+
+	for (index = 0; index < ArrayList_Count(server->clients); index++)
+	{
+		client = (rdpShadowClient*) ArrayList_GetItem(server->clients, index);
+
+		if (client->activated && !client->pointerUpdates)
+		{
+			blend = TRUE;
+			break;
+		}
+	}
+
+	ArrayList_Unlock(server->clients);
+
+	return blend;
+}
+
+/**
+ * Returns the client cache index for a shape id, replacing the least
+ * recently used entry if the shape is not in the client cache.
+ */
+
+int shadow_pointer_cache_get(rdpShadowPointerCache* cache, UINT32 id, BOOL* cached)
+{
+	UINT32 index;
+	UINT32 lru = 0;
+
+	*cached = FALSE;
+
+	if (!cache->size)
+		return -1;
+
+	cache->useCount++;
+
+	for (index = 0; index < cache->size; index++)
+	{
+		if (cache->ids[index] == id)
+		{
+			cache->lastUse[index] = cache->useCount;
+			*cached = TRUE;
+			return (int) index;
+		}
+
+		if (cache->lastUse[index] < cache->lastUse[lru])
+			lru = index;
+	}
+
+	cache->ids[lru] = id;
+	cache->lastUse[lru] = cache->useCount;
+
+	return (int) lru;
+}
+
+rdpShadowPointerCache* shadow_pointer_cache_new(UINT32 size)
+{
+	rdpShadowPointerCache* cache;
+
+	cache = (rdpShadowPointerCache*) calloc(1, sizeof(rdpShadowPointerCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->size = size;
+
+	if (size)
+	{
+		cache->ids = (UINT32*) calloc(size, sizeof(UINT32));
+		cache->lastUse = (UINT32*) calloc(size, sizeof(UINT32));
+
+		if (!cache->ids || !cache->lastUse)
+		{
+			shadow_pointer_cache_free(cache);
+			return NULL;
+		}
+	}
+
+	return cache;
+}
+
+void shadow_pointer_cache_free(rdpShadowPointerCache* cache)
+{
+	if (!cache)
+		return;
+
+	free(cache->ids);
+	free(cache->lastUse);
+
+	free(cache);
+}
+
+rdpShadowPointer* shadow_pointer_new(rdpShadowServer* server)
+{
+	rdpShadowPointer* pointer;
+
+	pointer = (rdpShadowPointer*) calloc(1, sizeof(rdpShadowPointer));
+
+	if (!pointer)
+		return NULL;
+
+	pointer->server = server;
+
+	return pointer;
+}
+
+void shadow_pointer_free(rdpShadowPointer* pointer)
+{
+	int index;
+
+	if (!pointer)
+		return;
+
+	for (index = 0; index < SHADOW_POINTER_CACHE_SIZE; index++)
+		shadow_pointer_shape_free(&(pointer->shapes[index]));
+
+	free(pointer);
+}
@@ -0,0 +1,91 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Copyright 2014 Marc-Andre Moreau <marcandre.moreau@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_POINTER_H
+#define FREERDP_SHADOW_SERVER_POINTER_H
+
+#include <freerdp/server/shadow.h>
+#include <freerdp/pointer.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#define SHADOW_POINTER_CACHE_SIZE		32
+#define SHADOW_POINTER_MAX_SIZE			96
+#define SHADOW_POINTER_INPUT_TIMEOUT		500
+
+/**
+ * Pointer shapes are converted to the new pointer update format once and
+ * kept in a server-side cache shared by all clients. Each client has its
+ * own cache of shape ids mirroring the pointer cache negotiated with it,
+ * so that shapes seen before are sent as cached pointer updates.
+ */
+
+struct rdp_shadow_pointer_shape
+{
+	UINT32 id;
+	UINT32 hash;
+	UINT32 lastUse;
+	POINTER_NEW_UPDATE pointerNew;
+};
+typedef struct rdp_shadow_pointer_shape rdpShadowPointerShape;
+
+struct rdp_shadow_pointer
+{
+	rdpShadowServer* server;
+
+	UINT32 x;
+	UINT32 y;
+	BOOL changed;
+	UINT32 nextId;
+	UINT32 useCount;
+	rdpShadowPointerShape* shape;
+	rdpShadowPointerShape shapes[SHADOW_POINTER_CACHE_SIZE];
+};
+
+struct rdp_shadow_pointer_cache
+{
+	UINT32 size;
+	UINT32 useCount;
+	UINT32* ids;
+	UINT32* lastUse;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int shadow_pointer_set_shape(rdpShadowPointer* pointer, BYTE* pixels, int step,
+		int width, int height, int xHot, int yHot);
+int shadow_pointer_set_position(rdpShadowPointer* pointer, int x, int y);
+
+BOOL shadow_pointer_blend_required(rdpShadowServer* server);
+
+int shadow_pointer_cache_get(rdpShadowPointerCache* cache, UINT32 id, BOOL* cached);
+
+rdpShadowPointerCache* shadow_pointer_cache_new(UINT32 size);
+void shadow_pointer_cache_free(rdpShadowPointerCache* cache);
+
+rdpShadowPointer* shadow_pointer_new(rdpShadowServer* server);
+void shadow_pointer_free(rdpShadowPointer* pointer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_POINTER_H */
@@ -45,7 +45,12 @@ rdpShadowScreen* shadow_screen_new(rdpShadowServer* server)
 
 	region16_init(&(screen->invalidRegion));
 
-	primary = &(subsystem->monitors[subsystem->selectedMonitor]);
+	/* all monitors are shared as one surface covering the virtual screen */
+
+	if ((subsystem->selectedMonitor < 0) || (subsystem->selectedMonitor >= subsystem->numMonitors))
+		primary = &(subsystem->virtualScreen);
+	else
+		primary = &(subsystem->monitors[subsystem->selectedMonitor]);
 
 	x = primary->left;
 	y = primary->top;
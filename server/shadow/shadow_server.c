@@ -45,11 +45,14 @@ static COMMAND_LINE_ARGUMENT_A shadow_args[] =
 {
 	{ "port", COMMAND_LINE_VALUE_REQUIRED, "<number>", NULL, NULL, -1, NULL, "Server port" },
 	{ "ipc-socket", COMMAND_LINE_VALUE_REQUIRED, "<ipc-socket>", NULL, NULL, -1, NULL, "Server IPC socket" },
-	{ "monitors", COMMAND_LINE_VALUE_OPTIONAL, "<0,1,2...>", NULL, NULL, -1, NULL, "Select or list monitors" },
+	{ "admin-socket", COMMAND_LINE_VALUE_REQUIRED, "<admin-socket>", NULL, NULL, -1, NULL, "Local socket serving server and client statistics" },
+	{ "subsystem", COMMAND_LINE_VALUE_REQUIRED, "<name>[,<options>]", NULL, NULL, -1, NULL, "Shadow subsystem (Synthetic for generated workloads)" },
+	{ "monitors", COMMAND_LINE_VALUE_OPTIONAL, "<0,1,2...|all>", NULL, NULL, -1, NULL, "Select or list monitors" },
 	{ "rect", COMMAND_LINE_VALUE_REQUIRED, "<x,y,w,h>", NULL, NULL, -1, NULL, "Select rectangle within monitor to share" },
 	{ "auth", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Clients must authenticate" },
 	{ "may-view", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Clients may view without prompt" },
 	{ "may-interact", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Clients may interact without prompt" },
+	{ "bandwidth", COMMAND_LINE_VALUE_REQUIRED, "<kbps>", NULL, NULL, -1, NULL, "Bandwidth target per client, in kbit/s" },
 	{ "version", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_VERSION, NULL, NULL, NULL, -1, NULL, "Print version" },
 	{ "help", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_HELP, NULL, NULL, NULL, -1, "?", "Print help" },
 	{ NULL, 0, NULL, NULL, NULL, -1, NULL, NULL }
@@ -171,10 +174,42 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 		{
 			server->port = (DWORD) atoi(arg->Value);
 		}
+		CommandLineSwitchCase(arg, "bandwidth")
+		{
+			server->maxBandwidth = (UINT32) atoi(arg->Value);
+		}
 		CommandLineSwitchCase(arg, "ipc-socket")
 		{
 			server->ipcSocket = _strdup(arg->Value);
 		}
+		CommandLineSwitchCase(arg, "admin-socket")
+		{
+			server->adminSocket = _strdup(arg->Value);
+		}
+		CommandLineSwitchCase(arg, "subsystem")
+		{
+			char* options;
+
+			free(server->subsystemName);
+			free(server->subsystemOptions);
+			server->subsystemOptions = NULL;
+
+			server->subsystemName = _strdup(arg->Value);
+
+			if (!server->subsystemName)
+				return -1;
+
+			options = strchr(server->subsystemName, ',');
+
+			if (options)
+			{
+				*options++ = '\0';
+				server->subsystemOptions = _strdup(options);
+
+				if (!server->subsystemOptions)
+					return -1;
+			}
+		}
 		CommandLineSwitchCase(arg, "may-view")
 		{
 			server->mayView = arg->Value ? TRUE : FALSE;
@@ -254,15 +289,18 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 		int numMonitors;
 		MONITOR_DEF monitors[16];
 
-		numMonitors = shadow_enum_monitors(monitors, 16, 0);
+		numMonitors = shadow_enum_monitors(monitors, 16, server->subsystemName);
 
 		if (arg->Flags & COMMAND_LINE_VALUE_PRESENT)
 		{
 			/* Select monitors */
 
-			index = atoi(arg->Value);
+			if (strcmp(arg->Value, "all") == 0)
+				index = -1;
+			else
+				index = atoi(arg->Value);
 
-			if (index < 0)
+			if (index < -1)
 				index = 0;
 
 			if (index >= numMonitors)
@@ -372,6 +410,26 @@ int shadow_server_start(rdpShadowServer* server)
 	if (!server->capture)
 		return -1;
 
+	if (shadow_capture_set_outputs(server->capture, server->subsystem->monitors,
+			server->subsystem->numMonitors, server->surface->x, server->surface->y,
+			server->surface->width, server->surface->height) < 0)
+		return -1;
+
+	/* clients are served by a fixed number of threads, however many connect */
+
+	server->loop = freerdp_peer_loop_new(SHADOW_CLIENT_LOOP_THREADS, shadow_client_closed);
+
+	if (!server->loop)
+		return -1;
+
+	if (server->adminSocket)
+	{
+		server->admin = shadow_admin_new(server, server->adminSocket);
+
+		if (!server->admin)
+			return -1;
+	}
+
 	if (!server->ipcSocket)
 		status = server->listener->Open(server->listener, NULL, (UINT16) server->port);
 	else
@@ -398,6 +456,23 @@ int shadow_server_stop(rdpShadowServer* server)
 		server->listener->Close(server->listener);
 	}
 
+	if (server->admin)
+	{
+		shadow_admin_free(server->admin);
+		server->admin = NULL;
+	}
+
+	if (server->loop)
+	{
+		freerdp_peer_loop_free(server->loop);
+		server->loop = NULL;
+	}
+
+	/* the screen surface goes away with the cached encodes of it */
+
+	if (server->cache)
+		shadow_cache_purge(server->cache, NULL);
+
 	if (server->screen)
 	{
 		shadow_screen_free(server->screen);
@@ -536,6 +611,7 @@ int shadow_server_init(rdpShadowServer* server)
 	WTSRegisterWtsApiFunctionTable(FreeRDP_InitWtsApi());
 
 	server->clients = ArrayList_New(TRUE);
+	server->lobbies = ArrayList_New(TRUE);
 
 	server->StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
@@ -559,7 +635,22 @@ int shadow_server_init(rdpShadowServer* server)
 	server->listener->info = (void*) server;
 	server->listener->PeerAccepted = shadow_client_accepted;
 
-	server->subsystem = shadow_subsystem_new(NULL);
+	server->pointer = shadow_pointer_new(server);
+
+	if (!server->pointer)
+		return -1;
+
+	server->cache = shadow_cache_new(server);
+
+	if (!server->cache)
+		return -1;
+
+	server->stats = shadow_stats_new();
+
+	if (!server->stats)
+		return -1;
+
+	server->subsystem = shadow_subsystem_new(server->subsystemName);
 
 	if (!server->subsystem)
 		return -1;
@@ -597,8 +688,35 @@ int shadow_server_uninit(rdpShadowServer* server)
 		server->ipcSocket = NULL;
 	}
 
+	free(server->adminSocket);
+	server->adminSocket = NULL;
+
+	free(server->subsystemName);
+	server->subsystemName = NULL;
+
+	free(server->subsystemOptions);
+	server->subsystemOptions = NULL;
+
 	shadow_subsystem_uninit(server->subsystem);
 
+	if (server->pointer)
+	{
+		shadow_pointer_free(server->pointer);
+		server->pointer = NULL;
+	}
+
+	if (server->cache)
+	{
+		shadow_cache_free(server->cache);
+		server->cache = NULL;
+	}
+
+	if (server->stats)
+	{
+		shadow_stats_free(server->stats);
+		server->stats = NULL;
+	}
+
 	return 1;
 }
 
@@ -637,6 +755,12 @@ void shadow_server_free(rdpShadowServer* server)
 		server->clients = NULL;
 	}
 
+	if (server->lobbies)
+	{
+		ArrayList_Free(server->lobbies);
+		server->lobbies = NULL;
+	}
+
 	shadow_subsystem_free(server->subsystem);
 
 	free(server);
@@ -0,0 +1,802 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/log.h>
+
+#ifndef _WIN32
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "shadow.h"
+
+#include "shadow_stats.h"
+
+#define TAG SERVER_TAG("shadow.stats")
+
+static const char* shadow_stats_codec_names[SHADOW_STATS_CODECS] =
+{
+	"remotefx",
+	"nscodec",
+	"planar",
+	"interleaved",
+	"cached"
+};
+
+/**
+ * Monotonic time in microseconds, the system time of winpr only has a
+ * resolution of a second outside of Windows.
+ */
+
+UINT64 shadow_stats_timestamp(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER counter;
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+
+	return (UINT64) ((counter.QuadPart / frequency.QuadPart) * 1000000) +
+			(UINT64) (((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart);
+#elif defined(__APPLE__)
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return ((UINT64) tv.tv_sec * 1000000) + tv.tv_usec;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((UINT64) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#endif
+}
+
+void shadow_stats_add(LONGLONG volatile* counter, LONGLONG value)
+{
+	LONGLONG current;
+
+	do
+	{
+		current = *counter;
+	}
+	while (InterlockedCompareExchange64(counter, current + value, current) != current);
+}
+
+void shadow_stats_set(LONGLONG volatile* counter, LONGLONG value)
+{
+	LONGLONG current;
+
+	do
+	{
+		current = *counter;
+	}
+	while (InterlockedCompareExchange64(counter, value, current) != current);
+}
+
+LONGLONG shadow_stats_get(LONGLONG volatile* counter)
+{
+	return InterlockedCompareExchange64(counter, 0, 0);
+}
+
+static LONGLONG shadow_stats_elapsed(UINT64 startTime)
+{
+	UINT64 now = shadow_stats_timestamp();
+
+	/* the time of day used on some platforms may be set back */
+	return (now > startTime) ? (LONGLONG) (now - startTime) : 0;
+}
+
+void shadow_stats_capture(rdpShadowServer* server, UINT64 startTime)
+{
+	rdpShadowStats* stats = server->stats;
+
+	if (!stats)
+		return;
+
+	shadow_stats_add(&(stats->captureCount), 1);
+	shadow_stats_add(&(stats->captureTime), shadow_stats_elapsed(startTime));
+}
+
+void shadow_stats_compare(rdpShadowServer* server, UINT64 startTime)
+{
+	rdpShadowStats* stats = server->stats;
+
+	if (!stats)
+		return;
+
+	shadow_stats_add(&(stats->compareTime), shadow_stats_elapsed(startTime));
+}
+
+void shadow_stats_update(rdpShadowServer* server, UINT64 startTime)
+{
+	rdpShadowStats* stats = server->stats;
+
+	if (!stats)
+		return;
+
+	shadow_stats_add(&(stats->updateCount), 1);
+	shadow_stats_add(&(stats->updateTime), shadow_stats_elapsed(startTime));
+}
+
+void shadow_stats_encode(rdpShadowClient* client, int codec, UINT64 startTime, UINT64 bytes)
+{
+	LONGLONG time;
+	rdpShadowStats* stats = client->server->stats;
+	rdpShadowClientStats* clientStats = client->stats;
+
+	if (!stats || !clientStats || (codec < 0) || (codec >= SHADOW_STATS_CODECS))
+		return;
+
+	time = shadow_stats_elapsed(startTime);
+
+	shadow_stats_add(&(clientStats->framesSent), 1);
+	shadow_stats_add(&(clientStats->codecs[codec].frames), 1);
+	shadow_stats_add(&(clientStats->codecs[codec].time), time);
+	shadow_stats_add(&(clientStats->codecs[codec].bytes), (LONGLONG) bytes);
+
+	shadow_stats_add(&(stats->framesSent), 1);
+	shadow_stats_add(&(stats->codecs[codec].frames), 1);
+	shadow_stats_add(&(stats->codecs[codec].time), time);
+	shadow_stats_add(&(stats->codecs[codec].bytes), (LONGLONG) bytes);
+}
+
+void shadow_stats_skip(rdpShadowClient* client)
+{
+	rdpShadowStats* stats = client->server->stats;
+	rdpShadowClientStats* clientStats = client->stats;
+
+	if (!stats || !clientStats)
+		return;
+
+	shadow_stats_add(&(clientStats->framesSkipped), 1);
+	shadow_stats_add(&(stats->framesSkipped), 1);
+}
+
+/**
+ * Sampled on every update: a client is accounted as blocked from the first
+ * update finding its output blocked until the first one finding it drained.
+ */
+
+void shadow_stats_write_blocked(rdpShadowClient* client, BOOL writeBlocked)
+{
+	LONGLONG time;
+	freerdp_peer* peer = client->context.peer;
+	rdpShadowStats* stats = client->server->stats;
+	rdpShadowClientStats* clientStats = client->stats;
+	rdpShadowEncoder* encoder = client->encoder;
+
+	if (!stats || !clientStats)
+		return;
+
+	if (writeBlocked && !clientStats->writeBlockedStart)
+	{
+		clientStats->writeBlockedStart = shadow_stats_timestamp();
+	}
+	else if (!writeBlocked && clientStats->writeBlockedStart)
+	{
+		time = shadow_stats_elapsed(clientStats->writeBlockedStart);
+		clientStats->writeBlockedStart = 0;
+
+		shadow_stats_add(&(clientStats->writeBlockedTime), time);
+		shadow_stats_add(&(stats->writeBlockedTime), time);
+	}
+
+	if (peer->GetOutputBufferSize)
+		shadow_stats_set(&(clientStats->bytesQueued), (LONGLONG) peer->GetOutputBufferSize(peer));
+
+	if (encoder)
+	{
+		shadow_stats_set(&(clientStats->rtt), encoder->rtt);
+		shadow_stats_set(&(clientStats->fps), encoder->fps);
+		shadow_stats_set(&(clientStats->bandwidth), encoder->bandwidth);
+	}
+}
+
+static BOOL shadow_stats_print(wStream* s, const char* format, ...)
+{
+	int length;
+	size_t remaining;
+	va_list args;
+
+	while (1)
+	{
+		remaining = Stream_Capacity(s) - Stream_GetPosition(s);
+
+		va_start(args, format);
+		length = vsnprintf((char*) Stream_Pointer(s), remaining, format, args);
+		va_end(args);
+
+		if (length < 0)
+			return FALSE;
+
+		if ((size_t) length < remaining)
+			break;
+
+		Stream_EnsureRemainingCapacity(s, length + 1);
+
+		if ((Stream_Capacity(s) - Stream_GetPosition(s)) <= (size_t) length)
+			return FALSE;
+	}
+
+	Stream_Seek(s, length);
+
+	return TRUE;
+}
+
+static BOOL shadow_stats_print_value(wStream* s, const char* name, const char* labels, LONGLONG value)
+{
+	return shadow_stats_print(s, "%s%s %lld\n", name, labels, (long long) value);
+}
+
+/* microseconds are written as seconds */
+
+static BOOL shadow_stats_print_time(wStream* s, const char* name, const char* labels, LONGLONG value)
+{
+	return shadow_stats_print(s, "%s%s %lld.%06lld\n", name, labels,
+			(long long) (value / 1000000), (long long) (value % 1000000));
+}
+
+/**
+ * Every metric is written as one group: its type, then its samples for all
+ * codecs or clients, as the exposition format expects.
+ */
+
+struct shadow_stats_metric
+{
+	const char* name;
+	const char* type;
+	BOOL seconds;
+};
+typedef struct shadow_stats_metric SHADOW_STATS_METRIC;
+
+static const SHADOW_STATS_METRIC shadow_stats_server_metrics[] =
+{
+	{ "shadow_uptime_seconds", "gauge", TRUE },
+	{ "shadow_clients", "gauge", FALSE },
+	{ "shadow_clients_accepted_total", "counter", FALSE },
+	{ "shadow_capture_frames_total", "counter", FALSE },
+	{ "shadow_capture_seconds_total", "counter", TRUE },
+	{ "shadow_compare_seconds_total", "counter", TRUE },
+	{ "shadow_update_rounds_total", "counter", FALSE },
+	{ "shadow_update_seconds_total", "counter", TRUE },
+	{ "shadow_frames_sent_total", "counter", FALSE },
+	{ "shadow_frames_skipped_total", "counter", FALSE },
+	{ "shadow_write_blocked_seconds_total", "counter", TRUE },
+	{ "shadow_cache_hits_total", "counter", FALSE },
+	{ "shadow_cache_misses_total", "counter", FALSE }
+};
+
+static const SHADOW_STATS_METRIC shadow_stats_client_metrics[] =
+{
+	{ "shadow_client_activated", "gauge", FALSE },
+	{ "shadow_client_frames_sent_total", "counter", FALSE },
+	{ "shadow_client_frames_skipped_total", "counter", FALSE },
+	{ "shadow_client_write_blocked_seconds_total", "counter", TRUE },
+	{ "shadow_client_bytes_queued", "gauge", FALSE },
+	{ "shadow_client_rtt_seconds", "gauge", TRUE },
+	{ "shadow_client_fps", "gauge", FALSE },
+	{ "shadow_client_bandwidth_bytes", "gauge", FALSE }
+};
+
+static const SHADOW_STATS_METRIC shadow_stats_codec_metrics[] =
+{
+	{ "encode_frames_total", "counter", FALSE },
+	{ "encode_seconds_total", "counter", TRUE },
+	{ "encode_bytes_total", "counter", FALSE }
+};
+
+#define SHADOW_STATS_METRICS(_metrics) ((int) (sizeof(_metrics) / sizeof(_metrics[0])))
+
+static BOOL shadow_stats_print_type(wStream* s, const char* prefix, const SHADOW_STATS_METRIC* metric)
+{
+	return shadow_stats_print(s, "# TYPE %s%s %s\n", prefix, metric->name, metric->type);
+}
+
+static BOOL shadow_stats_print_metric(wStream* s, const char* prefix, const SHADOW_STATS_METRIC* metric,
+		const char* labels, LONGLONG value)
+{
+	char name[96];
+
+	sprintf_s(name, sizeof(name), "%s%s", prefix, metric->name);
+
+	if (metric->seconds)
+		return shadow_stats_print_time(s, name, labels, value);
+
+	return shadow_stats_print_value(s, name, labels, value);
+}
+
+static LONGLONG shadow_stats_server_value(rdpShadowServer* server, int metric)
+{
+	rdpShadowStats* stats = server->stats;
+
+	switch (metric)
+	{
+		case 0:
+			return shadow_stats_elapsed(stats->startTime);
+		case 1:
+			return ArrayList_Count(server->clients);
+		case 2:
+			return shadow_stats_get(&(stats->clientsAccepted));
+		case 3:
+			return shadow_stats_get(&(stats->captureCount));
+		case 4:
+			return shadow_stats_get(&(stats->captureTime));
+		case 5:
+			return shadow_stats_get(&(stats->compareTime));
+		case 6:
+			return shadow_stats_get(&(stats->updateCount));
+		case 7:
+			return shadow_stats_get(&(stats->updateTime));
+		case 8:
+			return shadow_stats_get(&(stats->framesSent));
+		case 9:
+			return shadow_stats_get(&(stats->framesSkipped));
+		case 10:
+			return shadow_stats_get(&(stats->writeBlockedTime));
+		case 11:
+			return server->cache ? shadow_cache_hits(server->cache) : 0;
+		case 12:
+			return server->cache ? shadow_cache_misses(server->cache) : 0;
+	}
+
+	return 0;
+}
+
+static LONGLONG shadow_stats_client_value(rdpShadowClient* client, int metric)
+{
+	rdpShadowClientStats* stats = client->stats;
+
+	switch (metric)
+	{
+		case 0:
+			return client->activated ? 1 : 0;
+		case 1:
+			return shadow_stats_get(&(stats->framesSent));
+		case 2:
+			return shadow_stats_get(&(stats->framesSkipped));
+		case 3:
+			return shadow_stats_get(&(stats->writeBlockedTime));
+		case 4:
+			return shadow_stats_get(&(stats->bytesQueued));
+		case 5:
+			/* rtt is in milliseconds */
+			return shadow_stats_get(&(stats->rtt)) * 1000;
+		case 6:
+			return shadow_stats_get(&(stats->fps));
+		case 7:
+			return shadow_stats_get(&(stats->bandwidth));
+	}
+
+	return 0;
+}
+
+static LONGLONG shadow_stats_codec_value(rdpShadowCodecStats* codec, int metric)
+{
+	switch (metric)
+	{
+		case 0:
+			return shadow_stats_get(&(codec->frames));
+		case 1:
+			return shadow_stats_get(&(codec->time));
+		case 2:
+			return shadow_stats_get(&(codec->bytes));
+	}
+
+	return 0;
+}
+
+static void shadow_stats_client_labels(rdpShadowClient* client, char* labels, size_t size)
+{
+	freerdp_peer* peer = client->context.peer;
+
+	sprintf_s(labels, size, "client=\"%lld\",host=\"%s\"",
+			(long long) client->stats->id, peer ? peer->hostname : "");
+}
+
+static BOOL shadow_stats_write_codecs(rdpShadowServer* server, wStream* s, int metric)
+{
+	int index;
+	int codec;
+	char labels[96];
+	char codecLabels[160];
+	rdpShadowClient* client;
+	const SHADOW_STATS_METRIC* codecMetric = &shadow_stats_codec_metrics[metric];
+
+	if (!shadow_stats_print_type(s, "shadow_", codecMetric))
+		return FALSE;
+
+	for (codec = 0; codec < SHADOW_STATS_CODECS; codec++)
+	{
+		sprintf_s(codecLabels, sizeof(codecLabels), "{codec=\"%s\"}", shadow_stats_codec_names[codec]);
+
+		if (!shadow_stats_print_metric(s, "shadow_", codecMetric, codecLabels,
+				shadow_stats_codec_value(&(server->stats->codecs[codec]), metric)))
+			return FALSE;
+	}
+
+	if (!shadow_stats_print_type(s, "shadow_client_", codecMetric))
+		return FALSE;
+
+	for (index = 0; index < ArrayList_Count(server->clients); index++)
+	{
+		client = (rdpShadowClient*) ArrayList_GetItem(server->clients, index);
+
+		if (!client->stats)
+			continue;
+
+		shadow_stats_client_labels(client, labels, sizeof(labels));
+
+		for (codec = 0; codec < SHADOW_STATS_CODECS; codec++)
+		{
+			sprintf_s(codecLabels, sizeof(codecLabels), "{%s,codec=\"%s\"}", labels,
+					shadow_stats_codec_names[codec]);
+
+			if (!shadow_stats_print_metric(s, "shadow_client_", codecMetric, codecLabels,
+					shadow_stats_codec_value(&(client->stats->codecs[codec]), metric)))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL shadow_stats_write_clients(rdpShadowServer* server, wStream* s)
+{
+	int index;
+	int metric;
+	char labels[96];
+	char clientLabels[128];
+	rdpShadowClient* client;
+	const SHADOW_STATS_METRIC* clientMetric;
+
+	for (metric = 0; metric < SHADOW_STATS_METRICS(shadow_stats_client_metrics); metric++)
+	{
+		clientMetric = &shadow_stats_client_metrics[metric];
+
+		if (!shadow_stats_print_type(s, "", clientMetric))
+			return FALSE;
+
+		for (index = 0; index < ArrayList_Count(server->clients); index++)
+		{
+			client = (rdpShadowClient*) ArrayList_GetItem(server->clients, index);
+
+			if (!client->stats)
+				continue;
+
+			shadow_stats_client_labels(client, labels, sizeof(labels));
+			sprintf_s(clientLabels, sizeof(clientLabels), "{%s}", labels);
+
+			if (!shadow_stats_print_metric(s, "", clientMetric, clientLabels,
+					shadow_stats_client_value(client, metric)))
+				return FALSE;
+		}
+	}
+
+	for (metric = 0; metric < SHADOW_STATS_METRICS(shadow_stats_codec_metrics); metric++)
+	{
+		if (!shadow_stats_write_codecs(server, s, metric))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Writes a snapshot of the server and client counters in the Prometheus
+ * text exposition format. Counters are consistent one by one, not as a set.
+ */
+
+BOOL shadow_stats_write(rdpShadowServer* server, wStream* s)
+{
+	int metric;
+	BOOL status;
+	const SHADOW_STATS_METRIC* serverMetric;
+
+	if (!server->stats)
+		return FALSE;
+
+	for (metric = 0; metric < SHADOW_STATS_METRICS(shadow_stats_server_metrics); metric++)
+	{
+		serverMetric = &shadow_stats_server_metrics[metric];
+
+		if (!shadow_stats_print_type(s, "", serverMetric) ||
+				!shadow_stats_print_metric(s, "", serverMetric, "", shadow_stats_server_value(server, metric)))
+			return FALSE;
+	}
+
+	/* clients free their counters once removed from the list */
+
+	ArrayList_Lock(server->clients);
+	status = shadow_stats_write_clients(server, s);
+	ArrayList_Unlock(server->clients);
+
+	return status;
+}
+
+rdpShadowStats* shadow_stats_new(void)
+{
+	rdpShadowStats* stats;
+
+	stats = (rdpShadowStats*) calloc(1, sizeof(rdpShadowStats));
+
+	if (!stats)
+		return NULL;
+
+	stats->startTime = (LONGLONG) shadow_stats_timestamp();
+
+	return stats;
+}
+
+void shadow_stats_free(rdpShadowStats* stats)
+{
+	free(stats);
+}
+
+rdpShadowClientStats* shadow_client_stats_new(rdpShadowServer* server)
+{
+	rdpShadowClientStats* stats;
+
+	stats = (rdpShadowClientStats*) calloc(1, sizeof(rdpShadowClientStats));
+
+	if (!stats)
+		return NULL;
+
+	if (server->stats)
+	{
+		shadow_stats_add(&(server->stats->clientsAccepted), 1);
+		stats->id = shadow_stats_get(&(server->stats->clientsAccepted));
+	}
+
+	return stats;
+}
+
+void shadow_client_stats_free(rdpShadowClientStats* stats)
+{
+	free(stats);
+}
+
+/**
+ * The admin endpoint is a local socket, every connection to it is sent
+ * a snapshot of the counters and closed.
+ */
+
+#ifndef _WIN32
+
+static void shadow_admin_send(rdpShadowAdmin* admin, int fd)
+{
+	int status;
+	size_t offset = 0;
+	size_t length;
+	wStream* s = admin->s;
+
+	Stream_SetPosition(s, 0);
+
+	if (!shadow_stats_write(admin->server, s))
+	{
+		WLog_ERR(TAG, "failed to write stats");
+		return;
+	}
+
+	length = Stream_GetPosition(s);
+
+	while (offset < length)
+	{
+		status = send(fd, &(Stream_Buffer(s)[offset]), length - offset, 0);
+
+		if (status <= 0)
+			break;
+
+		offset += status;
+	}
+}
+
+static void* shadow_admin_thread(rdpShadowAdmin* admin)
+{
+	int fd;
+	DWORD status;
+	HANDLE events[2];
+	struct timeval timeout;
+
+	events[0] = admin->StopEvent;
+	events[1] = admin->event;
+
+	while (1)
+	{
+		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+
+		if (status != (WAIT_OBJECT_0 + 1))
+			break;
+
+		fd = accept(admin->sockfd, NULL, NULL);
+
+		if (fd < 0)
+			continue;
+
+		/* a reader that does not read does not hold the endpoint */
+
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		shadow_admin_send(admin, fd);
+
+		close(fd);
+	}
+
+	ExitThread(0);
+
+	return NULL;
+}
+
+static BOOL shadow_admin_open(rdpShadowAdmin* admin)
+{
+	int status;
+	mode_t mask;
+	struct stat st;
+	struct sockaddr_un addr;
+
+	if (strlen(admin->path) >= sizeof(addr.sun_path))
+	{
+		WLog_ERR(TAG, "admin socket path too long: %s", admin->path);
+		return FALSE;
+	}
+
+	/* only replace the socket left behind by a previous server */
+
+	if (lstat(admin->path, &st) == 0)
+	{
+		if (!S_ISSOCK(st.st_mode))
+		{
+			WLog_ERR(TAG, "admin socket path exists and is not a socket: %s", admin->path);
+			return FALSE;
+		}
+
+		unlink(admin->path);
+	}
+
+	admin->sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (admin->sockfd == -1)
+	{
+		WLog_ERR(TAG, "socket");
+		return FALSE;
+	}
+
+	fcntl(admin->sockfd, F_SETFL, O_NONBLOCK);
+
+	ZeroMemory(&addr, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, admin->path, sizeof(addr.sun_path) - 1);
+
+	/* the counters tell about the sessions, only the owner may read them */
+
+	mask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+	status = bind(admin->sockfd, (struct sockaddr*) &addr, sizeof(addr));
+	umask(mask);
+
+	if (status != 0)
+	{
+		WLog_ERR(TAG, "bind");
+		close(admin->sockfd);
+		admin->sockfd = -1;
+		return FALSE;
+	}
+
+	if (listen(admin->sockfd, 10) != 0)
+	{
+		WLog_ERR(TAG, "listen");
+		return FALSE;
+	}
+
+	admin->event = CreateFileDescriptorEvent(NULL, FALSE, FALSE, admin->sockfd);
+
+	if (!admin->event)
+		return FALSE;
+
+	WLog_INFO(TAG, "Admin socket listening on %s", admin->path);
+
+	return TRUE;
+}
+
+#endif
+
+rdpShadowAdmin* shadow_admin_new(rdpShadowServer* server, const char* path)
+{
+	rdpShadowAdmin* admin;
+
+	admin = (rdpShadowAdmin*) calloc(1, sizeof(rdpShadowAdmin));
+
+	if (!admin)
+		return NULL;
+
+	admin->server = server;
+	admin->sockfd = -1;
+
+#ifndef _WIN32
+	admin->path = _strdup(path);
+	admin->s = Stream_New(NULL, 4096);
+	admin->StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (!admin->path || !admin->s || !admin->StopEvent || !shadow_admin_open(admin))
+	{
+		shadow_admin_free(admin);
+		return NULL;
+	}
+
+	admin->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)
+			shadow_admin_thread, (void*) admin, 0, NULL);
+
+	if (!admin->thread)
+	{
+		shadow_admin_free(admin);
+		return NULL;
+	}
+#else
+	WLog_ERR(TAG, "admin socket not supported on this platform");
+	shadow_admin_free(admin);
+	admin = NULL;
+#endif
+
+	return admin;
+}
+
+void shadow_admin_free(rdpShadowAdmin* admin)
+{
+	if (!admin)
+		return;
+
+	if (admin->thread)
+	{
+		SetEvent(admin->StopEvent);
+		WaitForSingleObject(admin->thread, INFINITE);
+		CloseHandle(admin->thread);
+	}
+
+	if (admin->event)
+		CloseHandle(admin->event);
+
+	if (admin->StopEvent)
+		CloseHandle(admin->StopEvent);
+
+#ifndef _WIN32
+	if (admin->sockfd != -1)
+	{
+		close(admin->sockfd);
+		unlink(admin->path);
+	}
+#endif
+
+	Stream_Free(admin->s, TRUE);
+	free(admin->path);
+	free(admin);
+}
@@ -0,0 +1,129 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_STATS_H
+#define FREERDP_SHADOW_SERVER_STATS_H
+
+#include <freerdp/server/shadow.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/stream.h>
+
+#define SHADOW_STATS_REMOTEFX		0
+#define SHADOW_STATS_NSCODEC		1
+#define SHADOW_STATS_PLANAR		2
+#define SHADOW_STATS_INTERLEAVED	3
+#define SHADOW_STATS_CACHED		4
+#define SHADOW_STATS_CODECS		5
+
+/**
+ * Counters are updated with interlocked operations by the threads doing the
+ * work and read the same way by the admin endpoint, which never blocks them.
+ * Times are in microseconds, the counters of a client are also added to the
+ * totals of the server, which outlive the client.
+ */
+
+struct rdp_shadow_codec_stats
+{
+	LONGLONG frames;
+	LONGLONG time;
+	LONGLONG bytes;
+};
+typedef struct rdp_shadow_codec_stats rdpShadowCodecStats;
+
+struct rdp_shadow_client_stats
+{
+	LONGLONG id;
+
+	LONGLONG framesSent;
+	LONGLONG framesSkipped;
+	LONGLONG writeBlockedTime;
+	rdpShadowCodecStats codecs[SHADOW_STATS_CODECS];
+
+	/* gauges, bytes queued for sending, rtt in ms and bandwidth in bytes per second */
+	LONGLONG bytesQueued;
+	LONGLONG rtt;
+	LONGLONG fps;
+	LONGLONG bandwidth;
+
+	/* only used by the client thread */
+	UINT64 writeBlockedStart;
+};
+
+struct rdp_shadow_stats
+{
+	LONGLONG startTime;
+	LONGLONG clientsAccepted;
+
+	LONGLONG captureCount;
+	LONGLONG captureTime;
+	LONGLONG compareTime;
+	LONGLONG updateCount;
+	LONGLONG updateTime;
+
+	LONGLONG framesSent;
+	LONGLONG framesSkipped;
+	LONGLONG writeBlockedTime;
+	rdpShadowCodecStats codecs[SHADOW_STATS_CODECS];
+};
+
+struct rdp_shadow_admin
+{
+	rdpShadowServer* server;
+
+	char* path;
+	int sockfd;
+	HANDLE event;
+	HANDLE thread;
+	HANDLE StopEvent;
+	wStream* s;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+UINT64 shadow_stats_timestamp(void);
+
+void shadow_stats_add(LONGLONG volatile* counter, LONGLONG value);
+void shadow_stats_set(LONGLONG volatile* counter, LONGLONG value);
+LONGLONG shadow_stats_get(LONGLONG volatile* counter);
+
+void shadow_stats_capture(rdpShadowServer* server, UINT64 startTime);
+void shadow_stats_compare(rdpShadowServer* server, UINT64 startTime);
+void shadow_stats_update(rdpShadowServer* server, UINT64 startTime);
+
+void shadow_stats_encode(rdpShadowClient* client, int codec, UINT64 startTime, UINT64 bytes);
+void shadow_stats_skip(rdpShadowClient* client);
+void shadow_stats_write_blocked(rdpShadowClient* client, BOOL writeBlocked);
+
+BOOL shadow_stats_write(rdpShadowServer* server, wStream* s);
+
+rdpShadowStats* shadow_stats_new(void);
+void shadow_stats_free(rdpShadowStats* stats);
+
+rdpShadowClientStats* shadow_client_stats_new(rdpShadowServer* server);
+void shadow_client_stats_free(rdpShadowClientStats* stats);
+
+rdpShadowAdmin* shadow_admin_new(rdpShadowServer* server, const char* path);
+void shadow_admin_free(rdpShadowAdmin* admin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_STATS_H */
@@ -20,10 +20,14 @@
 #include "config.h"
 #endif
 
+#include <freerdp/log.h>
+
 #include "shadow.h"
 
 #include "shadow_subsystem.h"
 
+#define TAG SERVER_TAG("shadow")
+
 struct _RDP_SHADOW_SUBSYSTEM
 {
 	const char* name;
@@ -44,6 +48,8 @@ extern int Mac_ShadowSubsystemEntry(RDP_SHADOW_ENTRY_POINTS* pEntryPoints);
 extern int Win_ShadowSubsystemEntry(RDP_SHADOW_ENTRY_POINTS* pEntryPoints);
 #endif
 
+extern int Synthetic_ShadowSubsystemEntry(RDP_SHADOW_ENTRY_POINTS* pEntryPoints);
+
 
 static RDP_SHADOW_SUBSYSTEM g_Subsystems[] =
 {
@@ -65,6 +71,9 @@ static RDP_SHADOW_SUBSYSTEM g_Subsystems[] =
 
 static int g_SubsystemCount = (sizeof(g_Subsystems) / sizeof(g_Subsystems[0]));
 
+/* never the default, only selected by name */
+static RDP_SHADOW_SUBSYSTEM g_SyntheticSubsystem = { "Synthetic", Synthetic_ShadowSubsystemEntry };
+
 pfnShadowSubsystemEntry shadow_subsystem_load_static_entry(const char* name)
 {
 	int index;
@@ -76,14 +85,19 @@ pfnShadowSubsystemEntry shadow_subsystem_load_static_entry(const char* name)
 			if (g_Subsystems[index].name)
 				return g_Subsystems[index].entry;
 		}
+
+		return NULL;
 	}
 
 	for (index = 0; index < g_SubsystemCount; index++)
 	{
-		if (strcmp(name, g_Subsystems[index].name) == 0)
+		if (_stricmp(name, g_Subsystems[index].name) == 0)
 			return g_Subsystems[index].entry;
 	}
 
+	if (_stricmp(name, g_SyntheticSubsystem.name) == 0)
+		return g_SyntheticSubsystem.entry;
+
 	return NULL;
 }
 
@@ -109,7 +123,11 @@ rdpShadowSubsystem* shadow_subsystem_new(const char* name)
 	RDP_SHADOW_ENTRY_POINTS ep;
 	rdpShadowSubsystem* subsystem = NULL;
 
-	shadow_subsystem_load_entry_points(&ep, name);
+	if (shadow_subsystem_load_entry_points(&ep, name) < 0)
+	{
+		WLog_ERR(TAG, "unknown shadow subsystem: %s", name ? name : "(default)");
+		return NULL;
+	}
 
 	if (!ep.New)
 		return NULL;
@@ -138,7 +156,7 @@ int shadow_subsystem_init(rdpShadowSubsystem* subsystem, rdpShadowServer* server
 	subsystem->selectedMonitor = server->selectedMonitor;
 
 	subsystem->MsgPipe = MessagePipe_New();
-	subsystem->updateEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	subsystem->updateDoneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 	region16_init(&(subsystem->invalidRegion));
 
@@ -161,10 +179,10 @@ void shadow_subsystem_uninit(rdpShadowSubsystem* subsystem)
 		subsystem->MsgPipe = NULL;
 	}
 
-	if (subsystem->updateEvent)
+	if (subsystem->updateDoneEvent)
 	{
-		CloseHandle(subsystem->updateEvent);
-		subsystem->updateEvent = NULL;
+		CloseHandle(subsystem->updateDoneEvent);
+		subsystem->updateDoneEvent = NULL;
 	}
 
 	if (subsystem->invalidRegion.data)
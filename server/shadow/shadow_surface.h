@@ -35,6 +35,12 @@ struct rdp_shadow_surface
 	int scanline;
 	BYTE* data;
 
+	/* changes along with the content, cached encodes are kept per version */
+	UINT32 version;
+
+	/* lobby surfaces are shared by the clients of the same size */
+	int refCount;
+
 	CRITICAL_SECTION lock;
 	REGION16 invalidRegion;
 };
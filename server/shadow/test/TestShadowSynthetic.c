@@ -0,0 +1,350 @@
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/server/shadow.h>
+
+#ifndef _WIN32
+#include <sys/select.h>
+#endif
+
+#include "../shadow.h"
+
+/**
+ * Runs the shadow server on the synthetic subsystem and connects loopback
+ * clients to it, then reports the frame rate, encoding time and size of
+ * each workload as seen by the server.
+ *
+ * Usage: TestShadowSynthetic [<subsystem options> [<clients> [<seconds>]]]
+ */
+
+#define TEST_SHADOW_PORT		33890
+#define TEST_SHADOW_CLIENTS		2
+#define TEST_SHADOW_SECONDS		3
+#define TEST_SHADOW_MAX_CLIENTS		32
+
+static const char* g_Workloads[] =
+{
+	"idle",
+	"scroll",
+	"video",
+	"drag"
+};
+
+static BOOL g_Measure = FALSE;
+
+struct test_shadow_context
+{
+	rdpContext _p;
+
+	HANDLE thread;
+	HANDLE StopEvent;
+	HANDLE ConnectEvent;
+	DWORD port;
+	BOOL failed;
+	UINT64 bytes;
+};
+typedef struct test_shadow_context testShadowContext;
+
+static void test_shadow_surface_bits(rdpContext* context, SURFACE_BITS_COMMAND* cmd)
+{
+	if (g_Measure)
+		((testShadowContext*) context)->bytes += cmd->bitmapDataLength;
+}
+
+static void test_shadow_surface_frame_marker(rdpContext* context, SURFACE_FRAME_MARKER* marker)
+{
+	if ((marker->frameAction == SURFACECMD_FRAMEACTION_END) && (context->settings->FrameAcknowledge > 0))
+		IFCALL(context->update->SurfaceFrameAcknowledge, context, marker->frameId);
+}
+
+static void test_shadow_bitmap_update(rdpContext* context, BITMAP_UPDATE* bitmap)
+{
+	UINT32 index;
+
+	if (!g_Measure)
+		return;
+
+	for (index = 0; index < bitmap->number; index++)
+		((testShadowContext*) context)->bytes += bitmap->rectangles[index].bitmapLength;
+}
+
+static BOOL test_shadow_post_connect(freerdp* instance)
+{
+	rdpUpdate* update = instance->update;
+
+	update->SurfaceBits = test_shadow_surface_bits;
+	update->SurfaceFrameMarker = test_shadow_surface_frame_marker;
+	update->BitmapUpdate = test_shadow_bitmap_update;
+
+	return TRUE;
+}
+
+static void* test_shadow_client_thread(freerdp* instance)
+{
+	int i;
+	int fd;
+	int maxfd;
+	int rcount;
+	int wcount;
+	void* rfds[32];
+	void* wfds[32];
+	fd_set rfds_set;
+	struct timeval timeout;
+	testShadowContext* context = (testShadowContext*) instance->context;
+
+	if (!freerdp_connect(instance))
+	{
+		context->failed = TRUE;
+		SetEvent(context->ConnectEvent);
+		ExitThread(0);
+		return NULL;
+	}
+
+	SetEvent(context->ConnectEvent);
+
+	while (WaitForSingleObject(context->StopEvent, 0) != WAIT_OBJECT_0)
+	{
+		rcount = wcount = 0;
+
+		if (!freerdp_get_fds(instance, rfds, &rcount, wfds, &wcount))
+		{
+			context->failed = TRUE;
+			break;
+		}
+
+		maxfd = 0;
+		FD_ZERO(&rfds_set);
+
+		for (i = 0; i < rcount; i++)
+		{
+			fd = (int)(long) rfds[i];
+
+			if (fd > maxfd)
+				maxfd = fd;
+
+			FD_SET(fd, &rfds_set);
+		}
+
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100 * 1000;
+
+		if (select(maxfd + 1, &rfds_set, NULL, NULL, &timeout) < 0)
+			continue;
+
+		if (!freerdp_check_fds(instance))
+		{
+			context->failed = TRUE;
+			break;
+		}
+	}
+
+	freerdp_disconnect(instance);
+
+	ExitThread(0);
+	return NULL;
+}
+
+static freerdp* test_shadow_client_new(DWORD port)
+{
+	freerdp* instance;
+	rdpSettings* settings;
+	testShadowContext* context;
+
+	instance = freerdp_new();
+
+	if (!instance)
+		return NULL;
+
+	instance->PostConnect = test_shadow_post_connect;
+	instance->ContextSize = sizeof(testShadowContext);
+
+	if (freerdp_context_new(instance) != 0)
+	{
+		freerdp_free(instance);
+		return NULL;
+	}
+
+	context = (testShadowContext*) instance->context;
+	context->port = port;
+	context->StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	context->ConnectEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	settings = instance->settings;
+	settings->ServerHostname = _strdup("127.0.0.1");
+	settings->ServerPort = port;
+	settings->IgnoreCertificate = TRUE;
+	settings->NlaSecurity = FALSE;
+	settings->ColorDepth = 32;
+	settings->RemoteFxCodec = TRUE;
+	settings->FastPathOutput = TRUE;
+	settings->SurfaceCommandsEnabled = TRUE;
+	settings->FrameMarkerCommandEnabled = TRUE;
+	settings->SurfaceFrameMarkerEnabled = TRUE;
+
+	context->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)
+			test_shadow_client_thread, instance, 0, NULL);
+
+	return instance;
+}
+
+static BOOL test_shadow_client_free(freerdp* instance)
+{
+	BOOL failed;
+	testShadowContext* context = (testShadowContext*) instance->context;
+
+	SetEvent(context->StopEvent);
+
+	if (context->thread)
+	{
+		WaitForSingleObject(context->thread, INFINITE);
+		CloseHandle(context->thread);
+	}
+
+	failed = context->failed;
+
+	CloseHandle(context->StopEvent);
+	CloseHandle(context->ConnectEvent);
+
+	freerdp_context_free(instance);
+	freerdp_free(instance);
+
+	return failed ? FALSE : TRUE;
+}
+
+static void test_shadow_encoder_stats(rdpShadowServer* server, UINT64* frames, UINT64* time, UINT64* bytes)
+{
+	int index;
+	rdpShadowClient* client;
+
+	*frames = *time = *bytes = 0;
+
+	ArrayList_Lock(server->clients);
+
+	for (index = 0; index < ArrayList_Count(server->clients); index++)
+	{
+		client = (rdpShadowClient*) ArrayList_GetItem(server->clients, index);
+
+		*frames += client->encoder->frameCount;
+		*time += client->encoder->encodeTime;
+		*bytes += client->encoder->encodedBytes;
+	}
+
+	ArrayList_Unlock(server->clients);
+}
+
+static int test_shadow_run(const char* options, DWORD port, int numClients, int seconds)
+{
+	int index;
+	int status = -1;
+	UINT64 received = 0;
+	UINT64 frames[2], time[2], bytes[2];
+	rdpShadowServer* server;
+	freerdp* clients[TEST_SHADOW_MAX_CLIENTS] = { NULL };
+
+	server = shadow_server_new();
+
+	if (!server)
+		return -1;
+
+	server->port = port;
+	server->authentication = FALSE;
+	server->subsystemName = _strdup("Synthetic");
+	server->subsystemOptions = _strdup(options);
+
+	if ((shadow_server_init(server) < 0) || (shadow_server_start(server) < 0))
+	{
+		printf("%s: failed to start the shadow server\n", options);
+		goto out;
+	}
+
+	for (index = 0; index < numClients; index++)
+	{
+		clients[index] = test_shadow_client_new(port);
+
+		if (!clients[index])
+			goto out;
+	}
+
+	for (index = 0; index < numClients; index++)
+	{
+		testShadowContext* context = (testShadowContext*) clients[index]->context;
+
+		if ((WaitForSingleObject(context->ConnectEvent, 10000) != WAIT_OBJECT_0) || context->failed)
+		{
+			printf("%s: client %d failed to connect\n", options, index);
+			goto out;
+		}
+	}
+
+	/* leave the initial full screen updates out of the measurement */
+	Sleep(1000);
+
+	test_shadow_encoder_stats(server, &frames[0], &time[0], &bytes[0]);
+	g_Measure = TRUE;
+
+	Sleep(seconds * 1000);
+
+	g_Measure = FALSE;
+	test_shadow_encoder_stats(server, &frames[1], &time[1], &bytes[1]);
+
+	for (index = 0; index < numClients; index++)
+		received += ((testShadowContext*) clients[index]->context)->bytes;
+
+	frames[1] -= frames[0];
+	time[1] -= time[0];
+	bytes[1] -= bytes[0];
+
+	printf("%-24s %d clients: %6.1f fps %8.2f ms/frame %10d bytes/frame %10d bytes received\n",
+			options, numClients, (double) frames[1] / (numClients * seconds),
+			frames[1] ? (double) time[1] / (frames[1] * 1000) : 0.0,
+			frames[1] ? (int) (bytes[1] / frames[1]) : 0, (int) received);
+
+	status = 0;
+
+out:
+	for (index = 0; index < numClients; index++)
+	{
+		if (clients[index] && !test_shadow_client_free(clients[index]))
+			status = -1;
+	}
+
+	/* wait for the server side of the connections to go away */
+	for (index = 0; (index < 100) && server->clients && (ArrayList_Count(server->clients) > 0); index++)
+		Sleep(100);
+
+	shadow_server_uninit(server);
+	shadow_server_free(server);
+
+	return status;
+}
+
+int TestShadowSynthetic(int argc, char* argv[])
+{
+	int index;
+	int seconds = TEST_SHADOW_SECONDS;
+	int numClients = TEST_SHADOW_CLIENTS;
+
+	if (argc > 2)
+		numClients = atoi(argv[2]);
+
+	if (argc > 3)
+		seconds = atoi(argv[3]);
+
+	if ((numClients < 1) || (numClients > TEST_SHADOW_MAX_CLIENTS) || (seconds < 1))
+		return -1;
+
+	if (argc > 1)
+		return test_shadow_run(argv[1], TEST_SHADOW_PORT, numClients, seconds);
+
+	for (index = 0; index < (sizeof(g_Workloads) / sizeof(g_Workloads[0])); index++)
+	{
+		if (test_shadow_run(g_Workloads[index], TEST_SHADOW_PORT + index, numClients, seconds) < 0)
+			return -1;
+	}
+
+	return 0;
+}
@@ -335,17 +335,31 @@ typedef void* (*HASH_TABLE_VALUE_CLONE_FN)(void* value);
 typedef void (*HASH_TABLE_KEY_FREE_FN)(void* key);
 typedef void (*HASH_TABLE_VALUE_FREE_FN)(void* value);
 
+struct _wHashTableSlot
+{
+	void* key;
+	void* value;
+	UINT32 hash;
+	UINT32 distance;
+};
+typedef struct _wHashTableSlot wHashTableSlot;
+
 struct _wHashTable
 {
 	BOOL synchronized;
 	CRITICAL_SECTION lock;
 
-	int numOfBuckets;
 	int numOfElements;
-	float idealRatio;
-	float lowerRehashThreshold;
-	float upperRehashThreshold;
-	wKeyValuePair** bucketArray;
+
+	int numOfSlots;
+	int shift;
+	wHashTableSlot* slots;
+
+	int numOfOldSlots;
+	int oldShift;
+	int oldElements;
+	int rehashIndex;
+	wHashTableSlot* oldSlots;
 
 	HASH_TABLE_HASH_FN hash;
 	HASH_TABLE_KEY_COMPARE_FN keyCompare;
@@ -357,6 +371,16 @@ struct _wHashTable
 };
 typedef struct _wHashTable wHashTable;
 
+struct _wHashTableEnumerator
+{
+	wHashTable* table;
+	int index;
+
+	void* key;
+	void* value;
+};
+typedef struct _wHashTableEnumerator wHashTableEnumerator;
+
 WINPR_API int HashTable_Count(wHashTable* table);
 WINPR_API int HashTable_Add(wHashTable* table, void* key, void* value);
 WINPR_API BOOL HashTable_Remove(wHashTable* table, void* key);
@@ -368,6 +392,9 @@ WINPR_API void* HashTable_GetItemValue(wHashTable* table, void* key);
 WINPR_API BOOL HashTable_SetItemValue(wHashTable* table, void* key, void* value);
 WINPR_API int HashTable_GetKeys(wHashTable* table, ULONG_PTR** ppKeys);
 
+WINPR_API void HashTable_Enumerator_Reset(wHashTable* table, wHashTableEnumerator* enumerator);
+WINPR_API BOOL HashTable_Enumerator_MoveNext(wHashTableEnumerator* enumerator);
+
 WINPR_API UINT32 HashTable_PointerHash(void* pointer);
 WINPR_API BOOL HashTable_PointerCompare(void* pointer1, void* pointer2);
 
@@ -388,6 +415,8 @@ struct _wBufferPoolItem
 };
 typedef struct _wBufferPoolItem wBufferPoolItem;
 
+typedef struct _wBufferPoolCache wBufferPoolCache;
+
 struct _wBufferPool
 {
 	int fixedSize;
@@ -406,9 +435,33 @@ struct _wBufferPool
 	int uSize;
 	int uCapacity;
 	wBufferPoolItem* uArray;
+
+	DWORD flags;
+	DWORD cacheIndex;
+	int magazineSize;
+	wBufferPoolCache* caches;
+	UINT64 retiredHits;
+	UINT64 retiredRefills;
+	UINT64 retiredFlushes;
 };
 typedef struct _wBufferPool wBufferPool;
 
+/**
+ * BUFFER_POOL_FLAG_THREAD_CACHE: each thread keeps a small cache of
+ * buffers for synchronized fixed size pools. Buffers are moved between
+ * the thread cache and the shared pool in magazines of magazineSize
+ * buffers, so that most takes and returns do not enter the pool lock.
+ */
+#define BUFFER_POOL_FLAG_THREAD_CACHE	0x00000001
+
+struct _wBufferPoolStats
+{
+	UINT64 cacheHits;
+	UINT64 refills;
+	UINT64 flushes;
+};
+typedef struct _wBufferPoolStats wBufferPoolStats;
+
 WINPR_API int BufferPool_GetPoolSize(wBufferPool* pool);
 WINPR_API int BufferPool_GetBufferSize(wBufferPool* pool, void* buffer);
 
@@ -416,7 +469,22 @@ WINPR_API void* BufferPool_Take(wBufferPool* pool, int bufferSize);
 WINPR_API BOOL BufferPool_Return(wBufferPool* pool, void* buffer);
 WINPR_API void BufferPool_Clear(wBufferPool* pool);
 
+/*! \brief Gets the thread cache statistics of a pool.
+ *
+ * cacheHits counts takes and returns served by a thread cache, refills
+ * and flushes count the magazines moved from and to the shared pool.
+ */
+WINPR_API void BufferPool_GetStats(wBufferPool* pool, wBufferPoolStats* stats);
+
 WINPR_API wBufferPool* BufferPool_New(BOOL synchronized, int fixedSize, DWORD alignment);
+
+/*! \brief Creates a new buffer pool with the given BUFFER_POOL_FLAG_* flags.
+ *
+ * \param magazineSize number of buffers moved at once between a thread
+ *                     cache and the shared pool, 0 for the default.
+ */
+WINPR_API wBufferPool* BufferPool_NewEx(BOOL synchronized, int fixedSize, DWORD alignment,
+		DWORD dwFlags, int magazineSize);
 WINPR_API void BufferPool_Free(wBufferPool* pool);
 
 /* ObjectPool */
@@ -457,6 +525,13 @@ struct _wMessage
 	MESSAGE_FREE_FN Free;
 };
 
+struct _wMessageQueueSlot
+{
+	LONG sequence;
+	wMessage message;
+};
+typedef struct _wMessageQueueSlot wMessageQueueSlot;
+
 struct _wMessageQueue
 {
 	int head;
@@ -468,11 +543,27 @@ struct _wMessageQueue
 	HANDLE event;
 
 	wObject object;
+
+	DWORD flags;
+	LONG ringMask;
+	wMessageQueueSlot* ring;
+	LONG volatile ringTail;
+	LONG volatile ringHead;
+	LONG volatile count;
+	LONG volatile overflow;
 };
 typedef struct _wMessageQueue wMessageQueue;
 
 #define WMQ_QUIT	0xFFFFFFFF
 
+/**
+ * WMQ_FLAG_LOCKFREE: messages are posted into a bounded lock-free ring
+ * (any number of producers, a single consumer) and the queue event is only
+ * signalled when the queue goes from empty to non-empty. Messages posted
+ * while the ring is full spill into the regular locked array.
+ */
+#define WMQ_FLAG_LOCKFREE	0x00000001
+
 WINPR_API HANDLE MessageQueue_Event(wMessageQueue* queue);
 WINPR_API BOOL MessageQueue_Wait(wMessageQueue* queue);
 WINPR_API int MessageQueue_Size(wMessageQueue* queue);
@@ -510,6 +601,17 @@ WINPR_API int MessageQueue_Clear(wMessageQueue *queue);
  */
 WINPR_API wMessageQueue* MessageQueue_New(const wObject *callback);
 
+/*! \brief Creates a new message queue with the given WMQ_FLAG_* flags.
+ *
+ * \param callback a pointer to custom initialization / cleanup functions.
+ * \param dwFlags WMQ_FLAG_* flags, 0 behaves like MessageQueue_New.
+ * \param capacity number of ring slots for WMQ_FLAG_LOCKFREE queues,
+ *                 rounded up to a power of two.
+ *
+ * \return A pointer to a newly allocated MessageQueue or NULL.
+ */
+WINPR_API wMessageQueue* MessageQueue_NewEx(const wObject *callback, DWORD dwFlags, int capacity);
+
 /*! \brief Frees resources allocated by a message queue.
  * 				 This function will only free resources allocated
  *				 internally.
@@ -535,6 +637,7 @@ typedef struct _wMessagePipe wMessagePipe;
 WINPR_API void MessagePipe_PostQuit(wMessagePipe* pipe, int nExitCode);
 
 WINPR_API wMessagePipe* MessagePipe_New(void);
+WINPR_API wMessagePipe* MessagePipe_NewEx(DWORD dwFlags, int capacity);
 WINPR_API void MessagePipe_Free(wMessagePipe* pipe);
 
 /* Publisher/Subscriber Pattern */
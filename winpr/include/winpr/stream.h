@@ -227,16 +227,41 @@ static INLINE BOOL Stream_SafeSeek(wStream* s, size_t size) {
 
 /* StreamPool */
 
+#define STREAM_POOL_MIN_CLASS		8
+#define STREAM_POOL_MAX_CLASS		30
+#define STREAM_POOL_PAGE_CLASS		12
+#define STREAM_POOL_CLASSES		(STREAM_POOL_MAX_CLASS + 1)
+
+/**
+ * Free list of the streams of one size class. Streams of class n
+ * have a capacity of exactly 2^n bytes.
+ */
+
+struct _wStreamPoolClass
+{
+	int size;
+	int capacity;
+	wStream** array;
+};
+typedef struct _wStreamPoolClass wStreamPoolClass;
+
 struct _wStreamPool
 {
 	int aSize;
-	int aCapacity;
-	wStream** aArray;
-
 	int uSize;
+
+	wStreamPoolClass classes[STREAM_POOL_CLASSES];
+	int maxClass;
+
+	/* open addressing index of the streams in use up to a page, by buffer */
 	int uCapacity;
 	wStream** uArray;
 
+	/* streams in use larger than a page, sorted by buffer */
+	int lSize;
+	int lCapacity;
+	wStream** lArray;
+
 	CRITICAL_SECTION lock;
 	BOOL synchronized;
 	size_t defaultSize;
@@ -244,6 +269,7 @@ struct _wStreamPool
 
 WINPR_API wStream* StreamPool_Take(wStreamPool* pool, size_t size);
 WINPR_API void StreamPool_Return(wStreamPool* pool, wStream* s);
+WINPR_API BOOL StreamPool_EnsureCapacity(wStreamPool* pool, wStream* s, size_t size);
 
 WINPR_API void Stream_AddRef(wStream* s);
 WINPR_API void Stream_Release(wStream* s);
@@ -109,6 +109,9 @@ WINPR_API BOOL ResetEvent(HANDLE hEvent);
 typedef PVOID RTL_SRWLOCK;
 typedef RTL_SRWLOCK SRWLOCK, *PSRWLOCK;
 
+#define RTL_SRWLOCK_INIT		{ 0 }
+#define SRWLOCK_INIT			RTL_SRWLOCK_INIT
+
 WINPR_API VOID InitializeSRWLock(PSRWLOCK SRWLock);
 
 WINPR_API VOID AcquireSRWLockExclusive(PSRWLOCK SRWLock);
@@ -125,15 +128,13 @@ WINPR_API VOID ReleaseSRWLockShared(PSRWLOCK SRWLock);
 typedef PVOID RTL_CONDITION_VARIABLE;
 typedef RTL_CONDITION_VARIABLE CONDITION_VARIABLE, *PCONDITION_VARIABLE;
 
-/* Critical Section */
+#define RTL_CONDITION_VARIABLE_INIT		{ 0 }
+#define CONDITION_VARIABLE_INIT			RTL_CONDITION_VARIABLE_INIT
 
-#if defined(__linux__)
-/**
- * Linux NPTL thread synchronization primitives are implemented using
- * the futex system calls ... we can't beat futex with a spin loop.
- */
-#define WINPR_CRITICAL_SECTION_DISABLE_SPINCOUNT
-#endif
+#define RTL_CONDITION_VARIABLE_LOCKMODE_SHARED	0x1
+#define CONDITION_VARIABLE_LOCKMODE_SHARED	RTL_CONDITION_VARIABLE_LOCKMODE_SHARED
+
+/* Critical Section */
 
 typedef struct _RTL_CRITICAL_SECTION
 {
@@ -162,6 +163,16 @@ WINPR_API VOID LeaveCriticalSection(LPCRITICAL_SECTION lpCriticalSection);
 
 WINPR_API VOID DeleteCriticalSection(LPCRITICAL_SECTION lpCriticalSection);
 
+/* Condition Variable */
+
+WINPR_API VOID InitializeConditionVariable(PCONDITION_VARIABLE ConditionVariable);
+
+WINPR_API BOOL SleepConditionVariableCS(PCONDITION_VARIABLE ConditionVariable, PCRITICAL_SECTION CriticalSection, DWORD dwMilliseconds);
+WINPR_API BOOL SleepConditionVariableSRW(PCONDITION_VARIABLE ConditionVariable, PSRWLOCK SRWLock, DWORD dwMilliseconds, ULONG Flags);
+
+WINPR_API VOID WakeAllConditionVariable(PCONDITION_VARIABLE ConditionVariable);
+WINPR_API VOID WakeConditionVariable(PCONDITION_VARIABLE ConditionVariable);
+
 /* Sleep */
 
 WINPR_API VOID Sleep(DWORD dwMilliseconds);
@@ -349,11 +360,31 @@ WINPR_API HANDLE CreateWaitObjectEvent(LPSECURITY_ATTRIBUTES lpEventAttributes,
 #define CreateFileDescriptorEvent	CreateFileDescriptorEventA
 #endif
 
+WINPR_API HANDLE CreateNotificationEvent(LPSECURITY_ATTRIBUTES lpEventAttributes, BOOL bInitialState);
+
 WINPR_API int GetEventFileDescriptor(HANDLE hEvent);
 WINPR_API int SetEventFileDescriptor(HANDLE hEvent, int FileDescriptor);
 
 WINPR_API void* GetEventWaitObject(HANDLE hEvent);
 
+/* Wait Set */
+
+typedef struct winpr_wait_set WINPR_WAIT_SET;
+
+#define WAIT_SET_INVALID_INDEX	0xFFFFFFFF
+
+WINPR_API WINPR_WAIT_SET* WaitSet_New(void);
+WINPR_API void WaitSet_Free(WINPR_WAIT_SET* set);
+
+WINPR_API DWORD WaitSet_Add(WINPR_WAIT_SET* set, HANDLE handle);
+WINPR_API BOOL WaitSet_Remove(WINPR_WAIT_SET* set, DWORD index);
+WINPR_API BOOL WaitSet_SetWritable(WINPR_WAIT_SET* set, DWORD index, BOOL bWritable);
+
+WINPR_API DWORD WaitSet_Wait(WINPR_WAIT_SET* set, DWORD dwMilliseconds);
+WINPR_API BOOL WaitSet_IsReady(WINPR_WAIT_SET* set, DWORD index);
+WINPR_API BOOL WaitSet_IsWritable(WINPR_WAIT_SET* set, DWORD index);
+WINPR_API DWORD WaitSet_GetReady(WINPR_WAIT_SET* set, DWORD* indices, DWORD count);
+
 #ifdef __cplusplus
 }
 #endif
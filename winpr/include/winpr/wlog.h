@@ -112,16 +112,22 @@ struct _wLogLayout
 #define WLOG_APPENDER_CONSOLE	0
 #define WLOG_APPENDER_FILE	1
 #define WLOG_APPENDER_BINARY	2
+#define WLOG_APPENDER_CAPTURE	3
 
 #define WLOG_PACKET_INBOUND	1
 #define WLOG_PACKET_OUTBOUND	2
 
+/* packets of different peers are captured on different interfaces */
+#define WLOG_PACKET_INTERFACE(_id)		((((DWORD) (_id)) & 0xFFFF) << 16)
+#define WLOG_PACKET_GET_INTERFACE(_flags)	((((DWORD) (_flags)) >> 16) & 0xFFFF)
+
 typedef int (*WLOG_APPENDER_OPEN_FN)(wLog* log, wLogAppender* appender);
 typedef int (*WLOG_APPENDER_CLOSE_FN)(wLog* log, wLogAppender* appender);
 typedef int (*WLOG_APPENDER_WRITE_MESSAGE_FN)(wLog* log, wLogAppender* appender, wLogMessage* message);
 typedef int (*WLOG_APPENDER_WRITE_DATA_MESSAGE_FN)(wLog* log, wLogAppender* appender, wLogMessage* message);
 typedef int (*WLOG_APPENDER_WRITE_IMAGE_MESSAGE_FN)(wLog* log, wLogAppender* appender, wLogMessage* message);
 typedef int (*WLOG_APPENDER_WRITE_PACKET_MESSAGE_FN)(wLog* log, wLogAppender* appender, wLogMessage* message);
+typedef int (*WLOG_APPENDER_WRITE_BATCH_FN)(wLog* log, wLogAppender* appender, const char* data, size_t length);
 
 #define WLOG_APPENDER_COMMON() \
 	DWORD Type; \
@@ -129,6 +135,7 @@ typedef int (*WLOG_APPENDER_WRITE_PACKET_MESSAGE_FN)(wLog* log, wLogAppender* ap
 	wLogLayout* Layout; \
 	CRITICAL_SECTION lock; \
 	BOOL recursive; \
+	BOOL Async; \
 	void* TextMessageContext; \
 	void* DataMessageContext; \
 	void* ImageMessageContext; \
@@ -138,7 +145,8 @@ typedef int (*WLOG_APPENDER_WRITE_PACKET_MESSAGE_FN)(wLog* log, wLogAppender* ap
 	WLOG_APPENDER_WRITE_MESSAGE_FN WriteMessage; \
 	WLOG_APPENDER_WRITE_DATA_MESSAGE_FN WriteDataMessage; \
 	WLOG_APPENDER_WRITE_IMAGE_MESSAGE_FN WriteImageMessage; \
-	WLOG_APPENDER_WRITE_PACKET_MESSAGE_FN WritePacketMessage
+	WLOG_APPENDER_WRITE_PACKET_MESSAGE_FN WritePacketMessage; \
+	WLOG_APPENDER_WRITE_BATCH_FN WriteBatch
 
 struct _wLogAppender
 {
@@ -179,6 +187,47 @@ struct _wLogBinaryAppender
 };
 typedef struct _wLogBinaryAppender wLogBinaryAppender;
 
+/**
+ * The capture appender keeps the last packets logged with WLog_Packet() in
+ * a fixed size ring, memory-mapped from FullFileName, and writes them as
+ * pcapng when WLog_CaptureAppender_Dump() is called. Each packet interface
+ * id becomes a pcapng interface. Text messages are passed on to the
+ * appender of the parent logger, at the level of the parent logger.
+ */
+
+#define WLOG_CAPTURE_ALL_INTERFACES	0xFFFFFFFF
+
+struct _wLogCaptureAppender
+{
+	WLOG_APPENDER_COMMON();
+
+	char* FileName;
+	char* FilePath;
+	char* FullFileName;
+	UINT32 RingSize;
+	void* Ring;
+};
+typedef struct _wLogCaptureAppender wLogCaptureAppender;
+
+/**
+ * Asynchronous Appenders
+ *
+ * An appender in asynchronous mode only formats text messages on the
+ * calling thread: the formatted lines are queued in a ring owned by that
+ * thread and written in batches by a background flusher. When the ring is
+ * full, messages below WLOG_ERROR are dropped and counted, errors are
+ * written synchronously.
+ */
+
+struct _wLogAsyncStats
+{
+	UINT64 Queued;
+	UINT64 Dropped;
+	UINT64 Written;
+	UINT64 Batches;
+};
+typedef struct _wLogAsyncStats wLogAsyncStats;
+
 /**
  * Filter
  */
@@ -304,11 +353,21 @@ WINPR_API void WLog_SetLogAppenderType(wLog* log, DWORD logAppenderType);
 WINPR_API int WLog_OpenAppender(wLog* log);
 WINPR_API int WLog_CloseAppender(wLog* log);
 
+WINPR_API BOOL WLog_SetAsync(wLog* log, BOOL async);
+WINPR_API void WLog_Flush(void);
+WINPR_API void WLog_GetAsyncStats(wLogAsyncStats* stats);
+
 WINPR_API void WLog_ConsoleAppender_SetOutputStream(wLog* log, wLogConsoleAppender* appender, int outputStream);
 
 WINPR_API void WLog_FileAppender_SetOutputFileName(wLog* log, wLogFileAppender* appender, const char* filename);
 WINPR_API void WLog_FileAppender_SetOutputFilePath(wLog* log, wLogFileAppender* appender, const char* filepath);
 
+WINPR_API void WLog_CaptureAppender_SetOutputFileName(wLog* log, wLogCaptureAppender* appender, const char* filename);
+WINPR_API void WLog_CaptureAppender_SetOutputFilePath(wLog* log, wLogCaptureAppender* appender, const char* filepath);
+WINPR_API void WLog_CaptureAppender_SetRingSize(wLog* log, wLogCaptureAppender* appender, UINT32 size);
+WINPR_API int WLog_CaptureAppender_Dump(wLog* log, wLogCaptureAppender* appender,
+		const char* filename, DWORD seconds, DWORD interfaceId);
+
 WINPR_API wLogLayout* WLog_GetLogLayout(wLog* log);
 WINPR_API void WLog_Layout_SetPrefixFormat(wLog* log, wLogLayout* layout, const char* format);
 
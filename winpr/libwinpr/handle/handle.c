@@ -175,6 +175,9 @@ BOOL CloseHandle(HANDLE hObject)
 			}
 		}
 
+		if (event->bNotification)
+			pthread_mutex_destroy(&event->FdLock);
+
 		free(Object);
 		return TRUE;
 	}
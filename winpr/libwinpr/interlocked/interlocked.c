@@ -210,7 +210,16 @@ LONG InterlockedDecrement(LONG volatile *Addend)
 LONG InterlockedExchange(LONG volatile *Target, LONG Value)
 {
 #ifdef __GNUC__
-	return __sync_val_compare_and_swap(Target, *Target, Value);
+	LONG Initial;
+
+	/* a single compare-and-swap against *Target fails when it races */
+	do
+	{
+		Initial = *Target;
+	}
+	while (__sync_val_compare_and_swap(Target, Initial, Value) != Initial);
+
+	return Initial;
 #else
 	return 0;
 #endif
@@ -23,6 +23,8 @@
 
 #include <winpr/crt.h>
 #include <winpr/pool.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 
 #include "pool.h"
 
@@ -58,94 +60,450 @@ static void module_init()
 
 #else
 
-static TP_POOL DEFAULT_POOL =
+/**
+ * Work-stealing scheduler
+ *
+ * Submitted callback instances are spread round-robin over the worker
+ * deques. A worker drains its own deque newest first and, once it is empty,
+ * steals the oldest instance from the other workers before going to sleep.
+ *
+ * Sleeping workers are counted in Idle and parked on WakeSemaphore: a
+ * submitter claims one idle worker and releases a single token, so a wakeup
+ * costs one semaphore round-trip instead of waking every thread.
+ *
+ * Waiting for the callbacks of a work waits for its own completion event,
+ * completions of other works never wake or satisfy the waiter.
+ *
+ * Threads are started on demand, from Minimum up to the smaller of Maximum
+ * and the number of processors (or Minimum if it is larger).
+ */
+
+static TP_POOL DEFAULT_POOL;
+static INIT_ONCE DEFAULT_POOL_INIT_ONCE = INIT_ONCE_STATIC_INIT;
+
+static BOOL thread_pool_claim(LONG volatile* counter)
+{
+	LONG value;
+
+	while ((value = *counter) > 0)
+	{
+		if (InterlockedCompareExchange(counter, value - 1, value) == value)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static DWORD thread_pool_thread_limit(PTP_POOL pool)
+{
+	DWORD limit;
+	SYSTEM_INFO sysinfo;
+
+	GetSystemInfo(&sysinfo);
+	limit = sysinfo.dwNumberOfProcessors;
+
+	if (limit < pool->Minimum)
+		limit = pool->Minimum;
+
+	if (limit > pool->Maximum)
+		limit = pool->Maximum;
+
+	if (limit > TP_POOL_MAX_THREADS)
+		limit = TP_POOL_MAX_THREADS;
+
+	return (limit > 0) ? limit : 1;
+}
+
+static void thread_pool_run_instance(PTP_POOL pool, PTP_CALLBACK_INSTANCE callbackInstance)
 {
-	0, /* Minimum */
-	500, /* Maximum */
-	NULL, /* Threads */
-	0, /* ThreadCount */
-};
+	PTP_WORK work = callbackInstance->Work;
+
+	InterlockedDecrement(&pool->Pending);
+
+	work->WorkCallback(callbackInstance, work->CallbackParameter, work);
+
+	ThreadpoolCompleteWork(work, 1);
+}
+
+static PTP_CALLBACK_INSTANCE thread_pool_worker_next(PTP_WORKER worker, PTP_CALLBACK_INSTANCE done)
+{
+	PTP_CALLBACK_INSTANCE callbackInstance = NULL;
+
+	EnterCriticalSection(&worker->Lock);
+
+	if (done && (worker->FreeCount < TP_WORKER_FREE_INSTANCES))
+	{
+		done->Next = worker->FreeList;
+		worker->FreeList = done;
+		worker->FreeCount++;
+		done = NULL;
+	}
+
+	if (worker->Count > 0)
+	{
+		worker->Count--;
+		callbackInstance = worker->Deque[(worker->Head + worker->Count) % worker->Capacity];
+	}
+
+	LeaveCriticalSection(&worker->Lock);
+
+	free(done);
+
+	return callbackInstance;
+}
+
+static PTP_CALLBACK_INSTANCE thread_pool_worker_steal(PTP_WORKER victim)
+{
+	PTP_CALLBACK_INSTANCE callbackInstance = NULL;
+
+	if (victim->Count < 1)
+		return NULL;
+
+	EnterCriticalSection(&victim->Lock);
+
+	if (victim->Count > 0)
+	{
+		callbackInstance = victim->Deque[victim->Head];
+		victim->Head = (victim->Head + 1) % victim->Capacity;
+		victim->Count--;
+	}
+
+	LeaveCriticalSection(&victim->Lock);
+
+	return callbackInstance;
+}
 
 static void* thread_pool_work_func(void* arg)
 {
-	DWORD status;
+	LONG index;
+	LONG count;
 	PTP_POOL pool;
-	PTP_WORK work;
-	HANDLE events[2];
+	PTP_WORKER worker;
+	PTP_CALLBACK_INSTANCE done = NULL;
 	PTP_CALLBACK_INSTANCE callbackInstance;
 
-	pool = (PTP_POOL) arg;
-
-	events[0] = pool->TerminateEvent;
-	events[1] = Queue_Event(pool->PendingQueue);
+	worker = (PTP_WORKER) arg;
+	pool = worker->Pool;
 
 	while (1)
 	{
-		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		callbackInstance = thread_pool_worker_next(worker, done);
+		done = NULL;
 
-		if (status == WAIT_OBJECT_0)
-			break;
+		if (!callbackInstance)
+		{
+			count = pool->WorkerCount;
 
-		if (status != (WAIT_OBJECT_0 + 1))
-			break;
+			for (index = 1; index < count; index++)
+			{
+				callbackInstance = thread_pool_worker_steal(pool->Workers[(worker->Index + index) % count]);
 
-		callbackInstance = (PTP_CALLBACK_INSTANCE) Queue_Dequeue(pool->PendingQueue);
+				if (callbackInstance)
+					break;
+			}
+		}
 
 		if (callbackInstance)
 		{
-			work = callbackInstance->Work;
-			work->WorkCallback(callbackInstance, work->CallbackParameter, work);
-			CountdownEvent_Signal(pool->WorkComplete, 1);
-			free(callbackInstance);
+			thread_pool_run_instance(pool, callbackInstance);
+			done = callbackInstance;
+			continue;
 		}
+
+		if (pool->Terminate)
+			break;
+
+		InterlockedIncrement(&pool->Idle);
+
+		/* recheck after publishing ourselves as idle to not miss a submission */
+
+		if (((pool->Pending > 0) || pool->Terminate) && thread_pool_claim(&pool->Idle))
+			continue;
+
+		WaitForSingleObject(pool->WakeSemaphore, INFINITE);
 	}
 
 	return NULL;
 }
 
-static void threads_close(void *thread)
+static BOOL thread_pool_add_worker(PTP_POOL pool)
+{
+	PTP_WORKER worker;
+
+	if (pool->WorkerCount >= TP_POOL_MAX_THREADS)
+		return FALSE;
+
+	worker = (PTP_WORKER) calloc(1, sizeof(TP_WORKER));
+
+	if (!worker)
+		return FALSE;
+
+	worker->Pool = pool;
+	worker->Index = pool->WorkerCount;
+	worker->Capacity = 32;
+	worker->Deque = (PTP_CALLBACK_INSTANCE*) calloc(worker->Capacity, sizeof(PTP_CALLBACK_INSTANCE));
+
+	if (!worker->Deque)
+	{
+		free(worker);
+		return FALSE;
+	}
+
+	InitializeCriticalSectionAndSpinCount(&worker->Lock, 4000);
+
+	pool->Workers[pool->WorkerCount] = worker;
+
+	worker->Thread = CreateThread(NULL, 0,
+			(LPTHREAD_START_ROUTINE) thread_pool_work_func,
+			(void*) worker, 0, NULL);
+
+	if (!worker->Thread)
+	{
+		pool->Workers[pool->WorkerCount] = NULL;
+		DeleteCriticalSection(&worker->Lock);
+		free(worker->Deque);
+		free(worker);
+		return FALSE;
+	}
+
+	/* publish the worker only once it is fully initialized */
+	InterlockedIncrement(&pool->WorkerCount);
+
+	return TRUE;
+}
+
+static void thread_pool_free_worker(PTP_WORKER worker)
+{
+	PTP_CALLBACK_INSTANCE callbackInstance;
+
+	while (worker->Count > 0)
+	{
+		free(worker->Deque[worker->Head]);
+		worker->Head = (worker->Head + 1) % worker->Capacity;
+		worker->Count--;
+	}
+
+	while (worker->FreeList)
+	{
+		callbackInstance = worker->FreeList;
+		worker->FreeList = callbackInstance->Next;
+		free(callbackInstance);
+	}
+
+	CloseHandle(worker->Thread);
+	DeleteCriticalSection(&worker->Lock);
+	free(worker->Deque);
+	free(worker);
+}
+
+BOOL ThreadpoolSubmitInstance(PTP_POOL pool, PTP_WORK work)
+{
+	PTP_WORKER worker;
+	PTP_CALLBACK_INSTANCE callbackInstance;
+
+	if (pool->WorkerCount < 1)
+	{
+		EnterCriticalSection(&pool->Lock);
+
+		if (pool->WorkerCount < 1)
+			thread_pool_add_worker(pool);
+
+		LeaveCriticalSection(&pool->Lock);
+
+		if (pool->WorkerCount < 1)
+			return FALSE;
+	}
+
+	worker = pool->Workers[((ULONG) InterlockedIncrement(&pool->NextWorker)) % (ULONG) pool->WorkerCount];
+
+	EnterCriticalSection(&worker->Lock);
+
+	if (worker->Count == worker->Capacity)
+	{
+		DWORD index;
+		DWORD capacity = worker->Capacity * 2;
+		PTP_CALLBACK_INSTANCE* deque;
+
+		deque = (PTP_CALLBACK_INSTANCE*) malloc(capacity * sizeof(PTP_CALLBACK_INSTANCE));
+
+		if (!deque)
+		{
+			LeaveCriticalSection(&worker->Lock);
+			return FALSE;
+		}
+
+		for (index = 0; index < worker->Count; index++)
+			deque[index] = worker->Deque[(worker->Head + index) % worker->Capacity];
+
+		free(worker->Deque);
+		worker->Deque = deque;
+		worker->Capacity = capacity;
+		worker->Head = 0;
+	}
+
+	callbackInstance = worker->FreeList;
+
+	if (callbackInstance)
+	{
+		worker->FreeList = callbackInstance->Next;
+		worker->FreeCount--;
+	}
+	else
+	{
+		callbackInstance = (PTP_CALLBACK_INSTANCE) malloc(sizeof(TP_CALLBACK_INSTANCE));
+
+		if (!callbackInstance)
+		{
+			LeaveCriticalSection(&worker->Lock);
+			return FALSE;
+		}
+	}
+
+	callbackInstance->Work = work;
+	callbackInstance->Next = NULL;
+
+	InterlockedIncrement(&work->RefCount);
+
+	EnterCriticalSection(&work->Lock);
+
+	if (work->Pending++ == 0)
+		ResetEvent(work->CompletionEvent);
+
+	LeaveCriticalSection(&work->Lock);
+
+	InterlockedIncrement(&pool->Pending);
+
+	worker->Deque[(worker->Head + worker->Count) % worker->Capacity] = callbackInstance;
+	worker->Count++;
+
+	LeaveCriticalSection(&worker->Lock);
+
+	/**
+	 * Wake an idle worker for every queued instance: busy workers may be
+	 * running long callbacks, or waiting for this very instance.
+	 */
+
+	if (thread_pool_claim(&pool->Idle))
+	{
+		ReleaseSemaphore(pool->WakeSemaphore, 1, NULL);
+	}
+	else if ((DWORD) pool->WorkerCount < thread_pool_thread_limit(pool))
+	{
+		EnterCriticalSection(&pool->Lock);
+
+		if ((DWORD) pool->WorkerCount < thread_pool_thread_limit(pool))
+			thread_pool_add_worker(pool);
+
+		LeaveCriticalSection(&pool->Lock);
+	}
+
+	return TRUE;
+}
+
+void ThreadpoolCompleteWork(PTP_WORK work, LONG count)
+{
+	EnterCriticalSection(&work->Lock);
+
+	work->Pending -= count;
+
+	if (work->Pending == 0)
+		SetEvent(work->CompletionEvent);
+
+	LeaveCriticalSection(&work->Lock);
+
+	/* a waiter may close the work as soon as the event is set */
+
+	ThreadpoolReleaseWork(work, count);
+}
+
+void ThreadpoolReleaseWork(PTP_WORK work, LONG count)
 {
-	CloseHandle(thread);
+	if (InterlockedExchangeAdd(&work->RefCount, -count) != count)
+		return;
+
+	CloseHandle(work->CompletionEvent);
+	DeleteCriticalSection(&work->Lock);
+	free(work);
+}
+
+void ThreadpoolWaitForWork(PTP_POOL pool, PTP_WORK work)
+{
+	WaitForSingleObject(work->CompletionEvent, INFINITE);
 }
 
-void InitializeThreadpool(PTP_POOL pool)
+void ThreadpoolCancelWork(PTP_POOL pool, PTP_WORK work)
 {
-	int index;
-	HANDLE thread;
+	DWORD index;
+	DWORD count;
+	LONG worker;
+	LONG cancelled;
+	PTP_WORKER pWorker;
+	PTP_CALLBACK_INSTANCE callbackInstance;
 
-	if (!pool->Threads)
+	for (worker = 0; worker < pool->WorkerCount; worker++)
 	{
-		pool->Minimum = 0;
-		pool->Maximum = 500;
+		pWorker = pool->Workers[worker];
+		cancelled = 0;
 
-		pool->Threads = ArrayList_New(TRUE);
-		pool->Threads->object.fnObjectFree = threads_close;
+		EnterCriticalSection(&pWorker->Lock);
 
-		pool->PendingQueue = Queue_New(TRUE, -1, -1);
-		pool->WorkComplete = CountdownEvent_New(0);
+		for (index = count = 0; index < pWorker->Count; index++)
+		{
+			callbackInstance = pWorker->Deque[(pWorker->Head + index) % pWorker->Capacity];
+
+			if (callbackInstance->Work == work)
+			{
+				free(callbackInstance);
+				cancelled++;
+				continue;
+			}
+
+			pWorker->Deque[(pWorker->Head + count) % pWorker->Capacity] = callbackInstance;
+			count++;
+		}
+
+		pWorker->Count = count;
 
-		pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		LeaveCriticalSection(&pWorker->Lock);
 
-		for (index = 0; index < 4; index++)
+		if (cancelled)
 		{
-			thread = CreateThread(NULL, 0,
-					(LPTHREAD_START_ROUTINE) thread_pool_work_func,
-					(void*) pool, 0, NULL);
+			InterlockedExchangeAdd(&pool->Pending, -cancelled);
 
-			ArrayList_Add(pool->Threads, thread);
+			ThreadpoolCompleteWork(work, cancelled);
 		}
 	}
 }
 
-PTP_POOL GetDefaultThreadpool()
+static BOOL InitializeThreadpool(PTP_POOL pool)
 {
-	PTP_POOL pool = NULL;
+	pool->Minimum = 0;
+	pool->Maximum = 500;
 
-	pool = &DEFAULT_POOL;
+	InitializeCriticalSectionAndSpinCount(&pool->Lock, 4000);
 
-	InitializeThreadpool(pool);
+	pool->WakeSemaphore = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
 
-	return pool;
+	if (!pool->WakeSemaphore)
+	{
+		DeleteCriticalSection(&pool->Lock);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL CALLBACK init_default_threadpool(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	return InitializeThreadpool(&DEFAULT_POOL);
+}
+
+PTP_POOL GetDefaultThreadpool()
+{
+	if (!InitOnceExecuteOnce(&DEFAULT_POOL_INIT_ONCE, init_default_threadpool, NULL, NULL))
+		return NULL;
+
+	return &DEFAULT_POOL;
 }
 
 #endif
@@ -164,8 +522,11 @@ PTP_POOL CreateThreadpool(PVOID reserved)
 #else
 	pool = (PTP_POOL) calloc(1, sizeof(TP_POOL));
 
-	if (pool)
-		InitializeThreadpool(pool);
+	if (pool && !InitializeThreadpool(pool))
+	{
+		free(pool);
+		pool = NULL;
+	}
 #endif
 
 	return pool;
@@ -179,24 +540,19 @@ VOID CloseThreadpool(PTP_POOL ptpp)
 	if (pCloseThreadpool)
 		pCloseThreadpool(ptpp);
 #else
-	int index;
-	HANDLE thread;
+	LONG index;
 
-	SetEvent(ptpp->TerminateEvent);
+	InterlockedExchange(&ptpp->Terminate, 1);
+	ReleaseSemaphore(ptpp->WakeSemaphore, ptpp->WorkerCount, NULL);
 
-	index = ArrayList_Count(ptpp->Threads) - 1;
+	for (index = 0; index < ptpp->WorkerCount; index++)
+		WaitForSingleObject(ptpp->Workers[index]->Thread, INFINITE);
 
-	while (index >= 0)
-	{
-		thread = (HANDLE) ArrayList_GetItem(ptpp->Threads, index);
-		WaitForSingleObject(thread, INFINITE);
-		index--;
-	}
+	for (index = 0; index < ptpp->WorkerCount; index++)
+		thread_pool_free_worker(ptpp->Workers[index]);
 
-	ArrayList_Free(ptpp->Threads);
-	Queue_Free(ptpp->PendingQueue);
-	CountdownEvent_Free(ptpp->WorkComplete);
-	CloseHandle(ptpp->TerminateEvent);
+	CloseHandle(ptpp->WakeSemaphore);
+	DeleteCriticalSection(&ptpp->Lock);
 
 	free(ptpp);
 #endif
@@ -210,18 +566,27 @@ BOOL SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 	if (pSetThreadpoolThreadMinimum)
 		return pSetThreadpoolThreadMinimum(ptpp, cthrdMic);
 #else
-	HANDLE thread;
+	BOOL status = TRUE;
+
+	EnterCriticalSection(&ptpp->Lock);
 
 	ptpp->Minimum = cthrdMic;
 
-	while (ArrayList_Count(ptpp->Threads) < ptpp->Minimum)
-	{
-		thread = CreateThread(NULL, 0,
-				(LPTHREAD_START_ROUTINE) thread_pool_work_func,
-				(void*) ptpp, 0, NULL);
+	if (ptpp->Maximum < ptpp->Minimum)
+		ptpp->Maximum = ptpp->Minimum;
 
-		ArrayList_Add(ptpp->Threads, thread);
+	while ((DWORD) ptpp->WorkerCount < ptpp->Minimum)
+	{
+		if (!thread_pool_add_worker(ptpp))
+		{
+			status = FALSE;
+			break;
+		}
 	}
+
+	LeaveCriticalSection(&ptpp->Lock);
+
+	return status;
 #endif
 	return TRUE;
 }
@@ -234,7 +599,15 @@ VOID SetThreadpoolThreadMaximum(PTP_POOL ptpp, DWORD cthrdMost)
 	if (pSetThreadpoolThreadMaximum)
 		pSetThreadpoolThreadMaximum(ptpp, cthrdMost);
 #else
+	EnterCriticalSection(&ptpp->Lock);
+
+	/* running threads are not retired, this only limits further growth */
 	ptpp->Maximum = cthrdMost;
+
+	if (ptpp->Minimum > ptpp->Maximum)
+		ptpp->Minimum = ptpp->Maximum;
+
+	LeaveCriticalSection(&ptpp->Lock);
 #endif
 }
 
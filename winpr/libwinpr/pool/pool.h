@@ -25,19 +25,54 @@
 #include <winpr/thread.h>
 #include <winpr/collections.h>
 
+#define TP_POOL_MAX_THREADS		512
+#define TP_WORKER_FREE_INSTANCES	64
+
 struct _TP_CALLBACK_INSTANCE
 {
 	PTP_WORK Work;
+	PTP_CALLBACK_INSTANCE Next;
+};
+
+typedef struct _TP_WORKER TP_WORKER, *PTP_WORKER;
+
+/**
+ * Each worker owns a deque of callback instances: the owner takes the most
+ * recently queued instance, idle workers steal the oldest one. The lock also
+ * protects the worker's cache of free callback instances so that returning
+ * an instance and taking the next one costs a single lock round-trip.
+ */
+
+struct _TP_WORKER
+{
+	PTP_POOL Pool;
+	LONG Index;
+	HANDLE Thread;
+	CRITICAL_SECTION Lock;
+
+	PTP_CALLBACK_INSTANCE* Deque;
+	DWORD Capacity;
+	DWORD Head;
+	DWORD Count;
+
+	PTP_CALLBACK_INSTANCE FreeList;
+	DWORD FreeCount;
 };
 
 struct _TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
-	wArrayList* Threads;
-	wQueue* PendingQueue;
-	HANDLE TerminateEvent;
-	wCountdownEvent* WorkComplete;
+
+	CRITICAL_SECTION Lock;
+	PTP_WORKER Workers[TP_POOL_MAX_THREADS];
+	LONG volatile WorkerCount;
+	LONG volatile NextWorker;
+
+	LONG volatile Pending;
+	LONG volatile Idle;
+	LONG volatile Terminate;
+	HANDLE WakeSemaphore;
 };
 
 struct _TP_WORK
@@ -45,6 +80,18 @@ struct _TP_WORK
 	PVOID CallbackParameter;
 	PTP_WORK_CALLBACK WorkCallback;
 	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+
+	/**
+	 * Pending counts the queued and running callbacks of the work. It only
+	 * changes under Lock, together with CompletionEvent which is set while
+	 * it is zero, so that waiting for the callbacks is waiting for the event.
+	 * Every pending callback also holds a reference, the work is freed when
+	 * the last one is released, not when it is closed.
+	 */
+	CRITICAL_SECTION Lock;
+	LONG Pending;
+	HANDLE CompletionEvent;
+	LONG volatile RefCount;
 };
 
 struct _TP_TIMER
@@ -72,6 +119,12 @@ struct _TP_CLEANUP_GROUP
 PTP_POOL GetDefaultThreadpool(void);
 PTP_CALLBACK_ENVIRON GetDefaultThreadpoolEnvironment(void);
 
+BOOL ThreadpoolSubmitInstance(PTP_POOL pool, PTP_WORK work);
+void ThreadpoolCompleteWork(PTP_WORK work, LONG count);
+void ThreadpoolReleaseWork(PTP_WORK work, LONG count);
+void ThreadpoolWaitForWork(PTP_POOL pool, PTP_WORK work);
+void ThreadpoolCancelWork(PTP_POOL pool, PTP_WORK work);
+
 #endif
 
 #endif /* WINPR_POOL_PRIVATE_H */
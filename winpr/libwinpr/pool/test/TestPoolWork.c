@@ -1,9 +1,18 @@
 
 #include <winpr/crt.h>
 #include <winpr/pool.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
 #include <winpr/interlocked.h>
 
+#define BENCH_ITEMS	100000
+#define BENCH_ROUNDS	2000
+#define WAITER_THREADS	4
+
 static LONG count = 0;
+static LONG benchCount = 0;
+static LONG slowCount = 0;
 
 void CALLBACK test_WorkCallback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
 {
@@ -27,6 +36,155 @@ void CALLBACK test_WorkCallback(PTP_CALLBACK_INSTANCE instance, void* context, P
 	}
 }
 
+void CALLBACK test_BenchCallback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	InterlockedIncrement(&benchCount);
+}
+
+void CALLBACK test_SlowCallback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	Sleep(200);
+	InterlockedIncrement(&slowCount);
+}
+
+static PTP_CALLBACK_ENVIRON waiterEnvironment = NULL;
+
+static void* test_pool_work_waiter(void* arg)
+{
+	int index;
+	PTP_WORK work;
+	LONG* waiterCount = (LONG*) arg;
+
+	/* each waiter only waits on its own work, while the others keep completing theirs */
+
+	work = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_BenchCallback, NULL, waiterEnvironment);
+
+	if (!work)
+		return NULL;
+
+	for (index = 0; index < BENCH_ROUNDS; index++)
+	{
+		SubmitThreadpoolWork(work);
+		SubmitThreadpoolWork(work);
+		WaitForThreadpoolWorkCallbacks(work, FALSE);
+	}
+
+	CloseThreadpoolWork(work);
+	*waiterCount = BENCH_ROUNDS;
+
+	return NULL;
+}
+
+static int test_pool_work_waiters(PTP_CALLBACK_ENVIRON environment)
+{
+	int index;
+	HANDLE threads[WAITER_THREADS];
+	LONG waiterCount[WAITER_THREADS];
+
+	waiterEnvironment = environment;
+
+	for (index = 0; index < WAITER_THREADS; index++)
+	{
+		waiterCount[index] = 0;
+		threads[index] = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) test_pool_work_waiter,
+				&waiterCount[index], 0, NULL);
+
+		if (!threads[index])
+			return -1;
+	}
+
+	for (index = 0; index < WAITER_THREADS; index++)
+	{
+		WaitForSingleObject(threads[index], INFINITE);
+		CloseHandle(threads[index]);
+
+		if (waiterCount[index] != BENCH_ROUNDS)
+		{
+			printf("work waiter %d did not complete\n", index);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int test_pool_work_bench(PTP_CALLBACK_ENVIRON environment)
+{
+	int index;
+	UINT32 start, end;
+	PTP_WORK work;
+	PTP_WORK slowWork;
+
+	/* waiting on a work object must not wait for unrelated work */
+
+	slowWork = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_SlowCallback, NULL, environment);
+	work = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_BenchCallback, NULL, environment);
+
+	if (!slowWork || !work)
+	{
+		printf("CreateThreadpoolWork failure\n");
+		return -1;
+	}
+
+	SubmitThreadpoolWork(slowWork);
+
+	for (index = 0; index < 10; index++)
+		SubmitThreadpoolWork(work);
+
+	WaitForThreadpoolWorkCallbacks(work, FALSE);
+
+	if ((benchCount != 10) || (slowCount != 0))
+	{
+		printf("WaitForThreadpoolWorkCallbacks waited on the wrong work (%d/%d)\n",
+				(int) benchCount, (int) slowCount);
+		return -1;
+	}
+
+	WaitForThreadpoolWorkCallbacks(slowWork, FALSE);
+	CloseThreadpoolWork(slowWork);
+
+	if (slowCount != 1)
+		return -1;
+
+	/* throughput: many small callbacks, one wait */
+
+	benchCount = 0;
+	start = GetTickCount();
+
+	for (index = 0; index < BENCH_ITEMS; index++)
+		SubmitThreadpoolWork(work);
+
+	WaitForThreadpoolWorkCallbacks(work, FALSE);
+
+	end = GetTickCount();
+
+	if (benchCount != BENCH_ITEMS)
+	{
+		printf("missing callbacks: %d/%d\n", (int) benchCount, BENCH_ITEMS);
+		return -1;
+	}
+
+	printf("throughput: %d callbacks in %u ms\n", BENCH_ITEMS, end - start);
+
+	/* latency: submit and wait for a single callback */
+
+	start = GetTickCount();
+
+	for (index = 0; index < BENCH_ROUNDS; index++)
+	{
+		SubmitThreadpoolWork(work);
+		WaitForThreadpoolWorkCallbacks(work, FALSE);
+	}
+
+	end = GetTickCount();
+
+	printf("latency: %d submit/wait round-trips in %u ms\n", BENCH_ROUNDS, end - start);
+
+	CloseThreadpoolWork(work);
+
+	return 0;
+}
+
 int TestPoolWork(int argc, char* argv[])
 {
 	int index;
@@ -89,6 +247,12 @@ int TestPoolWork(int argc, char* argv[])
 
 	WaitForThreadpoolWorkCallbacks(work, FALSE);
 
+	if (test_pool_work_bench(&environment) < 0)
+		return -1;
+
+	if (test_pool_work_waiters(&environment) < 0)
+		return -1;
+
 	CloseThreadpoolCleanupGroupMembers(cleanupGroup, TRUE, NULL);
 
 	CloseThreadpoolCleanupGroup(cleanupGroup);
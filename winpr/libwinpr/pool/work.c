@@ -59,6 +59,16 @@ static void module_init()
 	pWaitForThreadpoolWorkCallbacks = (void*) GetProcAddress(kernel32_module, "WaitForThreadpoolWorkCallbacks");
 }
 
+#else
+
+static PTP_POOL thread_pool_from_work(PTP_WORK work)
+{
+	if (work->CallbackEnvironment->Pool)
+		return work->CallbackEnvironment->Pool;
+
+	return GetDefaultThreadpool();
+}
+
 #endif
 
 #ifdef WINPR_THREAD_POOL
@@ -73,7 +83,7 @@ PTP_WORK CreateThreadpoolWork(PTP_WORK_CALLBACK pfnwk, PVOID pv, PTP_CALLBACK_EN
 		return pCreateThreadpoolWork(pfnwk, pv, pcbe);
 
 #else
-	work = (PTP_WORK) malloc(sizeof(TP_WORK));
+	work = (PTP_WORK) calloc(1, sizeof(TP_WORK));
 
 	if (work)
 	{
@@ -84,6 +94,18 @@ PTP_WORK CreateThreadpoolWork(PTP_WORK_CALLBACK pfnwk, PVOID pv, PTP_CALLBACK_EN
 			pcbe = GetDefaultThreadpoolEnvironment();
 
 		work->CallbackEnvironment = pcbe;
+
+		/* no callback is pending yet */
+		work->CompletionEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
+
+		if (!work->CompletionEvent)
+		{
+			free(work);
+			return NULL;
+		}
+
+		InitializeCriticalSectionAndSpinCount(&work->Lock, 4000);
+		work->RefCount = 1;
 	}
 
 #endif
@@ -99,7 +121,8 @@ VOID CloseThreadpoolWork(PTP_WORK pwk)
 		pCloseThreadpoolWork(pwk);
 
 #else
-	free(pwk);
+	if (pwk)
+		ThreadpoolReleaseWork(pwk, 1);
 #endif
 }
 
@@ -113,16 +136,10 @@ VOID SubmitThreadpoolWork(PTP_WORK pwk)
 
 #else
 	PTP_POOL pool;
-	PTP_CALLBACK_INSTANCE callbackInstance;
-	pool = pwk->CallbackEnvironment->Pool;
-	callbackInstance = (PTP_CALLBACK_INSTANCE) malloc(sizeof(TP_CALLBACK_INSTANCE));
+	pool = thread_pool_from_work(pwk);
 
-	if (callbackInstance)
-	{
-		callbackInstance->Work = pwk;
-		CountdownEvent_AddCount(pool->WorkComplete, 1);
-		Queue_Enqueue(pool->PendingQueue, callbackInstance);
-	}
+	if (!pool || !ThreadpoolSubmitInstance(pool, pwk))
+		WLog_ERR(TAG, "error submitting work");
 
 #endif
 }
@@ -149,13 +166,16 @@ VOID WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallbacks)
 		pWaitForThreadpoolWorkCallbacks(pwk, fCancelPendingCallbacks);
 
 #else
-	HANDLE event;
 	PTP_POOL pool;
-	pool = pwk->CallbackEnvironment->Pool;
-	event = CountdownEvent_WaitHandle(pool->WorkComplete);
+	pool = thread_pool_from_work(pwk);
+
+	if (!pool)
+		return;
+
+	if (fCancelPendingCallbacks)
+		ThreadpoolCancelWork(pool, pwk);
 
-	if (WaitForSingleObject(event, INFINITE) != WAIT_OBJECT_0)
-		WLog_ERR(TAG, "error waiting on work completion");
+	ThreadpoolWaitForWork(pool, pwk);
 
 #endif
 }
@@ -22,6 +22,19 @@
 #endif
 
 #include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 /**
  * WakeByAddressAll
@@ -31,6 +44,106 @@
 
 #ifndef _WIN32
 
+/**
+ * On Linux, waiters block on the futex of the aligned 32-bit word containing
+ * the address. Smaller values share the futex of their word, and an 8-byte
+ * value waits on its low word in short slices, since a change in the high
+ * word alone cannot be detected by the kernel. Both only cause spurious
+ * wakeups, which callers of WaitOnAddress must handle anyway.
+ *
+ * Elsewhere, WaitOnAddress polls the value with a short sleep.
+ */
+
+#define WAIT_ON_ADDRESS_SLICE	1
+
+static BOOL winpr_address_equal(VOID volatile* Address, PVOID CompareAddress, SIZE_T AddressSize)
+{
+	switch (AddressSize)
+	{
+		case 1:
+			return (*((volatile BYTE*) Address) == *((BYTE*) CompareAddress)) ? TRUE : FALSE;
+
+		case 2:
+			return (*((volatile UINT16*) Address) == *((UINT16*) CompareAddress)) ? TRUE : FALSE;
+
+		case 4:
+			return (*((volatile UINT32*) Address) == *((UINT32*) CompareAddress)) ? TRUE : FALSE;
+
+		case 8:
+			return (*((volatile UINT64*) Address) == *((UINT64*) CompareAddress)) ? TRUE : FALSE;
+	}
+
+	return FALSE;
+}
+
+#ifdef __linux__
+
+static volatile INT32* winpr_address_word(VOID volatile* Address)
+{
+	return (volatile INT32*) (((ULONG_PTR) Address) & ~((ULONG_PTR) 3));
+}
+
+static int winpr_futex(volatile INT32* word, int op, INT32 value, const struct timespec* timeout)
+{
+	return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+VOID WakeByAddressAll(PVOID Address)
+{
+	winpr_futex(winpr_address_word(Address), FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+}
+
+VOID WakeByAddressSingle(PVOID Address)
+{
+	winpr_futex(winpr_address_word(Address), FUTEX_WAKE_PRIVATE, 1, NULL);
+}
+
+BOOL WaitOnAddress(VOID volatile* Address, PVOID CompareAddress, SIZE_T AddressSize, DWORD dwMilliseconds)
+{
+	INT32 value;
+	struct timespec timeout;
+	volatile INT32* word;
+
+	if ((AddressSize != 1) && (AddressSize != 2) && (AddressSize != 4) && (AddressSize != 8))
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	word = winpr_address_word(Address);
+	value = *word;
+
+	if (!winpr_address_equal(Address, CompareAddress, AddressSize))
+		return TRUE;
+
+	if ((AddressSize == 8) && (dwMilliseconds > WAIT_ON_ADDRESS_SLICE))
+	{
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = WAIT_ON_ADDRESS_SLICE * 1000000;
+
+		winpr_futex(word, FUTEX_WAIT_PRIVATE, value, &timeout);
+		return TRUE;
+	}
+
+	timeout.tv_sec = dwMilliseconds / 1000;
+	timeout.tv_nsec = (dwMilliseconds % 1000) * 1000000;
+
+	if (winpr_futex(word, FUTEX_WAIT_PRIVATE, value,
+			(dwMilliseconds == INFINITE) ? NULL : &timeout) == 0)
+		return TRUE;
+
+	if (errno == ETIMEDOUT)
+	{
+		SetLastError(ERROR_TIMEOUT);
+		return FALSE;
+	}
+
+	/* EAGAIN: the value changed before we could sleep, EINTR: spurious */
+	return TRUE;
+}
+
+#else
+
 VOID WakeByAddressAll(PVOID Address)
 {
 
@@ -41,9 +154,30 @@ VOID WakeByAddressSingle(PVOID Address)
 
 }
 
-BOOL WaitOnAddress(VOID volatile *Address, PVOID CompareAddress, SIZE_T AddressSize, DWORD dwMilliseconds)
+BOOL WaitOnAddress(VOID volatile* Address, PVOID CompareAddress, SIZE_T AddressSize, DWORD dwMilliseconds)
 {
+	DWORD start = GetTickCount();
+
+	if ((AddressSize != 1) && (AddressSize != 2) && (AddressSize != 4) && (AddressSize != 8))
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	while (winpr_address_equal(Address, CompareAddress, AddressSize))
+	{
+		if ((dwMilliseconds != INFINITE) && ((GetTickCount() - start) >= dwMilliseconds))
+		{
+			SetLastError(ERROR_TIMEOUT);
+			return FALSE;
+		}
+
+		usleep(WAIT_ON_ADDRESS_SLICE * 1000);
+	}
+
 	return TRUE;
 }
 
 #endif
+
+#endif
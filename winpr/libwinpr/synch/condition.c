@@ -22,6 +22,7 @@
 #endif
 
 #include <winpr/synch.h>
+#include <winpr/interlocked.h>
 
 #include "synch.h"
 
@@ -35,29 +36,88 @@
 
 #ifndef _WIN32
 
-VOID InitializeConditionVariable(PCONDITION_VARIABLE ConditionVariable)
+/**
+ * The condition variable is a 32-bit sequence number stored in the
+ * CONDITION_VARIABLE. A sleeping thread samples it before releasing the
+ * lock and waits with WaitOnAddress() until a wake advances it, so a wake
+ * issued between the release and the wait is never lost.
+ *
+ * As on Windows, a sleep may return without a matching wake: callers are
+ * expected to re-check their predicate in a loop.
+ */
+
+#define CONDITION_VARIABLE_SEQUENCE(_cv)	((LONG volatile*) (_cv))
+
+static BOOL winpr_condition_variable_wait(LONG volatile* sequence, LONG value, DWORD dwMilliseconds)
 {
+	if (!WaitOnAddress(sequence, &value, sizeof(LONG), dwMilliseconds))
+	{
+		SetLastError(ERROR_TIMEOUT);
+		return FALSE;
+	}
 
+	return TRUE;
+}
+
+VOID InitializeConditionVariable(PCONDITION_VARIABLE ConditionVariable)
+{
+	*ConditionVariable = NULL;
 }
 
 BOOL SleepConditionVariableCS(PCONDITION_VARIABLE ConditionVariable, PCRITICAL_SECTION CriticalSection, DWORD dwMilliseconds)
 {
-	return TRUE;
+	BOOL status;
+	LONG value;
+	LONG volatile* sequence = CONDITION_VARIABLE_SEQUENCE(ConditionVariable);
+
+	value = *sequence;
+
+	LeaveCriticalSection(CriticalSection);
+
+	status = winpr_condition_variable_wait(sequence, value, dwMilliseconds);
+
+	EnterCriticalSection(CriticalSection);
+
+	return status;
 }
 
 BOOL SleepConditionVariableSRW(PCONDITION_VARIABLE ConditionVariable, PSRWLOCK SRWLock, DWORD dwMilliseconds, ULONG Flags)
 {
-	return TRUE;
+	BOOL status;
+	LONG value;
+	LONG volatile* sequence = CONDITION_VARIABLE_SEQUENCE(ConditionVariable);
+
+	value = *sequence;
+
+	if (Flags & CONDITION_VARIABLE_LOCKMODE_SHARED)
+		ReleaseSRWLockShared(SRWLock);
+	else
+		ReleaseSRWLockExclusive(SRWLock);
+
+	status = winpr_condition_variable_wait(sequence, value, dwMilliseconds);
+
+	if (Flags & CONDITION_VARIABLE_LOCKMODE_SHARED)
+		AcquireSRWLockShared(SRWLock);
+	else
+		AcquireSRWLockExclusive(SRWLock);
+
+	return status;
 }
 
 VOID WakeAllConditionVariable(PCONDITION_VARIABLE ConditionVariable)
 {
+	LONG volatile* sequence = CONDITION_VARIABLE_SEQUENCE(ConditionVariable);
 
+	InterlockedIncrement(sequence);
+	WakeByAddressAll((PVOID) sequence);
 }
 
 VOID WakeConditionVariable(PCONDITION_VARIABLE ConditionVariable)
 {
+	LONG volatile* sequence = CONDITION_VARIABLE_SEQUENCE(ConditionVariable);
 
+	InterlockedIncrement(sequence);
+	WakeByAddressSingle((PVOID) sequence);
 }
 
 #endif
@@ -39,6 +39,22 @@
 #include "../log.h"
 #define TAG WINPR_TAG("synch.critical")
 
+/**
+ * Spin limit used when no spin count was requested. Contended threads first
+ * spin for about as long as recent acquisitions needed (SpinEstimate), and
+ * only sleep when the lock stays held longer than that.
+ */
+#define WINPR_CRITICAL_SECTION_ADAPTIVE_SPIN	200
+
+static INLINE void _CpuRelax(void)
+{
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	__asm__ __volatile__("pause" ::: "memory");
+#elif defined(__GNUC__) && (defined(__aarch64__) || (defined(__arm__) && (__ARM_ARCH >= 7)))
+	__asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
 VOID InitializeCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
 {
 	InitializeCriticalSectionEx(lpCriticalSection, 0, 0);
@@ -46,6 +62,8 @@ VOID InitializeCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
 
 BOOL InitializeCriticalSectionEx(LPCRITICAL_SECTION lpCriticalSection, DWORD dwSpinCount, DWORD Flags)
 {
+	WINPR_CRITICAL_SECTION_WAIT* wait;
+
 	/**
 	 * See http://msdn.microsoft.com/en-us/library/ff541979(v=vs.85).aspx
 	 * - The LockCount field indicates the number of times that any thread has
@@ -61,16 +79,21 @@ BOOL InitializeCriticalSectionEx(LPCRITICAL_SECTION lpCriticalSection, DWORD dwS
 		WLog_WARN(TAG, "Flags unimplemented");
 	}
 
+	wait = (WINPR_CRITICAL_SECTION_WAIT*) calloc(1, sizeof(WINPR_CRITICAL_SECTION_WAIT));
+
+	if (!wait)
+		return FALSE;
+
 	lpCriticalSection->DebugInfo = NULL;
 	lpCriticalSection->LockCount = -1;
 	lpCriticalSection->SpinCount = 0;
 	lpCriticalSection->RecursionCount = 0;
 	lpCriticalSection->OwningThread = NULL;
-	lpCriticalSection->LockSemaphore = (winpr_sem_t*) malloc(sizeof(winpr_sem_t));
+	lpCriticalSection->LockSemaphore = (HANDLE) wait;
 #if defined(__APPLE__)
-	semaphore_create(mach_task_self(), lpCriticalSection->LockSemaphore, SYNC_POLICY_FIFO, 0);
-#else
-	sem_init(lpCriticalSection->LockSemaphore, 0, 0);
+	semaphore_create(mach_task_self(), &wait->sem, SYNC_POLICY_FIFO, 0);
+#elif !defined(__linux__)
+	sem_init(&wait->sem, 0, 0);
 #endif
 	SetCriticalSectionSpinCount(lpCriticalSection, dwSpinCount);
 	return TRUE;
@@ -86,14 +109,19 @@ DWORD SetCriticalSectionSpinCount(LPCRITICAL_SECTION lpCriticalSection, DWORD dw
 #if !defined(WINPR_CRITICAL_SECTION_DISABLE_SPINCOUNT)
 	SYSTEM_INFO sysinfo;
 	DWORD dwPreviousSpinCount = lpCriticalSection->SpinCount;
+	WINPR_CRITICAL_SECTION_WAIT* wait = (WINPR_CRITICAL_SECTION_WAIT*) lpCriticalSection->LockSemaphore;
 
-	if (dwSpinCount)
-	{
-		/* Don't spin on uniprocessor systems! */
-		GetNativeSystemInfo(&sysinfo);
+	/* Don't spin on uniprocessor systems! */
+	GetNativeSystemInfo(&sysinfo);
 
-		if (sysinfo.dwNumberOfProcessors < 2)
-			dwSpinCount = 0;
+	if (sysinfo.dwNumberOfProcessors < 2)
+	{
+		dwSpinCount = 0;
+		wait->SpinMax = 0;
+	}
+	else
+	{
+		wait->SpinMax = dwSpinCount ? dwSpinCount : WINPR_CRITICAL_SECTION_ADAPTIVE_SPIN;
 	}
 
 	lpCriticalSection->SpinCount = dwSpinCount;
@@ -105,54 +133,105 @@ DWORD SetCriticalSectionSpinCount(LPCRITICAL_SECTION lpCriticalSection, DWORD dw
 
 static VOID _WaitForCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
 {
-#if defined(__APPLE__)
-	semaphore_wait(*((winpr_sem_t*) lpCriticalSection->LockSemaphore));
+	WINPR_CRITICAL_SECTION_WAIT* wait = (WINPR_CRITICAL_SECTION_WAIT*) lpCriticalSection->LockSemaphore;
+#if defined(__linux__)
+	LONG count;
+
+	while (1)
+	{
+		count = wait->Count;
+
+		if (count > 0)
+		{
+			if (InterlockedCompareExchange(&wait->Count, count - 1, count) == count)
+				return;
+
+			continue;
+		}
+
+		/* Sleepers is raised before the futex re-checks Count, so no wake-up is lost */
+		InterlockedIncrement(&wait->Sleepers);
+		WaitOnAddress(&wait->Count, &count, sizeof(LONG), INFINITE);
+		InterlockedDecrement(&wait->Sleepers);
+	}
+#elif defined(__APPLE__)
+	semaphore_wait(wait->sem);
 #else
-	sem_wait((winpr_sem_t*) lpCriticalSection->LockSemaphore);
+	sem_wait(&wait->sem);
 #endif
 }
 
 static VOID _UnWaitCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
 {
-#if defined __APPLE__
-	semaphore_signal(*((winpr_sem_t*) lpCriticalSection->LockSemaphore));
+	WINPR_CRITICAL_SECTION_WAIT* wait = (WINPR_CRITICAL_SECTION_WAIT*) lpCriticalSection->LockSemaphore;
+#if defined(__linux__)
+	InterlockedIncrement(&wait->Count);
+
+	/* the next owner may still be spinning or about to sleep */
+	if (wait->Sleepers)
+		WakeByAddressSingle((PVOID) &wait->Count);
+#elif defined(__APPLE__)
+	semaphore_signal(wait->sem);
 #else
-	sem_post((winpr_sem_t*) lpCriticalSection->LockSemaphore);
+	sem_post(&wait->sem);
 #endif
 }
 
+#if !defined(WINPR_CRITICAL_SECTION_DISABLE_SPINCOUNT)
+
+static BOOL _SpinForCriticalSection(LPCRITICAL_SECTION lpCriticalSection, WINPR_CRITICAL_SECTION_WAIT* wait)
+{
+	LONG spins;
+	LONG limit;
+	BOOL acquired = FALSE;
+
+	limit = wait->SpinEstimate * 2 + 10;
+
+	if (limit > (LONG) wait->SpinMax)
+		limit = (LONG) wait->SpinMax;
+
+	/* Spin while the owner is likely to leave soon, but don't compete with waiting threads */
+	for (spins = 0; spins < limit; spins++)
+	{
+		if (lpCriticalSection->LockCount > 0)
+			break;
+
+		if ((lpCriticalSection->LockCount == -1) &&
+				(InterlockedCompareExchange(&lpCriticalSection->LockCount, 0, -1) == -1))
+		{
+			acquired = TRUE;
+			break;
+		}
+
+		_CpuRelax();
+	}
+
+	/* Moving average of the spin time that was needed, racy updates are harmless */
+	wait->SpinEstimate += (spins - wait->SpinEstimate) / 8;
+
+	return acquired;
+}
+
+#endif
+
 VOID EnterCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
 {
 #if !defined(WINPR_CRITICAL_SECTION_DISABLE_SPINCOUNT)
-	ULONG SpinCount = lpCriticalSection->SpinCount;
-
-	/* If we're lucky or if the current thread is already owner we can return early */
-	if (SpinCount && TryEnterCriticalSection(lpCriticalSection))
-		return;
+	WINPR_CRITICAL_SECTION_WAIT* wait = (WINPR_CRITICAL_SECTION_WAIT*) lpCriticalSection->LockSemaphore;
 
-	/* Spin requested times but don't compete with another waiting thread */
-	while (SpinCount-- && lpCriticalSection->LockCount < 1)
+	if (wait->SpinMax)
 	{
-		/* Atomically try to acquire and check the if the section is free. */
-		if (InterlockedCompareExchange(&lpCriticalSection->LockCount, 0, -1) == -1)
+		/* If we're lucky or if the current thread is already owner we can return early */
+		if (TryEnterCriticalSection(lpCriticalSection))
+			return;
+
+		if (_SpinForCriticalSection(lpCriticalSection, wait))
 		{
 			lpCriticalSection->RecursionCount = 1;
 			lpCriticalSection->OwningThread = (HANDLE)(ULONG_PTR) GetCurrentThreadId();
 			return;
 		}
-
-		/* Failed to get the lock. Let the scheduler know that we're spinning. */
-		if (sched_yield()!=0)
-		{
-			/**
-			 * On some operating systems sched_yield is a stub.
-			 * usleep should at least trigger a context switch if any thread is waiting.
-			 * A ThreadYield() would be nice in winpr ...
-			 */
-			usleep(1);
-		}
 	}
-
 #endif
 
 	/* First try the fastest posssible path to get the lock. */
@@ -221,19 +300,21 @@ VOID LeaveCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
 
 VOID DeleteCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
 {
+	WINPR_CRITICAL_SECTION_WAIT* wait = (WINPR_CRITICAL_SECTION_WAIT*) lpCriticalSection->LockSemaphore;
+
 	lpCriticalSection->LockCount = -1;
 	lpCriticalSection->SpinCount = 0;
 	lpCriticalSection->RecursionCount = 0;
 	lpCriticalSection->OwningThread = NULL;
 
-	if (lpCriticalSection->LockSemaphore != NULL)
+	if (wait != NULL)
 	{
-#if defined __APPLE__
-		semaphore_destroy(mach_task_self(), *((winpr_sem_t*) lpCriticalSection->LockSemaphore));
-#else
-		sem_destroy((winpr_sem_t*) lpCriticalSection->LockSemaphore);
+#if defined(__APPLE__)
+		semaphore_destroy(mach_task_self(), wait->sem);
+#elif !defined(__linux__)
+		sem_destroy(&wait->sem);
 #endif
-		free(lpCriticalSection->LockSemaphore);
+		free(wait);
 		lpCriticalSection->LockSemaphore = NULL;
 	}
 }
@@ -26,6 +26,8 @@
 #include <stdlib.h>
 
 #include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 
 #ifndef _WIN32
 
@@ -58,6 +60,7 @@ HANDLE CreateEventW(LPSECURITY_ATTRIBUTES lpEventAttributes, BOOL bManualReset,
 	{
 		event->bAttached = FALSE;
 		event->bManualReset = bManualReset;
+		event->bNotification = FALSE;
 
 		if (!event->bManualReset)
 		{
@@ -138,6 +141,134 @@ static int eventfd_write(int fd, eventfd_t value)
 #endif
 #endif
 
+/**
+ * Brings the file descriptor of a notification event in line with its
+ * State word. Callers change State first, so the last one to get here
+ * always leaves the descriptor matching the final state.
+ */
+
+static BOOL winpr_event_sync_fd(WINPR_EVENT* event)
+{
+	int length = 0;
+	BOOL signaled;
+
+	pthread_mutex_lock(&event->FdLock);
+
+	signaled = event->State ? TRUE : FALSE;
+
+	if (signaled != event->FdSignaled)
+	{
+#ifdef HAVE_EVENTFD_H
+		eventfd_t value = 1;
+
+		do
+		{
+			if (signaled)
+				length = eventfd_write(event->pipe_fd[0], value);
+			else
+				length = eventfd_read(event->pipe_fd[0], &value);
+		}
+		while ((length < 0) && (errno == EINTR));
+
+#else
+		char value = '-';
+
+		if (signaled)
+			length = (write(event->pipe_fd[1], &value, 1) == 1) ? 0 : -1;
+		else
+			length = (read(event->pipe_fd[0], &value, 1) == 1) ? 0 : -1;
+
+#endif
+
+		if (length == 0)
+			event->FdSignaled = signaled;
+	}
+
+	pthread_mutex_unlock(&event->FdLock);
+
+	return (length == 0) ? TRUE : FALSE;
+}
+
+/**
+ * Returns the file descriptor of an event, creating it for notification
+ * events that have never been polled before.
+ */
+
+int winpr_event_get_fd(WINPR_EVENT* event)
+{
+	int fd[2];
+
+	if (!event->bNotification || (event->pipe_fd[0] != -1))
+		return event->pipe_fd[0];
+
+	pthread_mutex_lock(&event->FdLock);
+
+	if (event->pipe_fd[0] == -1)
+	{
+#ifdef HAVE_EVENTFD_H
+		fd[0] = eventfd(0, EFD_NONBLOCK);
+		fd[1] = -1;
+
+		if (fd[0] < 0)
+#else
+		if (pipe(fd) < 0)
+#endif
+		{
+			WLog_ERR(TAG, "failed to create event file descriptor");
+			pthread_mutex_unlock(&event->FdLock);
+			return -1;
+		}
+
+		event->pipe_fd[1] = fd[1];
+		event->FdSignaled = FALSE;
+
+		/* pairs with the State change in SetEvent and ResetEvent */
+		InterlockedExchange((LONG volatile*) &event->pipe_fd[0], fd[0]);
+	}
+
+	pthread_mutex_unlock(&event->FdLock);
+
+	if (!winpr_event_sync_fd(event))
+		return -1;
+
+	return event->pipe_fd[0];
+}
+
+DWORD winpr_notification_event_wait(WINPR_EVENT* event, DWORD dwMilliseconds)
+{
+	LONG state = 0;
+	DWORD elapsed;
+	DWORD dwStatus = WAIT_OBJECT_0;
+	ULONGLONG start;
+
+	if (event->State)
+		return WAIT_OBJECT_0;
+
+	if (dwMilliseconds == 0)
+		return WAIT_TIMEOUT;
+
+	start = GetTickCount64();
+	InterlockedIncrement(&event->Waiters);
+
+	while (!event->State)
+	{
+		elapsed = (DWORD) (GetTickCount64() - start);
+
+		if ((dwMilliseconds != INFINITE) && (elapsed >= dwMilliseconds))
+		{
+			dwStatus = WAIT_TIMEOUT;
+			break;
+		}
+
+		WaitOnAddress(&event->State, &state, sizeof(LONG),
+				(dwMilliseconds == INFINITE) ? INFINITE : (dwMilliseconds - elapsed));
+	}
+
+	InterlockedDecrement(&event->Waiters);
+
+	return dwStatus;
+}
+
 BOOL SetEvent(HANDLE hEvent)
 {
 	ULONG Type;
@@ -150,6 +281,22 @@ BOOL SetEvent(HANDLE hEvent)
 	if (winpr_Handle_GetInfo(hEvent, &Type, &Object))
 	{
 		event = (WINPR_EVENT*) Object;
+
+		if (event->bNotification)
+		{
+			/* setting a signaled event costs no system call */
+			if (event->State || InterlockedExchange(&event->State, 1))
+				return TRUE;
+
+			if (event->Waiters)
+				WakeByAddressAll((PVOID) &event->State);
+
+			if (event->pipe_fd[0] != -1)
+				return winpr_event_sync_fd(event);
+
+			return TRUE;
+		}
+
 #ifdef HAVE_EVENTFD_H
 		eventfd_t val = 1;
 
@@ -193,6 +340,17 @@ BOOL ResetEvent(HANDLE hEvent)
 	{
 		event = (WINPR_EVENT*) Object;
 
+		if (event->bNotification)
+		{
+			if (!event->State || (InterlockedCompareExchange(&event->State, 0, 1) != 1))
+				return TRUE;
+
+			if (event->pipe_fd[0] != -1)
+				return winpr_event_sync_fd(event);
+
+			return TRUE;
+		}
+
 		while (WaitForSingleObject(hEvent, 0) == WAIT_OBJECT_0)
 		{
 #ifdef HAVE_EVENTFD_H
@@ -233,6 +391,7 @@ HANDLE CreateFileDescriptorEventW(LPSECURITY_ATTRIBUTES lpEventAttributes, BOOL
 	{
 		event->bAttached = TRUE;
 		event->bManualReset = bManualReset;
+		event->bNotification = FALSE;
 		event->pipe_fd[0] = FileDescriptor;
 		event->pipe_fd[1] = -1;
 		WINPR_HANDLE_SET_TYPE(event, HANDLE_TYPE_EVENT);
@@ -250,6 +409,41 @@ HANDLE CreateFileDescriptorEventA(LPSECURITY_ATTRIBUTES lpEventAttributes, BOOL
 	return CreateFileDescriptorEventW(lpEventAttributes, bManualReset, bInitialState, FileDescriptor);
 }
 
+/**
+ * Creates a manual-reset event optimized for signaling between threads:
+ * setting a signaled event, resetting a non-signaled one and signaling an
+ * event nobody waits on do not enter the kernel, and no file descriptor is
+ * allocated until the event is waited on together with other objects.
+ */
+
+HANDLE CreateNotificationEvent(LPSECURITY_ATTRIBUTES lpEventAttributes, BOOL bInitialState)
+{
+#ifndef _WIN32
+	WINPR_EVENT* event;
+	event = (WINPR_EVENT*) calloc(1, sizeof(WINPR_EVENT));
+
+	if (!event)
+		return NULL;
+
+	event->bManualReset = TRUE;
+	event->bNotification = TRUE;
+	event->State = bInitialState ? 1 : 0;
+	event->pipe_fd[0] = -1;
+	event->pipe_fd[1] = -1;
+
+	if (pthread_mutex_init(&event->FdLock, NULL) != 0)
+	{
+		free(event);
+		return NULL;
+	}
+
+	WINPR_HANDLE_SET_TYPE(event, HANDLE_TYPE_EVENT);
+	return (HANDLE) event;
+#else
+	return CreateEvent(lpEventAttributes, TRUE, bInitialState, NULL);
+#endif
+}
+
 /**
  * Returns an event based on the handle returned by GetEventWaitObject()
  */
@@ -296,6 +490,9 @@ int GetEventFileDescriptor(HANDLE hEvent)
 		}
 	}
 
+	if (Type == HANDLE_TYPE_EVENT)
+		return winpr_event_get_fd(event);
+
 	return event->pipe_fd[0];
 #else
 	return -1;
@@ -29,6 +29,11 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_EVENTFD_H
+#include <sys/eventfd.h>
+#include <errno.h>
+#endif
+
 #ifndef _WIN32
 
 #include "../handle/handle.h"
@@ -45,12 +50,22 @@ HANDLE CreateSemaphoreW(LPSECURITY_ATTRIBUTES lpSemaphoreAttributes, LONG lIniti
 		return NULL;
 
 	semaphore->pipe_fd[0] = -1;
-	semaphore->pipe_fd[0] = -1;
+	semaphore->pipe_fd[1] = -1;
 	semaphore->sem = (winpr_sem_t*) NULL;
 
 	if (semaphore)
 	{
-#ifdef WINPR_PIPE_SEMAPHORE
+#if defined(WINPR_EVENTFD_SEMAPHORE)
+		semaphore->pipe_fd[0] = eventfd((unsigned int) lInitialCount, EFD_SEMAPHORE);
+
+		if (semaphore->pipe_fd[0] < 0)
+		{
+			WLog_ERR(TAG, "failed to create semaphore");
+			free(semaphore);
+			return NULL;
+		}
+
+#elif defined(WINPR_PIPE_SEMAPHORE)
 
 		if (pipe(semaphore->pipe_fd) < 0)
 		{
@@ -116,7 +131,25 @@ BOOL ReleaseSemaphore(HANDLE hSemaphore, LONG lReleaseCount, LPLONG lpPreviousCo
 	if (Type == HANDLE_TYPE_SEMAPHORE)
 	{
 		semaphore = (WINPR_SEMAPHORE*) Object;
-#ifdef WINPR_PIPE_SEMAPHORE
+#if defined(WINPR_EVENTFD_SEMAPHORE)
+
+		if (lReleaseCount > 0)
+		{
+			int status;
+			UINT64 value = (UINT64) lReleaseCount;
+
+			/* a single write releases any number of units */
+			do
+			{
+				status = write(semaphore->pipe_fd[0], &value, sizeof(value));
+			}
+			while ((status < 0) && (errno == EINTR));
+
+			if (status != sizeof(value))
+				return FALSE;
+		}
+
+#elif defined(WINPR_PIPE_SEMAPHORE)
 
 		if (semaphore->pipe_fd[0] != -1)
 		{
@@ -142,4 +175,27 @@ BOOL ReleaseSemaphore(HANDLE hSemaphore, LONG lReleaseCount, LPLONG lpPreviousCo
 	return FALSE;
 }
 
+/**
+ * Takes one unit from a semaphore file descriptor that was reported readable.
+ */
+
+BOOL winpr_semaphore_acquire_fd(int fd)
+{
+#if defined(WINPR_EVENTFD_SEMAPHORE)
+	int status;
+	UINT64 value;
+
+	do
+	{
+		status = read(fd, &value, sizeof(value));
+	}
+	while ((status < 0) && (errno == EINTR));
+
+	return (status == sizeof(value)) ? TRUE : FALSE;
+#else
+	BYTE value;
+	return (read(fd, &value, 1) == 1) ? TRUE : FALSE;
+#endif
+}
+
 #endif
@@ -22,6 +22,7 @@
 #endif
 
 #include <winpr/synch.h>
+#include <winpr/interlocked.h>
 
 /**
  * InitializeSRWLock
@@ -35,39 +36,146 @@
 
 #ifndef _WIN32
 
-VOID InitializeSRWLock(PSRWLOCK SRWLock)
+/**
+ * The lock is a single 32-bit word stored in the SRWLOCK:
+ *
+ * - SRW_LOCK_WRITER is set while the lock is held exclusively
+ * - SRW_LOCK_WAITERS is set when at least one thread is blocked on the lock
+ * - the remaining bits count the shared owners
+ *
+ * Threads block with WaitOnAddress() on the lock word. New shared owners
+ * are held back while a thread is waiting, so that a steady stream of
+ * readers cannot starve a writer. Releasing the lock when the waiter bit
+ * is set clears it and wakes all waiters, which then compete again.
+ */
+
+#define SRW_LOCK_WRITER		0x40000000
+#define SRW_LOCK_WAITERS	0x20000000
+#define SRW_LOCK_READERS	0x1FFFFFFF
+
+#define SRW_LOCK_STATE(_lock)	((LONG volatile*) (_lock))
+
+static void winpr_srw_lock_wait(LONG volatile* state, LONG value)
 {
+	if (!(value & SRW_LOCK_WAITERS))
+	{
+		if (InterlockedCompareExchange(state, value | SRW_LOCK_WAITERS, value) != value)
+			return;
+
+		value |= SRW_LOCK_WAITERS;
+	}
+
+	WaitOnAddress(state, &value, sizeof(LONG), INFINITE);
+}
 
+VOID InitializeSRWLock(PSRWLOCK SRWLock)
+{
+	*SRWLock = NULL;
 }
 
 VOID AcquireSRWLockExclusive(PSRWLOCK SRWLock)
 {
+	LONG value;
+	LONG volatile* state = SRW_LOCK_STATE(SRWLock);
 
+	while (1)
+	{
+		value = *state;
+
+		if (!(value & (SRW_LOCK_WRITER | SRW_LOCK_READERS)))
+		{
+			if (InterlockedCompareExchange(state, value | SRW_LOCK_WRITER, value) == value)
+				return;
+
+			continue;
+		}
+
+		winpr_srw_lock_wait(state, value);
+	}
 }
 
 VOID AcquireSRWLockShared(PSRWLOCK SRWLock)
 {
+	LONG value;
+	LONG volatile* state = SRW_LOCK_STATE(SRWLock);
+
+	while (1)
+	{
+		value = *state;
 
+		if (!(value & (SRW_LOCK_WRITER | SRW_LOCK_WAITERS)))
+		{
+			if (InterlockedCompareExchange(state, value + 1, value) == value)
+				return;
+
+			continue;
+		}
+
+		winpr_srw_lock_wait(state, value);
+	}
 }
 
 BOOL TryAcquireSRWLockExclusive(PSRWLOCK SRWLock)
 {
-	return TRUE;
+	LONG value;
+	LONG volatile* state = SRW_LOCK_STATE(SRWLock);
+
+	value = *state;
+
+	if (value & (SRW_LOCK_WRITER | SRW_LOCK_READERS))
+		return FALSE;
+
+	return (InterlockedCompareExchange(state, value | SRW_LOCK_WRITER, value) == value) ? TRUE : FALSE;
 }
 
 BOOL TryAcquireSRWLockShared(PSRWLOCK SRWLock)
 {
-	return TRUE;
+	LONG value;
+	LONG volatile* state = SRW_LOCK_STATE(SRWLock);
+
+	while (1)
+	{
+		value = *state;
+
+		if (value & (SRW_LOCK_WRITER | SRW_LOCK_WAITERS))
+			return FALSE;
+
+		/* only retry when another shared owner got in first */
+		if (InterlockedCompareExchange(state, value + 1, value) == value)
+			return TRUE;
+	}
 }
 
 VOID ReleaseSRWLockExclusive(PSRWLOCK SRWLock)
 {
+	LONG volatile* state = SRW_LOCK_STATE(SRWLock);
 
+	if (InterlockedExchange(state, 0) & SRW_LOCK_WAITERS)
+		WakeByAddressAll((PVOID) state);
 }
 
 VOID ReleaseSRWLockShared(PSRWLOCK SRWLock)
 {
-
+	LONG value;
+	LONG volatile* state = SRW_LOCK_STATE(SRWLock);
+
+	value = InterlockedDecrement(state);
+
+	/**
+	 * Only the last shared owner wakes the waiters. If a writer takes the
+	 * lock before the waiter bit is cleared, its release wakes them instead.
+	 */
+
+	while (value == SRW_LOCK_WAITERS)
+	{
+		if (InterlockedCompareExchange(state, 0, value) == value)
+		{
+			WakeByAddressAll((PVOID) state);
+			return;
+		}
+
+		value = *state;
+	}
 }
 
 #endif
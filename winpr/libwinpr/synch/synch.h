@@ -60,6 +60,37 @@ struct winpr_mutex
 };
 typedef struct winpr_mutex WINPR_MUTEX;
 
+/**
+ * Wait block of a critical section, referenced by its LockSemaphore.
+ *
+ * On Linux, contended threads sleep on the Count futex word and are handed
+ * the lock one at a time by LeaveCriticalSection. SpinEstimate tracks how
+ * long recent acquisitions had to spin, SpinMax caps it (0: never spin).
+ */
+
+struct winpr_critical_section_wait
+{
+#if defined(__linux__)
+	LONG volatile Count;
+	LONG volatile Sleepers;
+#else
+	winpr_sem_t sem;
+#endif
+	LONG SpinEstimate;
+	ULONG SpinMax;
+};
+typedef struct winpr_critical_section_wait WINPR_CRITICAL_SECTION_WAIT;
+
+/**
+ * With eventfd, a semaphore is a single EFD_SEMAPHORE descriptor in
+ * pipe_fd[0]: its counter is the semaphore count, and each read takes
+ * one unit. Otherwise, the count is the number of bytes in a pipe.
+ */
+
+#ifdef HAVE_EVENTFD_H
+#define WINPR_EVENTFD_SEMAPHORE	1
+#endif
+
 struct winpr_semaphore
 {
 	WINPR_HANDLE_DEF();
@@ -69,6 +100,16 @@ struct winpr_semaphore
 };
 typedef struct winpr_semaphore WINPR_SEMAPHORE;
 
+BOOL winpr_semaphore_acquire_fd(int fd);
+
+/**
+ * Notification events keep their state in the State word: threads blocked
+ * in WaitForSingleObject sleep on it with WaitOnAddress, and SetEvent only
+ * wakes them when Waiters is not zero. The file descriptor is created the
+ * first time the event is polled together with other objects, after which
+ * SetEvent and ResetEvent keep it in sync with State under the fd lock.
+ */
+
 struct winpr_event
 {
 	WINPR_HANDLE_DEF();
@@ -76,9 +117,18 @@ struct winpr_event
 	int pipe_fd[2];
 	BOOL bAttached;
 	BOOL bManualReset;
+
+	BOOL bNotification;
+	LONG volatile State;
+	LONG volatile Waiters;
+	BOOL FdSignaled;
+	pthread_mutex_t FdLock;
 };
 typedef struct winpr_event WINPR_EVENT;
 
+int winpr_event_get_fd(WINPR_EVENT* event);
+DWORD winpr_notification_event_wait(WINPR_EVENT* event, DWORD dwMilliseconds);
+
 #ifdef HAVE_TIMERFD_H
 #include <stdio.h>
 #include <unistd.h>
@@ -106,6 +156,19 @@ typedef struct winpr_timer WINPR_TIMER;
 
 typedef struct winpr_timer_queue_timer WINPR_TIMER_QUEUE_TIMER;
 
+/**
+ * Timer queues keep their timers in a hierarchical timer wheel with a
+ * resolution of one millisecond: level 0 holds the timers due within the
+ * next 256 ticks, and each further level covers 256 times the range of the
+ * previous one, so four levels cover any 32-bit due time. Timers of the
+ * higher levels are cascaded down as the wheel turns.
+ */
+
+#define TIMER_QUEUE_WHEEL_BITS		8
+#define TIMER_QUEUE_WHEEL_SIZE		(1 << TIMER_QUEUE_WHEEL_BITS)
+#define TIMER_QUEUE_WHEEL_MASK		(TIMER_QUEUE_WHEEL_SIZE - 1)
+#define TIMER_QUEUE_WHEEL_LEVELS	4
+
 struct winpr_timer_queue
 {
 	WINPR_HANDLE_DEF();
@@ -118,8 +181,17 @@ struct winpr_timer_queue
 	struct sched_param param;
 
 	BOOL bCancelled;
-	WINPR_TIMER_QUEUE_TIMER* activeHead;
-	WINPR_TIMER_QUEUE_TIMER* inactiveHead;
+
+#ifdef HAVE_TIMERFD_H
+	int fd;
+#endif
+	ULONGLONG BaseTime;
+	UINT64 CurrentTick;
+	UINT64 ArmedTick;
+	DWORD TimerCount;
+
+	UINT32 Pending[TIMER_QUEUE_WHEEL_LEVELS][TIMER_QUEUE_WHEEL_SIZE / 32];
+	WINPR_TIMER_QUEUE_TIMER* Wheel[TIMER_QUEUE_WHEEL_LEVELS][TIMER_QUEUE_WHEEL_SIZE];
 };
 typedef struct winpr_timer_queue WINPR_TIMER_QUEUE;
 
@@ -135,10 +207,13 @@ struct winpr_timer_queue_timer
 	
 	int FireCount;
 
-	struct timespec StartTime;
-	struct timespec ExpirationTime;
+	BOOL bActive;
+	int Level;
+	int Slot;
+	UINT64 ExpirationTick;
 
 	WINPR_TIMER_QUEUE* timerQueue;
+	WINPR_TIMER_QUEUE_TIMER* prev;
 	WINPR_TIMER_QUEUE_TIMER* next;
 };
 
@@ -9,6 +9,8 @@
 
 #define TEST_SYNC_CRITICAL_TEST1_RUNTIME_MS 500
 #define TEST_SYNC_CRITICAL_TEST1_RUNS 4
+#define TEST_SYNC_CRITICAL_BENCH_THREADS 4
+#define TEST_SYNC_CRITICAL_BENCH_ITERATIONS 100000
 
 CRITICAL_SECTION critical;
 LONG gTestValueVulnerable = 0;
@@ -92,6 +94,60 @@ static PVOID TestSynchCritical_Test2(PVOID arg)
 	return (PVOID)0;
 }
 
+/* contended microbenchmark: short hold times, as on queue and transport locks */
+static PVOID TestSynchCritical_Bench(PVOID arg)
+{
+	int i, j;
+	LONG* pValue = (LONG*)arg;
+
+	for (i = 0; i < TEST_SYNC_CRITICAL_BENCH_ITERATIONS; i++)
+	{
+		EnterCriticalSection(&critical);
+
+		for (j = 0; j < 16; j++)
+			(*pValue)++;
+
+		LeaveCriticalSection(&critical);
+	}
+
+	return (PVOID)0;
+}
+
+static BOOL TestSynchCritical_RunBench(DWORD dwSpinCount)
+{
+	int i;
+	LONG value = 0;
+	UINT32 start, end;
+	HANDLE hThreads[TEST_SYNC_CRITICAL_BENCH_THREADS];
+
+	InitializeCriticalSectionAndSpinCount(&critical, dwSpinCount);
+
+	start = GetTickCount();
+
+	for (i = 0; i < TEST_SYNC_CRITICAL_BENCH_THREADS; i++)
+		hThreads[i] = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) TestSynchCritical_Bench, &value, 0, NULL);
+
+	for (i = 0; i < TEST_SYNC_CRITICAL_BENCH_THREADS; i++)
+	{
+		WaitForSingleObject(hThreads[i], INFINITE);
+		CloseHandle(hThreads[i]);
+	}
+
+	end = GetTickCount();
+
+	DeleteCriticalSection(&critical);
+
+	printf("CriticalSection (spin count %u): %d threads x %d acquisitions in %u ms\n",
+		dwSpinCount, TEST_SYNC_CRITICAL_BENCH_THREADS, TEST_SYNC_CRITICAL_BENCH_ITERATIONS, end - start);
+
+	if (value != TEST_SYNC_CRITICAL_BENCH_THREADS * TEST_SYNC_CRITICAL_BENCH_ITERATIONS * 16)
+	{
+		printf("CriticalSection failure: unexpected benchmark value %d\n", value);
+		return FALSE;
+	}
+
+	return TRUE;
+}
 
 static PVOID TestSynchCritical_Main(PVOID arg)
 {
@@ -273,6 +329,16 @@ static PVOID TestSynchCritical_Main(PVOID arg)
 		goto fail;
 	}
 	CloseHandle(hThread);
+	LeaveCriticalSection(&critical);
+	DeleteCriticalSection(&critical);
+
+
+	/**
+	 * Contended acquisitions with the default adaptive spinning and with an explicit spin count
+	 */
+
+	if (!TestSynchCritical_RunBench(0) || !TestSynchCritical_RunBench(4000))
+		goto fail;
 
 	*pbThreadTerminated = TRUE; /* requ. for winpr issue, see below */
 	return (PVOID)0;
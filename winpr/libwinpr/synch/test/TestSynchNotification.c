@@ -0,0 +1,184 @@
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+
+#define TEST_NOTIFICATION_HANDOFFS	20000
+
+struct test_handoff
+{
+	HANDLE ping;
+	HANDLE pong;
+	int count;
+};
+typedef struct test_handoff TEST_HANDOFF;
+
+static DWORD WINAPI TestSynchNotification_Thread(LPVOID arg)
+{
+	int i;
+	TEST_HANDOFF* handoff = (TEST_HANDOFF*) arg;
+
+	for (i = 0; i < handoff->count; i++)
+	{
+		if (WaitForSingleObject(handoff->ping, INFINITE) != WAIT_OBJECT_0)
+			return 1;
+
+		ResetEvent(handoff->ping);
+		SetEvent(handoff->pong);
+	}
+
+	return 0;
+}
+
+/* returns the time taken by count round trips between two threads, or -1 */
+
+static int TestSynchNotification_Handoff(BOOL notification, int count)
+{
+	int i;
+	DWORD exitCode = 1;
+	UINT32 start, end;
+	HANDLE thread;
+	TEST_HANDOFF handoff;
+
+	handoff.count = count;
+
+	if (notification)
+	{
+		handoff.ping = CreateNotificationEvent(NULL, FALSE);
+		handoff.pong = CreateNotificationEvent(NULL, FALSE);
+	}
+	else
+	{
+		handoff.ping = CreateEvent(NULL, TRUE, FALSE, NULL);
+		handoff.pong = CreateEvent(NULL, TRUE, FALSE, NULL);
+	}
+
+	if (!handoff.ping || !handoff.pong)
+		return -1;
+
+	thread = CreateThread(NULL, 0, TestSynchNotification_Thread, &handoff, 0, NULL);
+
+	if (!thread)
+		return -1;
+
+	start = GetTickCount();
+
+	for (i = 0; i < count; i++)
+	{
+		SetEvent(handoff.ping);
+
+		if (WaitForSingleObject(handoff.pong, INFINITE) != WAIT_OBJECT_0)
+			break;
+
+		ResetEvent(handoff.pong);
+	}
+
+	end = GetTickCount();
+
+	WaitForSingleObject(thread, INFINITE);
+	GetExitCodeThread(thread, &exitCode);
+	CloseHandle(thread);
+
+	CloseHandle(handoff.ping);
+	CloseHandle(handoff.pong);
+
+	if ((i != count) || (exitCode != 0))
+		return -1;
+
+	return (int) (end - start);
+}
+
+int TestSynchNotification(int argc, char* argv[])
+{
+	int fd;
+	int elapsed;
+	HANDLE event;
+	HANDLE events[2];
+
+	event = CreateNotificationEvent(NULL, TRUE);
+
+	if (!event)
+	{
+		printf("CreateNotificationEvent failure\n");
+		return -1;
+	}
+
+	if (WaitForSingleObject(event, INFINITE) != WAIT_OBJECT_0)
+	{
+		printf("WaitForSingleObject(event, INFINITE) failure\n");
+		return -1;
+	}
+
+	ResetEvent(event);
+
+	if (WaitForSingleObject(event, 10) != WAIT_TIMEOUT)
+	{
+		printf("WaitForSingleObject(event, 10) failure\n");
+		return -1;
+	}
+
+	/* setting twice is the same as setting once */
+	SetEvent(event);
+	SetEvent(event);
+
+	if (WaitForSingleObject(event, 0) != WAIT_OBJECT_0)
+	{
+		printf("WaitForSingleObject(event, 0) failure\n");
+		return -1;
+	}
+
+	/* the file descriptor is created signaled */
+
+	events[0] = CreateEvent(NULL, TRUE, FALSE, NULL);
+	events[1] = event;
+
+	if (WaitForMultipleObjects(2, events, FALSE, 0) != (WAIT_OBJECT_0 + 1))
+	{
+		printf("WaitForMultipleObjects: signaled notification event not reported\n");
+		return -1;
+	}
+
+	ResetEvent(event);
+
+	if (WaitForMultipleObjects(2, events, FALSE, 0) != WAIT_TIMEOUT)
+	{
+		printf("WaitForMultipleObjects: reset notification event still signaled\n");
+		return -1;
+	}
+
+	SetEvent(event);
+
+	fd = GetEventFileDescriptor(event);
+
+	if ((fd < 0) || (WaitForMultipleObjects(2, events, FALSE, 0) != (WAIT_OBJECT_0 + 1)))
+	{
+		printf("WaitForMultipleObjects: notification event file descriptor out of sync\n");
+		return -1;
+	}
+
+	CloseHandle(events[0]);
+	CloseHandle(event);
+
+	elapsed = TestSynchNotification_Handoff(FALSE, TEST_NOTIFICATION_HANDOFFS);
+
+	if (elapsed < 0)
+	{
+		printf("event handoff failure\n");
+		return -1;
+	}
+
+	printf("CreateEvent: %d handoffs in %d ms\n", TEST_NOTIFICATION_HANDOFFS, elapsed);
+
+	elapsed = TestSynchNotification_Handoff(TRUE, TEST_NOTIFICATION_HANDOFFS);
+
+	if (elapsed < 0)
+	{
+		printf("notification event handoff failure\n");
+		return -1;
+	}
+
+	printf("CreateNotificationEvent: %d handoffs in %d ms\n", TEST_NOTIFICATION_HANDOFFS, elapsed);
+
+	return 0;
+}
@@ -0,0 +1,316 @@
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/thread.h>
+#include <winpr/interlocked.h>
+
+#define TEST_SRW_THREADS		4
+#define TEST_SRW_ITERATIONS		200000
+#define TEST_SRW_WRITE_RATIO		16
+#define TEST_SRW_ITEMS			20000
+
+static SRWLOCK srwLock = SRWLOCK_INIT;
+static CRITICAL_SECTION critical;
+static CONDITION_VARIABLE condition = CONDITION_VARIABLE_INIT;
+static CONDITION_VARIABLE finished = CONDITION_VARIABLE_INIT;
+
+static LONG gTestValueA = 0;
+static LONG gTestValueB = 0;
+static LONG gTestReaders = 0;
+static LONG gTestFailures = 0;
+
+static LONG gTestItems = 0;
+static LONG gTestConsumed = 0;
+
+static BOOL TestSynchSRW_Try(void)
+{
+	if (!TryAcquireSRWLockExclusive(&srwLock))
+	{
+		printf("TryAcquireSRWLockExclusive failed on a free lock\n");
+		return FALSE;
+	}
+
+	if (TryAcquireSRWLockShared(&srwLock) || TryAcquireSRWLockExclusive(&srwLock))
+	{
+		printf("TryAcquireSRWLock succeeded on an exclusively held lock\n");
+		return FALSE;
+	}
+
+	ReleaseSRWLockExclusive(&srwLock);
+
+	if (!TryAcquireSRWLockShared(&srwLock) || !TryAcquireSRWLockShared(&srwLock))
+	{
+		printf("TryAcquireSRWLockShared failed on a shared lock\n");
+		return FALSE;
+	}
+
+	if (TryAcquireSRWLockExclusive(&srwLock))
+	{
+		printf("TryAcquireSRWLockExclusive succeeded on a shared lock\n");
+		return FALSE;
+	}
+
+	ReleaseSRWLockShared(&srwLock);
+	ReleaseSRWLockShared(&srwLock);
+
+	if (!TryAcquireSRWLockExclusive(&srwLock))
+	{
+		printf("TryAcquireSRWLockExclusive failed after the shared owners left\n");
+		return FALSE;
+	}
+
+	ReleaseSRWLockExclusive(&srwLock);
+
+	return TRUE;
+}
+
+/* writers keep A == B, readers check it and that no writer is inside */
+
+static DWORD WINAPI TestSynchSRW_Worker(LPVOID arg)
+{
+	int i;
+
+	for (i = 0; i < TEST_SRW_ITERATIONS; i++)
+	{
+		if ((i % TEST_SRW_WRITE_RATIO) == 0)
+		{
+			AcquireSRWLockExclusive(&srwLock);
+
+			if (gTestReaders != 0)
+				gTestFailures++;
+
+			gTestValueA++;
+			SwitchToThread();
+			gTestValueB++;
+
+			ReleaseSRWLockExclusive(&srwLock);
+		}
+		else
+		{
+			AcquireSRWLockShared(&srwLock);
+			InterlockedIncrement(&gTestReaders);
+
+			if (gTestValueA != gTestValueB)
+				InterlockedIncrement(&gTestFailures);
+
+			InterlockedDecrement(&gTestReaders);
+			ReleaseSRWLockShared(&srwLock);
+		}
+	}
+
+	return 0;
+}
+
+static DWORD WINAPI TestSynchSRW_Consumer(LPVOID arg)
+{
+	BOOL shared = (arg != NULL) ? TRUE : FALSE;
+
+	while (1)
+	{
+		AcquireSRWLockExclusive(&srwLock);
+
+		while (!gTestItems && (gTestConsumed < TEST_SRW_ITEMS))
+			SleepConditionVariableSRW(&condition, &srwLock, INFINITE, 0);
+
+		if (gTestConsumed >= TEST_SRW_ITEMS)
+		{
+			ReleaseSRWLockExclusive(&srwLock);
+			break;
+		}
+
+		gTestItems--;
+		gTestConsumed++;
+
+		if (gTestConsumed == TEST_SRW_ITEMS)
+		{
+			WakeAllConditionVariable(&condition);
+			WakeAllConditionVariable(&finished);
+		}
+
+		ReleaseSRWLockExclusive(&srwLock);
+
+		if (shared)
+		{
+			/* a reader sleeping in shared mode is woken by the final broadcast */
+			AcquireSRWLockShared(&srwLock);
+
+			while (gTestConsumed < TEST_SRW_ITEMS)
+				SleepConditionVariableSRW(&finished, &srwLock, INFINITE, CONDITION_VARIABLE_LOCKMODE_SHARED);
+
+			ReleaseSRWLockShared(&srwLock);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static BOOL TestSynchSRW_Condition(void)
+{
+	int i;
+	HANDLE threads[TEST_SRW_THREADS];
+
+	for (i = 0; i < TEST_SRW_THREADS; i++)
+	{
+		threads[i] = CreateThread(NULL, 0, TestSynchSRW_Consumer, (i == 0) ? (LPVOID) 1 : NULL, 0, NULL);
+
+		if (!threads[i])
+			return FALSE;
+	}
+
+	for (i = 0; i < TEST_SRW_ITEMS; i++)
+	{
+		AcquireSRWLockExclusive(&srwLock);
+		gTestItems++;
+		ReleaseSRWLockExclusive(&srwLock);
+
+		WakeConditionVariable(&condition);
+	}
+
+	for (i = 0; i < TEST_SRW_THREADS; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+
+	if ((gTestConsumed != TEST_SRW_ITEMS) || (gTestItems != 0))
+	{
+		printf("SleepConditionVariableSRW: consumed %d items, %d left\n",
+				(int) gTestConsumed, (int) gTestItems);
+		return FALSE;
+	}
+
+	EnterCriticalSection(&critical);
+
+	if (SleepConditionVariableCS(&condition, &critical, 10) || (GetLastError() != ERROR_TIMEOUT))
+	{
+		printf("SleepConditionVariableCS: expected a timeout\n");
+		LeaveCriticalSection(&critical);
+		return FALSE;
+	}
+
+	LeaveCriticalSection(&critical);
+
+	return TRUE;
+}
+
+/* read-mostly workload: SRW lock against a critical section */
+
+static DWORD WINAPI TestSynchSRW_BenchSRW(LPVOID arg)
+{
+	int i;
+	LONG value = 0;
+
+	for (i = 0; i < TEST_SRW_ITERATIONS; i++)
+	{
+		if ((i % TEST_SRW_WRITE_RATIO) == 0)
+		{
+			AcquireSRWLockExclusive(&srwLock);
+			gTestValueA++;
+			ReleaseSRWLockExclusive(&srwLock);
+		}
+		else
+		{
+			AcquireSRWLockShared(&srwLock);
+			value += gTestValueA;
+			ReleaseSRWLockShared(&srwLock);
+		}
+	}
+
+	return (DWORD) value;
+}
+
+static DWORD WINAPI TestSynchSRW_BenchCritical(LPVOID arg)
+{
+	int i;
+	LONG value = 0;
+
+	for (i = 0; i < TEST_SRW_ITERATIONS; i++)
+	{
+		EnterCriticalSection(&critical);
+
+		if ((i % TEST_SRW_WRITE_RATIO) == 0)
+			gTestValueA++;
+		else
+			value += gTestValueA;
+
+		LeaveCriticalSection(&critical);
+	}
+
+	return (DWORD) value;
+}
+
+static BOOL TestSynchSRW_Run(LPTHREAD_START_ROUTINE routine, const char* name)
+{
+	int i;
+	UINT32 start, end;
+	HANDLE threads[TEST_SRW_THREADS];
+
+	start = GetTickCount();
+
+	for (i = 0; i < TEST_SRW_THREADS; i++)
+	{
+		threads[i] = CreateThread(NULL, 0, routine, NULL, 0, NULL);
+
+		if (!threads[i])
+			return FALSE;
+	}
+
+	for (i = 0; i < TEST_SRW_THREADS; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+
+	end = GetTickCount();
+
+	printf("%s: %d threads x %d operations (1/%d writes) in %u ms\n",
+			name, TEST_SRW_THREADS, TEST_SRW_ITERATIONS, TEST_SRW_WRITE_RATIO, end - start);
+
+	return TRUE;
+}
+
+int TestSynchSRW(int argc, char* argv[])
+{
+	int i;
+	HANDLE threads[TEST_SRW_THREADS];
+
+	InitializeCriticalSection(&critical);
+
+	if (!TestSynchSRW_Try())
+		return -1;
+
+	for (i = 0; i < TEST_SRW_THREADS; i++)
+	{
+		threads[i] = CreateThread(NULL, 0, TestSynchSRW_Worker, NULL, 0, NULL);
+
+		if (!threads[i])
+			return -1;
+	}
+
+	for (i = 0; i < TEST_SRW_THREADS; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+
+	if (gTestFailures || (gTestValueA != gTestValueB))
+	{
+		printf("SRW lock failure: %d inconsistent reads\n", (int) gTestFailures);
+		return -1;
+	}
+
+	if (!TestSynchSRW_Condition())
+		return -1;
+
+	if (!TestSynchSRW_Run(TestSynchSRW_BenchSRW, "SRWLOCK"))
+		return -1;
+
+	if (!TestSynchSRW_Run(TestSynchSRW_BenchCritical, "CRITICAL_SECTION"))
+		return -1;
+
+	DeleteCriticalSection(&critical);
+
+	return 0;
+}
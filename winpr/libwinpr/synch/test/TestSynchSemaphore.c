@@ -4,6 +4,7 @@
 
 int TestSynchSemaphore(int argc, char* argv[])
 {
+	int i;
 	HANDLE semaphore;
 
 	semaphore = CreateSemaphore(NULL, 0, 1, NULL);
@@ -16,6 +17,52 @@ int TestSynchSemaphore(int argc, char* argv[])
 
 	CloseHandle(semaphore);
 
+	semaphore = CreateSemaphore(NULL, 2, 8, NULL);
+
+	if (!semaphore)
+	{
+		printf("CreateSemaphore failure\n");
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		if (WaitForSingleObject(semaphore, 0) != WAIT_OBJECT_0)
+		{
+			printf("WaitForSingleObject(semaphore, 0) failure\n");
+			return -1;
+		}
+	}
+
+	if (WaitForSingleObject(semaphore, 0) != WAIT_TIMEOUT)
+	{
+		printf("WaitForSingleObject(semaphore, 0): semaphore count is not zero\n");
+		return -1;
+	}
+
+	if (!ReleaseSemaphore(semaphore, 3, NULL))
+	{
+		printf("ReleaseSemaphore failure\n");
+		return -1;
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		if (WaitForMultipleObjects(1, &semaphore, FALSE, 0) != WAIT_OBJECT_0)
+		{
+			printf("WaitForMultipleObjects(semaphore) failure\n");
+			return -1;
+		}
+	}
+
+	if (WaitForSingleObject(semaphore, 0) != WAIT_TIMEOUT)
+	{
+		printf("WaitForSingleObject(semaphore, 0): semaphore count is not zero\n");
+		return -1;
+	}
+
+	CloseHandle(semaphore);
+
 	return 0;
 }
 
@@ -3,10 +3,15 @@
 #include <winpr/sysinfo.h>
 
 #include <winpr/synch.h>
+#include <winpr/interlocked.h>
 
 #define FIRE_COUNT	5
 #define TIMER_COUNT	5
 
+#define BENCH_TIMER_COUNT	10000
+#define BENCH_DUE_TIME		200
+#define BENCH_DUE_SPREAD	800
+
 static int g_Count = 0;
 static HANDLE g_Event = NULL;
 
@@ -49,6 +54,116 @@ VOID CALLBACK TimerRoutine(PVOID lpParam, BOOLEAN TimerOrWaitFired)
 	Sleep(50);
 }
 
+static LONG g_BenchCount = 0;
+static LONG g_BenchLate = 0;
+static HANDLE g_BenchEvent = NULL;
+
+struct bench_data
+{
+	UINT64 ExpectedTime;
+};
+typedef struct bench_data BENCH_DATA;
+
+VOID CALLBACK BenchTimerRoutine(PVOID lpParam, BOOLEAN TimerOrWaitFired)
+{
+	LONG late;
+	BENCH_DATA* benchData = (BENCH_DATA*) lpParam;
+
+	late = (LONG) (GetTickCount64() - benchData->ExpectedTime);
+
+	if (late > g_BenchLate)
+		g_BenchLate = late;
+
+	if (InterlockedIncrement(&g_BenchCount) == BENCH_TIMER_COUNT)
+		SetEvent(g_BenchEvent);
+}
+
+static int TestSynchTimerQueue_Bench(void)
+{
+	int index;
+	UINT32 start, end;
+	HANDLE hTimerQueue;
+	HANDLE* hTimers;
+	BENCH_DATA* benchData;
+
+	hTimers = (HANDLE*) calloc(BENCH_TIMER_COUNT, sizeof(HANDLE));
+	benchData = (BENCH_DATA*) calloc(BENCH_TIMER_COUNT, sizeof(BENCH_DATA));
+	g_BenchEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	hTimerQueue = CreateTimerQueue();
+
+	if (!hTimers || !benchData || !g_BenchEvent || !hTimerQueue)
+		return -1;
+
+	/* one-shot timers spread over the next second, they must all fire */
+
+	start = GetTickCount();
+
+	for (index = 0; index < BENCH_TIMER_COUNT; index++)
+	{
+		DWORD DueTime = BENCH_DUE_TIME + (index * 7919) % BENCH_DUE_SPREAD;
+
+		benchData[index].ExpectedTime = GetTickCount64() + DueTime;
+
+		if (!CreateTimerQueueTimer(&hTimers[index], hTimerQueue, (WAITORTIMERCALLBACK) BenchTimerRoutine,
+				&benchData[index], DueTime, 0, 0))
+		{
+			printf("CreateTimerQueueTimer failed (%d)\n", (int) GetLastError());
+			return -1;
+		}
+	}
+
+	end = GetTickCount();
+
+	printf("CreateTimerQueueTimer: %d timers in %u ms\n", BENCH_TIMER_COUNT, end - start);
+
+	if (WaitForSingleObject(g_BenchEvent, BENCH_DUE_TIME + BENCH_DUE_SPREAD + 5000) != WAIT_OBJECT_0)
+	{
+		printf("TimerQueue: only %d of %d timers fired\n", (int) g_BenchCount, BENCH_TIMER_COUNT);
+		return -1;
+	}
+
+	printf("TimerQueue: %d timers fired, at most %d ms late\n", BENCH_TIMER_COUNT, (int) g_BenchLate);
+
+	/* rearm them far in the future, as connection timeouts would be, then cancel them */
+
+	start = GetTickCount();
+
+	for (index = 0; index < BENCH_TIMER_COUNT; index++)
+	{
+		if (!ChangeTimerQueueTimer(hTimerQueue, hTimers[index], 60000 + index, 1000))
+			return -1;
+	}
+
+	end = GetTickCount();
+
+	printf("ChangeTimerQueueTimer: %d timers in %u ms\n", BENCH_TIMER_COUNT, end - start);
+
+	start = GetTickCount();
+
+	for (index = 0; index < BENCH_TIMER_COUNT; index++)
+	{
+		if (!DeleteTimerQueueTimer(hTimerQueue, hTimers[index], NULL))
+			return -1;
+	}
+
+	end = GetTickCount();
+
+	printf("DeleteTimerQueueTimer: %d timers in %u ms\n", BENCH_TIMER_COUNT, end - start);
+
+	if (g_BenchCount != BENCH_TIMER_COUNT)
+	{
+		printf("TimerQueue: cancelled timers fired\n");
+		return -1;
+	}
+
+	DeleteTimerQueue(hTimerQueue);
+	CloseHandle(g_BenchEvent);
+	free(benchData);
+	free(hTimers);
+
+	return 0;
+}
+
 int TestSynchTimerQueue(int argc, char* argv[])
 {
 	int index;
@@ -105,5 +220,8 @@ int TestSynchTimerQueue(int argc, char* argv[])
 
 	CloseHandle(g_Event);
 
+	if (TestSynchTimerQueue_Bench() < 0)
+		return -1;
+
 	return 0;
 }
@@ -0,0 +1,229 @@
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#define WAIT_SET_HANDLES	60
+#define WAIT_SET_ROUNDS		20000
+
+int TestSynchWaitSet(int argc, char* argv[])
+{
+	int index;
+	int round;
+	int status = -1;
+	UINT32 start, end;
+	HANDLE semaphore = NULL;
+	DWORD semaphoreIndex;
+#ifndef _WIN32
+	char buffer[4096];
+	int fds[2] = { -1, -1 };
+	HANDLE socketEvent = NULL;
+	DWORD socketIndex;
+#endif
+	DWORD ready[2];
+	DWORD indices[WAIT_SET_HANDLES];
+	HANDLE events[WAIT_SET_HANDLES];
+	WINPR_WAIT_SET* set;
+
+	ZeroMemory(events, sizeof(events));
+
+	set = WaitSet_New();
+
+	if (!set)
+	{
+		printf("WaitSet_New failure\n");
+		return -1;
+	}
+
+	for (index = 0; index < WAIT_SET_HANDLES; index++)
+	{
+		events[index] = CreateEvent(NULL, TRUE, FALSE, NULL);
+		indices[index] = WaitSet_Add(set, events[index]);
+
+		if (indices[index] == WAIT_SET_INVALID_INDEX)
+		{
+			printf("WaitSet_Add failure\n");
+			goto out;
+		}
+	}
+
+	if (WaitSet_Wait(set, 0) != WAIT_TIMEOUT)
+	{
+		printf("WaitSet_Wait: unexpected ready handle\n");
+		goto out;
+	}
+
+	SetEvent(events[3]);
+	SetEvent(events[42]);
+
+	if (WaitSet_Wait(set, INFINITE) != WAIT_OBJECT_0)
+	{
+		printf("WaitSet_Wait failure\n");
+		goto out;
+	}
+
+	for (index = 0; index < WAIT_SET_HANDLES; index++)
+	{
+		BOOL expected = ((index == 3) || (index == 42)) ? TRUE : FALSE;
+
+		if (WaitSet_IsReady(set, indices[index]) != expected)
+		{
+			printf("WaitSet_IsReady: wrong state for handle %d\n", index);
+			goto out;
+		}
+	}
+
+	if ((WaitSet_GetReady(set, ready, 2) != 2) ||
+			!(((ready[0] == indices[3]) && (ready[1] == indices[42])) ||
+			((ready[0] == indices[42]) && (ready[1] == indices[3]))))
+	{
+		printf("WaitSet_GetReady: wrong ready handles\n");
+		goto out;
+	}
+
+	ResetEvent(events[3]);
+
+	if (!WaitSet_Remove(set, indices[42]))
+	{
+		printf("WaitSet_Remove failure\n");
+		goto out;
+	}
+
+	if (WaitSet_Wait(set, 0) != WAIT_TIMEOUT)
+	{
+		printf("WaitSet_Wait: removed handle still reported\n");
+		goto out;
+	}
+
+	indices[42] = WaitSet_Add(set, events[42]);
+
+	/* a ready semaphore is acquired by the wait that reports it */
+
+	semaphore = CreateSemaphore(NULL, 1, 1, NULL);
+	semaphoreIndex = WaitSet_Add(set, semaphore);
+	ResetEvent(events[42]);
+
+	if ((WaitSet_Wait(set, 0) != WAIT_OBJECT_0) || !WaitSet_IsReady(set, semaphoreIndex))
+	{
+		printf("WaitSet_Wait: semaphore not reported\n");
+		goto out;
+	}
+
+	if (WaitSet_Wait(set, 0) != WAIT_TIMEOUT)
+	{
+		printf("WaitSet_Wait: semaphore not acquired\n");
+		goto out;
+	}
+
+	WaitSet_Remove(set, semaphoreIndex);
+
+#ifndef _WIN32
+	/* where supported, a socket is reported while it takes output */
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		goto out;
+
+	ZeroMemory(buffer, sizeof(buffer));
+	socketEvent = CreateFileDescriptorEvent(NULL, FALSE, FALSE, fds[0]);
+	socketIndex = WaitSet_Add(set, socketEvent);
+
+	if (socketIndex == WAIT_SET_INVALID_INDEX)
+	{
+		printf("WaitSet_Add failure\n");
+		goto out;
+	}
+
+	if (WaitSet_SetWritable(set, socketIndex, TRUE))
+	{
+		if ((WaitSet_Wait(set, 0) != WAIT_OBJECT_0) ||
+				!WaitSet_IsWritable(set, socketIndex) || WaitSet_IsReady(set, socketIndex))
+		{
+			printf("WaitSet_Wait: writable socket not reported\n");
+			goto out;
+		}
+
+		while (send(fds[0], buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+
+		if (WaitSet_Wait(set, 0) != WAIT_TIMEOUT)
+		{
+			printf("WaitSet_Wait: full socket reported writable\n");
+			goto out;
+		}
+
+		while (recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+
+		if (!WaitSet_SetWritable(set, socketIndex, FALSE) || (WaitSet_Wait(set, 0) != WAIT_TIMEOUT))
+		{
+			printf("WaitSet_SetWritable: socket still reported writable\n");
+			goto out;
+		}
+	}
+
+	WaitSet_Remove(set, socketIndex);
+#endif
+
+	/* compare against WaitForMultipleObjects with the same handles */
+
+	SetEvent(events[WAIT_SET_HANDLES - 1]);
+
+	start = GetTickCount();
+
+	for (round = 0; round < WAIT_SET_ROUNDS; round++)
+	{
+		if (WaitForMultipleObjects(WAIT_SET_HANDLES, events, FALSE, INFINITE) != (WAIT_OBJECT_0 + WAIT_SET_HANDLES - 1))
+			goto out;
+	}
+
+	end = GetTickCount();
+
+	printf("WaitForMultipleObjects: %d waits on %d handles in %u ms\n",
+			WAIT_SET_ROUNDS, WAIT_SET_HANDLES, end - start);
+
+	start = GetTickCount();
+
+	for (round = 0; round < WAIT_SET_ROUNDS; round++)
+	{
+		if (WaitSet_Wait(set, INFINITE) != WAIT_OBJECT_0)
+			goto out;
+
+		if (!WaitSet_IsReady(set, indices[WAIT_SET_HANDLES - 1]))
+			goto out;
+	}
+
+	end = GetTickCount();
+
+	printf("WaitSet_Wait: %d waits on %d handles in %u ms\n",
+			WAIT_SET_ROUNDS, WAIT_SET_HANDLES, end - start);
+
+	status = 0;
+
+out:
+	WaitSet_Free(set);
+
+	for (index = 0; index < WAIT_SET_HANDLES; index++)
+	{
+		if (events[index])
+			CloseHandle(events[index]);
+	}
+
+	if (semaphore)
+		CloseHandle(semaphore);
+
+#ifndef _WIN32
+	if (socketEvent)
+		CloseHandle(socketEvent);
+
+	if (fds[0] != -1)
+	{
+		close(fds[0]);
+		close(fds[1]);
+	}
+#endif
+
+	return status;
+}
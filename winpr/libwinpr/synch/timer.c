@@ -316,232 +316,435 @@ BOOL CancelWaitableTimer(HANDLE hTimer)
  */
 
 /**
+ * Timer Queue
+ *
  * Design, Performance, and Optimization of Timer Strategies for Real-time ORBs:
  * http://www.cs.wustl.edu/~schmidt/Timer_Queue.html
+ *
+ * Timers live in a hierarchical timer wheel (see synch.h), which makes
+ * adding, changing and cancelling a timer O(1) regardless of how many
+ * timers the queue holds. Each queue has a single thread, which sleeps on
+ * a single timerfd armed for the next tick that needs attention: either a
+ * level 0 slot that expires or a higher level slot that has to be cascaded.
+ *
+ * Callbacks run on the queue thread with the queue lock held. The lock is
+ * recursive so that a callback may change or delete timers of its queue.
  */
 
-void timespec_add_ms(struct timespec* tspec, UINT32 ms)
-{
-	UINT64 ns = tspec->tv_nsec + (ms * 1000000);
-	tspec->tv_sec += (ns / 1000000000);
-	tspec->tv_nsec = (ns % 1000000000);
-}
-
-UINT64 timespec_to_ms(struct timespec* tspec)
-{
-	UINT64 ms;
-	ms = tspec->tv_sec * 1000;
-	ms += tspec->tv_nsec / 1000000;
-	return ms;
-}
+#define TIMER_QUEUE_NO_TICK		((UINT64) -1)
 
-static void timespec_gettimeofday(struct timespec* tspec)
+static UINT64 TimerQueue_Now(WINPR_TIMER_QUEUE* timerQueue)
 {
-	struct timeval tval;
-	gettimeofday(&tval, NULL);
-	tspec->tv_sec = tval.tv_sec;
-	tspec->tv_nsec = tval.tv_usec * 1000;
+	return (UINT64) (GetTickCount64() - timerQueue->BaseTime);
 }
 
-static int timespec_compare(const struct timespec* tspec1, const struct timespec* tspec2)
+static INLINE BOOL TimerQueue_IsPending(WINPR_TIMER_QUEUE* timerQueue, int level, int slot)
 {
-	if (tspec1->tv_sec == tspec2->tv_sec)
-		return (tspec1->tv_nsec - tspec2->tv_nsec);
-	else
-		return (tspec1->tv_sec - tspec2->tv_sec);
+	return (timerQueue->Pending[level][slot >> 5] & ((UINT32) 1 << (slot & 31))) ? TRUE : FALSE;
 }
 
-static void timespec_copy(struct timespec* dst, struct timespec* src)
-{
-	dst->tv_sec = src->tv_sec;
-	dst->tv_nsec = src->tv_nsec;
-}
+/**
+ * Returns the offset from index of the first slot with timers, looking
+ * at count slots and wrapping around the wheel, or -1 if there is none.
+ */
 
-void InsertTimerQueueTimer(WINPR_TIMER_QUEUE_TIMER** pHead, WINPR_TIMER_QUEUE_TIMER* timer)
+static int TimerQueue_FindPending(WINPR_TIMER_QUEUE* timerQueue, int level, int index, int count)
 {
-	WINPR_TIMER_QUEUE_TIMER* node;
+	int slot;
+	int offset = 0;
 
-	if (!(*pHead))
+	while (offset < count)
 	{
-		*pHead = timer;
-		timer->next = NULL;
-		return;
-	}
-
-	node = *pHead;
+		slot = (index + offset) & TIMER_QUEUE_WHEEL_MASK;
 
-	while (node->next)
-	{
-		if (timespec_compare(&(timer->ExpirationTime), &(node->ExpirationTime)) > 0)
+		if (!timerQueue->Pending[level][slot >> 5])
 		{
-			if (timespec_compare(&(timer->ExpirationTime), &(node->next->ExpirationTime)) < 0)
-				break;
+			offset += 32 - (slot & 31);
+			continue;
 		}
 
-		node = node->next;
+		if (TimerQueue_IsPending(timerQueue, level, slot))
+			return offset;
+
+		offset++;
 	}
 
-	if (node->next)
+	return -1;
+}
+
+/**
+ * Links a timer into the wheel and returns the tick at which the queue
+ * thread has to look at it.
+ */
+
+static UINT64 TimerQueue_Link(WINPR_TIMER_QUEUE* timerQueue, WINPR_TIMER_QUEUE_TIMER* timer)
+{
+	int slot;
+	int level;
+	int shift;
+	UINT64 delta;
+	UINT64 expires = timer->ExpirationTick;
+	UINT64 range = ((UINT64) 1 << (TIMER_QUEUE_WHEEL_LEVELS * TIMER_QUEUE_WHEEL_BITS)) - 1;
+
+	if (expires < timerQueue->CurrentTick)
+		expires = timerQueue->CurrentTick;
+
+	delta = expires - timerQueue->CurrentTick;
+
+	/* beyond the range of the wheel, the timer is looked at again when cascaded */
+	if (delta > range)
+		expires = timerQueue->CurrentTick + range;
+
+	for (level = 0; level < (TIMER_QUEUE_WHEEL_LEVELS - 1); level++)
 	{
-		timer->next = node->next->next;
-		node->next = timer;
+		if (delta < ((UINT64) 1 << ((level + 1) * TIMER_QUEUE_WHEEL_BITS)))
+			break;
 	}
+
+	shift = level * TIMER_QUEUE_WHEEL_BITS;
+	slot = (int) ((expires >> shift) & TIMER_QUEUE_WHEEL_MASK);
+
+	timer->Level = level;
+	timer->Slot = slot;
+	timer->bActive = TRUE;
+
+	timer->prev = NULL;
+	timer->next = timerQueue->Wheel[level][slot];
+
+	if (timer->next)
+		timer->next->prev = timer;
+
+	timerQueue->Wheel[level][slot] = timer;
+	timerQueue->Pending[level][slot >> 5] |= ((UINT32) 1 << (slot & 31));
+	timerQueue->TimerCount++;
+
+	return (expires >> shift) << shift;
+}
+
+static void TimerQueue_Unlink(WINPR_TIMER_QUEUE* timerQueue, WINPR_TIMER_QUEUE_TIMER* timer)
+{
+	int slot = timer->Slot;
+	int level = timer->Level;
+
+	if (!timer->bActive)
+		return;
+
+	if (timer->prev)
+		timer->prev->next = timer->next;
 	else
-	{
-		node->next = timer;
-		timer->next = NULL;
-	}
+		timerQueue->Wheel[level][slot] = timer->next;
+
+	if (timer->next)
+		timer->next->prev = timer->prev;
+
+	if (!timerQueue->Wheel[level][slot])
+		timerQueue->Pending[level][slot >> 5] &= ~((UINT32) 1 << (slot & 31));
+
+	timer->prev = NULL;
+	timer->next = NULL;
+	timer->bActive = FALSE;
+	timerQueue->TimerCount--;
 }
 
-void RemoveTimerQueueTimer(WINPR_TIMER_QUEUE_TIMER** pHead, WINPR_TIMER_QUEUE_TIMER* timer)
+static void TimerQueue_Cascade(WINPR_TIMER_QUEUE* timerQueue, int level)
 {
-	BOOL found = FALSE;
-	WINPR_TIMER_QUEUE_TIMER* node;
-	WINPR_TIMER_QUEUE_TIMER* prevNode;
+	int slot;
+	WINPR_TIMER_QUEUE_TIMER* timer;
+	WINPR_TIMER_QUEUE_TIMER* next;
+
+	slot = (int) ((timerQueue->CurrentTick >> (level * TIMER_QUEUE_WHEEL_BITS)) & TIMER_QUEUE_WHEEL_MASK);
 
-	if (timer == *pHead)
+	timer = timerQueue->Wheel[level][slot];
+	timerQueue->Wheel[level][slot] = NULL;
+	timerQueue->Pending[level][slot >> 5] &= ~((UINT32) 1 << (slot & 31));
+
+	while (timer)
 	{
-		*pHead = timer->next;
-		timer->next = NULL;
-		return;
+		next = timer->next;
+		timer->bActive = FALSE;
+		timerQueue->TimerCount--;
+		TimerQueue_Link(timerQueue, timer);
+		timer = next;
 	}
+}
 
-	node = *pHead;
-	prevNode = NULL;
+static void TimerQueue_Advance(WINPR_TIMER_QUEUE* timerQueue, UINT64 now)
+{
+	int slot;
+	int level;
+	int offset;
+	UINT64 next;
+	WINPR_TIMER_QUEUE_TIMER* timer;
 
-	while (node)
+	while (timerQueue->CurrentTick <= now)
 	{
-		if (node == timer)
+		if (!timerQueue->TimerCount)
 		{
-			found = TRUE;
+			timerQueue->CurrentTick = now + 1;
 			break;
 		}
 
-		prevNode = node;
-		node = node->next;
-	}
+		slot = (int) (timerQueue->CurrentTick & TIMER_QUEUE_WHEEL_MASK);
 
-	if (found)
-	{
-		if (prevNode)
+		if (!slot)
+		{
+			/* a new turn starts: refill the lower levels, from the top down */
+			for (level = 1; level < (TIMER_QUEUE_WHEEL_LEVELS - 1); level++)
+			{
+				if ((timerQueue->CurrentTick >> (level * TIMER_QUEUE_WHEEL_BITS)) & TIMER_QUEUE_WHEEL_MASK)
+					break;
+			}
+
+			for (; level > 0; level--)
+				TimerQueue_Cascade(timerQueue, level);
+		}
+
+		while ((timer = timerQueue->Wheel[0][slot]))
 		{
-			prevNode->next = timer->next;
+			TimerQueue_Unlink(timerQueue, timer);
+			timer->FireCount++;
+
+			if (timer->Period)
+			{
+				timer->ExpirationTick += timer->Period;
+				TimerQueue_Link(timerQueue, timer);
+			}
+
+			/* the callback may delete the timer */
+			timer->Callback(timer->Parameter, TRUE);
 		}
 
-		timer->next = NULL;
+		timerQueue->CurrentTick++;
+
+		/* skip the empty slots up to the end of the turn */
+		slot = (int) (timerQueue->CurrentTick & TIMER_QUEUE_WHEEL_MASK);
+
+		if (slot && (timerQueue->CurrentTick <= now))
+		{
+			offset = TimerQueue_FindPending(timerQueue, 0, slot, TIMER_QUEUE_WHEEL_SIZE - slot);
+
+			if (offset < 0)
+				next = (timerQueue->CurrentTick | TIMER_QUEUE_WHEEL_MASK) + 1;
+			else
+				next = timerQueue->CurrentTick + offset;
+
+			timerQueue->CurrentTick = (next <= now) ? next : (now + 1);
+		}
 	}
 }
 
-int FireExpiredTimerQueueTimers(WINPR_TIMER_QUEUE* timerQueue)
+static UINT64 TimerQueue_NextTick(WINPR_TIMER_QUEUE* timerQueue)
 {
-	struct timespec CurrentTime;
-	WINPR_TIMER_QUEUE_TIMER* node;
+	int level;
+	int shift;
+	int index;
+	int first;
+	int offset;
+	UINT64 tick;
+	UINT64 next = TIMER_QUEUE_NO_TICK;
+
+	if (!timerQueue->TimerCount)
+		return next;
 
-	if (!timerQueue->activeHead)
-		return 0;
+	index = (int) (timerQueue->CurrentTick & TIMER_QUEUE_WHEEL_MASK);
+	offset = TimerQueue_FindPending(timerQueue, 0, index, TIMER_QUEUE_WHEEL_SIZE);
 
-	timespec_gettimeofday(&CurrentTime);
-	node = timerQueue->activeHead;
+	if (offset >= 0)
+		next = timerQueue->CurrentTick + offset;
 
-	while (node)
+	/* the higher levels need attention when their next slot is cascaded */
+	for (level = 1; level < TIMER_QUEUE_WHEEL_LEVELS; level++)
 	{
-		if (timespec_compare(&CurrentTime, &(node->ExpirationTime)) >= 0)
-		{
-			node->Callback(node->Parameter, TRUE);
-			node->FireCount++;
-			timerQueue->activeHead = node->next;
-			node->next = NULL;
+		shift = level * TIMER_QUEUE_WHEEL_BITS;
+		index = (int) ((timerQueue->CurrentTick >> shift) & TIMER_QUEUE_WHEEL_MASK);
 
-			if (node->Period)
-			{
-				timespec_add_ms(&(node->ExpirationTime), node->Period);
-				InsertTimerQueueTimer(&(timerQueue->activeHead), node);
-			}
-			else
-			{
-				InsertTimerQueueTimer(&(timerQueue->inactiveHead), node);
-			}
+		/* the current slot is only done once its first tick was processed */
+		first = (timerQueue->CurrentTick & (((UINT64) 1 << shift) - 1)) ? 1 : 0;
+		offset = TimerQueue_FindPending(timerQueue, level, index + first, TIMER_QUEUE_WHEEL_SIZE);
 
-			node = timerQueue->activeHead;
-		}
-		else
+		if (offset < 0)
+			continue;
+
+		tick = ((timerQueue->CurrentTick >> shift) + first + offset) << shift;
+
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+static void TimerQueue_Arm(WINPR_TIMER_QUEUE* timerQueue, UINT64 tick)
+{
+	timerQueue->ArmedTick = tick;
+
+#ifdef HAVE_TIMERFD_H
+	{
+		UINT64 now;
+		UINT64 delay;
+		struct itimerspec due;
+
+		ZeroMemory(&due, sizeof(due));
+
+		if (tick != TIMER_QUEUE_NO_TICK)
 		{
-			break;
+			now = TimerQueue_Now(timerQueue);
+			delay = (tick > now) ? (tick - now) : 0;
+
+			/* a zero value would disarm the timer */
+			due.it_value.tv_sec = (time_t) (delay / 1000);
+			due.it_value.tv_nsec = (long) ((delay % 1000) * 1000000) + 1;
 		}
-	}
 
-	return 0;
+		if (timerfd_settime(timerQueue->fd, 0, &due, NULL) < 0)
+			WLog_ERR(TAG, "timerfd_settime() failure [%d] %s", errno, strerror(errno));
+	}
+#else
+	pthread_cond_signal(&(timerQueue->cond));
+#endif
 }
 
 static void* TimerQueueThread(void* arg)
 {
-	int status;
-	struct timespec timeout;
 	WINPR_TIMER_QUEUE* timerQueue = (WINPR_TIMER_QUEUE*) arg;
 
 	while (1)
 	{
-		pthread_mutex_lock(&(timerQueue->cond_mutex));
-		timespec_gettimeofday(&timeout);
+#ifdef HAVE_TIMERFD_H
+		UINT64 expirations;
 
-		if (!timerQueue->activeHead)
+		if ((read(timerQueue->fd, &expirations, sizeof(UINT64)) < 0) && (errno != EINTR))
 		{
-			timespec_add_ms(&timeout, 50);
+			WLog_ERR(TAG, "timer queue read() failure [%d] %s", errno, strerror(errno));
+			break;
 		}
-		else
+
+		pthread_mutex_lock(&(timerQueue->cond_mutex));
+#else
+		UINT64 now;
+		UINT64 delay;
+		struct timeval tval;
+		struct timespec timeout;
+
+		pthread_mutex_lock(&(timerQueue->cond_mutex));
+
+		if (!timerQueue->bCancelled)
 		{
-			if (timespec_compare(&timeout, &(timerQueue->activeHead->ExpirationTime)) < 0)
+			now = TimerQueue_Now(timerQueue);
+
+			if (timerQueue->ArmedTick == TIMER_QUEUE_NO_TICK)
+			{
+				pthread_cond_wait(&(timerQueue->cond), &(timerQueue->cond_mutex));
+			}
+			else if (timerQueue->ArmedTick > now)
 			{
-				timespec_copy(&timeout, &(timerQueue->activeHead->ExpirationTime));
+				delay = timerQueue->ArmedTick - now;
+				gettimeofday(&tval, NULL);
+				timeout.tv_sec = tval.tv_sec + (time_t) (delay / 1000);
+				timeout.tv_nsec = (tval.tv_usec * 1000) + (long) ((delay % 1000) * 1000000);
+
+				if (timeout.tv_nsec >= 1000000000)
+				{
+					timeout.tv_sec++;
+					timeout.tv_nsec -= 1000000000;
+				}
+
+				pthread_cond_timedwait(&(timerQueue->cond), &(timerQueue->cond_mutex), &timeout);
 			}
 		}
-
-		status = pthread_cond_timedwait(&(timerQueue->cond), &(timerQueue->cond_mutex), &timeout);
-		FireExpiredTimerQueueTimers(timerQueue);
-		pthread_mutex_unlock(&(timerQueue->cond_mutex));
+#endif
 
 		if (timerQueue->bCancelled)
+		{
+			pthread_mutex_unlock(&(timerQueue->cond_mutex));
 			break;
+		}
+
+		TimerQueue_Advance(timerQueue, TimerQueue_Now(timerQueue));
+		TimerQueue_Arm(timerQueue, TimerQueue_NextTick(timerQueue));
+
+		pthread_mutex_unlock(&(timerQueue->cond_mutex));
 	}
 
 	return NULL;
 }
 
-int StartTimerQueueThread(WINPR_TIMER_QUEUE* timerQueue)
+static int StartTimerQueueThread(WINPR_TIMER_QUEUE* timerQueue)
 {
+	pthread_mutexattr_t mutexattr;
+
+	pthread_mutexattr_init(&mutexattr);
+	pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE);
+
 	pthread_cond_init(&(timerQueue->cond), NULL);
-	pthread_mutex_init(&(timerQueue->cond_mutex), NULL);
+	pthread_mutex_init(&(timerQueue->cond_mutex), &mutexattr);
 	pthread_mutex_init(&(timerQueue->mutex), NULL);
+	pthread_mutexattr_destroy(&mutexattr);
+
 	pthread_attr_init(&(timerQueue->attr));
 	timerQueue->param.sched_priority = sched_get_priority_max(SCHED_FIFO);
 	pthread_attr_setschedparam(&(timerQueue->attr), &(timerQueue->param));
 	pthread_attr_setschedpolicy(&(timerQueue->attr), SCHED_FIFO);
-	pthread_create(&(timerQueue->thread), &(timerQueue->attr), TimerQueueThread, timerQueue);
+
+	if (pthread_create(&(timerQueue->thread), &(timerQueue->attr), TimerQueueThread, timerQueue) != 0)
+		return -1;
+
 	return 0;
 }
 
+static void DestroyTimerQueue(WINPR_TIMER_QUEUE* timerQueue)
+{
+	pthread_cond_destroy(&(timerQueue->cond));
+	pthread_mutex_destroy(&(timerQueue->cond_mutex));
+	pthread_mutex_destroy(&(timerQueue->mutex));
+	pthread_attr_destroy(&(timerQueue->attr));
+
+#ifdef HAVE_TIMERFD_H
+	if (timerQueue->fd >= 0)
+		close(timerQueue->fd);
+#endif
+
+	free(timerQueue);
+}
+
 HANDLE CreateTimerQueue(void)
 {
-	HANDLE handle = NULL;
 	WINPR_TIMER_QUEUE* timerQueue;
-	timerQueue = (WINPR_TIMER_QUEUE*) malloc(sizeof(WINPR_TIMER_QUEUE));
 
-	if (timerQueue)
+	timerQueue = (WINPR_TIMER_QUEUE*) calloc(1, sizeof(WINPR_TIMER_QUEUE));
+
+	if (!timerQueue)
+		return NULL;
+
+	WINPR_HANDLE_SET_TYPE(timerQueue, HANDLE_TYPE_TIMER_QUEUE);
+	timerQueue->bCancelled = FALSE;
+	timerQueue->BaseTime = GetTickCount64();
+	timerQueue->ArmedTick = TIMER_QUEUE_NO_TICK;
+
+#ifdef HAVE_TIMERFD_H
+	timerQueue->fd = timerfd_create(CLOCK_MONOTONIC, 0);
+
+	if (timerQueue->fd < 0)
 	{
-		ZeroMemory(timerQueue, sizeof(WINPR_TIMER_QUEUE));
-		WINPR_HANDLE_SET_TYPE(timerQueue, HANDLE_TYPE_TIMER_QUEUE);
-		handle = (HANDLE) timerQueue;
-		timerQueue->activeHead = NULL;
-		timerQueue->inactiveHead = NULL;
-		timerQueue->bCancelled = FALSE;
-		StartTimerQueueThread(timerQueue);
+		WLog_ERR(TAG, "timerfd_create() failure [%d] %s", errno, strerror(errno));
+		free(timerQueue);
+		return NULL;
 	}
+#endif
 
-	return handle;
+	if (StartTimerQueueThread(timerQueue) < 0)
+	{
+		DestroyTimerQueue(timerQueue);
+		return NULL;
+	}
+
+	return (HANDLE) timerQueue;
 }
 
 BOOL DeleteTimerQueueEx(HANDLE TimerQueue, HANDLE CompletionEvent)
 {
+	int slot;
+	int level;
 	void* rvalue;
 	WINPR_TIMER_QUEUE* timerQueue;
 	WINPR_TIMER_QUEUE_TIMER* node;
@@ -551,49 +754,32 @@ BOOL DeleteTimerQueueEx(HANDLE TimerQueue, HANDLE CompletionEvent)
 		return FALSE;
 
 	timerQueue = (WINPR_TIMER_QUEUE*) TimerQueue;
-	/* Cancel and delete timer queue timers */
+
+	/* Stop the queue thread, callbacks in progress complete first */
 	pthread_mutex_lock(&(timerQueue->cond_mutex));
 	timerQueue->bCancelled = TRUE;
-	pthread_cond_signal(&(timerQueue->cond));
+	TimerQueue_Arm(timerQueue, 0);
 	pthread_mutex_unlock(&(timerQueue->cond_mutex));
 	pthread_join(timerQueue->thread, &rvalue);
 
-	if (CompletionEvent == INVALID_HANDLE_VALUE)
-	{
-		/* Wait for all callback functions to complete before returning */
-	}
-	else
+	/* Cancel and delete timer queue timers */
+	for (level = 0; level < TIMER_QUEUE_WHEEL_LEVELS; level++)
 	{
-		/* Cancel all timers and return immediately */
-		/* Move all active timers to the inactive timer list */
-		node = timerQueue->activeHead;
-
-		while (node)
+		for (slot = 0; slot < TIMER_QUEUE_WHEEL_SIZE; slot++)
 		{
-			InsertTimerQueueTimer(&(timerQueue->inactiveHead), node);
-			node = node->next;
-		}
+			node = timerQueue->Wheel[level][slot];
 
-		timerQueue->activeHead = NULL;
-		/* Once all timers are inactive, free them */
-		node = timerQueue->inactiveHead;
-
-		while (node)
-		{
-			nextNode = node->next;
-			free(node);
-			node = nextNode;
+			while (node)
+			{
+				nextNode = node->next;
+				free(node);
+				node = nextNode;
+			}
 		}
-
-		timerQueue->inactiveHead = NULL;
 	}
 
 	/* Delete timer queue */
-	pthread_cond_destroy(&(timerQueue->cond));
-	pthread_mutex_destroy(&(timerQueue->cond_mutex));
-	pthread_mutex_destroy(&(timerQueue->mutex));
-	pthread_attr_destroy(&(timerQueue->attr));
-	free(timerQueue);
+	DestroyTimerQueue(timerQueue);
 
 	if (CompletionEvent && (CompletionEvent != INVALID_HANDLE_VALUE))
 		SetEvent(CompletionEvent);
@@ -609,25 +795,22 @@ BOOL DeleteTimerQueue(HANDLE TimerQueue)
 BOOL CreateTimerQueueTimer(PHANDLE phNewTimer, HANDLE TimerQueue,
 						   WAITORTIMERCALLBACK Callback, PVOID Parameter, DWORD DueTime, DWORD Period, ULONG Flags)
 {
-	struct timespec CurrentTime;
+	UINT64 tick;
+	UINT64 now;
 	WINPR_TIMER_QUEUE* timerQueue;
 	WINPR_TIMER_QUEUE_TIMER* timer;
 
 	if (!TimerQueue)
 		return FALSE;
 
-	timespec_gettimeofday(&CurrentTime);
 	timerQueue = (WINPR_TIMER_QUEUE*) TimerQueue;
-	timer = (WINPR_TIMER_QUEUE_TIMER*) malloc(sizeof(WINPR_TIMER_QUEUE_TIMER));
+	timer = (WINPR_TIMER_QUEUE_TIMER*) calloc(1, sizeof(WINPR_TIMER_QUEUE_TIMER));
 
 	if (!timer)
 		return FALSE;
 
 	WINPR_HANDLE_SET_TYPE(timer, HANDLE_TYPE_TIMER_QUEUE_TIMER);
 	*((UINT_PTR*) phNewTimer) = (UINT_PTR)(HANDLE) timer;
-	timespec_copy(&(timer->StartTime), &CurrentTime);
-	timespec_add_ms(&(timer->StartTime), DueTime);
-	timespec_copy(&(timer->ExpirationTime), &(timer->StartTime));
 	timer->Flags = Flags;
 	timer->DueTime = DueTime;
 	timer->Period = Period;
@@ -635,37 +818,52 @@ BOOL CreateTimerQueueTimer(PHANDLE phNewTimer, HANDLE TimerQueue,
 	timer->Parameter = Parameter;
 	timer->timerQueue = (WINPR_TIMER_QUEUE*) TimerQueue;
 	timer->FireCount = 0;
-	timer->next = NULL;
+
 	pthread_mutex_lock(&(timerQueue->cond_mutex));
-	InsertTimerQueueTimer(&(timerQueue->activeHead), timer);
-	pthread_cond_signal(&(timerQueue->cond));
+	now = TimerQueue_Now(timerQueue);
+
+	/* an empty wheel can jump ahead to the current time */
+	if (!timerQueue->TimerCount && (timerQueue->CurrentTick < now))
+		timerQueue->CurrentTick = now;
+
+	timer->ExpirationTick = now + DueTime;
+	tick = TimerQueue_Link(timerQueue, timer);
+
+	if (tick < timerQueue->ArmedTick)
+		TimerQueue_Arm(timerQueue, tick);
+
 	pthread_mutex_unlock(&(timerQueue->cond_mutex));
 	return TRUE;
 }
 
 BOOL ChangeTimerQueueTimer(HANDLE TimerQueue, HANDLE Timer, ULONG DueTime, ULONG Period)
 {
-	struct timespec CurrentTime;
+	UINT64 tick;
+	UINT64 now;
 	WINPR_TIMER_QUEUE* timerQueue;
 	WINPR_TIMER_QUEUE_TIMER* timer;
 
 	if (!TimerQueue || !Timer)
 		return FALSE;
 
-	timespec_gettimeofday(&CurrentTime);
 	timerQueue = (WINPR_TIMER_QUEUE*) TimerQueue;
 	timer = (WINPR_TIMER_QUEUE_TIMER*) Timer;
+
 	pthread_mutex_lock(&(timerQueue->cond_mutex));
-	RemoveTimerQueueTimer(&(timerQueue->activeHead), timer);
-	RemoveTimerQueueTimer(&(timerQueue->inactiveHead), timer);
+	TimerQueue_Unlink(timerQueue, timer);
+	now = TimerQueue_Now(timerQueue);
+
+	if (!timerQueue->TimerCount && (timerQueue->CurrentTick < now))
+		timerQueue->CurrentTick = now;
+
 	timer->DueTime = DueTime;
 	timer->Period = Period;
-	timer->next = NULL;
-	timespec_copy(&(timer->StartTime), &CurrentTime);
-	timespec_add_ms(&(timer->StartTime), DueTime);
-	timespec_copy(&(timer->ExpirationTime), &(timer->StartTime));
-	InsertTimerQueueTimer(&(timerQueue->activeHead), timer);
-	pthread_cond_signal(&(timerQueue->cond));
+	timer->ExpirationTick = now + DueTime;
+	tick = TimerQueue_Link(timerQueue, timer);
+
+	if (tick < timerQueue->ArmedTick)
+		TimerQueue_Arm(timerQueue, tick);
+
 	pthread_mutex_unlock(&(timerQueue->cond_mutex));
 	return TRUE;
 }
@@ -680,19 +878,13 @@ BOOL DeleteTimerQueueTimer(HANDLE TimerQueue, HANDLE Timer, HANDLE CompletionEve
 
 	timerQueue = (WINPR_TIMER_QUEUE*) TimerQueue;
 	timer = (WINPR_TIMER_QUEUE_TIMER*) Timer;
-	pthread_mutex_lock(&(timerQueue->cond_mutex));
-
-	if (CompletionEvent == INVALID_HANDLE_VALUE)
-	{
-		/* Wait for all callback functions to complete before returning */
-	}
-	else
-	{
-		/* Cancel timer and return immediately */
-		RemoveTimerQueueTimer(&(timerQueue->activeHead), timer);
-	}
 
-	pthread_cond_signal(&(timerQueue->cond));
+	/**
+	 * Callbacks run with the queue lock held, so once it is acquired
+	 * no callback of this timer is in progress, whatever CompletionEvent is.
+	 */
+	pthread_mutex_lock(&(timerQueue->cond_mutex));
+	TimerQueue_Unlink(timerQueue, timer);
 	pthread_mutex_unlock(&(timerQueue->cond_mutex));
 	free(timer);
 
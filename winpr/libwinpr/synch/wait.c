@@ -301,6 +301,9 @@ DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds)
 		WINPR_EVENT* event;
 		event = (WINPR_EVENT*) Object;
 
+		if (event->bNotification)
+			return winpr_notification_event_wait(event, dwMilliseconds);
+
 		status = waitOnFd(event->pipe_fd[0], dwMilliseconds);
 
 		if (status < 0)
@@ -321,7 +324,6 @@ DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds)
 		if (semaphore->pipe_fd[0] != -1)
 		{
 			int status;
-			int length;
 			status = waitOnFd(semaphore->pipe_fd[0], dwMilliseconds);
 
 			if (status < 0)
@@ -333,9 +335,7 @@ DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds)
 			if (status != 1)
 				return WAIT_TIMEOUT;
 
-			length = read(semaphore->pipe_fd[0], &length, 1);
-
-			if (length != 1)
+			if (!winpr_semaphore_acquire_fd(semaphore->pipe_fd[0]))
 			{
 				WLog_ERR(TAG, "semaphore read failure [%d] %s", errno, strerror(errno));
 				return WAIT_FAILED;
@@ -489,7 +489,7 @@ DWORD WaitForMultipleObjects(DWORD nCount, const HANDLE* lpHandles, BOOL bWaitAl
 
 		if (Type == HANDLE_TYPE_EVENT)
 		{
-			fd = ((WINPR_EVENT*) Object)->pipe_fd[0];
+			fd = winpr_event_get_fd((WINPR_EVENT*) Object);
 
 			if (fd == -1)
 			{
@@ -619,10 +619,7 @@ DWORD WaitForMultipleObjects(DWORD nCount, const HANDLE* lpHandles, BOOL bWaitAl
 		{
 			if (Type == HANDLE_TYPE_SEMAPHORE)
 			{
-				int length;
-				length = read(fd, &length, 1);
-
-				if (length != 1)
+				if (!winpr_semaphore_acquire_fd(fd))
 				{
 					WLog_ERR(TAG, "semaphore read() failure [%d] %s", errno, strerror(errno));
 					return WAIT_FAILED;
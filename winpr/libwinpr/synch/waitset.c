@@ -0,0 +1,526 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Synchronization Functions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <errno.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include "synch.h"
+
+#ifndef _WIN32
+#include "../pipe/pipe.h"
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#ifndef MAXIMUM_WAIT_OBJECTS
+#define MAXIMUM_WAIT_OBJECTS 64
+#endif
+
+#include "../log.h"
+#define TAG WINPR_TAG("sync.waitset")
+
+/**
+ * Wait Set
+ *
+ * A persistent set of handles for threads that wait on the same handles in
+ * a loop. Handles are resolved to their file descriptor once, when they are
+ * added, instead of on every wait.
+ *
+ * On Linux the set is backed by epoll: a wait only touches the handles that
+ * are actually ready, so its cost does not grow with the size of the set.
+ * Elsewhere the set falls back to WaitForMultipleObjects() and then polls
+ * the handles after the one it returned.
+ *
+ * As with WaitForMultipleObjects(), a ready semaphore or waitable timer is
+ * acquired by the wait that reports it.
+ *
+ * With epoll, the file descriptor of a handle can also be waited for to
+ * become writable, which WaitForMultipleObjects() cannot express.
+ */
+
+struct winpr_wait_set_entry
+{
+	HANDLE handle;
+	ULONG type;
+	int fd;
+	BOOL ready;
+	BOOL writable;
+	BOOL listed;
+	BOOL writeNotify;
+};
+typedef struct winpr_wait_set_entry WINPR_WAIT_SET_ENTRY;
+
+struct winpr_wait_set
+{
+	DWORD count;
+	DWORD capacity;
+	WINPR_WAIT_SET_ENTRY* entries;
+
+	DWORD readyCount;
+	DWORD* readyList;
+
+#ifdef HAVE_SYS_EPOLL_H
+	int epfd;
+	struct epoll_event* events;
+#else
+	DWORD waitCount;
+	HANDLE waitHandles[MAXIMUM_WAIT_OBJECTS];
+	DWORD waitIndices[MAXIMUM_WAIT_OBJECTS];
+#endif
+};
+
+#ifndef _WIN32
+
+static int winpr_wait_set_get_fd(HANDLE handle, ULONG* pType)
+{
+	ULONG Type;
+	PVOID Object;
+
+	if (!winpr_Handle_GetInfo(handle, &Type, &Object))
+		return -1;
+
+	*pType = Type;
+
+	if (Type == HANDLE_TYPE_EVENT)
+		return winpr_event_get_fd((WINPR_EVENT*) Object);
+
+#ifdef WINPR_PIPE_SEMAPHORE
+	if (Type == HANDLE_TYPE_SEMAPHORE)
+		return ((WINPR_SEMAPHORE*) Object)->pipe_fd[0];
+#endif
+
+	if (Type == HANDLE_TYPE_TIMER)
+		return ((WINPR_TIMER*) Object)->fd;
+
+	if (Type == HANDLE_TYPE_NAMED_PIPE)
+	{
+		WINPR_NAMED_PIPE* pipe = (WINPR_NAMED_PIPE*) Object;
+		return (pipe->ServerMode) ? pipe->serverfd : pipe->clientfd;
+	}
+
+	WLog_ERR(TAG, "unsupported handle type %d", (int) Type);
+	return -1;
+}
+
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+
+static BOOL winpr_wait_set_acquire(WINPR_WAIT_SET_ENTRY* entry)
+{
+	int length;
+
+	/* another waiter may have taken it first */
+	if (entry->type == HANDLE_TYPE_SEMAPHORE)
+		return winpr_semaphore_acquire_fd(entry->fd);
+
+	if (entry->type == HANDLE_TYPE_TIMER)
+	{
+		UINT64 expirations;
+
+		length = read(entry->fd, (void*) &expirations, sizeof(UINT64));
+
+		return (length == sizeof(UINT64)) ? TRUE : FALSE;
+	}
+
+	return TRUE;
+}
+
+static void winpr_wait_set_mark_ready(WINPR_WAIT_SET* set, DWORD index, UINT32 events)
+{
+	WINPR_WAIT_SET_ENTRY* entry = &set->entries[index];
+
+	if ((events & EPOLLOUT) && entry->writeNotify)
+		entry->writable = TRUE;
+
+	if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && winpr_wait_set_acquire(entry))
+		entry->ready = TRUE;
+
+	if ((entry->ready || entry->writable) && !entry->listed)
+	{
+		entry->listed = TRUE;
+		set->readyList[set->readyCount++] = index;
+	}
+}
+
+#else
+
+static void winpr_wait_set_update_handles(WINPR_WAIT_SET* set)
+{
+	DWORD index;
+
+	set->waitCount = 0;
+
+	for (index = 0; index < set->capacity; index++)
+	{
+		if (!set->entries[index].handle)
+			continue;
+
+		set->waitHandles[set->waitCount] = set->entries[index].handle;
+		set->waitIndices[set->waitCount] = index;
+		set->waitCount++;
+	}
+}
+
+#endif
+
+WINPR_WAIT_SET* WaitSet_New(void)
+{
+	WINPR_WAIT_SET* set;
+
+	set = (WINPR_WAIT_SET*) calloc(1, sizeof(WINPR_WAIT_SET));
+
+	if (!set)
+		return NULL;
+
+	set->capacity = 8;
+	set->entries = (WINPR_WAIT_SET_ENTRY*) calloc(set->capacity, sizeof(WINPR_WAIT_SET_ENTRY));
+	set->readyList = (DWORD*) calloc(set->capacity, sizeof(DWORD));
+
+#ifdef HAVE_SYS_EPOLL_H
+	set->events = (struct epoll_event*) calloc(set->capacity, sizeof(struct epoll_event));
+	set->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (!set->events || (set->epfd < 0))
+	{
+		WaitSet_Free(set);
+		return NULL;
+	}
+#endif
+
+	if (!set->entries || !set->readyList)
+	{
+		WaitSet_Free(set);
+		return NULL;
+	}
+
+	return set;
+}
+
+void WaitSet_Free(WINPR_WAIT_SET* set)
+{
+	if (!set)
+		return;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (set->epfd >= 0)
+		close(set->epfd);
+
+	free(set->events);
+#endif
+
+	free(set->readyList);
+	free(set->entries);
+	free(set);
+}
+
+DWORD WaitSet_Add(WINPR_WAIT_SET* set, HANDLE handle)
+{
+	DWORD index;
+	WINPR_WAIT_SET_ENTRY* entry;
+
+	for (index = 0; index < set->capacity; index++)
+	{
+		if (!set->entries[index].handle)
+			break;
+	}
+
+	if (index == set->capacity)
+	{
+		DWORD capacity = set->capacity * 2;
+		WINPR_WAIT_SET_ENTRY* entries;
+		DWORD* readyList;
+
+#ifndef HAVE_SYS_EPOLL_H
+		if (set->count >= MAXIMUM_WAIT_OBJECTS)
+			return WAIT_SET_INVALID_INDEX;
+#endif
+
+		entries = (WINPR_WAIT_SET_ENTRY*) realloc(set->entries, capacity * sizeof(WINPR_WAIT_SET_ENTRY));
+
+		if (!entries)
+			return WAIT_SET_INVALID_INDEX;
+
+		set->entries = entries;
+		ZeroMemory(&entries[set->capacity], (capacity - set->capacity) * sizeof(WINPR_WAIT_SET_ENTRY));
+
+		readyList = (DWORD*) realloc(set->readyList, capacity * sizeof(DWORD));
+
+		if (!readyList)
+			return WAIT_SET_INVALID_INDEX;
+
+		set->readyList = readyList;
+
+#ifdef HAVE_SYS_EPOLL_H
+		{
+			struct epoll_event* events;
+
+			events = (struct epoll_event*) realloc(set->events, capacity * sizeof(struct epoll_event));
+
+			if (!events)
+				return WAIT_SET_INVALID_INDEX;
+
+			set->events = events;
+		}
+#endif
+
+		set->capacity = capacity;
+	}
+
+	entry = &set->entries[index];
+	entry->fd = -1;
+	entry->ready = FALSE;
+	entry->writable = FALSE;
+	entry->listed = FALSE;
+	entry->writeNotify = FALSE;
+
+#ifndef _WIN32
+	entry->fd = winpr_wait_set_get_fd(handle, &entry->type);
+
+	if (entry->fd < 0)
+		return WAIT_SET_INVALID_INDEX;
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+	{
+		struct epoll_event event;
+
+		ZeroMemory(&event, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.u32 = index;
+
+		if (epoll_ctl(set->epfd, EPOLL_CTL_ADD, entry->fd, &event) < 0)
+		{
+			WLog_ERR(TAG, "epoll_ctl() failure [%d] %s", errno, strerror(errno));
+			entry->fd = -1;
+			return WAIT_SET_INVALID_INDEX;
+		}
+	}
+#endif
+
+	entry->handle = handle;
+	set->count++;
+
+#ifndef HAVE_SYS_EPOLL_H
+	winpr_wait_set_update_handles(set);
+#endif
+
+	return index;
+}
+
+BOOL WaitSet_Remove(WINPR_WAIT_SET* set, DWORD index)
+{
+	DWORD i;
+	WINPR_WAIT_SET_ENTRY* entry;
+
+	if ((index >= set->capacity) || !set->entries[index].handle)
+		return FALSE;
+
+	entry = &set->entries[index];
+
+#ifdef HAVE_SYS_EPOLL_H
+	epoll_ctl(set->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+#endif
+
+	if (entry->listed)
+	{
+		for (i = 0; i < set->readyCount; i++)
+		{
+			if (set->readyList[i] == index)
+			{
+				set->readyList[i] = set->readyList[--set->readyCount];
+				break;
+			}
+		}
+	}
+
+	ZeroMemory(entry, sizeof(WINPR_WAIT_SET_ENTRY));
+	entry->fd = -1;
+	set->count--;
+
+#ifndef HAVE_SYS_EPOLL_H
+	winpr_wait_set_update_handles(set);
+#endif
+
+	return TRUE;
+}
+
+/**
+ * Also waits for the file descriptor of a handle to become writable, as
+ * reported by WaitSet_IsWritable(). Only supported with epoll.
+ */
+
+BOOL WaitSet_SetWritable(WINPR_WAIT_SET* set, DWORD index, BOOL bWritable)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event event;
+	WINPR_WAIT_SET_ENTRY* entry;
+
+	if ((index >= set->capacity) || !set->entries[index].handle)
+		return FALSE;
+
+	entry = &set->entries[index];
+
+	if (entry->writeNotify == bWritable)
+		return TRUE;
+
+	ZeroMemory(&event, sizeof(event));
+	event.events = EPOLLIN | (bWritable ? EPOLLOUT : 0);
+	event.data.u32 = index;
+
+	if (epoll_ctl(set->epfd, EPOLL_CTL_MOD, entry->fd, &event) < 0)
+	{
+		WLog_ERR(TAG, "epoll_ctl() failure [%d] %s", errno, strerror(errno));
+		return FALSE;
+	}
+
+	entry->writeNotify = bWritable;
+
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+DWORD WaitSet_Wait(WINPR_WAIT_SET* set, DWORD dwMilliseconds)
+{
+	DWORD index;
+	WINPR_WAIT_SET_ENTRY* entry;
+
+	for (index = 0; index < set->readyCount; index++)
+	{
+		entry = &set->entries[set->readyList[index]];
+		entry->ready = FALSE;
+		entry->writable = FALSE;
+		entry->listed = FALSE;
+	}
+
+	set->readyCount = 0;
+
+	if (!set->count)
+	{
+		WLog_ERR(TAG, "wait set is empty");
+		return WAIT_FAILED;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	{
+		int status;
+		int timeout;
+
+		timeout = (dwMilliseconds == INFINITE) ? -1 : (int) dwMilliseconds;
+
+		while (1)
+		{
+			status = epoll_wait(set->epfd, set->events, (int) set->capacity, timeout);
+
+			if ((status < 0) && (errno == EINTR))
+				continue;
+
+			if (status < 0)
+			{
+				WLog_ERR(TAG, "epoll_wait() failure [%d] %s", errno, strerror(errno));
+				return WAIT_FAILED;
+			}
+
+			for (index = 0; index < (DWORD) status; index++)
+				winpr_wait_set_mark_ready(set, set->events[index].data.u32, set->events[index].events);
+
+			/* a ready semaphore may have been taken by another waiter */
+			if (set->readyCount || (timeout >= 0))
+				break;
+		}
+	}
+#else
+	{
+		DWORD status;
+
+		status = WaitForMultipleObjects(set->waitCount, set->waitHandles, FALSE, dwMilliseconds);
+
+		if (status == WAIT_FAILED)
+			return WAIT_FAILED;
+
+		if ((status - WAIT_OBJECT_0) < set->waitCount)
+		{
+			DWORD first = status - WAIT_OBJECT_0;
+
+			/* WaitForMultipleObjects already acquired the first object */
+			index = set->waitIndices[first];
+			set->entries[index].ready = TRUE;
+			set->entries[index].listed = TRUE;
+			set->readyList[set->readyCount++] = index;
+
+			for (first++; first < set->waitCount; first++)
+			{
+				if (WaitForSingleObject(set->waitHandles[first], 0) != WAIT_OBJECT_0)
+					continue;
+
+				index = set->waitIndices[first];
+				set->entries[index].ready = TRUE;
+				set->entries[index].listed = TRUE;
+				set->readyList[set->readyCount++] = index;
+			}
+		}
+	}
+#endif
+
+	return (set->readyCount > 0) ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+}
+
+BOOL WaitSet_IsReady(WINPR_WAIT_SET* set, DWORD index)
+{
+	if (index >= set->capacity)
+		return FALSE;
+
+	return set->entries[index].ready;
+}
+
+BOOL WaitSet_IsWritable(WINPR_WAIT_SET* set, DWORD index)
+{
+	if (index >= set->capacity)
+		return FALSE;
+
+	return set->entries[index].writable;
+}
+
+/**
+ * Copies the indices of the handles reported ready or writable by the last wait, so that
+ * large sets can be walked without testing every index. Returns the number
+ * of ready handles, which may be larger than count.
+ */
+
+DWORD WaitSet_GetReady(WINPR_WAIT_SET* set, DWORD* indices, DWORD count)
+{
+	DWORD index;
+
+	for (index = 0; (index < set->readyCount) && (index < count); index++)
+		indices[index] = set->readyList[index];
+
+	return set->readyCount;
+}
@@ -22,18 +22,222 @@
 #endif
 
 #include <winpr/crt.h>
+#include <winpr/thread.h>
 
 #include <winpr/collections.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 /**
  * C equivalent of the C# BufferManager Class:
  * http://msdn.microsoft.com/en-us/library/ms405814.aspx
  */
 
+#define BUFFER_POOL_MAGAZINE_SIZE	4
+
+/**
+ * Per-thread cache of a fixed size pool (BUFFER_POOL_FLAG_THREAD_CACHE).
+ *
+ * A cache holds up to two magazines of buffers. An empty cache is refilled
+ * with one magazine from the shared pool, and a full cache flushes one
+ * magazine back, so a thread alternating takes and returns stays within
+ * its cache. Caches are linked into the pool so that the pool can account
+ * for them and free them. On POSIX systems the cache of an exiting thread
+ * is flushed back to the shared pool.
+ */
+
+struct _wBufferPoolCache
+{
+	wBufferPool* pool;
+	wBufferPoolCache* prev;
+	wBufferPoolCache* next;
+
+	UINT64 hits;
+	UINT64 refills;
+	UINT64 flushes;
+
+	int count;
+	void* buffers[1];
+};
+
 /**
  * Methods
  */
 
+static void* BufferPool_AllocFixed(wBufferPool* pool)
+{
+	if (pool->alignment)
+		return _aligned_malloc(pool->fixedSize, pool->alignment);
+
+	return malloc(pool->fixedSize);
+}
+
+static void BufferPool_FreeBuffer(wBufferPool* pool, void* buffer)
+{
+	if (pool->alignment)
+		_aligned_free(buffer);
+	else
+		free(buffer);
+}
+
+static BOOL BufferPool_ReserveFixed(wBufferPool* pool, int count)
+{
+	if ((pool->size + count) >= pool->capacity)
+	{
+		void** newArray;
+		int newCapacity = pool->capacity * 2;
+
+		while ((pool->size + count) >= newCapacity)
+			newCapacity *= 2;
+
+		newArray = (void**) realloc(pool->array, sizeof(void*) * newCapacity);
+
+		if (!newArray)
+			return FALSE;
+
+		pool->capacity = newCapacity;
+		pool->array = newArray;
+	}
+
+	return TRUE;
+}
+
+static void BufferPool_RetireCache(wBufferPool* pool, wBufferPoolCache* cache)
+{
+	pool->retiredHits += cache->hits;
+	pool->retiredRefills += cache->refills;
+	pool->retiredFlushes += cache->flushes;
+
+	if (cache->prev)
+		cache->prev->next = cache->next;
+	else
+		pool->caches = cache->next;
+
+	if (cache->next)
+		cache->next->prev = cache->prev;
+}
+
+#ifndef _WIN32
+
+static void BufferPool_CacheDestructor(void* arg)
+{
+	int index;
+	wBufferPoolCache* cache = (wBufferPoolCache*) arg;
+	wBufferPool* pool = cache->pool;
+
+	EnterCriticalSection(&pool->lock);
+
+	for (index = 0; index < cache->count; index++)
+	{
+		if (BufferPool_ReserveFixed(pool, 1))
+			pool->array[(pool->size)++] = cache->buffers[index];
+		else
+			BufferPool_FreeBuffer(pool, cache->buffers[index]);
+	}
+
+	BufferPool_RetireCache(pool, cache);
+
+	LeaveCriticalSection(&pool->lock);
+
+	free(cache);
+}
+
+#endif
+
+static wBufferPoolCache* BufferPool_GetCache(wBufferPool* pool)
+{
+	wBufferPoolCache* cache;
+
+	cache = (wBufferPoolCache*) TlsGetValue(pool->cacheIndex);
+
+	if (cache)
+		return cache;
+
+	cache = (wBufferPoolCache*) calloc(1, sizeof(wBufferPoolCache) +
+			sizeof(void*) * (pool->magazineSize * 2 - 1));
+
+	if (!cache)
+		return NULL;
+
+	cache->pool = pool;
+
+	EnterCriticalSection(&pool->lock);
+	cache->next = pool->caches;
+
+	if (cache->next)
+		cache->next->prev = cache;
+
+	pool->caches = cache;
+	LeaveCriticalSection(&pool->lock);
+
+	TlsSetValue(pool->cacheIndex, cache);
+
+	return cache;
+}
+
+static void* BufferPool_CacheTake(wBufferPool* pool, wBufferPoolCache* cache)
+{
+	if (cache->count > 0)
+	{
+		cache->hits++;
+		return cache->buffers[--(cache->count)];
+	}
+
+	/* refill one magazine from the shared pool */
+
+	cache->refills++;
+
+	EnterCriticalSection(&pool->lock);
+
+	while ((cache->count < pool->magazineSize) && (pool->size > 0))
+		cache->buffers[(cache->count)++] = pool->array[--(pool->size)];
+
+	LeaveCriticalSection(&pool->lock);
+
+	if (cache->count > 0)
+		return cache->buffers[--(cache->count)];
+
+	return BufferPool_AllocFixed(pool);
+}
+
+static BOOL BufferPool_CacheReturn(wBufferPool* pool, wBufferPoolCache* cache, void* buffer)
+{
+	int index;
+
+	if (cache->count < (pool->magazineSize * 2))
+	{
+		cache->hits++;
+		cache->buffers[(cache->count)++] = buffer;
+		return TRUE;
+	}
+
+	/* flush the older magazine to the shared pool */
+
+	cache->flushes++;
+
+	EnterCriticalSection(&pool->lock);
+
+	if (!BufferPool_ReserveFixed(pool, pool->magazineSize))
+	{
+		LeaveCriticalSection(&pool->lock);
+		return FALSE;
+	}
+
+	for (index = 0; index < pool->magazineSize; index++)
+		pool->array[(pool->size)++] = cache->buffers[index];
+
+	LeaveCriticalSection(&pool->lock);
+
+	cache->count -= pool->magazineSize;
+	MoveMemory(&cache->buffers[0], &cache->buffers[pool->magazineSize], cache->count * sizeof(void*));
+
+	cache->buffers[(cache->count)++] = buffer;
+
+	return TRUE;
+}
+
 static BOOL BufferPool_ShiftAvailable(wBufferPool* pool, int index, int count)
 {
 	if (count > 0)
@@ -100,7 +304,12 @@ int BufferPool_GetPoolSize(wBufferPool* pool)
 	if (pool->fixedSize)
 	{
 		/* fixed size buffers */
+		wBufferPoolCache* cache;
+
 		size = pool->size;
+
+		for (cache = pool->caches; cache; cache = cache->next)
+			size += cache->count;
 	}
 	else
 	{
@@ -167,6 +376,14 @@ void* BufferPool_Take(wBufferPool* pool, int size)
 	BOOL found = FALSE;
 	void* buffer = NULL;
 
+	if (pool->flags & BUFFER_POOL_FLAG_THREAD_CACHE)
+	{
+		wBufferPoolCache* cache = BufferPool_GetCache(pool);
+
+		if (cache)
+			return BufferPool_CacheTake(pool, cache);
+	}
+
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
 
@@ -178,12 +395,7 @@ void* BufferPool_Take(wBufferPool* pool, int size)
 			buffer = pool->array[--(pool->size)];
 
 		if (!buffer)
-		{
-			if (pool->alignment)
-				buffer = _aligned_malloc(pool->fixedSize, pool->alignment);
-			else
-				buffer = malloc(pool->fixedSize);
-		}
+			buffer = BufferPool_AllocFixed(pool);
 
 		if (!buffer)
 			goto out_error;
@@ -295,6 +507,14 @@ BOOL BufferPool_Return(wBufferPool* pool, void* buffer)
 	int index = 0;
 	BOOL found = FALSE;
 
+	if (pool->flags & BUFFER_POOL_FLAG_THREAD_CACHE)
+	{
+		wBufferPoolCache* cache = BufferPool_GetCache(pool);
+
+		if (cache)
+			return BufferPool_CacheReturn(pool, cache, buffer);
+	}
+
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
 
@@ -302,16 +522,8 @@ BOOL BufferPool_Return(wBufferPool* pool, void* buffer)
 	{
 		/* fixed size buffers */
 
-		if ((pool->size + 1) >= pool->capacity)
-		{
-			int newCapacity = pool->capacity * 2;
-			void **newArray = (void **)realloc(pool->array, sizeof(void*) * newCapacity);
-			if (!newArray)
-				goto out_error;
-
-			pool->capacity = newCapacity;
-			pool->array = newArray;
-		}
+		if (!BufferPool_ReserveFixed(pool, 1))
+			goto out_error;
 
 		pool->array[(pool->size)++] = buffer;
 	}
@@ -380,11 +592,17 @@ void BufferPool_Clear(wBufferPool* pool)
 		while (pool->size > 0)
 		{
 			(pool->size)--;
+			BufferPool_FreeBuffer(pool, pool->array[pool->size]);
+		}
 
-			if (pool->alignment)
-				_aligned_free(pool->array[pool->size]);
-			else
-				free(pool->array[pool->size]);
+		/* the caches of other threads are only released by BufferPool_Free */
+
+		if (pool->flags & BUFFER_POOL_FLAG_THREAD_CACHE)
+		{
+			wBufferPoolCache* cache = (wBufferPoolCache*) TlsGetValue(pool->cacheIndex);
+
+			while (cache && (cache->count > 0))
+				BufferPool_FreeBuffer(pool, cache->buffers[--(cache->count)]);
 		}
 	}
 	else
@@ -420,11 +638,44 @@ void BufferPool_Clear(wBufferPool* pool)
  * Construction, Destruction
  */
 
+/**
+ * Statistics
+ */
+
+void BufferPool_GetStats(wBufferPool* pool, wBufferPoolStats* stats)
+{
+	wBufferPoolCache* cache;
+
+	if (pool->synchronized)
+		EnterCriticalSection(&pool->lock);
+
+	stats->cacheHits = pool->retiredHits;
+	stats->refills = pool->retiredRefills;
+	stats->flushes = pool->retiredFlushes;
+
+	/* the counters of live caches are read without their owner's knowledge */
+
+	for (cache = pool->caches; cache; cache = cache->next)
+	{
+		stats->cacheHits += cache->hits;
+		stats->refills += cache->refills;
+		stats->flushes += cache->flushes;
+	}
+
+	if (pool->synchronized)
+		LeaveCriticalSection(&pool->lock);
+}
+
 wBufferPool* BufferPool_New(BOOL synchronized, int fixedSize, DWORD alignment)
+{
+	return BufferPool_NewEx(synchronized, fixedSize, alignment, 0, 0);
+}
+
+wBufferPool* BufferPool_NewEx(BOOL synchronized, int fixedSize, DWORD alignment, DWORD dwFlags, int magazineSize)
 {
 	wBufferPool* pool = NULL;
 
-	pool = (wBufferPool*) malloc(sizeof(wBufferPool));
+	pool = (wBufferPool*) calloc(1, sizeof(wBufferPool));
 
 	if (pool)
 	{
@@ -436,6 +687,31 @@ wBufferPool* BufferPool_New(BOOL synchronized, int fixedSize, DWORD alignment)
 		pool->alignment = alignment;
 		pool->synchronized = synchronized;
 
+		/* thread caches only apply to shared fixed size pools */
+		if (pool->synchronized && pool->fixedSize)
+			pool->flags = dwFlags;
+
+		if (pool->flags & BUFFER_POOL_FLAG_THREAD_CACHE)
+		{
+			pool->magazineSize = (magazineSize > 0) ? magazineSize : BUFFER_POOL_MAGAZINE_SIZE;
+
+#ifndef _WIN32
+			{
+				pthread_key_t key;
+
+				if (pthread_key_create(&key, BufferPool_CacheDestructor) != 0)
+					pool->flags &= ~BUFFER_POOL_FLAG_THREAD_CACHE;
+				else
+					pool->cacheIndex = (DWORD) key;
+			}
+#else
+			pool->cacheIndex = TlsAlloc();
+
+			if (pool->cacheIndex == TLS_OUT_OF_INDEXES)
+				pool->flags &= ~BUFFER_POOL_FLAG_THREAD_CACHE;
+#endif
+		}
+
 		if (pool->synchronized)
 			InitializeCriticalSectionAndSpinCount(&pool->lock, 4000);
 
@@ -468,6 +744,29 @@ void BufferPool_Free(wBufferPool* pool)
 {
 	if (pool)
 	{
+		if (pool->flags & BUFFER_POOL_FLAG_THREAD_CACHE)
+		{
+			wBufferPoolCache* cache;
+
+			/* no cache destructor runs once the key is deleted */
+#ifndef _WIN32
+			pthread_key_delete((pthread_key_t) pool->cacheIndex);
+#else
+			TlsFree(pool->cacheIndex);
+#endif
+
+			while ((cache = pool->caches) != NULL)
+			{
+				while (cache->count > 0)
+					BufferPool_FreeBuffer(pool, cache->buffers[--(cache->count)]);
+
+				pool->caches = cache->next;
+				free(cache);
+			}
+
+			pool->flags &= ~BUFFER_POOL_FLAG_THREAD_CACHE;
+		}
+
 		BufferPool_Clear(pool);
 
 		if (pool->synchronized)
@@ -159,7 +159,7 @@ wCountdownEvent* CountdownEvent_New(DWORD initialCount)
 		countdown->count = initialCount;
 		countdown->initialCount = initialCount;
 		InitializeCriticalSectionAndSpinCount(&countdown->lock, 4000);
-		countdown->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		countdown->event = CreateNotificationEvent(NULL, FALSE);
 
 		if (countdown->count == 0)
 			SetEvent(countdown->event);
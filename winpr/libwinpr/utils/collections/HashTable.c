@@ -21,18 +21,27 @@
 #include "config.h"
 #endif
 
+#include <limits.h>
+
 #include <winpr/crt.h>
 
 #include <winpr/collections.h>
 
 /**
- * This implementation is based on the public domain
- * hash table implementation made by Keith Pomakis:
+ * Open addressing with Robin Hood probing: keys and values are stored
+ * inline in a power of two slot array, and every slot remembers its hash
+ * and its distance from its home slot. A lookup stops as soon as it meets
+ * a slot closer to home than the key it is looking for, which keeps probe
+ * sequences short even at high load.
  *
- * http://www.pomakis.com/hashtable/hashtable.c
- * http://www.pomakis.com/hashtable/hashtable.h
+ * Growing the table does not rehash everything at once: the previous slot
+ * array is kept and drained a few slots at a time by the operations that
+ * modify the table, so no single insertion pays for the whole rehash.
  */
 
+#define HASH_TABLE_INITIAL_SLOTS	64
+#define HASH_TABLE_REHASH_STEP		16
+
 BOOL HashTable_PointerCompare(void* pointer1, void* pointer2)
 {
 	return (pointer1 == pointer2);
@@ -40,7 +49,10 @@ BOOL HashTable_PointerCompare(void* pointer1, void* pointer2)
 
 UINT32 HashTable_PointerHash(void* pointer)
 {
-	return ((UINT32) (UINT_PTR) pointer) >> 4;
+	UINT64 value = (UINT64) (UINT_PTR) pointer;
+
+	/* the table mixes the bits, so just fold the upper half in */
+	return (UINT32) (value ^ (value >> 32));
 }
 
 BOOL HashTable_StringCompare(void* string1, void* string2)
@@ -74,101 +86,191 @@ void HashTable_StringFree(void* str)
 	free(str);
 }
 
-static int HashTable_IsProbablePrime(int oddNumber)
+static INLINE UINT32 HashTable_Hash(wHashTable* table, void* key)
+{
+	/* Fibonacci hashing, the slot index is taken from the upper bits */
+	return table->hash(key) * 0x9E3779B9;
+}
+
+static int HashTable_Shift(int numOfSlots)
 {
-	int i;
+	int shift = 32;
 
-	for (i = 3; i < 51; i += 2)
+	while (numOfSlots > 1)
 	{
-		if (oddNumber == i)
-			return 1;
-		else if (oddNumber % i == 0)
-			return 0;
+		numOfSlots >>= 1;
+		shift--;
 	}
 
-	return 1; /* maybe */
+	return shift;
 }
 
-static long HashTable_CalculateIdealNumOfBuckets(wHashTable* table)
+static int HashTable_Find(wHashTable* table, wHashTableSlot* slots, int numOfSlots,
+		int shift, void* key, UINT32 hash)
 {
-	int idealNumOfBuckets = table->numOfElements / ((int) table->idealRatio);
+	int index;
+	UINT32 distance = 1;
+	int mask = numOfSlots - 1;
 
-	if (idealNumOfBuckets < 5)
-		idealNumOfBuckets = 5;
-	else
-		idealNumOfBuckets |= 0x01;
+	index = (int) (hash >> shift);
 
-	while (!HashTable_IsProbablePrime(idealNumOfBuckets))
-		idealNumOfBuckets += 2;
+	while (slots[index].distance >= distance)
+	{
+		if ((slots[index].hash == hash) && table->keyCompare(key, slots[index].key))
+			return index;
 
-	return idealNumOfBuckets;
+		index = (index + 1) & mask;
+		distance++;
+	}
+
+	return -1;
 }
 
-void HashTable_Rehash(wHashTable* table, int numOfBuckets)
+static void HashTable_Insert(wHashTableSlot* slots, int numOfSlots, int shift, wHashTableSlot* slot)
 {
 	int index;
-	UINT32 hashValue;
-	wKeyValuePair* pair;
-	wKeyValuePair* nextPair;
-	wKeyValuePair** newBucketArray;
+	wHashTableSlot entry;
+	wHashTableSlot swap;
+	int mask = numOfSlots - 1;
+
+	entry = *slot;
+	entry.distance = 1;
+	index = (int) (entry.hash >> shift);
 
-	if (numOfBuckets == 0)
-		numOfBuckets = HashTable_CalculateIdealNumOfBuckets(table);
+	while (slots[index].distance)
+	{
+		/* take the slot from an entry that is closer to its home */
+		if (slots[index].distance < entry.distance)
+		{
+			swap = slots[index];
+			slots[index] = entry;
+			entry = swap;
+		}
+
+		index = (index + 1) & mask;
+		entry.distance++;
+	}
+
+	slots[index] = entry;
+}
 
-	if (numOfBuckets == table->numOfBuckets)
-		return; /* already the right size! */
+static void HashTable_Delete(wHashTableSlot* slots, int numOfSlots, int index)
+{
+	int next;
+	int mask = numOfSlots - 1;
 
-	newBucketArray = (wKeyValuePair**) calloc(numOfBuckets, sizeof(wKeyValuePair*));
+	/* shift the following entries back, no tombstones needed */
+	next = (index + 1) & mask;
 
-	if (!newBucketArray)
+	while (slots[next].distance > 1)
 	{
-		/*
-		 * Couldn't allocate memory for the new array.
-		 * This isn't a fatal error; we just can't perform the rehash.
-		 */
-		return;
+		slots[index] = slots[next];
+		slots[index].distance--;
+		index = next;
+		next = (next + 1) & mask;
 	}
 
-	for (index = 0; index < table->numOfBuckets; index++)
+	ZeroMemory(&slots[index], sizeof(wHashTableSlot));
+}
+
+static void HashTable_RehashStep(wHashTable* table, int steps)
+{
+	wHashTableSlot* slot;
+
+	while (table->oldSlots && (steps-- > 0))
 	{
-		pair = table->bucketArray[index];
+		if (!table->oldElements)
+		{
+			free(table->oldSlots);
+			table->oldSlots = NULL;
+			table->numOfOldSlots = 0;
+			break;
+		}
+
+		/* shifting back a run that wraps around can refill the first slots */
+		if (table->rehashIndex >= table->numOfOldSlots)
+			table->rehashIndex = 0;
+
+		slot = &table->oldSlots[table->rehashIndex];
 
-		while (pair)
+		if (!slot->distance)
 		{
-			nextPair = pair->next;
-			hashValue = table->hash(pair->key) % numOfBuckets;
-			pair->next = newBucketArray[hashValue];
-			newBucketArray[hashValue] = pair;
-			pair = nextPair;
+			table->rehashIndex++;
+			continue;
 		}
-	}
 
-	free(table->bucketArray);
-	table->bucketArray = newBucketArray;
-	table->numOfBuckets = numOfBuckets;
+		/* deleting may shift the next entry into this slot, so stay on it */
+		HashTable_Insert(table->slots, table->numOfSlots, table->shift, slot);
+		HashTable_Delete(table->oldSlots, table->numOfOldSlots, table->rehashIndex);
+		table->oldElements--;
+	}
 }
 
-void HashTable_SetIdealRatio(wHashTable* table, float idealRatio,
-		float lowerRehashThreshold, float upperRehashThreshold)
+static BOOL HashTable_Grow(wHashTable* table)
 {
-	table->idealRatio = idealRatio;
-	table->lowerRehashThreshold = lowerRehashThreshold;
-	table->upperRehashThreshold = upperRehashThreshold;
+	int numOfSlots;
+	wHashTableSlot* slots;
+
+	/* a previous rehash has to be complete before starting another one */
+	HashTable_RehashStep(table, INT_MAX);
+
+	numOfSlots = table->numOfSlots * 2;
+	slots = (wHashTableSlot*) calloc(numOfSlots, sizeof(wHashTableSlot));
+
+	if (!slots)
+		return FALSE;
+
+	table->oldSlots = table->slots;
+	table->numOfOldSlots = table->numOfSlots;
+	table->oldShift = table->shift;
+	table->oldElements = table->numOfElements;
+	table->rehashIndex = 0;
+
+	table->slots = slots;
+	table->numOfSlots = numOfSlots;
+	table->shift = HashTable_Shift(numOfSlots);
+
+	return TRUE;
 }
 
-wKeyValuePair* HashTable_Get(wHashTable* table, void* key)
+static wHashTableSlot* HashTable_Get(wHashTable* table, void* key)
 {
-	UINT32 hashValue;
-	wKeyValuePair* pair;
+	int index;
+	UINT32 hash;
 
-	hashValue = table->hash(key) % table->numOfBuckets;
+	hash = HashTable_Hash(table, key);
 
-	pair = table->bucketArray[hashValue];
+	index = HashTable_Find(table, table->slots, table->numOfSlots, table->shift, key, hash);
 
-	while (pair && !table->keyCompare(key, pair->key))
-		pair = pair->next;
+	if (index >= 0)
+		return &table->slots[index];
 
-	return pair;
+	if (table->oldSlots)
+	{
+		index = HashTable_Find(table, table->oldSlots, table->numOfOldSlots, table->oldShift, key, hash);
+
+		if (index >= 0)
+			return &table->oldSlots[index];
+	}
+
+	return NULL;
+}
+
+static void HashTable_FreeSlots(wHashTable* table, wHashTableSlot* slots, int numOfSlots)
+{
+	int index;
+
+	for (index = 0; index < numOfSlots; index++)
+	{
+		if (!slots[index].distance)
+			continue;
+
+		if (table->keyFree)
+			table->keyFree(slots[index].key);
+
+		if (table->valueFree)
+			table->valueFree(slots[index].value);
+	}
 }
 
 /**
@@ -200,9 +302,8 @@ int HashTable_Count(wHashTable* table)
 int HashTable_Add(wHashTable* table, void* key, void* value)
 {
 	int status = 0;
-	UINT32 hashValue;
-	wKeyValuePair* pair;
-	wKeyValuePair* newPair;
+	wHashTableSlot slot;
+	wHashTableSlot* pair;
 
 	if (!key || !value)
 		return -1;
@@ -226,11 +327,9 @@ int HashTable_Add(wHashTable* table, void* key, void* value)
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
-	hashValue = table->hash(key) % table->numOfBuckets;
-	pair = table->bucketArray[hashValue];
+	HashTable_RehashStep(table, HASH_TABLE_REHASH_STEP);
 
-	while (pair && !table->keyCompare(key, pair->key))
-		pair = pair->next;
+	pair = HashTable_Get(table, key);
 
 	if (pair)
 	{
@@ -250,27 +349,21 @@ int HashTable_Add(wHashTable* table, void* key, void* value)
 	}
 	else
 	{
-		newPair = (wKeyValuePair*) malloc(sizeof(wKeyValuePair));
-
-		if (!newPair)
+		/* keep the load factor under 3/4 */
+		if (((table->numOfElements + 1) * 4) > (table->numOfSlots * 3))
 		{
-			status = -1;
+			if (!HashTable_Grow(table) && ((table->numOfElements + 1) >= table->numOfSlots))
+				status = -1;
 		}
-		else
-		{
-			newPair->key = key;
-			newPair->value = value;
-			newPair->next = table->bucketArray[hashValue];
-			table->bucketArray[hashValue] = newPair;
-			table->numOfElements++;
 
-			if (table->upperRehashThreshold > table->idealRatio)
-			{
-				float elementToBucketRatio = (float) table->numOfElements / (float) table->numOfBuckets;
+		if (status == 0)
+		{
+			slot.key = key;
+			slot.value = value;
+			slot.hash = HashTable_Hash(table, key);
 
-				if (elementToBucketRatio > table->upperRehashThreshold)
-					HashTable_Rehash(table, 0);
-			}
+			HashTable_Insert(table->slots, table->numOfSlots, table->shift, &slot);
+			table->numOfElements++;
 		}
 	}
 
@@ -286,52 +379,49 @@ int HashTable_Add(wHashTable* table, void* key, void* value)
 
 BOOL HashTable_Remove(wHashTable* table, void* key)
 {
-	UINT32 hashValue;
+	int index;
+	UINT32 hash;
 	BOOL status = TRUE;
-	wKeyValuePair* pair = NULL;
-	wKeyValuePair* previousPair = NULL;
+	int numOfSlots;
+	wHashTableSlot* slots;
 
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
-	hashValue = table->hash(key) % table->numOfBuckets;
+	HashTable_RehashStep(table, HASH_TABLE_REHASH_STEP);
 
-	pair = table->bucketArray[hashValue];
+	slots = table->slots;
+	numOfSlots = table->numOfSlots;
+	hash = HashTable_Hash(table, key);
 
-	while (pair && !table->keyCompare(key, pair->key))
+	index = HashTable_Find(table, slots, numOfSlots, table->shift, key, hash);
+
+	if ((index < 0) && table->oldSlots)
 	{
-		previousPair = pair;
-		pair = pair->next;
+		slots = table->oldSlots;
+		numOfSlots = table->numOfOldSlots;
+
+		index = HashTable_Find(table, slots, numOfSlots, table->oldShift, key, hash);
+
+		if (index >= 0)
+			table->oldElements--;
 	}
 
-	if (!pair)
+	if (index < 0)
 	{
 		status = FALSE;
 	}
 	else
 	{
 		if (table->keyFree)
-			table->keyFree(pair->key);
+			table->keyFree(slots[index].key);
 
 		if (table->valueFree)
-			table->valueFree(pair->value);
+			table->valueFree(slots[index].value);
 
-		if (previousPair)
-			previousPair->next = pair->next;
-		else
-			table->bucketArray[hashValue] = pair->next;
-
-		free(pair);
+		HashTable_Delete(slots, numOfSlots, index);
 
 		table->numOfElements--;
-
-		if (table->lowerRehashThreshold > 0.0)
-		{
-			float elementToBucketRatio = (float) table->numOfElements / (float) table->numOfBuckets;
-
-			if (elementToBucketRatio < table->lowerRehashThreshold)
-				HashTable_Rehash(table, 0);
-		}
 	}
 
 	if (table->synchronized)
@@ -347,7 +437,7 @@ BOOL HashTable_Remove(wHashTable* table, void* key)
 void* HashTable_GetItemValue(wHashTable* table, void* key)
 {
 	void* value = NULL;
-	wKeyValuePair* pair;
+	wHashTableSlot* pair;
 
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
@@ -370,7 +460,7 @@ void* HashTable_GetItemValue(wHashTable* table, void* key)
 BOOL HashTable_SetItemValue(wHashTable* table, void* key, void* value)
 {
 	BOOL status = TRUE;
-	wKeyValuePair* pair;
+	wHashTableSlot* pair;
 
 	if (table->valueClone && value)
 	{
@@ -386,9 +476,15 @@ BOOL HashTable_SetItemValue(wHashTable* table, void* key, void* value)
 	pair = HashTable_Get(table, key);
 
 	if (!pair)
+	{
 		status = FALSE;
-	else
+	}
+	else if (pair->value != value)
+	{
+		if (table->valueFree)
+			table->valueFree(pair->value);
 		pair->value = value;
+	}
 
 	if (table->synchronized)
 		LeaveCriticalSection(&table->lock);
@@ -402,37 +498,23 @@ BOOL HashTable_SetItemValue(wHashTable* table, void* key, void* value)
 
 void HashTable_Clear(wHashTable* table)
 {
-	int index;
-	wKeyValuePair* pair;
-	wKeyValuePair* nextPair;
-
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
-	for (index = 0; index < table->numOfBuckets; index++)
-	{
-		pair = table->bucketArray[index];
-
-		while (pair)
-		{
-			nextPair = pair->next;
+	HashTable_FreeSlots(table, table->slots, table->numOfSlots);
+	ZeroMemory(table->slots, table->numOfSlots * sizeof(wHashTableSlot));
 
-			if (table->keyFree)
-				table->keyFree(pair->key);
-
-			if (table->valueFree)
-				table->valueFree(pair->value);
-
-			free(pair);
-
-			pair = nextPair;
-		}
+	if (table->oldSlots)
+	{
+		HashTable_FreeSlots(table, table->oldSlots, table->numOfOldSlots);
+		free(table->oldSlots);
 
-		table->bucketArray[index] = NULL;
+		table->oldSlots = NULL;
+		table->numOfOldSlots = 0;
+		table->oldElements = 0;
 	}
 
 	table->numOfElements = 0;
-	HashTable_Rehash(table, 5);
 
 	if (table->synchronized)
 		LeaveCriticalSection(&table->lock);
@@ -448,8 +530,6 @@ int HashTable_GetKeys(wHashTable* table, ULONG_PTR** ppKeys)
 	int count;
 	int index;
 	ULONG_PTR* pKeys;
-	wKeyValuePair* pair;
-	wKeyValuePair* nextPair;
 
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
@@ -467,18 +547,16 @@ int HashTable_GetKeys(wHashTable* table, ULONG_PTR** ppKeys)
 		return -1;
 	}
 
-	for (index = 0; index < table->numOfBuckets; index++)
+	for (index = 0; index < table->numOfSlots; index++)
 	{
-		pair = table->bucketArray[index];
-
-		while (pair)
-		{
-			nextPair = pair->next;
-
-			pKeys[iKey++] = (ULONG_PTR) pair->key;
+		if (table->slots[index].distance)
+			pKeys[iKey++] = (ULONG_PTR) table->slots[index].key;
+	}
 
-			pair = nextPair;
-		}
+	for (index = 0; index < table->numOfOldSlots; index++)
+	{
+		if (table->oldSlots[index].distance)
+			pKeys[iKey++] = (ULONG_PTR) table->oldSlots[index].key;
 	}
 
 	if (table->synchronized)
@@ -489,6 +567,65 @@ int HashTable_GetKeys(wHashTable* table, ULONG_PTR** ppKeys)
 	return count;
 }
 
+/**
+ * Starts enumerating the key/value pairs of the HashTable.
+ *
+ * The enumerator lives on the caller's stack and does not allocate.
+ * Adding or removing elements while enumerating may skip or repeat pairs.
+ */
+
+void HashTable_Enumerator_Reset(wHashTable* table, wHashTableEnumerator* enumerator)
+{
+	if (table->synchronized)
+		EnterCriticalSection(&table->lock);
+
+	/* enumerate a single slot array */
+	HashTable_RehashStep(table, INT_MAX);
+
+	if (table->synchronized)
+		LeaveCriticalSection(&table->lock);
+
+	enumerator->table = table;
+	enumerator->index = -1;
+	enumerator->key = NULL;
+	enumerator->value = NULL;
+}
+
+/**
+ * Advances the enumerator to the next key/value pair of the HashTable.
+ */
+
+BOOL HashTable_Enumerator_MoveNext(wHashTableEnumerator* enumerator)
+{
+	BOOL status = FALSE;
+	wHashTable* table = enumerator->table;
+
+	if (table->synchronized)
+		EnterCriticalSection(&table->lock);
+
+	for (enumerator->index++; enumerator->index < table->numOfSlots; enumerator->index++)
+	{
+		if (table->slots[enumerator->index].distance)
+		{
+			enumerator->key = table->slots[enumerator->index].key;
+			enumerator->value = table->slots[enumerator->index].value;
+			status = TRUE;
+			break;
+		}
+	}
+
+	if (!status)
+	{
+		enumerator->key = NULL;
+		enumerator->value = NULL;
+	}
+
+	if (table->synchronized)
+		LeaveCriticalSection(&table->lock);
+
+	return status;
+}
+
 /**
  * Determines whether the HashTable contains a specific key.
  */
@@ -535,28 +672,20 @@ BOOL HashTable_ContainsValue(wHashTable* table, void* value)
 {
 	int index;
 	BOOL status = FALSE;
-	wKeyValuePair* pair;
 
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
-	for (index = 0; index < table->numOfBuckets; index++)
+	for (index = 0; !status && (index < table->numOfSlots); index++)
 	{
-		pair = table->bucketArray[index];
-
-		while (pair)
-		{
-			if (table->valueCompare(value, pair->value))
-			{
-				status = TRUE;
-				break;
-			}
-
-			pair = pair->next;
-		}
+		if (table->slots[index].distance && table->valueCompare(value, table->slots[index].value))
+			status = TRUE;
+	}
 
-		if (status)
-			break;
+	for (index = 0; !status && (index < table->numOfOldSlots); index++)
+	{
+		if (table->oldSlots[index].distance && table->valueCompare(value, table->oldSlots[index].value))
+			status = TRUE;
 	}
 
 	if (table->synchronized)
@@ -581,21 +710,19 @@ wHashTable* HashTable_New(BOOL synchronized)
 
 		InitializeCriticalSectionAndSpinCount(&(table->lock), 4000);
 
-		table->numOfBuckets = 64;
+		table->numOfSlots = HASH_TABLE_INITIAL_SLOTS;
+		table->shift = HashTable_Shift(table->numOfSlots);
 		table->numOfElements = 0;
 
-		table->bucketArray = (wKeyValuePair**) calloc(table->numOfBuckets, sizeof(wKeyValuePair*));
+		table->slots = (wHashTableSlot*) calloc(table->numOfSlots, sizeof(wHashTableSlot));
 
-		if (!table->bucketArray)
+		if (!table->slots)
 		{
+			DeleteCriticalSection(&(table->lock));
 			free(table);
 			return NULL;
 		}
 
-		table->idealRatio = 3.0;
-		table->lowerRehashThreshold = 0.0;
-		table->upperRehashThreshold = 15.0;
-
 		table->hash = HashTable_PointerHash;
 		table->keyCompare = HashTable_PointerCompare;
 		table->valueCompare = HashTable_PointerCompare;
@@ -610,35 +737,17 @@ wHashTable* HashTable_New(BOOL synchronized)
 
 void HashTable_Free(wHashTable* table)
 {
-	int index;
-	wKeyValuePair* pair;
-	wKeyValuePair* nextPair;
-
 	if (table)
 	{
-		for (index = 0; index < table->numOfBuckets; index++)
-		{
-			pair = table->bucketArray[index];
-
-			while (pair)
-			{
-				nextPair = pair->next;
+		HashTable_FreeSlots(table, table->slots, table->numOfSlots);
 
-				if (table->keyFree)
-					table->keyFree(pair->key);
-
-				if (table->valueFree)
-					table->valueFree(pair->value);
-
-				free(pair);
-
-				pair = nextPair;
-			}
-		}
+		if (table->oldSlots)
+			HashTable_FreeSlots(table, table->oldSlots, table->numOfOldSlots);
 
 		DeleteCriticalSection(&(table->lock));
 
-		free(table->bucketArray);
+		free(table->oldSlots);
+		free(table->slots);
 		free(table);
 	}
 }
@@ -46,7 +46,7 @@ void MessagePipe_PostQuit(wMessagePipe* pipe, int nExitCode)
  * Construction, Destruction
  */
 
-wMessagePipe* MessagePipe_New()
+wMessagePipe* MessagePipe_NewEx(DWORD dwFlags, int capacity)
 {
 	wMessagePipe* pipe = NULL;
 
@@ -54,13 +54,18 @@ wMessagePipe* MessagePipe_New()
 
 	if (pipe)
 	{
-		pipe->In = MessageQueue_New(NULL);
-		pipe->Out = MessageQueue_New(NULL);
+		pipe->In = MessageQueue_NewEx(NULL, dwFlags, capacity);
+		pipe->Out = MessageQueue_NewEx(NULL, dwFlags, capacity);
 	}
 
 	return pipe;
 }
 
+wMessagePipe* MessagePipe_New()
+{
+	return MessagePipe_NewEx(0, 0);
+}
+
 void MessagePipe_Free(wMessagePipe* pipe)
 {
 	if (pipe)
@@ -22,7 +22,9 @@
 #endif
 
 #include <winpr/crt.h>
+#include <winpr/thread.h>
 #include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 
 #include <winpr/collections.h>
 
@@ -31,6 +33,217 @@
  * http://msdn.microsoft.com/en-us/library/ms632590/
  */
 
+/**
+ * Lock-free mode (WMQ_FLAG_LOCKFREE):
+ *
+ * Producers claim a ring slot by advancing ringTail with a compare-exchange
+ * and publish it by storing the slot sequence number, the single consumer
+ * owns ringHead. This is a bounded multi-producer single-consumer queue
+ * with per-slot sequence numbers, so an uncontended post costs one atomic
+ * operation and no lock.
+ *
+ * When the ring is full, messages go to the regular locked array instead.
+ * Once anything is in that overflow array all producers keep using it until
+ * the consumer has drained it, and the consumer only takes from the array
+ * once the ring is empty, which preserves per-producer ordering.
+ *
+ * count tracks every posted but not yet consumed message and is bumped
+ * before the message is published: the event is only set on the 0 -> 1
+ * transition and only reset by the consumer when it brings count back to 0.
+ */
+
+#if defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 7)))
+#define MQ_LOAD_ACQUIRE(_ptr)		__atomic_load_n((_ptr), __ATOMIC_ACQUIRE)
+#define MQ_STORE_RELEASE(_ptr, _val)	__atomic_store_n((_ptr), (_val), __ATOMIC_RELEASE)
+#else
+#define MQ_LOAD_ACQUIRE(_ptr)		InterlockedCompareExchange((_ptr), 0, 0)
+#define MQ_STORE_RELEASE(_ptr, _val)	InterlockedExchange((_ptr), (_val))
+#endif
+
+#define MQ_SEQ_DIFF(_a, _b)	((LONG) ((ULONG) (_a) - (ULONG) (_b)))
+#define MQ_SEQ_ADD(_a, _b)	((LONG) ((ULONG) (_a) + (ULONG) (_b)))
+
+static BOOL MessageQueue_RingPush(wMessageQueue* queue, wMessage* message)
+{
+	LONG pos;
+	LONG seq;
+	LONG diff;
+	wMessageQueueSlot* slot;
+
+	pos = MQ_LOAD_ACQUIRE(&queue->ringTail);
+
+	for (;;)
+	{
+		slot = &queue->ring[pos & queue->ringMask];
+		seq = MQ_LOAD_ACQUIRE(&slot->sequence);
+		diff = MQ_SEQ_DIFF(seq, pos);
+
+		if (diff == 0)
+		{
+			LONG prev = InterlockedCompareExchange(&queue->ringTail, MQ_SEQ_ADD(pos, 1), pos);
+
+			if (prev == pos)
+				break;
+
+			pos = prev;
+		}
+		else if (diff < 0)
+		{
+			return FALSE; /* full */
+		}
+		else
+		{
+			pos = MQ_LOAD_ACQUIRE(&queue->ringTail);
+		}
+	}
+
+	CopyMemory(&slot->message, message, sizeof(wMessage));
+	MQ_STORE_RELEASE(&slot->sequence, MQ_SEQ_ADD(pos, 1));
+
+	return TRUE;
+}
+
+static BOOL MessageQueue_RingPop(wMessageQueue* queue, wMessage* message, BOOL remove)
+{
+	LONG pos;
+	LONG seq;
+	wMessageQueueSlot* slot;
+
+	pos = queue->ringHead;
+	slot = &queue->ring[pos & queue->ringMask];
+	seq = MQ_LOAD_ACQUIRE(&slot->sequence);
+
+	if (MQ_SEQ_DIFF(seq, MQ_SEQ_ADD(pos, 1)) < 0)
+		return FALSE; /* empty, or the next slot is not published yet */
+
+	CopyMemory(message, &slot->message, sizeof(wMessage));
+
+	if (remove)
+	{
+		MQ_STORE_RELEASE(&slot->sequence, MQ_SEQ_ADD(pos, queue->ringMask + 1));
+		queue->ringHead = MQ_SEQ_ADD(pos, 1);
+	}
+
+	return TRUE;
+}
+
+static void MessageQueue_ArrayPush(wMessageQueue* queue, wMessage* message)
+{
+	if (queue->size == queue->capacity)
+	{
+		int old_capacity;
+		int new_capacity;
+
+		old_capacity = queue->capacity;
+		new_capacity = queue->capacity * 2;
+
+		queue->capacity = new_capacity;
+		queue->array = (wMessage*) realloc(queue->array, sizeof(wMessage) * queue->capacity);
+		ZeroMemory(&(queue->array[old_capacity]), old_capacity * sizeof(wMessage));
+
+		if (queue->tail < old_capacity)
+		{
+			CopyMemory(&(queue->array[old_capacity]), queue->array, queue->tail * sizeof(wMessage));
+			queue->tail += old_capacity;
+		}
+	}
+
+	CopyMemory(&(queue->array[queue->tail]), message, sizeof(wMessage));
+	queue->tail = (queue->tail + 1) % queue->capacity;
+	queue->size++;
+}
+
+static BOOL MessageQueue_ArrayPop(wMessageQueue* queue, wMessage* message, BOOL remove)
+{
+	if (queue->size < 1)
+		return FALSE;
+
+	CopyMemory(message, &(queue->array[queue->head]), sizeof(wMessage));
+
+	if (remove)
+	{
+		ZeroMemory(&(queue->array[queue->head]), sizeof(wMessage));
+		queue->head = (queue->head + 1) % queue->capacity;
+		queue->size--;
+	}
+
+	return TRUE;
+}
+
+static void MessageQueue_LockFreeDispatch(wMessageQueue* queue, wMessage* message)
+{
+	BOOL signal;
+
+	signal = (InterlockedIncrement(&queue->count) == 1) ? TRUE : FALSE;
+
+	if (MQ_LOAD_ACQUIRE(&queue->overflow) || !MessageQueue_RingPush(queue, message))
+	{
+		EnterCriticalSection(&queue->lock);
+		MessageQueue_ArrayPush(queue, message);
+		InterlockedIncrement(&queue->overflow);
+		LeaveCriticalSection(&queue->lock);
+	}
+
+	if (signal)
+		SetEvent(queue->event);
+}
+
+static int MessageQueue_LockFreePeek(wMessageQueue* queue, wMessage* message, BOOL remove)
+{
+	BOOL found;
+
+	for (;;)
+	{
+		found = MessageQueue_RingPop(queue, message, remove);
+
+		/**
+		 * A claimed slot not published yet may hold an older message of a
+		 * producer whose newer ones spilled into the array: the array is
+		 * only read once the ring is empty.
+		 */
+
+		if (!found && (MQ_LOAD_ACQUIRE(&queue->ringTail) == queue->ringHead) &&
+				MQ_LOAD_ACQUIRE(&queue->overflow))
+		{
+			EnterCriticalSection(&queue->lock);
+
+			found = MessageQueue_ArrayPop(queue, message, remove);
+
+			if (found && remove)
+				InterlockedDecrement(&queue->overflow);
+
+			LeaveCriticalSection(&queue->lock);
+		}
+
+		if (found)
+			break;
+
+		/**
+		 * Nothing visible yet, but a producer may be between counting its
+		 * message and publishing it: wait for it rather than reporting an
+		 * empty queue while the event is set.
+		 */
+
+		if (MQ_LOAD_ACQUIRE(&queue->count) < 1)
+			return 0;
+
+		SwitchToThread();
+	}
+
+	if (remove)
+	{
+		if (InterlockedDecrement(&queue->count) == 0)
+		{
+			ResetEvent(queue->event);
+
+			if (MQ_LOAD_ACQUIRE(&queue->count) > 0)
+				SetEvent(queue->event);
+		}
+	}
+
+	return 1;
+}
+
 /**
  * Properties
  */
@@ -50,6 +263,9 @@ HANDLE MessageQueue_Event(wMessageQueue* queue)
 
 int MessageQueue_Size(wMessageQueue* queue)
 {
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
+		return (int) MQ_LOAD_ACQUIRE(&queue->count);
+
 	return queue->size;
 }
 
@@ -69,35 +285,19 @@ BOOL MessageQueue_Wait(wMessageQueue* queue)
 
 void MessageQueue_Dispatch(wMessageQueue* queue, wMessage* message)
 {
-	EnterCriticalSection(&queue->lock);
+	message->time = (UINT64) GetTickCount();
 
-	if (queue->size == queue->capacity)
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
 	{
-		int old_capacity;
-		int new_capacity;
-
-		old_capacity = queue->capacity;
-		new_capacity = queue->capacity * 2;
-
-		queue->capacity = new_capacity;
-		queue->array = (wMessage*) realloc(queue->array, sizeof(wMessage) * queue->capacity);
-		ZeroMemory(&(queue->array[old_capacity]), old_capacity * sizeof(wMessage));
-
-		if (queue->tail < old_capacity)
-		{
-			CopyMemory(&(queue->array[old_capacity]), queue->array, queue->tail * sizeof(wMessage));
-			queue->tail += old_capacity;
-		}
+		MessageQueue_LockFreeDispatch(queue, message);
+		return;
 	}
 
-	CopyMemory(&(queue->array[queue->tail]), message, sizeof(wMessage));
-	queue->tail = (queue->tail + 1) % queue->capacity;
-	queue->size++;
+	EnterCriticalSection(&queue->lock);
 
-	message = &(queue->array[queue->tail]);
-	message->time = (UINT64) GetTickCount();
+	MessageQueue_ArrayPush(queue, message);
 
-	if (queue->size > 0)
+	if (queue->size == 1)
 		SetEvent(queue->event);
 
 	LeaveCriticalSection(&queue->lock);
@@ -128,15 +328,18 @@ int MessageQueue_Get(wMessageQueue* queue, wMessage* message)
 	if (!MessageQueue_Wait(queue))
 		return status;
 
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
+	{
+		if (MessageQueue_LockFreePeek(queue, message, TRUE))
+			status = (message->id != WMQ_QUIT) ? 1 : 0;
+
+		return status;
+	}
+
 	EnterCriticalSection(&queue->lock);
 
-	if (queue->size > 0)
+	if (MessageQueue_ArrayPop(queue, message, TRUE))
 	{
-		CopyMemory(message, &(queue->array[queue->head]), sizeof(wMessage));
-		ZeroMemory(&(queue->array[queue->head]), sizeof(wMessage));
-		queue->head = (queue->head + 1) % queue->capacity;
-		queue->size--;
-
 		if (queue->size < 1)
 			ResetEvent(queue->event);
 
@@ -152,22 +355,17 @@ int MessageQueue_Peek(wMessageQueue* queue, wMessage* message, BOOL remove)
 {
 	int status = 0;
 
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
+		return MessageQueue_LockFreePeek(queue, message, remove);
+
 	EnterCriticalSection(&queue->lock);
 
-	if (queue->size > 0)
+	if (MessageQueue_ArrayPop(queue, message, remove))
 	{
-		CopyMemory(message, &(queue->array[queue->head]), sizeof(wMessage));
 		status = 1;
 
-		if (remove)
-		{
-			ZeroMemory(&(queue->array[queue->head]), sizeof(wMessage));
-			queue->head = (queue->head + 1) % queue->capacity;
-			queue->size--;
-
-			if (queue->size < 1)
-				ResetEvent(queue->event);
-		}
+		if (remove && (queue->size < 1))
+			ResetEvent(queue->event);
 	}
 
 	LeaveCriticalSection(&queue->lock);
@@ -179,32 +377,59 @@ int MessageQueue_Peek(wMessageQueue* queue, wMessage* message, BOOL remove)
  * Construction, Destruction
  */
 
-wMessageQueue* MessageQueue_New(const wObject *callback)
+wMessageQueue* MessageQueue_NewEx(const wObject *callback, DWORD dwFlags, int capacity)
 {
 	wMessageQueue* queue = NULL;
 
-	queue = (wMessageQueue*) malloc(sizeof(wMessageQueue));
+	queue = (wMessageQueue*) calloc(1, sizeof(wMessageQueue));
+
+	if (!queue)
+		return NULL;
+
+	queue->capacity = 32;
+	queue->array = (wMessage*) calloc(queue->capacity, sizeof(wMessage));
+
+	if (!queue->array)
+		goto error;
+
+	queue->flags = dwFlags;
 
-	if (queue)
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
 	{
-		queue->head = 0;
-		queue->tail = 0;
-		queue->size = 0;
+		LONG index;
+		LONG size = 2;
 
-		queue->capacity = 32;
-		queue->array = (wMessage*) malloc(sizeof(wMessage) * queue->capacity);
-		ZeroMemory(queue->array, sizeof(wMessage) * queue->capacity);
+		while (size < capacity)
+			size <<= 1;
 
-		InitializeCriticalSectionAndSpinCount(&queue->lock, 4000);
-		queue->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		queue->ring = (wMessageQueueSlot*) calloc(size, sizeof(wMessageQueueSlot));
 
-		if (callback)
-			queue->object = *callback;
-		else
-			ZeroMemory(&queue->object, sizeof(queue->object));
+		if (!queue->ring)
+			goto error;
+
+		for (index = 0; index < size; index++)
+			queue->ring[index].sequence = index;
+
+		queue->ringMask = size - 1;
 	}
 
+	InitializeCriticalSectionAndSpinCount(&queue->lock, 4000);
+	queue->event = CreateNotificationEvent(NULL, FALSE);
+
+	if (callback)
+		queue->object = *callback;
+
 	return queue;
+
+error:
+	free(queue->array);
+	free(queue);
+	return NULL;
+}
+
+wMessageQueue* MessageQueue_New(const wObject *callback)
+{
+	return MessageQueue_NewEx(callback, 0, 0);
 }
 
 void MessageQueue_Free(wMessageQueue* queue)
@@ -212,6 +437,7 @@ void MessageQueue_Free(wMessageQueue* queue)
 	CloseHandle(queue->event);
 	DeleteCriticalSection(&queue->lock);
 
+	free(queue->ring);
 	free(queue->array);
 	free(queue);
 }
@@ -220,6 +446,22 @@ int MessageQueue_Clear(wMessageQueue *queue)
 {
 	int status = 0;
 
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
+	{
+		wMessage msg;
+
+		while (MessageQueue_LockFreePeek(queue, &msg, TRUE))
+		{
+			/* Free resources of message. */
+			if (queue->object.fnObjectUninit)
+				queue->object.fnObjectUninit(&msg);
+			if (queue->object.fnObjectFree)
+				queue->object.fnObjectFree(&msg);
+		}
+
+		return status;
+	}
+
 	EnterCriticalSection(&queue->lock);
 
 	while(queue->size > 0)
@@ -243,4 +485,3 @@ int MessageQueue_Clear(wMessageQueue *queue)
 
 	return status;
 }
-
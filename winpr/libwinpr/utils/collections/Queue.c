@@ -265,7 +265,7 @@ wQueue* Queue_New(BOOL synchronized, int capacity, int growthFactor)
 	if (!queue->array)
 		goto out_free;
 
-	queue->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	queue->event = CreateNotificationEvent(NULL, FALSE);
 	if (!queue->event)
 		goto out_free_array;
 
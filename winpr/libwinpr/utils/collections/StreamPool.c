@@ -26,93 +26,238 @@
 #include <winpr/collections.h>
 
 /**
- * Methods
+ * Streams are kept in power-of-two size classes: a stream of class n has a
+ * capacity of 2^n bytes. Taking and returning a stream only pushes to or pops
+ * from the free list of its class.
+ *
+ * Buffers up to a page are aligned on their size, so the start of the buffer
+ * that contains a pointer can be computed for each of these classes by masking
+ * the pointer, and they are indexed by buffer start. Larger buffers are only
+ * page aligned and kept sorted, there are few of them in use at a time.
+ * StreamPool_Find() is bounded by the number of small classes plus a binary
+ * search, instead of the number of streams in use.
  */
 
-void StreamPool_ShiftUsed(wStreamPool* pool, int index, int count)
+static int StreamPool_SizeClass(size_t size)
 {
-	if (count > 0)
-	{
-		if (pool->uSize + count > pool->uCapacity)
-		{
-			pool->uCapacity *= 2;
-			pool->uArray = (wStream**) realloc(pool->uArray, sizeof(wStream*) * pool->uCapacity);
-		}
+	int sizeClass = STREAM_POOL_MIN_CLASS;
 
-		MoveMemory(&pool->uArray[index + count], &pool->uArray[index], (pool->uSize - index) * sizeof(wStream*));
-		pool->uSize += count;
+	while (((size_t) 1 << sizeClass) < size)
+	{
+		if (++sizeClass > STREAM_POOL_MAX_CLASS)
+			return -1;
 	}
-	else if (count < 0)
+
+	return sizeClass;
+}
+
+static BYTE* StreamPool_AllocBuffer(size_t size)
+{
+	size_t alignment = size;
+
+	if (alignment > ((size_t) 1 << STREAM_POOL_PAGE_CLASS))
+		alignment = (size_t) 1 << STREAM_POOL_PAGE_CLASS;
+
+#ifdef _WIN32
+	return (BYTE*) _aligned_malloc(size, alignment);
+#else
+	void* buffer = NULL;
+
+	if (posix_memalign(&buffer, alignment, size) != 0)
+		return NULL;
+
+	return (BYTE*) buffer;
+#endif
+}
+
+static void StreamPool_FreeBuffer(BYTE* buffer)
+{
+#ifdef _WIN32
+	_aligned_free(buffer);
+#else
+	free(buffer);
+#endif
+}
+
+static void StreamPool_FreeStream(wStream* s)
+{
+	StreamPool_FreeBuffer(Stream_Buffer(s));
+	Stream_Free(s, FALSE);
+}
+
+static UINT32 StreamPool_Hash(wStreamPool* pool, BYTE* buffer)
+{
+	UINT32 hash = (UINT32) (((ULONG_PTR) buffer) >> STREAM_POOL_MIN_CLASS);
+
+	/* Fibonacci hashing, uCapacity is a power of two */
+	return (hash * 2654435769U) & (pool->uCapacity - 1);
+}
+
+static wStream* StreamPool_Lookup(wStreamPool* pool, BYTE* buffer)
+{
+	wStream* s;
+	UINT32 index = StreamPool_Hash(pool, buffer);
+
+	while ((s = pool->uArray[index]) != NULL)
 	{
-		if (pool->uSize - index + count > 0)
-		{
-			MoveMemory(&pool->uArray[index], &pool->uArray[index - count],
-					(pool->uSize - index + count) * sizeof(wStream*));
-		}
+		if (Stream_Buffer(s) == buffer)
+			return s;
 
-		pool->uSize += count;
+		index = (index + 1) & (pool->uCapacity - 1);
 	}
+
+	return NULL;
 }
 
-/**
- * Adds a used stream to the pool.
- */
+static void StreamPool_Insert(wStreamPool* pool, wStream* s)
+{
+	UINT32 index = StreamPool_Hash(pool, Stream_Buffer(s));
+
+	while (pool->uArray[index])
+		index = (index + 1) & (pool->uCapacity - 1);
 
-void StreamPool_AddUsed(wStreamPool* pool, wStream* s)
+	pool->uArray[index] = s;
+}
+
+/* index of the first large stream whose buffer starts after ptr */
+
+static int StreamPool_LargeBound(wStreamPool* pool, BYTE* ptr)
 {
-	if ((pool->uSize + 1) >= pool->uCapacity)
+	int mid;
+	int low = 0;
+	int high = pool->lSize;
+
+	while (low < high)
 	{
-		pool->uCapacity *= 2;
-		pool->uArray = (wStream**) realloc(pool->uArray, sizeof(wStream*) * pool->uCapacity);
+		mid = (low + high) / 2;
+
+		if (Stream_Buffer(pool->lArray[mid]) <= ptr)
+			low = mid + 1;
+		else
+			high = mid;
 	}
 
-	pool->uArray[(pool->uSize)++] = s;
+	return low;
 }
 
-/**
- * Removes a used stream from the pool.
- */
-
-void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
+static BOOL StreamPool_AddLarge(wStreamPool* pool, wStream* s)
 {
 	int index;
-	BOOL found = FALSE;
 
-	for (index = 0; index < pool->uSize; index++)
+	if (pool->lSize >= pool->lCapacity)
 	{
-		if (pool->uArray[index] == s)
-		{
-			found = TRUE;
-			break;
-		}
+		int capacity = (pool->lCapacity > 0) ? pool->lCapacity * 2 : 8;
+		wStream** array = (wStream**) realloc(pool->lArray, sizeof(wStream*) * capacity);
+
+		if (!array)
+			return FALSE;
+
+		pool->lCapacity = capacity;
+		pool->lArray = array;
 	}
 
-	if (found)
-		StreamPool_ShiftUsed(pool, index, -1);
+	index = StreamPool_LargeBound(pool, Stream_Buffer(s));
+
+	MoveMemory(&pool->lArray[index + 1], &pool->lArray[index],
+			(pool->lSize - index) * sizeof(wStream*));
+
+	pool->lArray[index] = s;
+	pool->lSize++;
+	pool->uSize++;
+	return TRUE;
 }
 
-void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
+static void StreamPool_RemoveLarge(wStreamPool* pool, wStream* s)
 {
-	if (count > 0)
+	int index = StreamPool_LargeBound(pool, Stream_Buffer(s)) - 1;
+
+	if ((index < 0) || (pool->lArray[index] != s))
+		return;
+
+	MoveMemory(&pool->lArray[index], &pool->lArray[index + 1],
+			(pool->lSize - index - 1) * sizeof(wStream*));
+
+	pool->lSize--;
+	pool->uSize--;
+}
+
+static BOOL StreamPool_AddUsed(wStreamPool* pool, wStream* s, int sizeClass)
+{
+	if (sizeClass > STREAM_POOL_PAGE_CLASS)
+		return StreamPool_AddLarge(pool, s);
+
+	/* keep the index at most half full */
+	if ((pool->uSize + 1) * 2 > pool->uCapacity)
 	{
-		if (pool->aSize + count > pool->aCapacity)
+		int index;
+		int capacity = pool->uCapacity;
+		wStream** array = pool->uArray;
+
+		pool->uArray = (wStream**) calloc(capacity * 2, sizeof(wStream*));
+
+		if (!pool->uArray)
+		{
+			pool->uArray = array;
+			return FALSE;
+		}
+
+		pool->uCapacity = capacity * 2;
+
+		for (index = 0; index < capacity; index++)
 		{
-			pool->aCapacity *= 2;
-			pool->aArray = (wStream**) realloc(pool->aArray, sizeof(wStream*) * pool->aCapacity);
+			if (array[index])
+				StreamPool_Insert(pool, array[index]);
 		}
 
-		MoveMemory(&pool->aArray[index + count], &pool->aArray[index], (pool->aSize - index) * sizeof(wStream*));
-		pool->aSize += count;
+		free(array);
+	}
+
+	StreamPool_Insert(pool, s);
+
+	if (sizeClass > pool->maxClass)
+		pool->maxClass = sizeClass;
+
+	pool->uSize++;
+	return TRUE;
+}
+
+static void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
+{
+	wStream* next;
+	UINT32 hole, slot, home;
+	UINT32 mask = pool->uCapacity - 1;
+
+	if (Stream_Capacity(s) > ((size_t) 1 << STREAM_POOL_PAGE_CLASS))
+	{
+		StreamPool_RemoveLarge(pool, s);
+		return;
+	}
+
+	hole = StreamPool_Hash(pool, Stream_Buffer(s));
+
+	while (pool->uArray[hole] != s)
+	{
+		if (!pool->uArray[hole])
+			return;
+
+		hole = (hole + 1) & mask;
 	}
-	else if (count < 0)
+
+	pool->uArray[hole] = NULL;
+	pool->uSize--;
+
+	/* move back the entries of the cluster that probed past the hole */
+
+	for (slot = (hole + 1) & mask; (next = pool->uArray[slot]) != NULL; slot = (slot + 1) & mask)
 	{
-		if (pool->aSize - index + count > 0)
+		home = StreamPool_Hash(pool, Stream_Buffer(next));
+
+		if (((slot - home) & mask) >= ((slot - hole) & mask))
 		{
-			MoveMemory(&pool->aArray[index], &pool->aArray[index - count],
-					(pool->aSize - index + count) * sizeof(wStream*));
+			pool->uArray[hole] = next;
+			pool->uArray[slot] = NULL;
+			hole = slot;
 		}
-
-		pool->aSize += count;
 	}
 }
 
@@ -122,9 +267,9 @@ void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
 
 wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 {
-	int index;
-	int foundIndex;
+	int sizeClass;
 	wStream* s = NULL;
+	wStreamPoolClass* poolClass;
 
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
@@ -132,36 +277,47 @@ wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 	if (size == 0)
 		size = pool->defaultSize;
 
-	foundIndex = -1;
+	sizeClass = StreamPool_SizeClass(size);
 
-	for (index = 0; index < pool->aSize; index++)
-	{
-		s = pool->aArray[index];
+	if (sizeClass < 0)
+		goto out;
 
-		if (Stream_Capacity(s) >= size)
-		{
-			foundIndex = index;
-			break;
-		}
-	}
+	poolClass = &pool->classes[sizeClass];
 
-	if (foundIndex < 0)
+	if (poolClass->size > 0)
 	{
-		s = Stream_New(NULL, size);
+		s = poolClass->array[--(poolClass->size)];
+		pool->aSize--;
 	}
 	else
 	{
-		StreamPool_ShiftAvailable(pool, foundIndex, -1);
+		size = (size_t) 1 << sizeClass;
+		s = Stream_New(StreamPool_AllocBuffer(size), size);
 
-		Stream_SetPosition(s, 0);
-		Stream_EnsureCapacity(s, size);
+		if (!s)
+			goto out;
+
+		if (!Stream_Buffer(s))
+		{
+			Stream_Free(s, FALSE);
+			s = NULL;
+			goto out;
+		}
 	}
 
+	Stream_SetPosition(s, 0);
+	Stream_SetLength(s, Stream_Capacity(s));
+
 	s->pool = pool;
 	s->count = 1;
 
-	StreamPool_AddUsed(pool, s);
+	if (!StreamPool_AddUsed(pool, s, sizeClass))
+	{
+		StreamPool_FreeStream(s);
+		s = NULL;
+	}
 
+out:
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 
@@ -174,25 +330,89 @@ wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 
 void StreamPool_Return(wStreamPool* pool, wStream* s)
 {
+	int sizeClass;
+	wStreamPoolClass* poolClass;
+
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
 
-	if ((pool->aSize + 1) >= pool->aCapacity)
-	{
-		pool->aCapacity *= 2;
-		pool->aArray = (wStream**) realloc(pool->aArray, sizeof(wStream*) * pool->aCapacity);
-	}
-	else if ((pool->aSize + 1) * 3 < pool->aCapacity)
+	StreamPool_RemoveUsed(pool, s);
+
+	sizeClass = StreamPool_SizeClass(Stream_Capacity(s));
+	poolClass = &pool->classes[sizeClass];
+
+	if (poolClass->size >= poolClass->capacity)
 	{
-		pool->aCapacity /= 2;
-		pool->aArray = (wStream**) realloc(pool->aArray, sizeof(wStream*) * pool->aCapacity);
+		int capacity = (poolClass->capacity > 0) ? poolClass->capacity * 2 : 8;
+		wStream** array = (wStream**) realloc(poolClass->array, sizeof(wStream*) * capacity);
+
+		if (!array)
+		{
+			StreamPool_FreeStream(s);
+			goto out;
+		}
+
+		poolClass->capacity = capacity;
+		poolClass->array = array;
 	}
 
-	pool->aArray[(pool->aSize)++] = s;
+	poolClass->array[(poolClass->size)++] = s;
+	pool->aSize++;
+
+out:
+	if (pool->synchronized)
+		LeaveCriticalSection(&pool->lock);
+}
+
+/**
+ * Grows a stream of the pool, moving it to a larger size class.
+ * Called by Stream_EnsureCapacity() for pooled streams.
+ */
+
+BOOL StreamPool_EnsureCapacity(wStreamPool* pool, wStream* s, size_t size)
+{
+	int sizeClass;
+	size_t position;
+	size_t capacity;
+	BYTE* buffer;
+	BOOL status = FALSE;
+
+	if (Stream_Capacity(s) >= size)
+		return TRUE;
+
+	sizeClass = StreamPool_SizeClass(size);
+
+	if (sizeClass < 0)
+		return FALSE;
+
+	capacity = (size_t) 1 << sizeClass;
+	buffer = StreamPool_AllocBuffer(capacity);
+
+	if (!buffer)
+		return FALSE;
+
+	CopyMemory(buffer, Stream_Buffer(s), Stream_Capacity(s));
+	ZeroMemory(&buffer[Stream_Capacity(s)], capacity - Stream_Capacity(s));
+
+	position = Stream_GetPosition(s);
+
+	if (pool->synchronized)
+		EnterCriticalSection(&pool->lock);
+
 	StreamPool_RemoveUsed(pool, s);
+	StreamPool_FreeBuffer(Stream_Buffer(s));
+
+	s->buffer = buffer;
+	s->capacity = capacity;
+	s->length = capacity;
+	Stream_SetPosition(s, position);
+
+	status = StreamPool_AddUsed(pool, s, sizeClass);
 
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
+
+	return status;
 }
 
 /**
@@ -253,25 +473,35 @@ void Stream_Release(wStream* s)
 wStream* StreamPool_Find(wStreamPool* pool, BYTE* ptr)
 {
 	int index;
+	int sizeClass;
+	ULONG_PTR mask;
 	wStream* s = NULL;
-	BOOL found = FALSE;
 
 	EnterCriticalSection(&pool->lock);
 
-	for (index = 0; index < pool->uSize; index++)
+	for (sizeClass = STREAM_POOL_MIN_CLASS; sizeClass <= pool->maxClass; sizeClass++)
 	{
-		s = pool->uArray[index];
+		mask = ((ULONG_PTR) 1 << sizeClass) - 1;
+		s = StreamPool_Lookup(pool, (BYTE*) (((ULONG_PTR) ptr) & ~mask));
 
-		if ((ptr >= Stream_Buffer(s)) && (ptr < (Stream_Buffer(s) + Stream_Capacity(s))))
-		{
-			found = TRUE;
+		/* a smaller stream may start at the same boundary */
+		if (s && (ptr < (Stream_Buffer(s) + Stream_Capacity(s))))
 			break;
-		}
+
+		s = NULL;
+	}
+
+	if (!s && ((index = StreamPool_LargeBound(pool, ptr)) > 0))
+	{
+		s = pool->lArray[index - 1];
+
+		if (ptr >= (Stream_Buffer(s) + Stream_Capacity(s)))
+			s = NULL;
 	}
 
 	LeaveCriticalSection(&pool->lock);
 
-	return (found) ? s : NULL;
+	return s;
 }
 
 /**
@@ -308,15 +538,22 @@ void StreamPool_Release(wStreamPool* pool, BYTE* ptr)
 
 void StreamPool_Clear(wStreamPool* pool)
 {
+	int sizeClass;
+	wStreamPoolClass* poolClass;
+
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
 
-	while (pool->aSize > 0)
+	for (sizeClass = 0; sizeClass < STREAM_POOL_CLASSES; sizeClass++)
 	{
-		(pool->aSize)--;
-		Stream_Free(pool->aArray[pool->aSize], TRUE);
+		poolClass = &pool->classes[sizeClass];
+
+		while (poolClass->size > 0)
+			StreamPool_FreeStream(poolClass->array[--(poolClass->size)]);
 	}
 
+	pool->aSize = 0;
+
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 }
@@ -335,20 +572,16 @@ wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 	{
 		pool->synchronized = synchronized;
 		pool->defaultSize = defaultSize;
+		pool->maxClass = STREAM_POOL_MIN_CLASS - 1;
 
-		pool->aSize = 0;
-		pool->aCapacity = 32;
-		pool->aArray = (wStream**) calloc(pool->aCapacity, sizeof(wStream*));
-
-		if (!pool->aArray)
-			return NULL;
-
-		pool->uSize = 0;
-		pool->uCapacity = 32;
+		pool->uCapacity = 64;
 		pool->uArray = (wStream**) calloc(pool->uCapacity, sizeof(wStream*));
 
 		if (!pool->uArray)
+		{
+			free(pool);
 			return NULL;
+		}
 
 		InitializeCriticalSectionAndSpinCount(&pool->lock, 4000);
 	}
@@ -358,14 +591,19 @@ wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 
 void StreamPool_Free(wStreamPool* pool)
 {
+	int sizeClass;
+
 	if (pool)
 	{
 		StreamPool_Clear(pool);
 
 		DeleteCriticalSection(&pool->lock);
 
-		free(pool->aArray);
 		free(pool->uArray);
+		free(pool->lArray);
+
+		for (sizeClass = 0; sizeClass < STREAM_POOL_CLASSES; sizeClass++)
+			free(pool->classes[sizeClass].array);
 
 		free(pool);
 	}
@@ -27,6 +27,13 @@
 
 void Stream_EnsureCapacity(wStream* s, size_t size)
 {
+	/* pooled buffers are aligned on their size class and indexed by the pool */
+	if (s->pool)
+	{
+		StreamPool_EnsureCapacity(s->pool, s, size);
+		return;
+	}
+
 	if (s->capacity < size)
 	{
 		size_t position;
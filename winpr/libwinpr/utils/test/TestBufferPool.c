@@ -1,10 +1,86 @@
 
 #include <winpr/crt.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
 #include <winpr/stream.h>
 #include <winpr/collections.h>
 
+#define BENCH_THREADS		4
+#define BENCH_ITERATIONS	200000
+#define BENCH_BUFFER_SIZE	((8192 + 32) * 3)
+
+/* takes and returns buffers the way a tile worker does: two at a time */
+static DWORD WINAPI TestBufferPool_Worker(LPVOID arg)
+{
+	int i;
+	BYTE* dwt;
+	BYTE* tile;
+	wBufferPool* pool = (wBufferPool*) arg;
+
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+	{
+		dwt = (BYTE*) BufferPool_Take(pool, -1);
+		tile = (BYTE*) BufferPool_Take(pool, -1);
+
+		if (!dwt || !tile)
+			return 1;
+
+		dwt[0] = tile[BENCH_BUFFER_SIZE - 1] = (BYTE) i;
+
+		BufferPool_Return(pool, tile);
+		BufferPool_Return(pool, dwt);
+	}
+
+	return 0;
+}
+
+static int TestBufferPool_Bench(DWORD dwFlags, wBufferPoolStats* stats)
+{
+	int i;
+	DWORD exitCode;
+	UINT32 start, end;
+	wBufferPool* pool;
+	HANDLE threads[BENCH_THREADS];
+
+	pool = BufferPool_NewEx(TRUE, BENCH_BUFFER_SIZE, 16, dwFlags, 0);
+
+	if (!pool)
+		return -1;
+
+	start = GetTickCount();
+
+	for (i = 0; i < BENCH_THREADS; i++)
+		threads[i] = CreateThread(NULL, 0, TestBufferPool_Worker, pool, 0, NULL);
+
+	for (i = 0; i < BENCH_THREADS; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		GetExitCodeThread(threads[i], &exitCode);
+		CloseHandle(threads[i]);
+
+		if (exitCode != 0)
+			return -1;
+	}
+
+	end = GetTickCount();
+
+	BufferPool_GetStats(pool, stats);
+
+	printf("BufferPool (%s): %d threads x %d take/return pairs in %u ms, "
+			"cache hits: %llu refills: %llu flushes: %llu\n",
+			(dwFlags & BUFFER_POOL_FLAG_THREAD_CACHE) ? "thread cache" : "shared",
+			BENCH_THREADS, BENCH_ITERATIONS * 2, end - start,
+			(unsigned long long) stats->cacheHits, (unsigned long long) stats->refills,
+			(unsigned long long) stats->flushes);
+
+	BufferPool_Free(pool);
+
+	return 0;
+}
+
 int TestBufferPool(int argc, char* argv[])
 {
+	wBufferPoolStats stats;
 	DWORD PoolSize;
 	int BufferSize;
 	wBufferPool* pool;
@@ -55,6 +131,55 @@ int TestBufferPool(int argc, char* argv[])
 
 	BufferPool_Free(pool);
 
+	/* fixed size pool with thread caches */
+
+	pool = BufferPool_NewEx(TRUE, BENCH_BUFFER_SIZE, 16, BUFFER_POOL_FLAG_THREAD_CACHE, 2);
+
+	Buffers[0] = BufferPool_Take(pool, -1);
+	Buffers[1] = BufferPool_Take(pool, -1);
+	Buffers[2] = BufferPool_Take(pool, -1);
+
+	BufferPool_Return(pool, Buffers[0]);
+	BufferPool_Return(pool, Buffers[1]);
+	BufferPool_Return(pool, Buffers[2]);
+
+	if (BufferPool_GetPoolSize(pool) != 3)
+	{
+		printf("BufferPool_GetPoolSize failure: Actual: %d Expected: %d\n", BufferPool_GetPoolSize(pool), 3);
+		return -1;
+	}
+
+	if ((BufferPool_Take(pool, -1) != Buffers[2]) || (BufferPool_Take(pool, -1) != Buffers[1]))
+	{
+		printf("BufferPool_Take failure: thread cache not used\n");
+		return -1;
+	}
+
+	BufferPool_GetStats(pool, &stats);
+
+	if ((stats.cacheHits != 5) || (stats.refills != 3))
+	{
+		printf("BufferPool_GetStats failure: hits: %d refills: %d\n", (int) stats.cacheHits, (int) stats.refills);
+		return -1;
+	}
+
+	BufferPool_Return(pool, Buffers[1]);
+	BufferPool_Return(pool, Buffers[2]);
+
+	BufferPool_Free(pool);
+
+	if (TestBufferPool_Bench(0, &stats) < 0)
+		return -1;
+
+	if (TestBufferPool_Bench(BUFFER_POOL_FLAG_THREAD_CACHE, &stats) < 0)
+		return -1;
+
+	if (stats.cacheHits < (stats.refills + stats.flushes))
+	{
+		printf("BufferPool failure: thread caches mostly missed\n");
+		return -1;
+	}
+
 	return 0;
 }
 
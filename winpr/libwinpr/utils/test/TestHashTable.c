@@ -1,8 +1,14 @@
 
 #include <winpr/crt.h>
 #include <winpr/tchar.h>
+#include <winpr/sysinfo.h>
 #include <winpr/collections.h>
 
+#define TEST_HASH_TABLE_KEYS		100000
+#define TEST_HASH_TABLE_ROUNDS		10
+
+#define TEST_HASH_TABLE_KEY(_i)		((void*) (ULONG_PTR) (0x10000 + ((_i) * 48)))
+
 static char* key1 = "key1";
 static char* key2 = "key2";
 static char* key3 = "key3";
@@ -277,6 +283,168 @@ int test_hash_table_string()
 	return 1;
 }
 
+int test_hash_table_growth()
+{
+	int index;
+	int count;
+	ULONG_PTR sum;
+	ULONG_PTR expected;
+	wHashTable* table;
+	wHashTableEnumerator enumerator;
+
+	table = HashTable_New(FALSE);
+
+	if (!table)
+		return -1;
+
+	/* every key must stay reachable while the table is being rehashed */
+
+	for (index = 1; index <= TEST_HASH_TABLE_KEYS; index++)
+	{
+		if (HashTable_Add(table, (void*) (ULONG_PTR) index, (void*) (ULONG_PTR) (index * 2)) < 0)
+		{
+			printf("HashTable_Add: failed to add key %d\n", index);
+			return -1;
+		}
+
+		if ((index % 97) == 0)
+		{
+			int key = index - (index / 97);
+
+			if (HashTable_GetItemValue(table, (void*) (ULONG_PTR) key) != (void*) (ULONG_PTR) (key * 2))
+			{
+				printf("HashTable_GetItemValue: key %d lost after %d insertions\n", key, index);
+				return -1;
+			}
+		}
+	}
+
+	for (index = 2; index <= TEST_HASH_TABLE_KEYS; index += 2)
+	{
+		if (!HashTable_Remove(table, (void*) (ULONG_PTR) index))
+		{
+			printf("HashTable_Remove: key %d not found\n", index);
+			return -1;
+		}
+	}
+
+	count = HashTable_Count(table);
+
+	if (count != (TEST_HASH_TABLE_KEYS / 2))
+	{
+		printf("HashTable_Count: Expected : %d, Actual: %d\n", TEST_HASH_TABLE_KEYS / 2, count);
+		return -1;
+	}
+
+	for (index = 1; index <= TEST_HASH_TABLE_KEYS; index++)
+	{
+		BOOL contained = HashTable_Contains(table, (void*) (ULONG_PTR) index);
+
+		if (contained != ((index % 2) ? TRUE : FALSE))
+		{
+			printf("HashTable_Contains: wrong result for key %d\n", index);
+			return -1;
+		}
+	}
+
+	sum = expected = 0;
+	count = 0;
+
+	HashTable_Enumerator_Reset(table, &enumerator);
+
+	while (HashTable_Enumerator_MoveNext(&enumerator))
+	{
+		if ((ULONG_PTR) enumerator.value != ((ULONG_PTR) enumerator.key) * 2)
+		{
+			printf("HashTable_Enumerator: wrong value for key %d\n", (int) (ULONG_PTR) enumerator.key);
+			return -1;
+		}
+
+		sum += (ULONG_PTR) enumerator.key;
+		count++;
+	}
+
+	for (index = 1; index <= TEST_HASH_TABLE_KEYS; index += 2)
+		expected += index;
+
+	if ((count != (TEST_HASH_TABLE_KEYS / 2)) || (sum != expected))
+	{
+		printf("HashTable_Enumerator: enumerated %d keys\n", count);
+		return -1;
+	}
+
+	HashTable_Free(table);
+
+	return 1;
+}
+
+int test_hash_table_benchmark()
+{
+	int index;
+	int round;
+	UINT32 start;
+	UINT32 end;
+	ULONG_PTR sum = 0;
+	wHashTable* table;
+	wHashTableEnumerator enumerator;
+
+	/* keys spaced like heap allocations, looked up in scattered order */
+
+	table = HashTable_New(FALSE);
+
+	if (!table)
+		return -1;
+
+	start = GetTickCount();
+
+	for (index = 1; index <= TEST_HASH_TABLE_KEYS; index++)
+		HashTable_Add(table, TEST_HASH_TABLE_KEY(index), (void*) (ULONG_PTR) index);
+
+	end = GetTickCount();
+
+	printf("HashTable_Add: %d keys in %u ms\n", TEST_HASH_TABLE_KEYS, end - start);
+
+	start = GetTickCount();
+
+	for (round = 0; round < TEST_HASH_TABLE_ROUNDS; round++)
+	{
+		for (index = 1; index <= TEST_HASH_TABLE_KEYS; index++)
+			sum += (ULONG_PTR) HashTable_GetItemValue(table, TEST_HASH_TABLE_KEY(((index * 7919) % TEST_HASH_TABLE_KEYS) + 1));
+	}
+
+	end = GetTickCount();
+
+	printf("HashTable_GetItemValue: %d lookups in %u ms\n",
+			TEST_HASH_TABLE_KEYS * TEST_HASH_TABLE_ROUNDS, end - start);
+
+	start = GetTickCount();
+
+	for (round = 0; round < TEST_HASH_TABLE_ROUNDS; round++)
+	{
+		HashTable_Enumerator_Reset(table, &enumerator);
+
+		while (HashTable_Enumerator_MoveNext(&enumerator))
+			sum += (ULONG_PTR) enumerator.value;
+	}
+
+	end = GetTickCount();
+
+	printf("HashTable_Enumerator: %d passes in %u ms\n", TEST_HASH_TABLE_ROUNDS, end - start);
+
+	start = GetTickCount();
+
+	for (index = 1; index <= TEST_HASH_TABLE_KEYS; index++)
+		HashTable_Remove(table, TEST_HASH_TABLE_KEY(index));
+
+	end = GetTickCount();
+
+	printf("HashTable_Remove: %d keys in %u ms\n", TEST_HASH_TABLE_KEYS, end - start);
+
+	HashTable_Free(table);
+
+	return (sum != 0) ? 1 : -1;
+}
+
 int TestHashTable(int argc, char* argv[])
 {
 	if (test_hash_table_pointer() < 0)
@@ -285,5 +453,11 @@ int TestHashTable(int argc, char* argv[])
 	if (test_hash_table_string() < 0)
 		return 1;
 
+	if (test_hash_table_growth() < 0)
+		return 1;
+
+	if (test_hash_table_benchmark() < 0)
+		return 1;
+
 	return 0;
 }
@@ -1,8 +1,15 @@
 
 #include <winpr/crt.h>
 #include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 #include <winpr/collections.h>
 
+#define BENCH_PRODUCERS		2
+#define BENCH_MESSAGES		200000
+#define BENCH_BURST		1000
+#define BENCH_ROUNDS		1000
+
 static void* message_queue_consumer_thread(void* arg)
 {
 	wMessage message;
@@ -24,6 +31,259 @@ static void* message_queue_consumer_thread(void* arg)
 	return NULL;
 }
 
+struct _BENCH_PRODUCER
+{
+	wMessageQueue* queue;
+	UINT32 id;
+	size_t last;
+	HANDLE thread;
+};
+typedef struct _BENCH_PRODUCER BENCH_PRODUCER;
+
+static void* message_queue_bench_producer_thread(void* arg)
+{
+	size_t index;
+	BENCH_PRODUCER* producer;
+
+	producer = (BENCH_PRODUCER*) arg;
+
+	for (index = 0; index < BENCH_MESSAGES; index++)
+		MessageQueue_Post(producer->queue, NULL, producer->id, (void*) (index + 1), NULL);
+
+	return NULL;
+}
+
+static int test_message_queue_bench(DWORD dwFlags, const char* name)
+{
+	int status = 0;
+	int received = 0;
+	UINT32 index;
+	BENCH_PRODUCER producers[BENCH_PRODUCERS];
+	UINT32 start, end;
+	wMessage message;
+	wMessageQueue* queue;
+
+	queue = MessageQueue_NewEx(NULL, dwFlags, 64);
+
+	if (!queue)
+		return -1;
+
+	start = GetTickCount();
+
+	for (index = 0; index < BENCH_PRODUCERS; index++)
+	{
+		producers[index].queue = queue;
+		producers[index].id = index;
+		producers[index].last = 0;
+		producers[index].thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) message_queue_bench_producer_thread,
+				(void*) &producers[index], 0, NULL);
+	}
+
+	while (received < (BENCH_PRODUCERS * BENCH_MESSAGES))
+	{
+		if (!MessageQueue_Wait(queue))
+			break;
+
+		while (MessageQueue_Peek(queue, &message, TRUE))
+		{
+			index = message.id;
+
+			if ((index >= BENCH_PRODUCERS) || ((size_t) message.wParam != producers[index].last + 1))
+			{
+				printf("%s: message %d out of order\n", name, received);
+				status = -1;
+			}
+			else
+			{
+				producers[index].last = (size_t) message.wParam;
+			}
+
+			received++;
+		}
+	}
+
+	end = GetTickCount();
+
+	for (index = 0; index < BENCH_PRODUCERS; index++)
+	{
+		WaitForSingleObject(producers[index].thread, INFINITE);
+		CloseHandle(producers[index].thread);
+	}
+
+	if (MessageQueue_Size(queue) != 0)
+	{
+		printf("%s: queue not empty after drain\n", name);
+		status = -1;
+	}
+
+	printf("%s: %d messages from %d producers in %u ms\n",
+			name, received, BENCH_PRODUCERS, end - start);
+
+	MessageQueue_Free(queue);
+
+	return status;
+}
+
+static int test_message_queue_burst(DWORD dwFlags, const char* name)
+{
+	int round;
+	size_t index;
+	size_t expected;
+	UINT32 start, end;
+	wMessage message;
+	wMessageQueue* queue;
+
+	/* post and drain from a single thread to measure per-message overhead */
+
+	queue = MessageQueue_NewEx(NULL, dwFlags, BENCH_BURST);
+
+	if (!queue)
+		return -1;
+
+	start = GetTickCount();
+
+	for (round = 0; round < BENCH_ROUNDS; round++)
+	{
+		for (index = 0; index < BENCH_BURST; index++)
+			MessageQueue_Post(queue, NULL, 0, (void*) index, NULL);
+
+		expected = 0;
+
+		while (MessageQueue_Peek(queue, &message, TRUE))
+		{
+			if ((size_t) message.wParam != expected++)
+			{
+				MessageQueue_Free(queue);
+				return -1;
+			}
+		}
+
+		if (expected != BENCH_BURST)
+		{
+			MessageQueue_Free(queue);
+			return -1;
+		}
+	}
+
+	end = GetTickCount();
+
+	printf("%s: %d messages posted and drained in %u ms\n",
+			name, BENCH_BURST * BENCH_ROUNDS, end - start);
+
+	MessageQueue_Free(queue);
+
+	return 0;
+}
+
+#define STALL_RING		8
+#define STALL_MESSAGES		(STALL_RING + 8)
+
+struct _STALL_CONSUMER
+{
+	wMessageQueue* queue;
+	LONG received;
+	wMessage messages[STALL_MESSAGES + 1];
+};
+typedef struct _STALL_CONSUMER STALL_CONSUMER;
+
+static void* message_queue_stall_consumer_thread(void* arg)
+{
+	STALL_CONSUMER* consumer;
+
+	consumer = (STALL_CONSUMER*) arg;
+
+	while (consumer->received < STALL_MESSAGES + 1)
+	{
+		if (MessageQueue_Get(consumer->queue, &consumer->messages[consumer->received]) < 0)
+			break;
+
+		InterlockedIncrement(&consumer->received);
+	}
+
+	return NULL;
+}
+
+static int test_message_queue_stalled_producer(void)
+{
+	LONG pos;
+	int status = 0;
+	size_t index;
+	HANDLE thread;
+	wMessage* message;
+	wMessageQueueSlot* slot;
+	STALL_CONSUMER consumer;
+	wMessageQueue* queue;
+
+	queue = MessageQueue_NewEx(NULL, WMQ_FLAG_LOCKFREE, STALL_RING);
+
+	if (!queue)
+		return -1;
+
+	ZeroMemory(&consumer, sizeof(consumer));
+	consumer.queue = queue;
+
+	/* producer 1 counts its message and claims the head slot, then stalls */
+
+	if (InterlockedIncrement(&queue->count) == 1)
+		SetEvent(queue->event);
+
+	pos = queue->ringTail;
+	InterlockedCompareExchange(&queue->ringTail, pos + 1, pos);
+	slot = &queue->ring[pos & queue->ringMask];
+
+	/* producer 2 fills the rest of the ring and spills into the array */
+
+	for (index = 0; index < STALL_MESSAGES; index++)
+		MessageQueue_Post(queue, NULL, 2, (void*) index, NULL);
+
+	thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) message_queue_stall_consumer_thread,
+			(void*) &consumer, 0, NULL);
+
+	Sleep(50);
+
+	if (consumer.received != 0)
+	{
+		printf("stalled producer: %d messages taken past an unpublished slot\n",
+				(int) consumer.received);
+		status = -1;
+	}
+
+	ZeroMemory(&slot->message, sizeof(wMessage));
+	slot->message.id = 1;
+	InterlockedExchange(&slot->sequence, pos + 1);
+
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+
+	if (consumer.received != STALL_MESSAGES + 1)
+	{
+		printf("stalled producer: %d messages received\n", (int) consumer.received);
+		status = -1;
+	}
+
+	if (consumer.messages[0].id != 1)
+	{
+		printf("stalled producer: its message was not received first\n");
+		status = -1;
+	}
+
+	for (index = 0; index < STALL_MESSAGES; index++)
+	{
+		message = &consumer.messages[index + 1];
+
+		if ((message->id != 2) || ((size_t) message->wParam != index))
+		{
+			printf("stalled producer: message %d out of order\n", (int) index);
+			status = -1;
+			break;
+		}
+	}
+
+	MessageQueue_Free(queue);
+
+	return status;
+}
+
 int TestMessageQueue(int argc, char* argv[])
 {
 	HANDLE thread;
@@ -42,5 +302,33 @@ int TestMessageQueue(int argc, char* argv[])
 
 	MessageQueue_Free(queue);
 
+	queue = MessageQueue_NewEx(NULL, WMQ_FLAG_LOCKFREE, 4);
+
+	thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) message_queue_consumer_thread, (void*) queue, 0, NULL);
+
+	MessageQueue_Post(queue, NULL, 123, NULL, NULL);
+	MessageQueue_Post(queue, NULL, 456, NULL, NULL);
+	MessageQueue_Post(queue, NULL, 789, NULL, NULL);
+	MessageQueue_PostQuit(queue, 0);
+
+	WaitForSingleObject(thread, INFINITE);
+
+	MessageQueue_Free(queue);
+
+	if (test_message_queue_stalled_producer() < 0)
+		return -1;
+
+	if (test_message_queue_burst(0, "locked") < 0)
+		return -1;
+
+	if (test_message_queue_burst(WMQ_FLAG_LOCKFREE, "lockfree") < 0)
+		return -1;
+
+	if (test_message_queue_bench(0, "locked") < 0)
+		return -1;
+
+	if (test_message_queue_bench(WMQ_FLAG_LOCKFREE, "lockfree") < 0)
+		return -1;
+
 	return 0;
 }
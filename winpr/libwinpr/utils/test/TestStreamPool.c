@@ -1,10 +1,115 @@
 
 #include <winpr/crt.h>
 #include <winpr/stream.h>
+#include <winpr/sysinfo.h>
 #include <winpr/collections.h>
 
 #define BUFFER_SIZE 16384
 
+#define BENCH_STREAMS		1024
+#define BENCH_ROUNDS		500
+
+static int TestStreamPool_Find(wStreamPool* pool)
+{
+	wStream* s;
+	wStream* t;
+
+	s = StreamPool_Take(pool, 3000);
+	t = StreamPool_Take(pool, 0);
+
+	if (Stream_Capacity(s) < 3000)
+		return -1;
+
+	if ((StreamPool_Find(pool, Stream_Buffer(s)) != s) ||
+			(StreamPool_Find(pool, Stream_Buffer(s) + 2999) != s) ||
+			(StreamPool_Find(pool, Stream_Buffer(t) + BUFFER_SIZE - 1) != t))
+	{
+		printf("StreamPool_Find: stream not found\n");
+		return -1;
+	}
+
+	/* a grown stream must still be found by pointers into its new buffer */
+
+	Stream_SetPosition(s, 100);
+	Stream_EnsureCapacity(s, 100000);
+
+	if ((Stream_GetPosition(s) != 100) || (StreamPool_Find(pool, Stream_Buffer(s) + 70000) != s))
+	{
+		printf("StreamPool_Find: grown stream not found\n");
+		return -1;
+	}
+
+	Stream_Release(s);
+	Stream_Release(t);
+
+	if (StreamPool_Find(pool, Stream_Buffer(t)) != NULL)
+	{
+		printf("StreamPool_Find: returned stream still found\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int TestStreamPool_Bench(wStreamPool* pool)
+{
+	int i, j;
+	UINT32 start, end;
+	wStream* s[BENCH_STREAMS];
+
+	start = GetTickCount();
+
+	for (i = 0; i < BENCH_ROUNDS; i++)
+	{
+		for (j = 0; j < BENCH_STREAMS; j++)
+			s[j] = StreamPool_Take(pool, (j % 4) ? 0 : 64 + j * 256);
+
+		/* streams are not released in the order they were taken */
+		for (j = 0; j < BENCH_STREAMS; j++)
+			Stream_Release(s[(j * 97) % BENCH_STREAMS]);
+	}
+
+	end = GetTickCount();
+
+	printf("StreamPool: %d take/release with %d streams in use in %u ms\n",
+			BENCH_ROUNDS * BENCH_STREAMS, BENCH_STREAMS, end - start);
+
+	for (j = 0; j < BENCH_STREAMS; j++)
+		s[j] = StreamPool_Take(pool, (j % 4) ? 0 : 64 + j * 256);
+
+	start = GetTickCount();
+
+	for (i = 0; i < BENCH_ROUNDS; i++)
+	{
+		for (j = 0; j < BENCH_STREAMS; j++)
+		{
+			StreamPool_AddRef(pool, Stream_Buffer(s[j]) + (j * 7) % 64);
+			StreamPool_Release(pool, Stream_Buffer(s[j]) + (j * 13) % 64);
+		}
+	}
+
+	end = GetTickCount();
+
+	printf("StreamPool: %d interior pointer add/release with %d streams in use in %u ms\n",
+			BENCH_ROUNDS * BENCH_STREAMS, BENCH_STREAMS, end - start);
+
+	for (j = 0; j < BENCH_STREAMS; j++)
+	{
+		if (s[j]->count != 1)
+		{
+			printf("StreamPool: unexpected reference count %u\n", s[j]->count);
+			return -1;
+		}
+
+		Stream_Release(s[j]);
+	}
+
+	if (pool->uSize != 0)
+		return -1;
+
+	return 0;
+}
+
 int TestStreamPool(int argc, char* argv[])
 {
 	wStream* s[5];
@@ -94,6 +199,12 @@ int TestStreamPool(int argc, char* argv[])
 
 	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
 
+	if (TestStreamPool_Find(pool) < 0)
+		return -1;
+
+	if (TestStreamPool_Bench(pool) < 0)
+		return -1;
+
 	StreamPool_Free(pool);
 
 	return 0;
@@ -0,0 +1,201 @@
+
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/file.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/wlog.h>
+
+#define TEST_WLOG_THREADS		4
+#define TEST_WLOG_MESSAGES		20000
+#define TEST_WLOG_ERROR_RATIO		100
+
+static DWORD WINAPI TestWLogAsync_Thread(LPVOID arg)
+{
+	int i;
+	wLog* log = WLog_Get("com.test.async");
+
+	for (i = 0; i < TEST_WLOG_MESSAGES; i++)
+	{
+		if ((i % TEST_WLOG_ERROR_RATIO) == 0)
+			WLog_Print(log, WLOG_ERROR, "thread %d message %d failed", (int) (size_t) arg, i);
+		else
+			WLog_Print(log, WLOG_INFO, "thread %d message %d: %s", (int) (size_t) arg, i, "some diagnostic output");
+	}
+
+	return 0;
+}
+
+static BOOL TestWLogAsync_CountLines(const char* filename, UINT64* lines, UINT64* errors)
+{
+	FILE* fp;
+	char line[1024];
+
+	*lines = *errors = 0;
+
+	fp = fopen(filename, "r");
+
+	if (!fp)
+		return FALSE;
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		(*lines)++;
+
+		if (strncmp(line, "[ERROR:", 7) == 0)
+			(*errors)++;
+	}
+
+	fclose(fp);
+
+	return TRUE;
+}
+
+static BOOL TestWLogAsync_Run(const char* path, BOOL async)
+{
+	int i;
+	BOOL status = FALSE;
+	UINT32 start, end;
+	UINT64 lines, errors;
+	char* filename;
+	char name[64];
+	wLog* root;
+	wLogLayout* layout;
+	wLogAppender* appender;
+	wLogAsyncStats stats;
+	HANDLE threads[TEST_WLOG_THREADS];
+
+	sprintf_s(name, sizeof(name), "TestWLogAsync_%u_%d.log", (unsigned int) GetCurrentProcessId(), async);
+	filename = GetCombinedPath(path, name);
+
+	if (!filename)
+		return FALSE;
+
+	DeleteFileA(filename);
+
+	root = WLog_GetRoot();
+	WLog_SetLogLevel(root, WLOG_INFO);
+	WLog_SetLogAppenderType(root, WLOG_APPENDER_FILE);
+
+	appender = WLog_GetLogAppender(root);
+	WLog_FileAppender_SetOutputFilePath(root, (wLogFileAppender*) appender, path);
+	WLog_FileAppender_SetOutputFileName(root, (wLogFileAppender*) appender, name);
+
+	layout = WLog_GetLogLayout(root);
+	WLog_Layout_SetPrefixFormat(root, layout, "[%lv:%mn] [%tid] - ");
+
+	if (async && !WLog_SetAsync(root, TRUE))
+	{
+		printf("WLog_SetAsync failure\n");
+		goto out;
+	}
+
+	if (WLog_OpenAppender(root) < 0)
+	{
+		printf("WLog_OpenAppender failure\n");
+		goto out;
+	}
+
+	start = GetTickCount();
+
+	for (i = 0; i < TEST_WLOG_THREADS; i++)
+	{
+		threads[i] = CreateThread(NULL, 0, TestWLogAsync_Thread, (LPVOID) (size_t) i, 0, NULL);
+
+		if (!threads[i])
+			goto out;
+	}
+
+	for (i = 0; i < TEST_WLOG_THREADS; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+
+	end = GetTickCount();
+
+	WLog_Flush();
+	WLog_CloseAppender(root);
+
+	if (!TestWLogAsync_CountLines(filename, &lines, &errors))
+	{
+		printf("failed to read %s\n", filename);
+		goto out;
+	}
+
+	printf("%s: %d threads x %d messages logged in %u ms, %d lines written\n",
+			async ? "asynchronous" : "synchronous", TEST_WLOG_THREADS, TEST_WLOG_MESSAGES,
+			end - start, (int) lines);
+
+	/* errors are never dropped */
+	if (errors != (TEST_WLOG_THREADS * TEST_WLOG_MESSAGES / TEST_WLOG_ERROR_RATIO))
+	{
+		printf("expected %d errors, found %d\n",
+				TEST_WLOG_THREADS * TEST_WLOG_MESSAGES / TEST_WLOG_ERROR_RATIO, (int) errors);
+		goto out;
+	}
+
+	if (async)
+	{
+		WLog_GetAsyncStats(&stats);
+
+		printf("queued: %d dropped: %d written: %d batches: %d\n", (int) stats.Queued,
+				(int) stats.Dropped, (int) stats.Written, (int) stats.Batches);
+
+		/* errors that did not fit in the ring were written directly */
+		if ((stats.Written != stats.Queued) || (lines < stats.Written) ||
+				(lines > (stats.Written + errors)) ||
+				((stats.Queued + stats.Dropped) > (TEST_WLOG_THREADS * TEST_WLOG_MESSAGES)))
+		{
+			printf("inconsistent asynchronous appender statistics\n");
+			goto out;
+		}
+
+		if ((lines + stats.Dropped) != (TEST_WLOG_THREADS * TEST_WLOG_MESSAGES))
+		{
+			printf("%d messages lost\n", (int) (TEST_WLOG_THREADS * TEST_WLOG_MESSAGES - lines - stats.Dropped));
+			goto out;
+		}
+
+		WLog_SetAsync(root, FALSE);
+	}
+	else if (lines != (TEST_WLOG_THREADS * TEST_WLOG_MESSAGES))
+	{
+		printf("expected %d lines\n", TEST_WLOG_THREADS * TEST_WLOG_MESSAGES);
+		goto out;
+	}
+
+	status = TRUE;
+
+out:
+	DeleteFileA(filename);
+	free(filename);
+	return status;
+}
+
+int TestWLogAsync(int argc, char* argv[])
+{
+	char* path;
+	int status = -1;
+
+	WLog_Init();
+
+	path = GetKnownPath(KNOWN_PATH_TEMP);
+
+	if (!path)
+		return -1;
+
+	if (!TestWLogAsync_Run(path, FALSE))
+		goto out;
+
+	if (!TestWLogAsync_Run(path, TRUE))
+		goto out;
+
+	status = 0;
+
+out:
+	free(path);
+	WLog_Uninit();
+	return status;
+}
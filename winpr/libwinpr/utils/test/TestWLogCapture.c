@@ -0,0 +1,219 @@
+
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/file.h>
+#include <winpr/sysinfo.h>
+#include <winpr/wlog.h>
+
+#define TEST_CAPTURE_INTERFACES		3
+#define TEST_CAPTURE_PACKETS		20000
+#define TEST_CAPTURE_RING_SIZE		(1024 * 1024)
+
+static BYTE g_Packet[2048];
+
+static int TestWLogCapture_Log(wLog* log, int count)
+{
+	int i;
+	int length;
+
+	for (i = 0; i < count; i++)
+	{
+		length = 64 + ((i * 37) % 1400);
+
+		/* the payload starts with the packet number */
+		*((UINT32*) g_Packet) = (UINT32) i;
+
+		WLog_Packet(log, WLOG_TRACE, g_Packet, length,
+				((i & 1) ? WLOG_PACKET_OUTBOUND : WLOG_PACKET_INBOUND) |
+				WLOG_PACKET_INTERFACE(i % TEST_CAPTURE_INTERFACES));
+	}
+
+	return count;
+}
+
+/* returns the number of packets, or -1 if the file is not valid pcapng */
+
+static int TestWLogCapture_Check(const char* filename, DWORD interfaceId, UINT32* last)
+{
+	FILE* fp;
+	int count = 0;
+	int interfaces = 0;
+	UINT32 header[7];
+	UINT32 length;
+	UINT32 number;
+	BYTE* block;
+
+	fp = fopen(filename, "rb");
+
+	if (!fp)
+		return -1;
+
+	block = (BYTE*) malloc(1 << 17);
+
+	if ((fread(header, 28, 1, fp) != 1) || (header[0] != 0x0A0D0D0A) || (header[2] != 0x1A2B3C4D))
+		count = -1;
+
+	while ((count >= 0) && (fread(header, 8, 1, fp) == 1))
+	{
+		length = header[1];
+
+		if ((length < 12) || (length & 3) || (length > (1 << 17)) ||
+				(fread(&block[8], length - 8, 1, fp) != 1) ||
+				(*((UINT32*) &block[length - 4]) != length))
+		{
+			count = -1;
+			break;
+		}
+
+		if (header[0] == 0x00000001)
+		{
+			interfaces++;
+			continue;
+		}
+
+		if ((header[0] != 0x00000006) || (*((UINT32*) &block[8]) >= (UINT32) interfaces))
+		{
+			count = -1;
+			break;
+		}
+
+		/* 28 bytes of block header, then 54 bytes of ethernet, IPv4 and TCP */
+		number = *((UINT32*) &block[28 + 54]);
+
+		if ((interfaceId != WLOG_CAPTURE_ALL_INTERFACES) && (*((UINT32*) &block[8]) != interfaceId))
+			count = -1;
+		else if ((count > 0) && (number <= *last))
+			count = -1;
+		else
+			count++;
+
+		*last = number;
+	}
+
+	free(block);
+	fclose(fp);
+
+	return count;
+}
+
+int TestWLogCapture(int argc, char* argv[])
+{
+	int count;
+	int status = -1;
+	UINT32 last;
+	UINT32 start, end;
+	char* path;
+	char* dump;
+	char* ring;
+	char* pcap;
+	char* wlog;
+	char name[64];
+	wLog* log;
+	wLogAppender* appender;
+
+	WLog_Init();
+
+	path = GetKnownPath(KNOWN_PATH_TEMP);
+
+	if (!path)
+		return -1;
+
+	sprintf_s(name, sizeof(name), "TestWLogCapture_%u.pcapng", (unsigned int) GetCurrentProcessId());
+	dump = GetCombinedPath(path, name);
+
+	sprintf_s(name, sizeof(name), "TestWLogCapture_%u.ring", (unsigned int) GetCurrentProcessId());
+	ring = GetCombinedPath(path, name);
+
+	sprintf_s(name, sizeof(name), "%u.pcap", (unsigned int) GetCurrentProcessId());
+	wlog = GetKnownSubPath(KNOWN_PATH_TEMP, "wlog");
+	pcap = GetCombinedPath(wlog, name);
+	free(wlog);
+
+	log = WLog_Get("com.test.capture");
+	WLog_SetLogLevel(log, WLOG_TRACE);
+
+	/* pcap output of the console appender, for comparison */
+
+	WLog_SetLogAppenderType(log, WLOG_APPENDER_CONSOLE);
+
+	start = GetTickCount();
+	TestWLogCapture_Log(log, TEST_CAPTURE_PACKETS);
+	end = GetTickCount();
+
+	printf("pcap file: %d packets logged in %u ms\n", TEST_CAPTURE_PACKETS, end - start);
+
+	WLog_SetLogAppenderType(log, WLOG_APPENDER_CAPTURE);
+
+	appender = WLog_GetLogAppender(log);
+	sprintf_s(name, sizeof(name), "TestWLogCapture_%u.ring", (unsigned int) GetCurrentProcessId());
+	WLog_CaptureAppender_SetOutputFilePath(log, (wLogCaptureAppender*) appender, path);
+	WLog_CaptureAppender_SetOutputFileName(log, (wLogCaptureAppender*) appender, name);
+	WLog_CaptureAppender_SetRingSize(log, (wLogCaptureAppender*) appender, TEST_CAPTURE_RING_SIZE);
+
+	if (WLog_OpenAppender(log) < 0)
+	{
+		printf("WLog_OpenAppender failure\n");
+		goto out;
+	}
+
+	/* text messages go to the parent appender */
+	WLog_Print(log, WLOG_ERROR, "capture appender test");
+
+	/* fewer packets than the ring can hold */
+
+	TestWLogCapture_Log(log, 100);
+
+	count = WLog_CaptureAppender_Dump(log, (wLogCaptureAppender*) appender, dump, 0, WLOG_CAPTURE_ALL_INTERFACES);
+
+	if ((count != 100) || (TestWLogCapture_Check(dump, WLOG_CAPTURE_ALL_INTERFACES, &last) != 100) || (last != 99))
+	{
+		printf("WLog_CaptureAppender_Dump: expected 100 packets, got %d\n", count);
+		goto out;
+	}
+
+	/* wrap around the ring several times */
+
+	start = GetTickCount();
+	TestWLogCapture_Log(log, TEST_CAPTURE_PACKETS);
+	end = GetTickCount();
+
+	printf("capture ring: %d packets logged in %u ms\n", TEST_CAPTURE_PACKETS, end - start);
+
+	count = WLog_CaptureAppender_Dump(log, (wLogCaptureAppender*) appender, dump, 0, WLOG_CAPTURE_ALL_INTERFACES);
+
+	if ((count <= 0) || (count >= TEST_CAPTURE_PACKETS) ||
+			(TestWLogCapture_Check(dump, WLOG_CAPTURE_ALL_INTERFACES, &last) != count) ||
+			(last != (TEST_CAPTURE_PACKETS - 1)))
+	{
+		printf("WLog_CaptureAppender_Dump: invalid ring dump (%d packets)\n", count);
+		goto out;
+	}
+
+	printf("capture ring: last %d packets kept\n", count);
+
+	count = WLog_CaptureAppender_Dump(log, (wLogCaptureAppender*) appender, dump, 60, 1);
+
+	if ((count <= 0) || (TestWLogCapture_Check(dump, 1, &last) != count))
+	{
+		printf("WLog_CaptureAppender_Dump: invalid interface dump (%d packets)\n", count);
+		goto out;
+	}
+
+	status = 0;
+
+out:
+	WLog_CloseAppender(log);
+
+	DeleteFileA(pcap);
+	DeleteFileA(ring);
+	DeleteFileA(dump);
+
+	free(pcap);
+	free(ring);
+	free(dump);
+	free(path);
+
+	WLog_Uninit();
+
+	return status;
+}
@@ -43,6 +43,10 @@ wLogAppender* WLog_Appender_New(wLog* log, DWORD logAppenderType)
 	{
 		appender = (wLogAppender*) WLog_BinaryAppender_New(log);
 	}
+	else if (logAppenderType == WLOG_APPENDER_CAPTURE)
+	{
+		appender = (wLogAppender*) WLog_CaptureAppender_New(log);
+	}
 
 	if (!appender)
 		appender = (wLogAppender*) WLog_ConsoleAppender_New(log);
@@ -58,6 +62,9 @@ void WLog_Appender_Free(wLog* log, wLogAppender* appender)
 {
 	if (appender)
 	{
+		if (appender->Async)
+			WLog_Flush();
+
 		if (appender->Layout)
 		{
 			WLog_Layout_Free(log, appender->Layout);
@@ -78,6 +85,10 @@ void WLog_Appender_Free(wLog* log, wLogAppender* appender)
 		{
 			WLog_BinaryAppender_Free(log, (wLogBinaryAppender*) appender);
 		}
+		else if (appender->Type == WLOG_APPENDER_CAPTURE)
+		{
+			WLog_CaptureAppender_Free(log, (wLogCaptureAppender*) appender);
+		}
 	}
 }
 
@@ -140,6 +151,9 @@ int WLog_CloseAppender(wLog* log)
 
 	if (appender->State)
 	{
+		if (appender->Async)
+			WLog_Flush();
+
 		status = appender->Close(log, appender);
 		appender->State = 0;
 	}
@@ -0,0 +1,529 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * WinPR Logger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/interlocked.h>
+
+#include <winpr/wlog.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "wlog/AsyncAppender.h"
+
+/**
+ * Asynchronous Appender
+ *
+ * Each logging thread owns a single producer, single consumer ring of
+ * preformatted records: the prefix is formatted when the message is logged
+ * since it may contain the time and thread id. Publishing a record only
+ * costs a copy and one interlocked exchange, no lock is taken.
+ *
+ * A single flusher thread drains the rings and concatenates consecutive
+ * records of the same appender into one batch, which is handed to the
+ * WriteBatch callback of that appender under its lock. The flusher runs
+ * every WLOG_ASYNC_FLUSH_INTERVAL ms, or earlier when a ring is half full.
+ *
+ * Records of different threads are written in the order the flusher visits
+ * the rings, not strictly in time order.
+ */
+
+#define WLOG_ASYNC_RING_SIZE		(64 * 1024)
+#define WLOG_ASYNC_RING_MASK		(WLOG_ASYNC_RING_SIZE - 1)
+#define WLOG_ASYNC_RECORD_ALIGN		32
+#define WLOG_ASYNC_BATCH_SIZE		(64 * 1024)
+#define WLOG_ASYNC_FLUSH_INTERVAL	100
+
+struct _wLogAsyncRecord
+{
+	UINT32 Size;
+	UINT32 Length;
+	wLog* Log;
+	wLogAppender* Appender; /* NULL: padding up to the end of the ring */
+};
+typedef struct _wLogAsyncRecord wLogAsyncRecord;
+
+typedef struct _wLogAsyncRing wLogAsyncRing;
+
+struct _wLogAsyncRing
+{
+	/* owned by the producer */
+	LONG volatile Head;
+	UINT32 CachedTail;
+	UINT32 volatile Queued;
+	UINT32 volatile Dropped;
+
+	BYTE Padding[64];
+
+	/* owned by the flusher */
+	LONG volatile Tail;
+	LONG volatile Closed;
+	wLogAsyncRing* Next;
+
+	BYTE* Buffer;
+};
+
+struct _wLogAsync
+{
+	CRITICAL_SECTION lock;
+	HANDLE thread;
+	HANDLE event;
+	BOOL stop;
+
+#ifndef _WIN32
+	pthread_key_t key;
+#else
+	DWORD key;
+#endif
+
+	wLogAsyncRing* rings;
+
+	char* batch;
+	size_t batchLength;
+	UINT32 batchRecords;
+	wLog* batchLog;
+	wLogAppender* batchAppender;
+
+	/* totals, including the rings of threads that have exited */
+	UINT64 Queued;
+	UINT64 Dropped;
+	UINT64 Written;
+	UINT64 Batches;
+};
+typedef struct _wLogAsync wLogAsync;
+
+static wLogAsync* volatile g_Async = NULL;
+
+static void WLog_Async_FreeRing(wLogAsync* async, wLogAsyncRing* ring)
+{
+	async->Queued += ring->Queued;
+	async->Dropped += ring->Dropped;
+
+	free(ring->Buffer);
+	free(ring);
+}
+
+#ifndef _WIN32
+static void WLog_Async_ThreadExit(void* value)
+{
+	wLogAsyncRing* ring = (wLogAsyncRing*) value;
+
+	/* the flusher frees the ring once it has been drained */
+	InterlockedExchange(&ring->Closed, TRUE);
+}
+#endif
+
+static wLogAsyncRing* WLog_Async_GetRing(wLogAsync* async)
+{
+	wLogAsyncRing* ring;
+
+#ifndef _WIN32
+	ring = (wLogAsyncRing*) pthread_getspecific(async->key);
+#else
+	ring = (wLogAsyncRing*) TlsGetValue(async->key);
+#endif
+
+	if (ring)
+		return ring;
+
+	ring = (wLogAsyncRing*) calloc(1, sizeof(wLogAsyncRing));
+
+	if (!ring)
+		return NULL;
+
+	ring->Buffer = (BYTE*) malloc(WLOG_ASYNC_RING_SIZE);
+
+	if (!ring->Buffer)
+	{
+		free(ring);
+		return NULL;
+	}
+
+	EnterCriticalSection(&async->lock);
+	ring->Next = async->rings;
+	async->rings = ring;
+	LeaveCriticalSection(&async->lock);
+
+#ifndef _WIN32
+	pthread_setspecific(async->key, ring);
+#else
+	TlsSetValue(async->key, ring);
+#endif
+
+	return ring;
+}
+
+static void WLog_Async_WriteBatch(wLogAsync* async)
+{
+	wLogAppender* appender = async->batchAppender;
+
+	if (!async->batchLength)
+		return;
+
+	async->batch[async->batchLength] = '\0';
+
+	EnterCriticalSection(&appender->lock);
+	appender->WriteBatch(async->batchLog, appender, async->batch, async->batchLength);
+	LeaveCriticalSection(&appender->lock);
+
+	async->Written += async->batchRecords;
+	async->Batches++;
+
+	async->batchLength = 0;
+	async->batchRecords = 0;
+}
+
+static void WLog_Async_AddRecord(wLogAsync* async, wLogAsyncRecord* record)
+{
+	if ((record->Appender != async->batchAppender) ||
+			(async->batchLength + record->Length >= WLOG_ASYNC_BATCH_SIZE))
+	{
+		WLog_Async_WriteBatch(async);
+	}
+
+	CopyMemory(&async->batch[async->batchLength], &record[1], record->Length);
+	async->batchLength += record->Length;
+	async->batchRecords++;
+
+	async->batchLog = record->Log;
+	async->batchAppender = record->Appender;
+}
+
+/* called with the async lock held */
+
+static void WLog_Async_Drain(wLogAsync* async)
+{
+	UINT32 head;
+	UINT32 tail;
+	wLogAsyncRing* ring;
+	wLogAsyncRing** link;
+	wLogAsyncRecord* record;
+
+	link = &async->rings;
+
+	while ((ring = *link) != NULL)
+	{
+		BOOL closed = ring->Closed;
+
+		head = (UINT32) InterlockedCompareExchange(&ring->Head, 0, 0);
+		tail = (UINT32) ring->Tail;
+
+		while (tail != head)
+		{
+			record = (wLogAsyncRecord*) &ring->Buffer[tail & WLOG_ASYNC_RING_MASK];
+
+			if (record->Appender)
+				WLog_Async_AddRecord(async, record);
+
+			tail += record->Size;
+		}
+
+		InterlockedExchange(&ring->Tail, (LONG) tail);
+
+		if (closed)
+		{
+			*link = ring->Next;
+			WLog_Async_FreeRing(async, ring);
+			continue;
+		}
+
+		link = &ring->Next;
+	}
+
+	WLog_Async_WriteBatch(async);
+}
+
+static DWORD WINAPI WLog_Async_Thread(LPVOID arg)
+{
+	BOOL stop = FALSE;
+	wLogAsync* async = (wLogAsync*) arg;
+
+	while (!stop)
+	{
+		WaitForSingleObject(async->event, WLOG_ASYNC_FLUSH_INTERVAL);
+		ResetEvent(async->event);
+
+		EnterCriticalSection(&async->lock);
+		WLog_Async_Drain(async);
+		stop = async->stop;
+		LeaveCriticalSection(&async->lock);
+	}
+
+	return 0;
+}
+
+static void WLog_Async_Free(wLogAsync* async)
+{
+	wLogAsyncRing* ring;
+
+	if (!async)
+		return;
+
+	if (async->thread)
+	{
+		EnterCriticalSection(&async->lock);
+		async->stop = TRUE;
+		LeaveCriticalSection(&async->lock);
+
+		SetEvent(async->event);
+		WaitForSingleObject(async->thread, INFINITE);
+		CloseHandle(async->thread);
+	}
+
+#ifndef _WIN32
+	pthread_key_delete(async->key);
+#else
+	TlsFree(async->key);
+#endif
+
+	while ((ring = async->rings) != NULL)
+	{
+		async->rings = ring->Next;
+		WLog_Async_FreeRing(async, ring);
+	}
+
+	if (async->event)
+		CloseHandle(async->event);
+
+	DeleteCriticalSection(&async->lock);
+
+	free(async->batch);
+	free(async);
+}
+
+static wLogAsync* WLog_Async_New(void)
+{
+	wLogAsync* async;
+
+	async = (wLogAsync*) calloc(1, sizeof(wLogAsync));
+
+	if (!async)
+		return NULL;
+
+	InitializeCriticalSectionAndSpinCount(&async->lock, 4000);
+
+#ifndef _WIN32
+	if (pthread_key_create(&async->key, WLog_Async_ThreadExit) != 0)
+	{
+		DeleteCriticalSection(&async->lock);
+		free(async);
+		return NULL;
+	}
+#else
+	async->key = TlsAlloc();
+#endif
+
+	async->batch = (char*) malloc(WLOG_ASYNC_BATCH_SIZE);
+	async->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (!async->batch || !async->event)
+	{
+		WLog_Async_Free(async);
+		return NULL;
+	}
+
+	async->thread = CreateThread(NULL, 0, WLog_Async_Thread, (void*) async, 0, NULL);
+
+	if (!async->thread)
+	{
+		WLog_Async_Free(async);
+		return NULL;
+	}
+
+	return async;
+}
+
+static int WLog_Async_WriteDirect(wLog* log, wLogAppender* appender, wLogMessage* message)
+{
+	int status;
+
+	EnterCriticalSection(&appender->lock);
+	status = appender->WriteMessage(log, appender, message);
+	LeaveCriticalSection(&appender->lock);
+
+	return status;
+}
+
+int WLog_AsyncAppender_WriteMessage(wLog* log, wLogAppender* appender, wLogMessage* message)
+{
+	char* p;
+	UINT32 size;
+	UINT32 head;
+	UINT32 used;
+	UINT32 offset;
+	UINT32 padding;
+	size_t prefixLength;
+	size_t textLength;
+	wLogAsyncRing* ring;
+	wLogAsyncRecord* record;
+	wLogAsync* async = g_Async;
+	char prefix[WLOG_MAX_PREFIX_SIZE];
+
+	if (!async || !(ring = WLog_Async_GetRing(async)))
+		return WLog_Async_WriteDirect(log, appender, message);
+
+	message->PrefixString = prefix;
+	WLog_Layout_GetMessagePrefix(log, appender->Layout, message);
+
+	prefixLength = strnlen(prefix, WLOG_MAX_PREFIX_SIZE - 1);
+	textLength = strnlen(message->TextString, WLOG_MAX_STRING_SIZE);
+
+	size = (UINT32) (sizeof(wLogAsyncRecord) + prefixLength + textLength + 1);
+	size = (size + WLOG_ASYNC_RECORD_ALIGN - 1) & ~(WLOG_ASYNC_RECORD_ALIGN - 1);
+
+	head = (UINT32) ring->Head;
+	offset = head & WLOG_ASYNC_RING_MASK;
+	padding = ((offset + size) > WLOG_ASYNC_RING_SIZE) ? (WLOG_ASYNC_RING_SIZE - offset) : 0;
+
+	if ((head - ring->CachedTail + padding + size) > WLOG_ASYNC_RING_SIZE)
+	{
+		ring->CachedTail = (UINT32) InterlockedCompareExchange(&ring->Tail, 0, 0);
+
+		if ((head - ring->CachedTail + padding + size) > WLOG_ASYNC_RING_SIZE)
+		{
+			SetEvent(async->event);
+
+			if (message->Level >= WLOG_ERROR)
+				return WLog_Async_WriteDirect(log, appender, message);
+
+			ring->Dropped++;
+			return 0;
+		}
+	}
+
+	if (padding)
+	{
+		record = (wLogAsyncRecord*) &ring->Buffer[offset];
+		record->Size = padding;
+		record->Length = 0;
+		record->Log = NULL;
+		record->Appender = NULL;
+		offset = 0;
+	}
+
+	record = (wLogAsyncRecord*) &ring->Buffer[offset];
+	record->Size = size;
+	record->Length = (UINT32) (prefixLength + textLength + 1);
+	record->Log = log;
+	record->Appender = appender;
+
+	p = (char*) &record[1];
+	CopyMemory(p, prefix, prefixLength);
+	CopyMemory(&p[prefixLength], message->TextString, textLength);
+	p[prefixLength + textLength] = '\n';
+
+	ring->Queued++;
+
+	used = head - ring->CachedTail;
+	head += padding + size;
+	InterlockedExchange(&ring->Head, (LONG) head);
+
+	/* wake up the flusher once per refill instead of on every record */
+	if ((used <= (WLOG_ASYNC_RING_SIZE / 2)) && ((head - ring->CachedTail) > (WLOG_ASYNC_RING_SIZE / 2)))
+		SetEvent(async->event);
+
+	return 1;
+}
+
+BOOL WLog_SetAsync(wLog* log, BOOL async)
+{
+	wLogAsync* instance;
+	wLogAppender* appender;
+
+	appender = WLog_GetLogAppender(log);
+
+	if (!appender)
+		return FALSE;
+
+	if (!async)
+	{
+		appender->Async = FALSE;
+		WLog_Flush();
+		return TRUE;
+	}
+
+	if (!appender->WriteBatch)
+		return FALSE;
+
+	if (!g_Async)
+	{
+		instance = WLog_Async_New();
+
+		if (!instance)
+			return FALSE;
+
+		if (InterlockedCompareExchangePointer((PVOID volatile*) &g_Async, instance, NULL) != NULL)
+			WLog_Async_Free(instance);
+	}
+
+	appender->Async = TRUE;
+
+	return TRUE;
+}
+
+void WLog_Flush(void)
+{
+	wLogAsync* async = g_Async;
+
+	if (!async)
+		return;
+
+	EnterCriticalSection(&async->lock);
+	WLog_Async_Drain(async);
+	LeaveCriticalSection(&async->lock);
+}
+
+void WLog_GetAsyncStats(wLogAsyncStats* stats)
+{
+	wLogAsyncRing* ring;
+	wLogAsync* async = g_Async;
+
+	ZeroMemory(stats, sizeof(wLogAsyncStats));
+
+	if (!async)
+		return;
+
+	EnterCriticalSection(&async->lock);
+
+	stats->Queued = async->Queued;
+	stats->Dropped = async->Dropped;
+	stats->Written = async->Written;
+	stats->Batches = async->Batches;
+
+	for (ring = async->rings; ring; ring = ring->Next)
+	{
+		stats->Queued += ring->Queued;
+		stats->Dropped += ring->Dropped;
+	}
+
+	LeaveCriticalSection(&async->lock);
+}
+
+void WLog_AsyncAppender_Uninit(void)
+{
+	wLogAsync* async = g_Async;
+
+	g_Async = NULL;
+	WLog_Async_Free(async);
+}
@@ -0,0 +1,591 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * WinPR Logger
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/sysinfo.h>
+
+#include <winpr/wlog.h>
+
+#include "wlog/PacketMessage.h"
+
+#include "wlog/CaptureAppender.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+/**
+ * Capture Appender
+ *
+ * Packets are stored as pcapng enhanced packet blocks in a ring that
+ * follows a small header in a memory-mapped file: logging a packet is a
+ * copy into the mapping, the file is only written back by the system.
+ * When a block does not fit in front of the end of the ring, the rest is
+ * filled with a padding block and the block starts over at the beginning.
+ * The oldest blocks are evicted as the ring wraps.
+ *
+ * All blocks are a multiple of 8 bytes long, so that a padding block,
+ * which only has a type and a length, always fits.
+ */
+
+#define WLOG_CAPTURE_RING_MAGIC		0x474E5257 /* "WRNG" */
+#define WLOG_CAPTURE_RING_VERSION	1
+
+#define WLOG_CAPTURE_DEFAULT_RING_SIZE	(16 * 1024 * 1024)
+#define WLOG_CAPTURE_MIN_RING_SIZE	(1024 * 1024)
+#define WLOG_CAPTURE_SNAPLEN		65535
+
+#define PCAPNG_BLOCK_PADDING		0x00000000
+#define PCAPNG_BLOCK_SECTION_HEADER	0x0A0D0D0A
+#define PCAPNG_BLOCK_INTERFACE		0x00000001
+#define PCAPNG_BLOCK_ENHANCED_PACKET	0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC		0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET	1
+
+struct _wLogCaptureRingHeader
+{
+	UINT32 Magic;
+	UINT32 Version;
+	UINT32 Size;
+	UINT32 Reserved;
+	UINT64 Head;
+	UINT64 Tail;
+};
+typedef struct _wLogCaptureRingHeader wLogCaptureRingHeader;
+
+struct _wLogCaptureRing
+{
+	BYTE* Memory;
+	size_t MemorySize;
+#ifndef _WIN32
+	int fd;
+#endif
+
+	wLogCaptureRingHeader* Header;
+	BYTE* Data;
+	UINT32 Size;
+
+	/* per interface TCP sequence numbers, inbound then outbound */
+	UINT32 InterfaceCount;
+	UINT32* SequenceNumbers;
+};
+typedef struct _wLogCaptureRing wLogCaptureRing;
+
+static UINT64 WLog_CaptureAppender_GetTime(void)
+{
+	FILETIME ft;
+	UINT64 time;
+
+	GetSystemTimeAsFileTime(&ft);
+	time = (((UINT64) ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+
+	/* microseconds since 1970 */
+	return (time - 116444736000000000ULL) / 10;
+}
+
+static void WLog_CaptureRing_Free(wLogCaptureRing* ring)
+{
+	if (!ring)
+		return;
+
+#ifndef _WIN32
+	if (ring->fd >= 0)
+	{
+		if (ring->Memory)
+			munmap(ring->Memory, ring->MemorySize);
+
+		close(ring->fd);
+	}
+	else
+#endif
+	{
+		free(ring->Memory);
+	}
+
+	free(ring->SequenceNumbers);
+	free(ring);
+}
+
+static wLogCaptureRing* WLog_CaptureRing_New(const char* filename, UINT32 size)
+{
+	wLogCaptureRing* ring;
+
+	ring = (wLogCaptureRing*) calloc(1, sizeof(wLogCaptureRing));
+
+	if (!ring)
+		return NULL;
+
+	ring->Size = size;
+	ring->MemorySize = sizeof(wLogCaptureRingHeader) + size;
+
+#ifndef _WIN32
+	ring->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+	if (ring->fd >= 0)
+	{
+		if (ftruncate(ring->fd, ring->MemorySize) == 0)
+		{
+			ring->Memory = (BYTE*) mmap(NULL, ring->MemorySize, PROT_READ | PROT_WRITE,
+					MAP_SHARED, ring->fd, 0);
+
+			if (ring->Memory == MAP_FAILED)
+				ring->Memory = NULL;
+		}
+
+		if (!ring->Memory)
+		{
+			close(ring->fd);
+			ring->fd = -1;
+		}
+	}
+#endif
+
+	/* without a file, the ring is only kept in memory */
+	if (!ring->Memory)
+		ring->Memory = (BYTE*) calloc(1, ring->MemorySize);
+
+	if (!ring->Memory)
+	{
+		WLog_CaptureRing_Free(ring);
+		return NULL;
+	}
+
+	ring->Header = (wLogCaptureRingHeader*) ring->Memory;
+	ring->Data = &ring->Memory[sizeof(wLogCaptureRingHeader)];
+
+	ring->Header->Magic = WLOG_CAPTURE_RING_MAGIC;
+	ring->Header->Version = WLOG_CAPTURE_RING_VERSION;
+	ring->Header->Size = size;
+	ring->Header->Head = 0;
+	ring->Header->Tail = 0;
+
+	return ring;
+}
+
+static void WLog_CaptureRing_Evict(wLogCaptureRing* ring, UINT32 length)
+{
+	UINT32* block;
+	wLogCaptureRingHeader* header = ring->Header;
+
+	while ((header->Head + length - header->Tail) > ring->Size)
+	{
+		block = (UINT32*) &ring->Data[header->Tail % ring->Size];
+		header->Tail += block[1];
+	}
+}
+
+static BYTE* WLog_CaptureRing_Reserve(wLogCaptureRing* ring, UINT32 length)
+{
+	UINT32 offset;
+	UINT32 padding;
+	UINT32* block;
+	wLogCaptureRingHeader* header = ring->Header;
+
+	offset = (UINT32) (header->Head % ring->Size);
+
+	if ((offset + length) > ring->Size)
+	{
+		padding = ring->Size - offset;
+		WLog_CaptureRing_Evict(ring, padding);
+
+		block = (UINT32*) &ring->Data[offset];
+		block[0] = PCAPNG_BLOCK_PADDING;
+		block[1] = padding;
+
+		header->Head += padding;
+		offset = 0;
+	}
+
+	WLog_CaptureRing_Evict(ring, length);
+
+	return &ring->Data[offset];
+}
+
+static UINT32* WLog_CaptureRing_GetSequenceNumbers(wLogCaptureRing* ring, UINT32 interfaceId)
+{
+	UINT32 count;
+	UINT32* numbers;
+
+	if (interfaceId >= ring->InterfaceCount)
+	{
+		count = interfaceId + 1;
+		numbers = (UINT32*) realloc(ring->SequenceNumbers, count * 2 * sizeof(UINT32));
+
+		if (!numbers)
+			return NULL;
+
+		ZeroMemory(&numbers[ring->InterfaceCount * 2], (count - ring->InterfaceCount) * 2 * sizeof(UINT32));
+
+		ring->SequenceNumbers = numbers;
+		ring->InterfaceCount = count;
+	}
+
+	return &ring->SequenceNumbers[interfaceId * 2];
+}
+
+void WLog_CaptureAppender_SetOutputFileName(wLog* log, wLogCaptureAppender* appender, const char* filename)
+{
+	if (!appender)
+		return;
+
+	if (appender->Type != WLOG_APPENDER_CAPTURE)
+		return;
+
+	if (!filename)
+		return;
+
+	appender->FileName = _strdup(filename);
+}
+
+void WLog_CaptureAppender_SetOutputFilePath(wLog* log, wLogCaptureAppender* appender, const char* filepath)
+{
+	if (!appender)
+		return;
+
+	if (appender->Type != WLOG_APPENDER_CAPTURE)
+		return;
+
+	if (!filepath)
+		return;
+
+	appender->FilePath = _strdup(filepath);
+}
+
+void WLog_CaptureAppender_SetRingSize(wLog* log, wLogCaptureAppender* appender, UINT32 size)
+{
+	if (!appender)
+		return;
+
+	if (appender->Type != WLOG_APPENDER_CAPTURE)
+		return;
+
+	if (size < WLOG_CAPTURE_MIN_RING_SIZE)
+		size = WLOG_CAPTURE_MIN_RING_SIZE;
+
+	appender->RingSize = size & ~7;
+}
+
+int WLog_CaptureAppender_Open(wLog* log, wLogCaptureAppender* appender)
+{
+	DWORD ProcessId;
+
+	ProcessId = GetCurrentProcessId();
+
+	if (!log || !appender)
+		return -1;
+
+	if (!appender->FilePath)
+	{
+		appender->FilePath = GetKnownSubPath(KNOWN_PATH_TEMP, "wlog");
+	}
+
+	if (!PathFileExistsA(appender->FilePath))
+	{
+		CreateDirectoryA(appender->FilePath, 0);
+		UnixChangeFileMode(appender->FilePath, 0xFFFF);
+	}
+
+	if (!appender->FileName)
+	{
+		appender->FileName = (char*) malloc(256);
+		sprintf_s(appender->FileName, 256, "%u.ring", (unsigned int) ProcessId);
+	}
+
+	if (!appender->FullFileName)
+	{
+		appender->FullFileName = GetCombinedPath(appender->FilePath, appender->FileName);
+	}
+
+	appender->Ring = WLog_CaptureRing_New(appender->FullFileName, appender->RingSize);
+
+	if (!appender->Ring)
+		return -1;
+
+	return 0;
+}
+
+int WLog_CaptureAppender_Close(wLog* log, wLogCaptureAppender* appender)
+{
+	if (!log || !appender)
+		return -1;
+
+	WLog_CaptureRing_Free((wLogCaptureRing*) appender->Ring);
+	appender->Ring = NULL;
+
+	return 0;
+}
+
+int WLog_CaptureAppender_WriteMessage(wLog* log, wLogCaptureAppender* appender, wLogMessage* message)
+{
+	wLog* owner = log;
+
+	if (!log || !appender || !message)
+		return -1;
+
+	while (owner && (owner->Appender != (wLogAppender*) appender))
+		owner = owner->Parent;
+
+	if (!owner || !owner->Parent)
+		return 0;
+
+	if (message->Level < WLog_GetLogLevel(owner->Parent))
+		return 0;
+
+	return WLog_WriteAppender(log, WLog_GetLogAppender(owner->Parent), message);
+}
+
+int WLog_CaptureAppender_WritePacketMessage(wLog* log, wLogCaptureAppender* appender, wLogMessage* message)
+{
+	BYTE* p;
+	UINT32 length;
+	UINT32 captured;
+	UINT32 original;
+	UINT32 interfaceId;
+	UINT32* sequence;
+	UINT64 timestamp;
+	wLogCaptureRing* ring;
+
+	if (!log || !appender || !message)
+		return -1;
+
+	ring = (wLogCaptureRing*) appender->Ring;
+
+	if (!ring || (message->PacketLength < 0))
+		return -1;
+
+	interfaceId = WLOG_PACKET_GET_INTERFACE(message->PacketFlags);
+	sequence = WLog_CaptureRing_GetSequenceNumbers(ring, interfaceId);
+
+	if (!sequence)
+		return -1;
+
+	original = (UINT32) message->PacketLength;
+	captured = (original > WLOG_CAPTURE_SNAPLEN) ? WLOG_CAPTURE_SNAPLEN : original;
+
+	/* enhanced packet block, padded with an end of options marker if needed */
+	length = 28 + ((WLOG_PACKET_HEADER_LENGTH + captured + 3) & ~3) + 4;
+
+	if (length & 7)
+		length += 4;
+
+	timestamp = WLog_CaptureAppender_GetTime();
+
+	p = WLog_CaptureRing_Reserve(ring, length);
+	ZeroMemory(&p[length - 12], 12);
+
+	((UINT32*) p)[0] = PCAPNG_BLOCK_ENHANCED_PACKET;
+	((UINT32*) p)[1] = length;
+	((UINT32*) p)[2] = interfaceId;
+	((UINT32*) p)[3] = (UINT32) (timestamp >> 32);
+	((UINT32*) p)[4] = (UINT32) timestamp;
+	((UINT32*) p)[5] = WLOG_PACKET_HEADER_LENGTH + captured;
+	((UINT32*) p)[6] = WLOG_PACKET_HEADER_LENGTH + original;
+
+	if (message->PacketFlags & WLOG_PACKET_OUTBOUND)
+	{
+		WLog_PacketMessage_WriteHeaders(&p[28], original, message->PacketFlags,
+				sequence[1], sequence[0], (UINT16) (49152 + (interfaceId % 16384)));
+		sequence[1] += original;
+	}
+	else
+	{
+		WLog_PacketMessage_WriteHeaders(&p[28], original, message->PacketFlags,
+				sequence[0], sequence[1], (UINT16) (49152 + (interfaceId % 16384)));
+		sequence[0] += original;
+	}
+
+	CopyMemory(&p[28 + WLOG_PACKET_HEADER_LENGTH], message->PacketData, captured);
+	((UINT32*) &p[length - 4])[0] = length;
+
+	ring->Header->Head += length;
+
+	return 1;
+}
+
+static BOOL WLog_CaptureAppender_WriteHeaders(FILE* fp, UINT32 interfaceCount)
+{
+	UINT32 index;
+	UINT32 block[7];
+
+	block[0] = PCAPNG_BLOCK_SECTION_HEADER;
+	block[1] = 28;
+	block[2] = PCAPNG_BYTE_ORDER_MAGIC;
+	block[3] = 1; /* version 1.0 */
+	block[4] = 0xFFFFFFFF; /* unknown section length */
+	block[5] = 0xFFFFFFFF;
+	block[6] = 28;
+
+	if (fwrite(block, 28, 1, fp) != 1)
+		return FALSE;
+
+	for (index = 0; index < interfaceCount; index++)
+	{
+		block[0] = PCAPNG_BLOCK_INTERFACE;
+		block[1] = 20;
+		block[2] = PCAPNG_LINKTYPE_ETHERNET;
+		block[3] = WLOG_PACKET_HEADER_LENGTH + WLOG_CAPTURE_SNAPLEN;
+		block[4] = 20;
+
+		if (fwrite(block, 20, 1, fp) != 1)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+int WLog_CaptureAppender_Dump(wLog* log, wLogCaptureAppender* appender,
+		const char* filename, DWORD seconds, DWORD interfaceId)
+{
+	FILE* fp;
+	BYTE* data;
+	UINT32* block;
+	UINT32 offset;
+	UINT32 length;
+	UINT32 first;
+	UINT32 interfaceCount;
+	UINT64 timestamp;
+	UINT64 minimum = 0;
+	int count = 0;
+	wLogCaptureRing* ring;
+	wLogCaptureRingHeader* header;
+
+	if (!log || !appender || !filename)
+		return -1;
+
+	if (appender->Type != WLOG_APPENDER_CAPTURE)
+		return -1;
+
+	if (seconds)
+		minimum = WLog_CaptureAppender_GetTime() - (seconds * 1000000ULL);
+
+	/* copy the ring in order, so that logging is only held up by a copy */
+
+	EnterCriticalSection(&appender->lock);
+
+	ring = (wLogCaptureRing*) appender->Ring;
+
+	if (!ring)
+	{
+		LeaveCriticalSection(&appender->lock);
+		return -1;
+	}
+
+	header = ring->Header;
+	length = (UINT32) (header->Head - header->Tail);
+	interfaceCount = ring->InterfaceCount;
+
+	data = (BYTE*) malloc(length + 1);
+
+	if (!data)
+	{
+		LeaveCriticalSection(&appender->lock);
+		return -1;
+	}
+
+	offset = (UINT32) (header->Tail % ring->Size);
+	first = ((offset + length) > ring->Size) ? (ring->Size - offset) : length;
+
+	CopyMemory(data, &ring->Data[offset], first);
+	CopyMemory(&data[first], ring->Data, length - first);
+
+	LeaveCriticalSection(&appender->lock);
+
+	fp = fopen(filename, "wb");
+
+	if (!fp)
+	{
+		free(data);
+		return -1;
+	}
+
+	if (!WLog_CaptureAppender_WriteHeaders(fp, interfaceCount))
+		count = -1;
+
+	for (offset = 0; (count >= 0) && (offset < length); offset += block[1])
+	{
+		block = (UINT32*) &data[offset];
+
+		if (block[1] < 8)
+			break;
+
+		if (block[0] != PCAPNG_BLOCK_ENHANCED_PACKET)
+			continue;
+
+		if ((interfaceId != WLOG_CAPTURE_ALL_INTERFACES) && (block[2] != interfaceId))
+			continue;
+
+		timestamp = (((UINT64) block[3]) << 32) | block[4];
+
+		if (timestamp < minimum)
+			continue;
+
+		if (fwrite(block, block[1], 1, fp) != 1)
+			count = -1;
+		else
+			count++;
+	}
+
+	fclose(fp);
+	free(data);
+
+	return count;
+}
+
+wLogCaptureAppender* WLog_CaptureAppender_New(wLog* log)
+{
+	wLogCaptureAppender* CaptureAppender;
+
+	CaptureAppender = (wLogCaptureAppender*) calloc(1, sizeof(wLogCaptureAppender));
+
+	if (CaptureAppender)
+	{
+		CaptureAppender->Type = WLOG_APPENDER_CAPTURE;
+
+		CaptureAppender->Open = (WLOG_APPENDER_OPEN_FN) WLog_CaptureAppender_Open;
+		CaptureAppender->Close = (WLOG_APPENDER_OPEN_FN) WLog_CaptureAppender_Close;
+
+		CaptureAppender->WriteMessage =
+				(WLOG_APPENDER_WRITE_MESSAGE_FN) WLog_CaptureAppender_WriteMessage;
+		CaptureAppender->WritePacketMessage =
+				(WLOG_APPENDER_WRITE_PACKET_MESSAGE_FN) WLog_CaptureAppender_WritePacketMessage;
+
+		CaptureAppender->RingSize = WLOG_CAPTURE_DEFAULT_RING_SIZE;
+	}
+
+	return CaptureAppender;
+}
+
+void WLog_CaptureAppender_Free(wLog* log, wLogCaptureAppender* appender)
+{
+	if (appender)
+	{
+		WLog_CaptureRing_Free((wLogCaptureRing*) appender->Ring);
+
+		free(appender->FileName);
+		free(appender->FilePath);
+		free(appender->FullFileName);
+		free(appender);
+	}
+}
@@ -130,6 +130,30 @@ int WLog_ConsoleAppender_WriteMessage(wLog* log, wLogConsoleAppender* appender,
 	return 1;
 }
 
+#ifndef ANDROID
+int WLog_ConsoleAppender_WriteBatch(wLog* log, wLogConsoleAppender* appender, const char* data, size_t length)
+{
+	FILE* fp;
+
+#ifdef _WIN32
+	if (appender->outputStream == WLOG_CONSOLE_DEBUG)
+	{
+		OutputDebugStringA(data);
+		return 1;
+	}
+#endif
+
+	fp = (appender->outputStream == WLOG_CONSOLE_STDERR) ? stderr : stdout;
+
+	if (fwrite(data, 1, length, fp) != length)
+		return -1;
+
+	fflush(fp);
+
+	return 1;
+}
+#endif
+
 static int g_DataId = 0;
 
 int WLog_ConsoleAppender_WriteDataMessage(wLog* log, wLogConsoleAppender* appender, wLogMessage* message)
@@ -211,6 +235,10 @@ wLogConsoleAppender* WLog_ConsoleAppender_New(wLog* log)
 				(WLOG_APPENDER_WRITE_IMAGE_MESSAGE_FN) WLog_ConsoleAppender_WriteImageMessage;
 		ConsoleAppender->WritePacketMessage =
 				(WLOG_APPENDER_WRITE_PACKET_MESSAGE_FN) WLog_ConsoleAppender_WritePacketMessage;
+#ifndef ANDROID
+		ConsoleAppender->WriteBatch =
+				(WLOG_APPENDER_WRITE_BATCH_FN) WLog_ConsoleAppender_WriteBatch;
+#endif
 
 		ConsoleAppender->outputStream = WLOG_CONSOLE_STDOUT;
 
@@ -141,6 +141,26 @@ int WLog_FileAppender_WriteMessage(wLog* log, wLogFileAppender* appender, wLogMe
 	return 1;
 }
 
+int WLog_FileAppender_WriteBatch(wLog* log, wLogFileAppender* appender, const char* data, size_t length)
+{
+	FILE* fp;
+
+	if (!log || !appender || !data)
+		return -1;
+
+	fp = appender->FileDescriptor;
+
+	if (!fp)
+		return -1;
+
+	if (fwrite(data, 1, length, fp) != length)
+		return -1;
+
+	fflush(fp);
+
+	return 1;
+}
+
 static int g_DataId = 0;
 
 int WLog_FileAppender_WriteDataMessage(wLog* log, wLogFileAppender* appender, wLogMessage* message)
@@ -203,6 +223,8 @@ wLogFileAppender* WLog_FileAppender_New(wLog* log)
 				(WLOG_APPENDER_WRITE_DATA_MESSAGE_FN) WLog_FileAppender_WriteDataMessage;
 		FileAppender->WriteImageMessage =
 				(WLOG_APPENDER_WRITE_IMAGE_MESSAGE_FN) WLog_FileAppender_WriteImageMessage;
+		FileAppender->WriteBatch =
+				(WLOG_APPENDER_WRITE_BATCH_FN) WLog_FileAppender_WriteBatch;
 
 		FileAppender->FileName = NULL;
 		FileAppender->FilePath = NULL;
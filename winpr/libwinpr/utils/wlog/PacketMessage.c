@@ -234,21 +234,11 @@ void Pcap_Close(wPcap* pcap)
 	free(pcap);
 }
 
-int WLog_PacketMessage_Write_EthernetHeader(wPcap* pcap, wEthernetHeader* ethernet)
+static void WLog_PacketMessage_Write_EthernetHeader(wStream* s, wEthernetHeader* ethernet)
 {
-	wStream* s;
-	BYTE buffer[14];
-
-	if (!pcap || !pcap->fp || !ethernet)
-		return -1;
-
-	s = Stream_New(buffer, 14);
 	Stream_Write(s, ethernet->Destination, 6);
 	Stream_Write(s, ethernet->Source, 6);
 	Stream_Write_UINT16_BE(s, ethernet->Type);
-	fwrite(buffer, 14, 1, pcap->fp);
-	Stream_Free(s, FALSE);
-	return 0;
 }
 
 UINT16 IPv4Checksum(BYTE* ipv4, int length)
@@ -273,15 +263,10 @@ UINT16 IPv4Checksum(BYTE* ipv4, int length)
 	return (UINT16)(~checksum);
 }
 
-int WLog_PacketMessage_Write_IPv4Header(wPcap* pcap, wIPv4Header* ipv4)
+static void WLog_PacketMessage_Write_IPv4Header(wStream* s, wIPv4Header* ipv4)
 {
-	wStream* s;
-	BYTE buffer[20];
+	BYTE* buffer = Stream_Pointer(s);
 
-	if (!pcap || !pcap->fp || !ipv4)
-		return -1;
-
-	s = Stream_New(buffer, 20);
 	Stream_Write_UINT8(s, (ipv4->Version << 4) | ipv4->InternetHeaderLength);
 	Stream_Write_UINT8(s, ipv4->TypeOfService);
 	Stream_Write_UINT16_BE(s, ipv4->TotalLength);
@@ -292,24 +277,14 @@ int WLog_PacketMessage_Write_IPv4Header(wPcap* pcap, wIPv4Header* ipv4)
 	Stream_Write_UINT16(s, ipv4->HeaderChecksum);
 	Stream_Write_UINT32_BE(s, ipv4->SourceAddress);
 	Stream_Write_UINT32_BE(s, ipv4->DestinationAddress);
-	ipv4->HeaderChecksum = IPv4Checksum((BYTE*) buffer, 20);
+	ipv4->HeaderChecksum = IPv4Checksum(buffer, 20);
 	Stream_Rewind(s, 10);
 	Stream_Write_UINT16(s, ipv4->HeaderChecksum);
 	Stream_Seek(s, 8);
-	fwrite(buffer, 20, 1, pcap->fp);
-	Stream_Free(s, FALSE);
-	return 0;
 }
 
-int WLog_PacketMessage_Write_TcpHeader(wPcap* pcap, wTcpHeader* tcp)
+static void WLog_PacketMessage_Write_TcpHeader(wStream* s, wTcpHeader* tcp)
 {
-	wStream* s;
-	BYTE buffer[20];
-
-	if (!pcap || !pcap->fp || !tcp)
-		return -1;
-
-	s = Stream_New(buffer, 20);
 	Stream_Write_UINT16_BE(s, tcp->SourcePort);
 	Stream_Write_UINT16_BE(s, tcp->DestinationPort);
 	Stream_Write_UINT32_BE(s, tcp->SequenceNumber);
@@ -319,29 +294,23 @@ int WLog_PacketMessage_Write_TcpHeader(wPcap* pcap, wTcpHeader* tcp)
 	Stream_Write_UINT16_BE(s, tcp->Window);
 	Stream_Write_UINT16_BE(s, tcp->Checksum);
 	Stream_Write_UINT16_BE(s, tcp->UrgentPointer);
-
-	if (pcap->fp)
-		fwrite(buffer, 20, 1, pcap->fp);
-
-	Stream_Free(s, FALSE);
-	return 0;
 }
 
-static UINT32 g_InboundSequenceNumber = 0;
-static UINT32 g_OutboundSequenceNumber = 0;
+/**
+ * Writes the synthetic ethernet, IPv4 and TCP headers of a packet to the
+ * WLOG_PACKET_HEADER_LENGTH bytes of buffer. The local end of the fake
+ * connection uses the given port, the remote end always uses 3389.
+ */
 
-int WLog_PacketMessage_Write(wPcap* pcap, void* data, DWORD length, DWORD flags)
+void WLog_PacketMessage_WriteHeaders(BYTE* buffer, DWORD length, DWORD flags,
+		UINT32 sequenceNumber, UINT32 acknowledgementNumber, UINT16 port)
 {
+	wStream* s;
 	wTcpHeader tcp;
 	wIPv4Header ipv4;
-	struct timeval tp;
-	wPcapRecord record;
 	wEthernetHeader ethernet;
 	ethernet.Type = 0x0800;
 
-	if (!pcap || !pcap->fp)
-		return -1;
-
 	if (flags & WLOG_PACKET_OUTBOUND)
 	{
 		/* 00:15:5D:01:64:04 */
@@ -392,47 +361,68 @@ int WLog_PacketMessage_Write(wPcap* pcap, void* data, DWORD length, DWORD flags)
 	{
 		ipv4.SourceAddress = 0xC0A80196; /* 192.168.1.150 */
 		ipv4.DestinationAddress = 0x4A7D64C8; /* 74.125.100.200 */
+		tcp.SourcePort = port;
+		tcp.DestinationPort = 3389;
 	}
 	else
 	{
 		ipv4.SourceAddress = 0x4A7D64C8; /* 74.125.100.200 */
 		ipv4.DestinationAddress = 0xC0A80196; /* 192.168.1.150 */
+		tcp.SourcePort = 3389;
+		tcp.DestinationPort = port;
 	}
 
-	tcp.SourcePort = 3389;
-	tcp.DestinationPort = 3389;
+	tcp.SequenceNumber = sequenceNumber;
+	tcp.AcknowledgementNumber = acknowledgementNumber;
+	tcp.Offset = 5;
+	tcp.Reserved = 0;
+	tcp.TcpFlags = 0x0018;
+	tcp.Window = 0x7FFF;
+	tcp.Checksum = 0;
+	tcp.UrgentPointer = 0;
+
+	s = Stream_New(buffer, WLOG_PACKET_HEADER_LENGTH);
+	WLog_PacketMessage_Write_EthernetHeader(s, &ethernet);
+	WLog_PacketMessage_Write_IPv4Header(s, &ipv4);
+	WLog_PacketMessage_Write_TcpHeader(s, &tcp);
+	Stream_Free(s, FALSE);
+}
+
+static UINT32 g_InboundSequenceNumber = 0;
+static UINT32 g_OutboundSequenceNumber = 0;
+
+int WLog_PacketMessage_Write(wPcap* pcap, void* data, DWORD length, DWORD flags)
+{
+	struct timeval tp;
+	wPcapRecord record;
+	BYTE headers[WLOG_PACKET_HEADER_LENGTH];
+
+	if (!pcap || !pcap->fp)
+		return -1;
 
 	if (flags & WLOG_PACKET_OUTBOUND)
 	{
-		tcp.SequenceNumber = g_OutboundSequenceNumber;
-		tcp.AcknowledgementNumber = g_InboundSequenceNumber;
+		WLog_PacketMessage_WriteHeaders(headers, length, flags,
+				g_OutboundSequenceNumber, g_InboundSequenceNumber, 3389);
 		g_OutboundSequenceNumber += length;
 	}
 	else
 	{
-		tcp.SequenceNumber = g_InboundSequenceNumber;
-		tcp.AcknowledgementNumber = g_OutboundSequenceNumber;
+		WLog_PacketMessage_WriteHeaders(headers, length, flags,
+				g_InboundSequenceNumber, g_OutboundSequenceNumber, 3389);
 		g_InboundSequenceNumber += length;
 	}
 
-	tcp.Offset = 5;
-	tcp.Reserved = 0;
-	tcp.TcpFlags = 0x0018;
-	tcp.Window = 0x7FFF;
-	tcp.Checksum = 0;
-	tcp.UrgentPointer = 0;
 	record.data = data;
 	record.length = length;
-	record.header.incl_len = record.length + 14 + 20 + 20;
-	record.header.orig_len = record.length + 14 + 20 + 20;
+	record.header.incl_len = record.length + WLOG_PACKET_HEADER_LENGTH;
+	record.header.orig_len = record.length + WLOG_PACKET_HEADER_LENGTH;
 	record.next = NULL;
 	gettimeofday(&tp, 0);
 	record.header.ts_sec = tp.tv_sec;
 	record.header.ts_usec = tp.tv_usec;
 	Pcap_Write_RecordHeader(pcap, &record.header);
-	WLog_PacketMessage_Write_EthernetHeader(pcap, &ethernet);
-	WLog_PacketMessage_Write_IPv4Header(pcap, &ipv4);
-	WLog_PacketMessage_Write_TcpHeader(pcap, &tcp);
+	fwrite(headers, WLOG_PACKET_HEADER_LENGTH, 1, pcap->fp);
 	Pcap_Write_RecordContent(pcap, &record);
 	fflush(pcap->fp);
 	return 0;
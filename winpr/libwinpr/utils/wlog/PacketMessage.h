@@ -116,6 +116,11 @@ struct _wTcpHeader
 };
 typedef struct _wTcpHeader wTcpHeader;
 
+#define WLOG_PACKET_HEADER_LENGTH	(14 + 20 + 20)
+
+void WLog_PacketMessage_WriteHeaders(BYTE* buffer, DWORD length, DWORD flags,
+		UINT32 sequenceNumber, UINT32 acknowledgementNumber, UINT16 port);
+
 int WLog_PacketMessage_Write(wPcap* pcap, void* data, DWORD length, DWORD flags);
 
 #endif /* WINPR_WLOG_PACKET_MESSAGE_PRIVATE_H */
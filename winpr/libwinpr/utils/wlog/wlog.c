@@ -36,6 +36,7 @@
 #include <winpr/wlog.h>
 
 #include "wlog/wlog.h"
+#include "wlog/AsyncAppender.h"
 
 #include "../../log.h"
 
@@ -92,20 +93,31 @@ static void log_recursion(const char* file, const char* fkt, int line)
 }
 
 int WLog_Write(wLog* log, wLogMessage* message)
+{
+	return WLog_WriteAppender(log, WLog_GetLogAppender(log), message);
+}
+
+int WLog_WriteAppender(wLog* log, wLogAppender* appender, wLogMessage* message)
 {
 	int status = -1;
-	wLogAppender* appender;
-	appender = WLog_GetLogAppender(log);
 
 	if (!appender)
 		return -1;
 
 	if (!appender->State)
-		WLog_OpenAppender(log);
+	{
+		if (appender->Open)
+			appender->Open(log, appender);
+
+		appender->State = 1;
+	}
 
 	if (!appender->WriteMessage)
 		return -1;
 
+	if (appender->Async)
+		return WLog_AsyncAppender_WriteMessage(log, appender, message);
+
 	EnterCriticalSection(&appender->lock);
 
 	if (appender->recursive)
@@ -599,6 +611,21 @@ wLog* WLog_GetRoot()
 		}
 
 		WLog_SetLogAppenderType(g_RootLog, logAppenderType);
+		nSize = GetEnvironmentVariableA("WLOG_ASYNC", NULL, 0);
+
+		if (nSize)
+		{
+			env = (LPSTR) malloc(nSize);
+			nSize = GetEnvironmentVariableA("WLOG_ASYNC", env, nSize);
+
+			if (env)
+			{
+				if ((_stricmp(env, "TRUE") == 0) || (strcmp(env, "1") == 0))
+					WLog_SetAsync(g_RootLog, TRUE);
+
+				free(env);
+			}
+		}
 	}
 
 	return g_RootLog;
@@ -666,6 +693,8 @@ void WLog_Uninit()
 	DWORD index;
 	wLog* child = NULL;
 
+	WLog_AsyncAppender_Uninit();
+
 	for (index = 0; index < root->ChildrenCount; index++)
 	{
 		child = root->Children[index];
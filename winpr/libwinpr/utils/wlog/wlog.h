@@ -27,6 +27,8 @@
 
 void WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* message);
 
+int WLog_WriteAppender(wLog* log, wLogAppender* appender, wLogMessage* message);
+
 #include "wlog/Layout.h"
 #include "wlog/Appender.h"
 